@@ -7,11 +7,26 @@ parser.add_argument("-w", default=".", help="workloads file")
 parser.add_argument("-t", default="./sample.trc", help="trace file")
 parser.add_argument("-f", default="True", help="given folders")
 
+vpu_ops = ["softmax", "layernorm", "gelu", "add"]
+
 def gen_pim_trace(workload, trace_file):
     fin = open(workload, 'r')
     fout = open(trace_file, 'w')
     line = fin.readline()
-    cutV, cutH, tile_M, post_delay, mcf, ucf, df = eval(line)
+    # a VPU op "op, elements, vectors" is a dataflow address with cut_no op + 1
+    op = line.replace(',', ' ').split()
+    if op and op[0] in vpu_ops:
+        vpuaddr = (vpu_ops.index(op[0]) + 1) * 2 + 3 * (2**5)
+        vpuaddr += int(op[1]) * (2**7)
+        vpuaddr += int(op[2]) * (2**39)
+        fout.write(hex(vpuaddr) + '\tPIM\t0\n')
+        fin.close()
+        fout.close()
+        return
+    fields = eval(line)
+    cutV, cutH, tile_M, post_delay, mcf, ucf, df = fields[:7]
+    # a convolution appends kernel_size, stride
+    kernel_size, stride = fields[7:] if len(fields) == 9 else (0, 0)
     # print(cutV, cutH, tile_M, post_delay)
 
     exp = 5
@@ -31,6 +46,12 @@ def gen_pim_trace(workload, trace_file):
     exp += 1
 
     cutaddr += math.log(tile_M, 2) * (2**exp)
+    exp += 4
+    exp += 3 + 1 # cutV, cutH of the next kernel
+
+    cutaddr += kernel_size * (2**exp)
+    exp += 5
+    cutaddr += stride * (2**exp)
 
     loadaddrs = []
 
@@ -48,7 +69,7 @@ def gen_pim_trace(workload, trace_file):
             exp += 2
             if (df == 0 and j==0):
                 dim = int(dim/2) # GEMM interleaving
-            if (df == 1): # N[i] == 1 (mcf*ucf == 16)
+            if (df == 1): # N[i] is the batch (mcf*ucf == 16)
                 if (j == 0):
                     loadaddr += max(1, dim/mcf) * (2**exp)
                 elif (j == 1):
@@ -62,6 +83,8 @@ def gen_pim_trace(workload, trace_file):
                 loadaddr += (int(dims[1]*dims[2]/1024)+1) * (2**exp)
             elif (df == 1 and j!=2): # Allocating addresses of Inputs and outputs in GEMV kernel
                 loadaddr += (int(dims[0]*dims[1]/1024)+1) * (2**exp)
+                if (j == 1 and dims[2] > 1): # a batch of inputs takes rows of its own
+                    loadaddr += (int(dims[1]*dims[2]/1024)+1) * (2**exp)
             else: # Allocating address of Weights
                 loadaddr += 0
             loadaddrs.append(loadaddr)
@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include "./../ext/headers/args.hxx"
+#include "cpu.h"
+
+using namespace dramsim3;
+
+namespace {
+
+// heap allocations made by the whole process so far
+uint64_t allocations = 0;
+
+}  // namespace
+
+void *operator new(size_t size) {
+    allocations++;
+    void *ptr = std::malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+
+// ticks every cycle of a kernel, skipping idle ones would hide their cost
+uint64_t RunKernel(WorkloadCPU &cpu, const std::vector<PimTransaction> &kernel,
+                   uint64_t max_cycles, const Config &config,
+                   uint64_t &cycle_allocations, uint64_t &allocating_cycles,
+                   uint64_t &epoch_allocations) {
+    cpu.Launch(kernel);
+    uint64_t cycles = 0;
+    for (; cycles < max_cycles && !cpu.Done(); cycles++) {
+        uint64_t before = allocations;
+        cpu.ClockTick();
+        uint64_t count = allocations - before;
+        // epoch stats are collected once per epoch, not per cycle
+        if (cpu.Clock() % config.epoch_period == 0) {
+            epoch_allocations += count;
+        } else if (count > 0) {
+            cycle_allocations += count;
+            allocating_cycles++;
+        }
+    }
+    return cycles;
+}
+
+int main(int argc, const char **argv) {
+    args::ArgumentParser parser(
+        "PIM scheduler allocation benchmark, runs a kernel once to warm up and "
+        "then counts the heap allocations of every cycle of its next runs.",
+        "Examples: \n"
+        "./build/dramsim3allocbench configs/HBM2_8Gb_x128.ini -w wl/gemm4\n"
+        "./build/dramsim3allocbench configs/HBM2_8Gb_x128.ini -w wl/gemv4 "
+        "-r 4");
+    args::HelpFlag help(parser, "help", "Display the help menu", {'h', "help"});
+    args::ValueFlag<std::string> workload_arg(
+        parser, "workload", "PIM workload file (mandatory), see pim_kernel.h",
+        {'w', "workload"});
+    args::ValueFlag<int> runs_arg(parser, "runs",
+                                  "Runs of the kernel to count allocations in",
+                                  {'r', "runs"}, 1);
+    args::ValueFlag<uint64_t> num_cycles_arg(
+        parser, "num_cycles", "Cycle limit of a single run", {'c', "cycles"},
+        5000000);
+    args::Positional<std::string> config_arg(
+        parser, "config", "The config file name (mandatory)");
+
+    try {
+        parser.ParseCLI(argc, argv);
+    } catch (args::Help) {
+        std::cout << parser;
+        return 0;
+    } catch (args::ParseError e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << parser;
+        return 1;
+    }
+
+    std::string config_file = args::get(config_arg);
+    std::string workload_file = args::get(workload_arg);
+    if (config_file.empty() || workload_file.empty()) {
+        std::cerr << parser;
+        return 1;
+    }
+
+    Config config(config_file, ".");
+    config.output_level = -1;
+    config.cmd_trace = false;
+    config.channel_threads = 1;
+    Timing timing(config);
+    WorkloadCPU cpu(config, timing);
+    auto kernel = PimKernel(ReadPimWorkload(workload_file));
+    uint64_t max_cycles = args::get(num_cycles_arg);
+
+    // the first run sizes every buffer and touches every stat
+    uint64_t cycle_allocations = 0;
+    uint64_t allocating_cycles = 0;
+    uint64_t epoch_allocations = 0;
+    uint64_t warmup = RunKernel(cpu, kernel, max_cycles, config,
+                                cycle_allocations, allocating_cycles,
+                                epoch_allocations);
+    std::cout << "warmup: " << warmup << " cycles, " << cycle_allocations
+              << " allocations in " << allocating_cycles << " cycles"
+              << std::endl;
+
+    cycle_allocations = 0;
+    allocating_cycles = 0;
+    epoch_allocations = 0;
+    uint64_t cycles = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < args::get(runs_arg); r++) {
+        cycles += RunKernel(cpu, kernel, max_cycles, config, cycle_allocations,
+                            allocating_cycles, epoch_allocations);
+    }
+    auto seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+    std::cout << "measured: " << cycles << " cycles in " << seconds << " s, "
+              << cycle_allocations << " allocations in " << allocating_cycles
+              << " cycles ("
+              << static_cast<double>(cycle_allocations) /
+                     std::max<uint64_t>(cycles, 1)
+              << " per cycle), " << epoch_allocations
+              << " at epoch boundaries" << std::endl;
+    return 0;
+}
@@ -1,4 +1,7 @@
 #include "bankstate.h"
+#include "checkpoint.h"
+
+#include <limits>
 
 namespace dramsim3 {
 
@@ -213,6 +216,51 @@ void BankState::UpdateState(const Command& cmd) {
     return;
 }
 
+uint64_t BankState::NextTimingEvent(uint64_t clk) const {
+    uint64_t next = std::numeric_limits<uint64_t>::max();
+    for (auto time : cmd_timing_) {
+        if (time >= clk && time < next) {
+            next = time;
+        }
+    }
+    return next;
+}
+
+void BankState::SaveRelativeState(uint64_t clk,
+                                  std::vector<int64_t>& state) const {
+    state.push_back(static_cast<int64_t>(state_));
+    state.push_back(open_row_);
+    state.push_back(row_hit_count_);
+    // constraints already met are all equivalent to "met now"
+    for (auto time : cmd_timing_) {
+        state.push_back(time > clk ? time - clk : 0);
+    }
+}
+
+void BankState::RestoreRelativeState(uint64_t clk,
+                                     std::vector<int64_t>::const_iterator& it) {
+    state_ = static_cast<State>(*it++);
+    open_row_ = *it++;
+    row_hit_count_ = *it++;
+    for (auto& time : cmd_timing_) {
+        time = clk + *it++;
+    }
+}
+
+void BankState::SaveCheckpoint(CheckpointWriter& out) const {
+    Put(out, state_);
+    Put(out, cmd_timing_);
+    Put(out, open_row_);
+    Put(out, row_hit_count_);
+}
+
+void BankState::RestoreCheckpoint(CheckpointReader& in) {
+    Get(in, state_);
+    Get(in, cmd_timing_);
+    Get(in, open_row_);
+    Get(in, row_hit_count_);
+}
+
 void BankState::UpdateTiming(CommandType cmd_type, uint64_t time) {
     cmd_timing_[static_cast<int>(cmd_type)] =
         std::max(cmd_timing_[static_cast<int>(cmd_type)], time);
@@ -1,6 +1,7 @@
 #ifndef __BANKSTATE_H
 #define __BANKSTATE_H
 
+#include <cstdint>
 #include <vector>
 #include "common.h"
 
@@ -23,6 +24,19 @@ class BankState {
     int OpenRow() const { return open_row_; }
     int RowHitCount() const { return row_hit_count_; }
 
+    // Earliest timing constraint of this bank that is not yet met at clk,
+    // UINT64_MAX if every command is already allowed
+    uint64_t NextTimingEvent(uint64_t clk) const;
+
+    // Append the row state and the timing constraints relative to clk,
+    // restore them relative to another cycle (PIM tile replay)
+    void SaveRelativeState(uint64_t clk, std::vector<int64_t>& state) const;
+    void RestoreRelativeState(uint64_t clk,
+                              std::vector<int64_t>::const_iterator& it);
+
+    void SaveCheckpoint(CheckpointWriter& out) const;
+    void RestoreCheckpoint(CheckpointReader& in);
+
    private:
     // Current state of the Bank
     // Apriori or instantaneously transitions on a command.
@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include "./../ext/headers/args.hxx"
+#include "cpu.h"
+#include "pim_kernel.h"
+#include "result_cache.h"
+
+using namespace dramsim3;
+
+namespace {
+
+// a config file parsed once and shared (read only) by all of its jobs
+struct ParsedConfig {
+    ParsedConfig(const std::string &config_file)
+        : config(config_file, "."), timing(config) {
+        // jobs run side by side, don't let them write files or spawn threads
+        config.output_level = -1;
+        config.cmd_trace = false;
+        config.channel_threads = 1;
+    }
+    Config config;
+    Timing timing;
+};
+
+struct Job {
+    std::string config_file;
+    // a trace, or PIM workload files run back to back as with -w
+    std::string trace_file;
+    std::vector<std::string> workload_files;
+    std::vector<PimTransaction> kernel;
+    uint64_t cycles;
+    const ParsedConfig *parsed;
+    nlohmann::json result;
+    bool cache_hit;
+    bool cache_mismatch;
+};
+
+// manifest lines: <config> <trace> [cycles] or
+// <config> -w <workload> [-w <workload>...] [cycles], '#' starts a comment
+bool ReadManifest(const std::string &manifest, uint64_t default_cycles,
+                  std::vector<Job> &jobs) {
+    std::ifstream in(manifest);
+    if (in.fail()) {
+        std::cerr << "Can't open manifest " << manifest << std::endl;
+        return false;
+    }
+    std::string line;
+    int line_no = 0;
+    while (std::getline(in, line)) {
+        line_no++;
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        Job job;
+        if (!(fields >> job.config_file)) continue;
+        std::string word;
+        fields >> word;
+        while (word == "-w") {
+            std::string file;
+            if (!(fields >> file)) break;
+            job.workload_files.push_back(file);
+            word.clear();
+            fields >> word;
+        }
+        if (job.workload_files.empty()) {
+            if (word.empty() || word == "-w") {
+                std::cerr << manifest << ":" << line_no
+                          << ": missing trace or workload file" << std::endl;
+                return false;
+            }
+            job.trace_file = word;
+            word.clear();
+            fields >> word;
+        }
+        job.cycles = default_cycles;
+        if (!word.empty()) {
+            std::istringstream cycles(word);
+            if (!(cycles >> job.cycles) || !(cycles >> std::ws).eof() ||
+                fields >> word) {
+                std::cerr << manifest << ":" << line_no
+                          << ": expected the number of cycles" << std::endl;
+                return false;
+            }
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+nlohmann::json Simulate(const Job &job, bool skip_idle) {
+    std::unique_ptr<CPU> cpu_ptr;
+    if (!job.kernel.empty()) {
+        auto workload_cpu =
+            new WorkloadCPU(job.parsed->config, job.parsed->timing);
+        workload_cpu->Launch(job.kernel);
+        cpu_ptr.reset(workload_cpu);
+    } else {
+        cpu_ptr.reset(new TraceBasedCPU(job.parsed->config,
+                                        job.parsed->timing, job.trace_file));
+    }
+    CPU &cpu = *cpu_ptr;
+    cpu.SetEndCycle(job.cycles);
+    bool turned_off = false;
+    for (uint64_t clk = 0; clk < job.cycles; clk++) {
+        cpu.ClockTick();
+        if (cpu.turnOff()) {
+            turned_off = true;
+            break;
+        }
+        if (skip_idle) {
+            uint64_t next = std::min(cpu.NextEventCycle(), job.cycles);
+            if (next > clk + 1) {
+                cpu.SkipCycles(next - clk - 1);
+                clk = next - 1;
+            }
+        }
+    }
+    cpu.PrintStats();
+    return SimulationResult(cpu.Memory(), turned_off);
+}
+
+void RunJob(Job &job, bool skip_idle, bool full_stats,
+            const ResultCache *cache, bool cache_verify) {
+    std::string cache_key;
+    nlohmann::json cached;
+    job.cache_hit = false;
+    job.cache_mismatch = false;
+    if (cache) {
+        cache_key = !job.kernel.empty()
+                        ? ResultKey(job.parsed->config, job.kernel, job.cycles)
+                        : ResultKey(job.parsed->config, job.trace_file,
+                                    job.cycles);
+        job.cache_hit = cache->Lookup(cache_key, cached);
+    }
+
+    auto &result = job.result;
+    if (!job.cache_hit) {
+        result = Simulate(job, skip_idle);
+        if (cache) cache->Store(cache_key, result);
+    } else if (cache_verify) {
+        result = Simulate(job, skip_idle);
+        for (const auto &field : ResultCache::Mismatches(cached, result)) {
+            result["cache_mismatch"].push_back(field);
+            job.cache_mismatch = true;
+        }
+    } else {
+        result = cached;
+    }
+    result["config"] = job.config_file;
+    if (!job.workload_files.empty()) {
+        result["workloads"] = job.workload_files;
+    } else {
+        result["trace"] = job.trace_file;
+    }
+    if (cache) result["cached"] = job.cache_hit;
+    if (!full_stats) result.erase("stats");
+}
+
+}  // namespace
+
+int main(int argc, const char **argv) {
+    args::ArgumentParser parser(
+        "DRAM Simulator batch driver, runs every job of a manifest in one "
+        "process.",
+        "Manifest lines are \"<config> <trace> [cycles]\" or \"<config> -w "
+        "<workload> [-w <workload>...] [cycles]\", e.g.\n"
+        "configs/HBM2_8Gb_x128.ini traces/QK_128 1000000\n"
+        "configs/HBM2_8Gb_x128.ini -w wl/gemm -w wl/gemm2 1000000\n"
+        "./build/dramsim3batch jobs.txt -j 8 -o results.json");
+    args::HelpFlag help(parser, "help", "Display the help menu", {'h', "help"});
+    args::ValueFlag<uint64_t> num_cycles_arg(
+        parser, "num_cycles", "Cycles to simulate for jobs that don't say",
+        {'c', "cycles"}, 100000);
+    args::ValueFlag<std::string> output_arg(parser, "output",
+                                            "Consolidated result file",
+                                            {'o', "output"}, "batch.json");
+    args::ValueFlag<unsigned> threads_arg(
+        parser, "threads", "Worker threads (default: all cores)",
+        {'j', "threads"}, std::thread::hardware_concurrency());
+    args::Flag no_skip_arg(
+        parser, "no_skip",
+        "Tick every cycle instead of skipping cycles where nothing happens",
+        {"no-skip"});
+    args::Flag full_stats_arg(parser, "full_stats",
+                              "Add the per-channel stats of every job",
+                              {"full-stats"});
+    args::ValueFlag<std::string> cache_arg(
+        parser, "cache", "Result cache directory, cached jobs are not rerun",
+        {"cache"});
+    args::Flag cache_verify_arg(
+        parser, "cache_verify",
+        "Rerun cached jobs and check them against the cached result",
+        {"cache-verify"});
+    args::Positional<std::string> manifest_arg(
+        parser, "manifest", "The job manifest file (mandatory)");
+
+    try {
+        parser.ParseCLI(argc, argv);
+    } catch (args::Help) {
+        std::cout << parser;
+        return 0;
+    } catch (args::ParseError e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << parser;
+        return 1;
+    }
+
+    std::string manifest = args::get(manifest_arg);
+    if (manifest.empty()) {
+        std::cerr << parser;
+        return 1;
+    }
+    bool skip_idle = !args::get(no_skip_arg);
+    bool full_stats = args::get(full_stats_arg);
+    bool cache_verify = args::get(cache_verify_arg);
+    std::unique_ptr<ResultCache> cache;
+    if (cache_arg) cache.reset(new ResultCache(args::get(cache_arg)));
+
+    std::vector<Job> jobs;
+    if (!ReadManifest(manifest, args::get(num_cycles_arg), jobs)) return 1;
+
+    // parse every config once and check all traces and workloads before
+    // anything runs
+    std::map<std::string, std::unique_ptr<ParsedConfig>> configs;
+    for (auto &job : jobs) {
+        auto &parsed = configs[job.config_file];
+        if (!parsed) parsed.reset(new ParsedConfig(job.config_file));
+        job.parsed = parsed.get();
+        if (!job.workload_files.empty()) {
+            std::vector<PimWorkload> workloads;
+            for (const auto &file : job.workload_files) {
+                workloads.push_back(ReadPimWorkload(file));
+            }
+            job.kernel = PimKernels(workloads);
+            continue;
+        }
+        if (std::ifstream(job.trace_file).fail()) {
+            std::cerr << "Trace file " << job.trace_file << " does not exist"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    // jobs vary a lot in length, so idle workers take the next one
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<size_t> next_job(0);
+    auto worker = [&]() {
+        for (size_t i = next_job++; i < jobs.size(); i = next_job++) {
+            RunJob(jobs[i], skip_idle, full_stats, cache.get(), cache_verify);
+        }
+    };
+    unsigned num_threads = std::max(1u, args::get(threads_arg));
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < num_threads && i < jobs.size(); i++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : workers) {
+        thread.join();
+    }
+    auto seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+    std::ofstream out(args::get(output_arg));
+    if (out.fail()) {
+        std::cerr << "Can't write " << args::get(output_arg) << std::endl;
+        return 1;
+    }
+    out << "[";
+    for (size_t i = 0; i < jobs.size(); i++) {
+        out << (i == 0 ? "\n" : ",\n") << jobs[i].result.dump();
+    }
+    out << "\n]" << std::endl;
+
+    std::cout << jobs.size() << " jobs (" << configs.size() << " configs) in "
+              << seconds << " s on " << std::max<size_t>(1, workers.size() + 1)
+              << " threads" << std::endl;
+    if (cache) {
+        int hits = 0;
+        int mismatches = 0;
+        for (const auto &job : jobs) {
+            hits += job.cache_hit;
+            mismatches += job.cache_mismatch;
+        }
+        std::cout << hits << " result cache hits";
+        if (cache_verify) std::cout << ", " << mismatches << " mismatched";
+        std::cout << std::endl;
+        if (mismatches > 0) return 1;
+    }
+    return 0;
+}
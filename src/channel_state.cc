@@ -1,4 +1,8 @@
 #include "channel_state.h"
+#include "checkpoint.h"
+
+#include <functional>
+#include <limits>
 
 namespace dramsim3 {
 ChannelState::ChannelState(const Config& config, const Timing& timing)
@@ -58,6 +62,23 @@ void ChannelState::BankNeedRefresh(int rank, int bankgroup, int bank,
     return;
 }
 
+uint64_t ChannelState::RefreshWaitingBanks() const {
+    uint64_t banks = 0;
+    for (const auto& ref : refresh_q_) {
+        if (ref.cmd_type == CommandType::REFRESH_BANK) {
+            int bank = (ref.Rank() * config_.bankgroups + ref.Bankgroup()) *
+                           config_.banks_per_group +
+                       ref.Bank();
+            banks |= uint64_t(1) << bank;
+        } else {
+            for (int i = 0; i < config_.banks; i++) {
+                banks |= uint64_t(1) << (ref.Rank() * config_.banks + i);
+            }
+        }
+    }
+    return banks;
+}
+
 void ChannelState::RankNeedRefresh(int rank, bool need) {
     if (need) {
         Address addr = Address(-1, rank, -1, -1, -1, -1);
@@ -305,6 +326,65 @@ void ChannelState::UpdateActivationTimes(int rank, uint64_t curr_time) {
     return;
 }
 
+uint64_t ChannelState::NextEventCycle(uint64_t clk) const {
+    uint64_t next = std::numeric_limits<uint64_t>::max();
+    for (const auto& rank_states : bank_states_) {
+        for (const auto& bg_states : rank_states) {
+            for (const auto& bank_state : bg_states) {
+                next = std::min(next, bank_state.NextTimingEvent(clk));
+            }
+        }
+    }
+    for (const auto& windows : {std::cref(four_aw_), std::cref(thirty_two_aw_)}) {
+        for (const auto& rank_window : windows.get()) {
+            for (auto time : rank_window) {
+                if (time >= clk) {
+                    next = std::min(next, time);
+                }
+            }
+        }
+    }
+    return next;
+}
+
+void ChannelState::SaveRelativeState(uint64_t clk,
+                                     std::vector<int64_t>& state) const {
+    for (const auto& rank_states : bank_states_) {
+        for (const auto& bg_states : rank_states) {
+            for (const auto& bank_state : bg_states) {
+                bank_state.SaveRelativeState(clk, state);
+            }
+        }
+    }
+    for (const auto& windows : {std::cref(four_aw_), std::cref(thirty_two_aw_)}) {
+        for (const auto& rank_window : windows.get()) {
+            state.push_back(rank_window.size());
+            for (auto time : rank_window) {
+                state.push_back(time > clk ? time - clk : 0);
+            }
+        }
+    }
+}
+
+void ChannelState::RestoreRelativeState(
+    uint64_t clk, std::vector<int64_t>::const_iterator& it) {
+    for (auto& rank_states : bank_states_) {
+        for (auto& bg_states : rank_states) {
+            for (auto& bank_state : bg_states) {
+                bank_state.RestoreRelativeState(clk, it);
+            }
+        }
+    }
+    for (auto windows : {&four_aw_, &thirty_two_aw_}) {
+        for (auto& rank_window : *windows) {
+            rank_window.resize(*it++);
+            for (auto& time : rank_window) {
+                time = clk + *it++;
+            }
+        }
+    }
+}
+
 bool ChannelState::IsFAWReady(int rank, uint64_t curr_time) const {
     if (!four_aw_[rank].empty()) {
         if (curr_time < four_aw_[rank][0] && four_aw_[rank].size() >= 4) {
@@ -324,4 +404,34 @@ bool ChannelState::Is32AWReady(int rank, uint64_t curr_time) const {
     return true;
 }
 
+void ChannelState::SaveCheckpoint(CheckpointWriter& out) const {
+    Put(out, rank_idle_cycles);
+    Put(out, rank_is_sref_);
+    for (const auto& rank : bank_states_) {
+        for (const auto& bankgroup : rank) {
+            for (const auto& bank : bankgroup) {
+                bank.SaveCheckpoint(out);
+            }
+        }
+    }
+    Put(out, refresh_q_);
+    Put(out, four_aw_);
+    Put(out, thirty_two_aw_);
+}
+
+void ChannelState::RestoreCheckpoint(CheckpointReader& in) {
+    Get(in, rank_idle_cycles);
+    Get(in, rank_is_sref_);
+    for (auto& rank : bank_states_) {
+        for (auto& bankgroup : rank) {
+            for (auto& bank : bankgroup) {
+                bank.RestoreCheckpoint(in);
+            }
+        }
+    }
+    Get(in, refresh_q_);
+    Get(in, four_aw_);
+    Get(in, thirty_two_aw_);
+}
+
 }  // namespace dramsim3
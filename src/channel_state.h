@@ -18,12 +18,23 @@ class ChannelState {
     void UpdateTimingAndStates(const Command& cmd, uint64_t clk);
     bool ActivationWindowOk(int rank, uint64_t curr_time) const;
     void UpdateActivationTimes(int rank, uint64_t curr_time);
+    // Earliest cycle >= clk at which a bank timing or activation window
+    // constraint expires, UINT64_MAX if nothing is pending
+    uint64_t NextEventCycle(uint64_t clk) const;
+    // Bank states and activation windows relative to clk, see BankState
+    void SaveRelativeState(uint64_t clk, std::vector<int64_t>& state) const;
+    void RestoreRelativeState(uint64_t clk,
+                              std::vector<int64_t>::const_iterator& it);
+    void SaveCheckpoint(CheckpointWriter& out) const;
+    void RestoreCheckpoint(CheckpointReader& in);
     bool IsRowOpen(int rank, int bankgroup, int bank) const {
         return bank_states_[rank][bankgroup][bank].IsRowOpen();
     }
     bool IsAllBankIdleInRank(int rank) const;
     bool IsRankSelfRefreshing(int rank) const { return rank_is_sref_[rank]; }
     bool IsRefreshWaiting() const { return !refresh_q_.empty(); }
+    // banks with a refresh waiting, see Refresh::OwedBanks()
+    uint64_t RefreshWaitingBanks() const;
     bool IsRWPendingOnRef(const Command& cmd) const;
     const Command& PendingRefCommand() const {return refresh_q_.front(); }
     void BankNeedRefresh(int rank, int bankgroup, int bank, bool need);
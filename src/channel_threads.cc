@@ -0,0 +1,76 @@
+#include "channel_threads.h"
+
+#include <algorithm>
+
+namespace dramsim3 {
+
+ChannelThreads::ChannelThreads(int num_threads, int num_channels)
+    : num_threads_(std::max(1, std::min(num_threads, num_channels))),
+      num_channels_(num_channels),
+      work_(nullptr),
+      generation_(0),
+      pending_(0),
+      stop_(false),
+      parked_(0) {
+    for (int i = 1; i < num_threads_; i++) {
+        workers_.emplace_back(&ChannelThreads::WorkerLoop, this, i);
+    }
+}
+
+ChannelThreads::~ChannelThreads() {
+    stop_.store(true, std::memory_order_release);
+    generation_.fetch_add(1, std::memory_order_seq_cst);
+    WakeParked();
+    for (auto &worker : workers_) {
+        worker.join();
+    }
+}
+
+void ChannelThreads::Run(const std::function<void(int)> &work) {
+    work_ = &work;
+    pending_.store(num_threads_ - 1, std::memory_order_relaxed);
+    generation_.fetch_add(1, std::memory_order_seq_cst);
+    WakeParked();
+    RunBlock(0);
+    SpinUntil([this] { return pending_.load(std::memory_order_acquire) == 0; });
+    work_ = nullptr;
+}
+
+void ChannelThreads::WakeParked() {
+    // sequentially consistent with the parked_ increment of a worker, so
+    // either it sees the new generation or it is counted here
+    if (parked_.load(std::memory_order_seq_cst) == 0) return;
+    std::lock_guard<std::mutex> lock(park_mutex_);
+    park_cv_.notify_all();
+}
+
+void ChannelThreads::WorkerLoop(int thread_id) {
+    uint64_t seen = 0;
+    while (true) {
+        int spins = 0;
+        while (generation_.load(std::memory_order_acquire) == seen) {
+            if (++spins % kSpinsBeforeYield == 0) std::this_thread::yield();
+            if (spins < kSpinsBeforePark) continue;
+            std::unique_lock<std::mutex> lock(park_mutex_);
+            parked_.fetch_add(1, std::memory_order_seq_cst);
+            park_cv_.wait(lock, [this, seen] {
+                return generation_.load(std::memory_order_seq_cst) != seen;
+            });
+            parked_.fetch_sub(1, std::memory_order_relaxed);
+        }
+        seen = generation_.load(std::memory_order_acquire);
+        if (stop_.load(std::memory_order_acquire)) return;
+        RunBlock(thread_id);
+        pending_.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+void ChannelThreads::RunBlock(int thread_id) const {
+    int begin = num_channels_ * thread_id / num_threads_;
+    int end = num_channels_ * (thread_id + 1) / num_threads_;
+    for (int i = begin; i < end; i++) {
+        (*work_)(i);
+    }
+}
+
+}  // namespace dramsim3
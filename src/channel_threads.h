@@ -0,0 +1,63 @@
+#ifndef __CHANNEL_THREADS_H
+#define __CHANNEL_THREADS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dramsim3 {
+
+// spin this many times before giving the core away, waits between threads
+// stepping the same simulation are usually only a few hundred nanoseconds
+const int kSpinsBeforeYield = 1024;
+
+template <typename Pred>
+void SpinUntil(Pred pred) {
+    int spins = 0;
+    while (!pred()) {
+        if (++spins >= kSpinsBeforeYield) {
+            std::this_thread::yield();
+            spins = 0;
+        }
+    }
+}
+
+// an idle worker spins (and yields) this many times before it sleeps until
+// the next Run(), e.g. while a PIM kernel steps the channels serially
+const int kSpinsBeforePark = 64 * kSpinsBeforeYield;
+
+// A fixed pool of threads stepping channel controllers in lockstep.
+// Channels are split into contiguous blocks, one block per thread, the
+// calling thread works on the first block and Run() returns only when all
+// blocks are done, so every call is a barrier.
+class ChannelThreads {
+   public:
+    ChannelThreads(int num_threads, int num_channels);
+    ~ChannelThreads();
+    void Run(const std::function<void(int channel)> &work);
+    int NumThreads() const { return num_threads_; }
+
+   private:
+    int num_threads_;
+    int num_channels_;
+    std::vector<std::thread> workers_;
+
+    const std::function<void(int)> *work_;
+    std::atomic<uint64_t> generation_;
+    std::atomic<int> pending_;
+    std::atomic<bool> stop_;
+    // workers asleep on park_cv_, Run() only takes the lock if there are any
+    std::atomic<int> parked_;
+    std::mutex park_mutex_;
+    std::condition_variable park_cv_;
+
+    void WakeParked();
+    void WorkerLoop(int thread_id);
+    void RunBlock(int thread_id) const;
+};
+
+}  // namespace dramsim3
+#endif
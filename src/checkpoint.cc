@@ -0,0 +1,160 @@
+#include "checkpoint.h"
+
+namespace dramsim3 {
+
+CheckpointWriter::CheckpointWriter(const std::string& file_name)
+    : file_name_(file_name),
+      out_(file_name, std::ofstream::out | std::ofstream::binary) {
+    if (out_.fail()) {
+        std::cerr << "Can't write checkpoint " << file_name << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+}
+
+void CheckpointWriter::Write(const void* data, size_t size) {
+    out_.write(static_cast<const char*>(data), size);
+    if (out_.fail()) {
+        std::cerr << "Failed writing checkpoint " << file_name_ << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+}
+
+CheckpointReader::CheckpointReader(const std::string& file_name)
+    : file_name_(file_name),
+      in_(file_name, std::ifstream::in | std::ifstream::binary) {
+    if (in_.fail()) {
+        std::cerr << "Can't read checkpoint " << file_name << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+}
+
+void CheckpointReader::Read(void* data, size_t size) {
+    in_.read(static_cast<char*>(data), size);
+    if (in_.fail()) {
+        std::cerr << "Checkpoint " << file_name_ << " is truncated"
+                  << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+}
+
+void Put(CheckpointWriter& out, const std::string& value) {
+    Put(out, static_cast<uint64_t>(value.size()));
+    out.Write(value.data(), value.size());
+}
+
+void Get(CheckpointReader& in, std::string& value) {
+    uint64_t size;
+    Get(in, size);
+    value.resize(size);
+    if (size > 0) in.Read(&value[0], size);
+}
+
+void Put(CheckpointWriter& out, const Address& addr) {
+    Put(out, addr.channel);
+    Put(out, addr.rank);
+    Put(out, addr.bankgroup);
+    Put(out, addr.bank);
+    Put(out, addr.row);
+    Put(out, addr.column);
+}
+
+void Get(CheckpointReader& in, Address& addr) {
+    Get(in, addr.channel);
+    Get(in, addr.rank);
+    Get(in, addr.bankgroup);
+    Get(in, addr.bank);
+    Get(in, addr.row);
+    Get(in, addr.column);
+}
+
+void Put(CheckpointWriter& out, const Command& cmd) {
+    Put(out, cmd.cmd_type);
+    Put(out, cmd.addr);
+    Put(out, cmd.hex_addr);
+}
+
+void Get(CheckpointReader& in, Command& cmd) {
+    Get(in, cmd.cmd_type);
+    Get(in, cmd.addr);
+    Get(in, cmd.hex_addr);
+}
+
+// queued transactions only carry the fields of the copy constructor, the
+// PIM fields are only used by the trace reader
+void Put(CheckpointWriter& out, const Transaction& trans) {
+    Put(out, trans.addr);
+    Put(out, trans.added_cycle);
+    Put(out, trans.complete_cycle);
+    Put(out, static_cast<uint8_t>(trans.is_write));
+    Put(out, static_cast<uint8_t>(trans.is_pim));
+    Put(out, static_cast<uint8_t>(trans.active));
+}
+
+void Get(CheckpointReader& in, Transaction& trans) {
+    uint8_t is_write, is_pim, active;
+    Get(in, trans.addr);
+    Get(in, trans.added_cycle);
+    Get(in, trans.complete_cycle);
+    Get(in, is_write);
+    Get(in, is_pim);
+    Get(in, active);
+    trans.is_write = is_write;
+    trans.is_pim = is_pim;
+    trans.active = active;
+}
+
+void Put(CheckpointWriter& out, const PimTransaction& pim) {
+    Put(out, pim.type);
+    Put(out, pim.cut_mask);
+    Put(out, pim.vcuts);
+    Put(out, pim.hcuts);
+    Put(out, pim.mcf);
+    Put(out, pim.ucf);
+    Put(out, pim.df);
+    Put(out, pim.M_tile_size);
+    Put(out, pim.vcuts_next);
+    Put(out, pim.hcuts_next);
+    Put(out, pim.kernel_size);
+    Put(out, pim.stride);
+    Put(out, pim.cut_no);
+    Put(out, pim.load_type);
+    Put(out, pim.dim_value);
+    Put(out, pim.base_row);
+    Put(out, pim.M_cap);
+    Put(out, pim.K_cap);
+    Put(out, pim.append_from);
+    Put(out, pim.append_to);
+    Put(out, pim.vpu_op);
+    Put(out, pim.vpu_elements);
+    Put(out, pim.vpu_vectors);
+    Put(out, pim.tenant);
+}
+
+void Get(CheckpointReader& in, PimTransaction& pim) {
+    Get(in, pim.type);
+    Get(in, pim.cut_mask);
+    Get(in, pim.vcuts);
+    Get(in, pim.hcuts);
+    Get(in, pim.mcf);
+    Get(in, pim.ucf);
+    Get(in, pim.df);
+    Get(in, pim.M_tile_size);
+    Get(in, pim.vcuts_next);
+    Get(in, pim.hcuts_next);
+    Get(in, pim.kernel_size);
+    Get(in, pim.stride);
+    Get(in, pim.cut_no);
+    Get(in, pim.load_type);
+    Get(in, pim.dim_value);
+    Get(in, pim.base_row);
+    Get(in, pim.M_cap);
+    Get(in, pim.K_cap);
+    Get(in, pim.append_from);
+    Get(in, pim.append_to);
+    Get(in, pim.vpu_op);
+    Get(in, pim.vpu_elements);
+    Get(in, pim.vpu_vectors);
+    Get(in, pim.tenant);
+}
+
+}  // namespace dramsim3
@@ -0,0 +1,195 @@
+#ifndef __CHECKPOINT_H
+#define __CHECKPOINT_H
+
+#include <array>
+#include <fstream>
+#include <map>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "common.h"
+#include "pim_kernel.h"
+
+namespace dramsim3 {
+
+// Binary snapshot of the simulator state. Values are stored in host byte
+// order, a snapshot is meant to be restored by the same build with the same
+// config file.
+class CheckpointWriter {
+   public:
+    explicit CheckpointWriter(const std::string& file_name);
+    void Write(const void* data, size_t size);
+
+   private:
+    std::string file_name_;
+    std::ofstream out_;
+};
+
+class CheckpointReader {
+   public:
+    explicit CheckpointReader(const std::string& file_name);
+    void Read(void* data, size_t size);
+
+   private:
+    std::string file_name_;
+    std::ifstream in_;
+};
+
+template <typename T>
+using EnableIfScalar = typename std::enable_if<std::is_arithmetic<T>::value ||
+                                               std::is_enum<T>::value>::type;
+
+template <typename T, typename = EnableIfScalar<T>>
+void Put(CheckpointWriter& out, const T& value) {
+    out.Write(&value, sizeof(T));
+}
+
+template <typename T, typename = EnableIfScalar<T>>
+void Get(CheckpointReader& in, T& value) {
+    in.Read(&value, sizeof(T));
+}
+
+void Put(CheckpointWriter& out, const std::string& value);
+void Get(CheckpointReader& in, std::string& value);
+void Put(CheckpointWriter& out, const Address& addr);
+void Get(CheckpointReader& in, Address& addr);
+void Put(CheckpointWriter& out, const Command& cmd);
+void Get(CheckpointReader& in, Command& cmd);
+void Put(CheckpointWriter& out, const Transaction& trans);
+void Get(CheckpointReader& in, Transaction& trans);
+void Put(CheckpointWriter& out, const PimTransaction& pim);
+void Get(CheckpointReader& in, PimTransaction& pim);
+
+template <typename A, typename B>
+void Put(CheckpointWriter& out, const std::pair<A, B>& value) {
+    Put(out, value.first);
+    Put(out, value.second);
+}
+
+template <typename A, typename B>
+void Get(CheckpointReader& in, std::pair<A, B>& value) {
+    Get(in, value.first);
+    Get(in, value.second);
+}
+
+template <typename T>
+void Put(CheckpointWriter& out, const std::vector<T>& values) {
+    Put(out, static_cast<uint64_t>(values.size()));
+    for (const auto& value : values) {
+        Put(out, static_cast<const T&>(value));
+    }
+}
+
+template <typename T>
+void Get(CheckpointReader& in, std::vector<T>& values) {
+    uint64_t size;
+    Get(in, size);
+    values.clear();
+    values.reserve(size);
+    for (uint64_t i = 0; i < size; i++) {
+        T value;
+        Get(in, value);
+        values.push_back(value);
+    }
+}
+
+template <typename T, size_t N>
+void Put(CheckpointWriter& out, const std::array<T, N>& values) {
+    for (const auto& value : values) {
+        Put(out, value);
+    }
+}
+
+template <typename T, size_t N>
+void Get(CheckpointReader& in, std::array<T, N>& values) {
+    for (auto& value : values) {
+        Get(in, value);
+    }
+}
+
+template <typename Map>
+void PutMap(CheckpointWriter& out, const Map& values) {
+    Put(out, static_cast<uint64_t>(values.size()));
+    for (const auto& it : values) {
+        Put(out, it.first);
+        Put(out, it.second);
+    }
+}
+
+template <typename K, typename V>
+void Put(CheckpointWriter& out, const std::map<K, V>& values) {
+    PutMap(out, values);
+}
+
+template <typename K, typename V>
+void Get(CheckpointReader& in, std::map<K, V>& values) {
+    uint64_t size;
+    Get(in, size);
+    values.clear();
+    for (uint64_t i = 0; i < size; i++) {
+        std::pair<K, V> value;
+        Get(in, value);
+        values.insert(value);
+    }
+}
+
+template <typename K, typename V>
+void Put(CheckpointWriter& out, const std::multimap<K, V>& values) {
+    PutMap(out, values);
+}
+
+template <typename K, typename V>
+void Get(CheckpointReader& in, std::multimap<K, V>& values) {
+    uint64_t size;
+    Get(in, size);
+    values.clear();
+    for (uint64_t i = 0; i < size; i++) {
+        std::pair<K, V> value;
+        Get(in, value);
+        values.insert(values.end(), value);
+    }
+}
+
+template <typename K, typename V>
+void Put(CheckpointWriter& out, const std::unordered_map<K, V>& values) {
+    PutMap(out, values);
+}
+
+// entries are assigned in place, keys that already exist keep their
+// iteration order (which the stats output depends on)
+template <typename K, typename V>
+void Get(CheckpointReader& in, std::unordered_map<K, V>& values) {
+    uint64_t size;
+    Get(in, size);
+    for (uint64_t i = 0; i < size; i++) {
+        K key;
+        Get(in, key);
+        Get(in, values[key]);
+    }
+}
+
+template <typename T>
+void Put(CheckpointWriter& out, const std::unordered_set<T>& values) {
+    Put(out, static_cast<uint64_t>(values.size()));
+    for (const auto& value : values) {
+        Put(out, value);
+    }
+}
+
+template <typename T>
+void Get(CheckpointReader& in, std::unordered_set<T>& values) {
+    uint64_t size;
+    Get(in, size);
+    values.clear();
+    for (uint64_t i = 0; i < size; i++) {
+        T value;
+        Get(in, value);
+        values.insert(value);
+    }
+}
+
+}  // namespace dramsim3
+#endif
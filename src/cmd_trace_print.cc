@@ -0,0 +1,57 @@
+#include <string.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include "./../ext/headers/args.hxx"
+#include "command_tracer.h"
+
+using namespace dramsim3;
+
+int main(int argc, const char **argv) {
+    args::ArgumentParser parser(
+        "Prints a binary command trace in the text format of the old "
+        "CMD_TRACE builds.",
+        "./build/dramsim3cmdtrace dramsim3ch_0cmd.bin > dramsim3ch_0cmd.trace");
+    args::HelpFlag help(parser, "help", "Display the help menu", {'h', "help"});
+    args::Positional<std::string> trace_arg(
+        parser, "cmd_trace", "The binary command trace (mandatory)");
+
+    try {
+        parser.ParseCLI(argc, argv);
+    } catch (args::Help) {
+        std::cout << parser;
+        return 0;
+    } catch (args::ParseError e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << parser;
+        return 1;
+    }
+
+    std::string trace_file = args::get(trace_arg);
+    if (trace_file.empty()) {
+        std::cerr << parser;
+        return 1;
+    }
+    std::ifstream in(trace_file, std::ifstream::binary);
+    if (in.fail()) {
+        std::cerr << "Can't open " << trace_file << std::endl;
+        return 1;
+    }
+    CommandTraceHeader header;
+    in.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (in.fail() ||
+        memcmp(header.magic, kCommandTraceMagic, sizeof(header.magic)) != 0 ||
+        header.version != kCommandTraceVersion ||
+        header.record_size != sizeof(CommandTraceRecord)) {
+        std::cerr << trace_file << " is not a command trace" << std::endl;
+        return 1;
+    }
+
+    CommandTraceRecord record;
+    while (in.read(reinterpret_cast<char *>(&record), sizeof(record))) {
+        uint64_t clk;
+        Command cmd = UnpackCommand(record, header.channel, clk);
+        std::cout << std::left << std::setw(18) << clk << " " << cmd << "\n";
+    }
+    return 0;
+}
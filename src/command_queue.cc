@@ -1,4 +1,5 @@
 #include "command_queue.h"
+#include "checkpoint.h"
 
 namespace dramsim3 {
 
@@ -31,6 +32,7 @@ CommandQueue::CommandQueue(int channel_id, const Config& config,
         cmd_queue.reserve(config_.cmd_queue_size);
         queues_.push_back(cmd_queue);
     }
+    ref_q_indices_.assign(num_queues_, false);
 }
 
 Command CommandQueue::GetCommandToIssue() {
@@ -38,7 +40,7 @@ Command CommandQueue::GetCommandToIssue() {
         auto& queue = GetNextQueue();
         // if we're refresing, skip the command queues that are involved
         if (is_in_ref_) {
-            if (ref_q_indices_.find(queue_idx_) != ref_q_indices_.end()) {
+            if (ref_q_indices_[queue_idx_]) {
                 continue;
             }
         }
@@ -68,7 +70,7 @@ Command CommandQueue::FinishRefresh() {
     auto cmd = channel_state_.GetReadyCommand(ref, clk_);
 
     if (cmd.IsRefresh()) {
-        ref_q_indices_.clear();
+        ref_q_indices_.assign(num_queues_, false);
         is_in_ref_ = false;
     }
     return cmd;
@@ -148,15 +150,15 @@ void CommandQueue::GetRefQIndices(const Command& ref) {
         if (queue_structure_ == QueueStructure::PER_BANK) {
             for (int i = 0; i < num_queues_; i++) {
                 if (i / config_.banks == ref.Rank()) {
-                    ref_q_indices_.insert(i);
+                    ref_q_indices_[i] = true;
                 }
             }
         } else {
-            ref_q_indices_.insert(ref.Rank());
+            ref_q_indices_[ref.Rank()] = true;
         }
     } else {  // refb
         int idx = GetQueueIndex(ref.Rank(), ref.Bankgroup(), ref.Bank());
-        ref_q_indices_.insert(idx);
+        ref_q_indices_[idx] = true;
     }
     return;
 }
@@ -229,4 +231,22 @@ bool CommandQueue::HasRWDependency(const CMDIterator& cmd_it,
     return false;
 }
 
+void CommandQueue::SaveCheckpoint(CheckpointWriter& out) const {
+    Put(out, queues_);
+    Put(out, ref_q_indices_);
+    Put(out, is_in_ref_);
+    Put(out, queue_idx_);
+    Put(out, clk_);
+    Put(out, rank_q_empty);
+}
+
+void CommandQueue::RestoreCheckpoint(CheckpointReader& in) {
+    Get(in, queues_);
+    Get(in, ref_q_indices_);
+    Get(in, is_in_ref_);
+    Get(in, queue_idx_);
+    Get(in, clk_);
+    Get(in, rank_q_empty);
+}
+
 }  // namespace dramsim3
@@ -1,7 +1,6 @@
 #ifndef __COMMAND_QUEUE_H
 #define __COMMAND_QUEUE_H
 
-#include <unordered_set>
 #include <vector>
 #include "channel_state.h"
 #include "common.h"
@@ -21,11 +20,14 @@ class CommandQueue {
     Command GetCommandToIssue();
     Command FinishRefresh();
     void ClockTick() { clk_ += 1; };
+    void SkipCycles(uint64_t cycles) { clk_ += cycles; };
     bool WillAcceptCommand(int rank, int bankgroup, int bank) const;
     bool AddCommand(Command cmd);
     bool QueueEmpty() const;
     int QueueUsage() const;
-    bool IsInRef() { return is_in_ref_; };
+    bool IsInRef() const { return is_in_ref_; };
+    void SaveCheckpoint(CheckpointWriter& out) const;
+    void RestoreCheckpoint(CheckpointReader& in);
     std::vector<bool> rank_q_empty;
 
    private:
@@ -48,8 +50,9 @@ class CommandQueue {
 
     std::vector<CMDQueue> queues_;
 
-    // Refresh related data structures
-    std::unordered_set<int> ref_q_indices_;
+    // Refresh related data structures, whether each queue waits for the
+    // pending refresh (flags rather than a set, refreshing never allocates)
+    std::vector<bool> ref_q_indices_;
     bool is_in_ref_;
 
     int num_queues_;
@@ -0,0 +1,149 @@
+#include "command_tracer.h"
+#include <string.h>
+#include <chrono>
+#include "channel_threads.h"
+
+namespace dramsim3 {
+
+namespace {
+// records per channel ring, 512KB each
+const uint64_t kRingSize = 1 << 15;
+
+const int kRowBits = 26;
+const int kColumnBits = 16;
+const int kBankBits = 6;
+
+uint64_t Field(int value, int bits, int pos) {
+    return (static_cast<uint64_t>(value + 1) & ((1ULL << bits) - 1)) << pos;
+}
+
+int GetField(uint64_t word, int bits, int pos) {
+    return static_cast<int>((word >> pos) & ((1ULL << bits) - 1)) - 1;
+}
+}  // namespace
+
+CommandTraceRecord PackCommand(uint64_t clk, const Command& cmd) {
+    CommandTraceRecord record;
+    record.clk_type = (clk & ((1ULL << 56) - 1)) |
+                      static_cast<uint64_t>(cmd.cmd_type) << 56;
+    int pos = 0;
+    record.addr = Field(cmd.Row(), kRowBits, pos);
+    pos += kRowBits;
+    record.addr |= Field(cmd.Column(), kColumnBits, pos);
+    pos += kColumnBits;
+    record.addr |= Field(cmd.Bank(), kBankBits, pos);
+    pos += kBankBits;
+    record.addr |= Field(cmd.Bankgroup(), kBankBits, pos);
+    pos += kBankBits;
+    record.addr |= Field(cmd.Rank(), kBankBits, pos);
+    pos += kBankBits;
+    record.addr |= static_cast<uint64_t>(cmd.Channel() < 0) << pos;
+    return record;
+}
+
+Command UnpackCommand(const CommandTraceRecord& record, int channel,
+                      uint64_t& clk) {
+    clk = record.clk_type & ((1ULL << 56) - 1);
+    auto cmd_type = static_cast<CommandType>(record.clk_type >> 56);
+    int pos = 0;
+    int row = GetField(record.addr, kRowBits, pos);
+    pos += kRowBits;
+    int column = GetField(record.addr, kColumnBits, pos);
+    pos += kColumnBits;
+    int bank = GetField(record.addr, kBankBits, pos);
+    pos += kBankBits;
+    int bankgroup = GetField(record.addr, kBankBits, pos);
+    pos += kBankBits;
+    int rank = GetField(record.addr, kBankBits, pos);
+    pos += kBankBits;
+    if ((record.addr >> pos) & 1) channel = -1;
+    return Command(cmd_type, Address(channel, rank, bankgroup, bank, row, column),
+                   0);
+}
+
+void CommandTracer::Ring::Append(uint64_t clk, const Command& cmd) {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    SpinUntil([this, head] {
+        return head - tail_.load(std::memory_order_acquire) <= mask_;
+    });
+    records_[head & mask_] = PackCommand(clk, cmd);
+    head_.store(head + 1, std::memory_order_release);
+}
+
+CommandTracer::CommandTracer(const Config& config)
+    : rings_(config.channels), stop_(false) {
+    if (config.rows >= (1 << kRowBits) || config.columns >= (1 << kColumnBits) ||
+        config.ranks >= (1 << kBankBits) ||
+        config.bankgroups >= (1 << kBankBits) ||
+        config.banks_per_group >= (1 << kBankBits)) {
+        std::cerr << "Command trace records can't hold the addresses of this "
+                     "config"
+                  << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    for (int i = 0; i < config.channels; i++) {
+        Ring& ring = rings_[i];
+        ring.records_.resize(kRingSize);
+        ring.mask_ = kRingSize - 1;
+        ring.head_.store(0, std::memory_order_relaxed);
+        ring.tail_.store(0, std::memory_order_relaxed);
+        std::string file_name =
+            config.output_prefix + "ch_" + std::to_string(i) + "cmd.bin";
+        ring.out_.open(file_name, std::ofstream::out | std::ofstream::binary);
+        if (ring.out_.fail()) {
+            std::cerr << "Can't write command trace " << file_name
+                      << std::endl;
+            AbruptExit(__FILE__, __LINE__);
+        }
+        CommandTraceHeader header;
+        memcpy(header.magic, kCommandTraceMagic, sizeof(header.magic));
+        header.version = kCommandTraceVersion;
+        header.record_size = sizeof(CommandTraceRecord);
+        header.channel = i;
+        header.reserved = 0;
+        ring.out_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+    writer_ = std::thread(&CommandTracer::WriterLoop, this);
+}
+
+CommandTracer::~CommandTracer() {
+    stop_.store(true, std::memory_order_release);
+    writer_.join();
+}
+
+size_t CommandTracer::Drain(Ring& ring) {
+    uint64_t head = ring.head_.load(std::memory_order_acquire);
+    uint64_t tail = ring.tail_.load(std::memory_order_relaxed);
+    size_t drained = head - tail;
+    while (tail != head) {
+        // up to the end of the ring in one write
+        uint64_t end = std::min(head, (tail | ring.mask_) + 1);
+        ring.out_.write(
+            reinterpret_cast<const char*>(&ring.records_[tail & ring.mask_]),
+            (end - tail) * sizeof(CommandTraceRecord));
+        tail = end;
+    }
+    ring.tail_.store(tail, std::memory_order_release);
+    return drained;
+}
+
+void CommandTracer::WriterLoop() {
+    while (true) {
+        // read the flag first, records appended before it was set are then
+        // all visible to the drain below
+        bool stop = stop_.load(std::memory_order_acquire);
+        size_t drained = 0;
+        for (auto& ring : rings_) {
+            drained += Drain(ring);
+        }
+        if (stop) break;
+        if (drained == 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    }
+    for (auto& ring : rings_) {
+        ring.out_.close();
+    }
+}
+
+}  // namespace dramsim3
@@ -0,0 +1,76 @@
+#ifndef __COMMAND_TRACER_H
+#define __COMMAND_TRACER_H
+
+#include <atomic>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "common.h"
+#include "configuration.h"
+
+namespace dramsim3 {
+
+// Binary command trace of one channel: a header followed by 16-byte records
+// in host byte order, rendered as text by dramsim3cmdtrace.
+const char kCommandTraceMagic[8] = {'H', 'B', 'D', 'C', 'M', 'D', 'T', 'R'};
+const uint32_t kCommandTraceVersion = 1;
+
+struct CommandTraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    int32_t channel;
+    uint32_t reserved;
+};
+
+// word 0: cycle (56 bits) and command type (8 bits); word 1: row (26 bits),
+// column (16), bank (6), bankgroup (6) and rank (6), each stored +1 so that
+// unset (-1) fields survive, and a bit for commands without a channel
+struct CommandTraceRecord {
+    uint64_t clk_type;
+    uint64_t addr;
+};
+
+CommandTraceRecord PackCommand(uint64_t clk, const Command& cmd);
+Command UnpackCommand(const CommandTraceRecord& record, int channel,
+                      uint64_t& clk);
+
+// Command tracing off the simulation threads. Controllers append records to
+// a ring per channel, a writer thread drains the rings to
+// <output_prefix>ch_<channel>cmd.bin.
+class CommandTracer {
+   public:
+    class Ring {
+       public:
+        // waits only if the writer is a whole ring behind
+        void Append(uint64_t clk, const Command& cmd);
+
+       private:
+        friend class CommandTracer;
+        std::vector<CommandTraceRecord> records_;
+        uint64_t mask_;
+        std::ofstream out_;
+        char pad_head_[64];
+        std::atomic<uint64_t> head_;
+        char pad_tail_[64];
+        std::atomic<uint64_t> tail_;
+        char pad_end_[64];
+    };
+
+    explicit CommandTracer(const Config& config);
+    // writes out everything appended so far
+    ~CommandTracer();
+    Ring* GetRing(int channel) { return &rings_[channel]; }
+
+   private:
+    std::vector<Ring> rings_;
+    std::atomic<bool> stop_;
+    std::thread writer_;
+
+    void WriterLoop();
+    size_t Drain(Ring& ring);
+};
+
+}  // namespace dramsim3
+#endif
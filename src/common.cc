@@ -1,7 +1,6 @@
 #include "common.h"
 #include "fmt/format.h"
 #include <sstream>
-#include <unordered_set>
 #include <sys/stat.h>
 #include <math.h>
 
@@ -41,22 +40,13 @@ std::ostream& operator<<(std::ostream& os, const Transaction& trans) {
 }
 
 std::istream& operator>>(std::istream& is, Transaction& trans) {
-    std::unordered_set<std::string> write_types = {"WRITE", "write", "P_MEM_WR",
-                                                   "BOFF"};
-    std::unordered_set<std::string> pim_types = {"PIM"};
     std::string mem_op;
     is >> std::hex >> trans.addr >> mem_op >> std::dec >> trans.added_cycle;
     // std::cout<<"Transaction being read: "<<std::hex<<trans.addr<<'\t'<<mem_op<<std::dec<<'\t'<<trans.added_cycle<<'\n';
-    int w_cnt = write_types.count(mem_op);
-    int pim_cnt = pim_types.count(mem_op);
-    if (w_cnt == 0 && pim_cnt == 0)
-        trans.active = false;
-    else
-        trans.active = true;
-    trans.is_write = w_cnt == 1;
-    trans.is_pim = pim_cnt == 1;
-
-
+    trans.is_write = mem_op == "WRITE" || mem_op == "write" ||
+                     mem_op == "P_MEM_WR" || mem_op == "BOFF";
+    trans.is_pim = mem_op == "PIM";
+    trans.active = trans.is_write || trans.is_pim;
     return is;
 }
 
@@ -41,6 +41,9 @@ inline uint32_t ModuloWidth(uint64_t addr, uint32_t bit_width, uint32_t pos) {
 }
 
 // extern std::function<Address(uint64_t)> AddressMapping;
+class CheckpointWriter;
+class CheckpointReader;
+
 int GetBitInPos(uint64_t bits, int pos);
 // it's 2017 and c++ std::string still lacks a split function, oh well
 std::vector<std::string> StringSplit(const std::string& s, char delim);
@@ -1,5 +1,6 @@
 #include "configuration.h"
 
+#include <algorithm>
 #include <vector>
 
 #ifdef THERMAL
@@ -24,6 +25,7 @@ Config::Config(std::string config_file, std::string out_dir)
     InitTimingParams();
     InitPowerParams();
     InitOtherParams();
+    InitPIMParams();
 #ifdef THERMAL
     InitThermalParams();
 #endif  // THERMAL
@@ -161,11 +163,16 @@ void Config::InitOtherParams() {
     const auto& reader = *reader_;
     epoch_period = GetInteger("other", "epoch_period", 100000);
     // determine how much output we want:
-    // -1: no file output at all (NOT implemented yet)
+    // -1: no file or console output, stats are only kept in memory
     // 0: no epoch file output, only outputs the summary in the end
     // 1: default value, adds epoch CSV output on level 0
     // 2: adds histogram outputs in a different CSV format
     output_level = reader.GetInteger("other", "output_level", 1);
+#ifdef CMD_TRACE
+    cmd_trace = reader.GetBoolean("other", "cmd_trace", true);
+#else
+    cmd_trace = reader.GetBoolean("other", "cmd_trace", false);
+#endif  // CMD_TRACE
     // Other Parameters
     // give a prefix instead of specify the output name one by one...
     // this would allow outputing to a directory and you can always override
@@ -186,6 +193,108 @@ void Config::InitOtherParams() {
     return;
 }
 
+void Config::InitPIMParams() {
+    const auto& reader = *reader_;
+    steady_state = reader.GetBoolean("pim", "steady_state", false);
+    steady_state_validate = GetInteger("pim", "steady_state_validate", 0);
+    double_buffer = reader.GetBoolean("pim", "double_buffer", false);
+    if (steady_state && double_buffer) {
+        // a prefetch spans tile boundaries, so tiles do not start from
+        // comparable states
+        std::cout << "WARNING: steady_state is not supported with "
+                     "double_buffer, disabling it"
+                  << std::endl;
+        steady_state = false;
+    }
+    // weight tiles go to every 8th (GEMM) and 16th (GEMV) bank by default.
+    // A GEMM keeps its inputs and outputs in the odd banks, a GEMV shares
+    // its weight banks with them.
+    gemm_weight_banks =
+        GetInteger("pim", "gemm_weight_banks", std::max(1, banks / 8));
+    gemv_weight_banks =
+        GetInteger("pim", "gemv_weight_banks", std::max(1, banks / 16));
+    auto power_of_2 = [](int n) { return n > 0 && (n & (n - 1)) == 0; };
+    if (!power_of_2(gemm_weight_banks) || !power_of_2(gemv_weight_banks) ||
+        gemm_weight_banks > banks / 2 || gemv_weight_banks > banks) {
+        std::cerr << "gemm_weight_banks and gemv_weight_banks must be powers "
+                     "of 2 up to banks / 2 and banks"
+                  << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    refresh_aware = reader.GetBoolean("pim", "refresh_aware", false);
+    refresh_postpone = GetInteger("pim", "refresh_postpone", 8);
+    if (refresh_aware) {
+        if (refresh_policy != RefreshPolicy::BANK_LEVEL_STAGGERED) {
+            std::cout << "WARNING: refresh_aware uses BANK_LEVEL_STAGGERED "
+                         "refresh"
+                      << std::endl;
+            refresh_policy = RefreshPolicy::BANK_LEVEL_STAGGERED;
+        }
+        // banks are tracked in 64 bit masks
+        if (ranks * banks > 64) {
+            std::cerr << "refresh_aware supports at most 64 banks per channel"
+                      << std::endl;
+            AbruptExit(__FILE__, __LINE__);
+        }
+        // tiles are keyed by the refresh phase only
+        if (steady_state) {
+            std::cout << "WARNING: steady_state is not supported with "
+                         "refresh_aware, disabling it"
+                      << std::endl;
+            steady_state = false;
+        }
+    }
+    pipeline_layers = reader.GetBoolean("pim", "pipeline_layers", false);
+    if (steady_state && pipeline_layers) {
+        // the next kernel's weights are loaded before its first tile starts
+        std::cout << "WARNING: steady_state is not supported with "
+                     "pipeline_layers, disabling it"
+                  << std::endl;
+        steady_state = false;
+    }
+    std::string arbitration =
+        reader.Get("pim", "tenant_arbitration", "ROUND_ROBIN");
+    if (arbitration == "ROUND_ROBIN") {
+        tenant_arbitration = TenantArbitration::ROUND_ROBIN;
+    } else if (arbitration == "WEIGHTED") {
+        tenant_arbitration = TenantArbitration::WEIGHTED;
+    } else if (arbitration == "PRIORITY") {
+        tenant_arbitration = TenantArbitration::PRIORITY;
+    } else {
+        std::cerr << "Unknown tenant_arbitration " << arbitration << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    transaction_queue_depth = GetInteger("pim", "transaction_queue_depth", 32);
+    kernel_queue_depth = GetInteger("pim", "kernel_queue_depth", 8);
+    if (transaction_queue_depth < 1 || kernel_queue_depth < 1) {
+        std::cerr << "PIM queue depths must be at least 1" << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    vpu_lanes = GetInteger("pim", "vpu_lanes", 16);
+    vpu_buffer = GetInteger("pim", "vpu_buffer", 8192);
+    vpu_softmax_latency = GetInteger("pim", "vpu_softmax_latency", 24);
+    vpu_layernorm_latency = GetInteger("pim", "vpu_layernorm_latency", 16);
+    vpu_gelu_latency = GetInteger("pim", "vpu_gelu_latency", 12);
+    vpu_add_latency = GetInteger("pim", "vpu_add_latency", 4);
+    if (vpu_lanes < 1 || vpu_buffer < vpu_lanes || vpu_softmax_latency < 0 ||
+        vpu_layernorm_latency < 0 || vpu_gelu_latency < 0 ||
+        vpu_add_latency < 0) {
+        std::cerr << "The VPU needs at least 1 lane, a buffer of at least "
+                     "vpu_lanes elements and latencies of at least 0"
+                  << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+#ifdef THERMAL
+    if (steady_state) {
+        std::cout << "WARNING: steady_state is not supported with the "
+                     "thermal model, disabling it"
+                  << std::endl;
+        steady_state = false;
+    }
+#endif  // THERMAL
+    return;
+}
+
 void Config::InitPowerParams() {
     const auto& reader = *reader_;
     // Power-related parameters
@@ -252,6 +361,16 @@ void Config::InitSystemParams() {
     sref_threshold = GetInteger("system", "sref_threshold", 1000);
     aggressive_precharging_enabled =
         reader.GetBoolean("system", "aggressive_precharging_enabled", false);
+    channel_threads = GetInteger("system", "channel_threads", 1);
+#ifdef THERMAL
+    // the thermal model is shared by all channels
+    if (channel_threads > 1) {
+        std::cout << "WARNING: channel_threads = " << channel_threads
+                  << " is ignored, thermal builds step the channels serially"
+                  << std::endl;
+        channel_threads = 1;
+    }
+#endif  // THERMAL
 
     return;
 }
@@ -31,6 +31,9 @@ enum class RefreshPolicy {
     SIZE
 };
 
+// which tenant's PIM commands a channel issues when several have one ready
+enum class TenantArbitration { ROUND_ROBIN, WEIGHTED, PRIORITY, SIZE };
+
 class Config {
    public:
     Config(std::string config_file, std::string out_dir);
@@ -137,10 +140,54 @@ class Config {
     int sref_threshold;
     bool aggressive_precharging_enabled;
     bool enable_hbm_dual_cmd;
-
+    // threads stepping the channel controllers, 1 steps them serially;
+    // PIM kernels always step them serially
+    int channel_threads;
+
+    // PIM
+    // replay the cost of BLAS tiles that repeat an already simulated one
+    bool steady_state;
+    // simulate every n-th replayable tile in detail to measure the error
+    int steady_state_validate;
+    // load the next weight tile into shadow PE registers while the current
+    // one streams
+    bool double_buffer;
+    // banks per channel a cut of all banks spreads each weight tile over,
+    // the more the fewer columns a load reads from each of them
+    int gemm_weight_banks;
+    int gemv_weight_banks;
+    // every how many banks a cut reads its weight tiles from, for the df of
+    // its dataflow
+    int WeightBankStride(int df) const {
+        return banks / (df == 0 ? gemm_weight_banks : gemv_weight_banks);
+    }
+    // keep PIM kernels running through refreshes of the banks they do not
+    // use and postpone the others to tile boundaries (bank refresh only)
+    bool refresh_aware;
+    // bank refreshes a channel may postpone before one is forced
+    int refresh_postpone;
+    // configure the next kernel and load its first weights while the
+    // running one drains its outputs
+    bool pipeline_layers;
+    TenantArbitration tenant_arbitration;
+    // PIM transactions and whole kernels (see SubmitPimKernel()) queued for
+    // the scheduler, per tenant in multi-tenant mode
+    int transaction_queue_depth;
+    int kernel_queue_depth;
+    // The VPU that runs softmax, layernorm and elementwise ops between
+    // kernels: elements it processes per cycle, elements its input/output
+    // buffer holds, and the pipeline latency of one pass of each op
+    int vpu_lanes;
+    int vpu_buffer;
+    int vpu_softmax_latency;
+    int vpu_layernorm_latency;
+    int vpu_gelu_latency;
+    int vpu_add_latency;
 
     int epoch_period;
     int output_level;
+    // write binary command traces (see command_tracer.h)
+    bool cmd_trace;
     std::string output_dir;
     std::string output_prefix;
     std::string json_stats_name;
@@ -194,6 +241,7 @@ class Config {
                    int default_val) const;
     void InitDRAMParams();
     void InitOtherParams();
+    void InitPIMParams();
     void InitPowerParams();
     void InitSystemParams();
 #ifdef THERMAL
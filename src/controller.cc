@@ -1,5 +1,5 @@
 #include "controller.h"
-#include <iomanip>
+#include "checkpoint.h"
 #include <iostream>
 #include <limits>
 
@@ -26,6 +26,7 @@ Controller::Controller(int channel, const Config &config, const Timing &timing)
                           ? RowBufPolicy::CLOSE_PAGE
                           : RowBufPolicy::OPEN_PAGE),
       last_trans_clk_(0),
+      active_(true),
       write_draining_(0) {
     if (is_unified_queue_) {
         unified_queue_.reserve(config_.trans_queue_size);
@@ -33,13 +34,12 @@ Controller::Controller(int channel, const Config &config, const Timing &timing)
         read_queue_.reserve(config_.trans_queue_size);
         write_buffer_.reserve(config_.trans_queue_size);
     }
-
-#ifdef CMD_TRACE
-    std::string trace_file_name = config_.output_prefix + "ch_" +
-                                  std::to_string(channel_id_) + "cmd.trace";
-    // std::cout << "Command Trace write to " << trace_file_name << std::endl;
-    cmd_trace_.open(trace_file_name, std::ofstream::out);
-#endif  // CMD_TRACE
+    // the PIM scheduler queues at most a command per bank and cycle, which
+    // are issued soon after, so streaming does not grow these
+    rd_in_cmds_.reserve(config_.banks);
+    rd_w_cmds_.reserve(config_.banks);
+    wr_cmds_.reserve(config_.banks);
+    release_time.reserve(config_.banks);
 }
 
 std::pair<uint64_t, int> Controller::ReturnDoneTrans(uint64_t clk) {
@@ -66,11 +66,272 @@ Command Controller::GetReadyCommand(Command& cmd, uint64_t clk) {
     return channel_state_.GetReadyCommand(cmd, clk);
 }
 
-bool Controller::pim_refresh_coming() {
+bool Controller::pim_refresh_coming() const {
     return refresh_.pim_refresh_coming();
 }
 
+uint64_t Controller::OpenBanks() const {
+    uint64_t banks = 0;
+    for (int r = 0; r < config_.ranks; r++) {
+        for (int bg = 0; bg < config_.bankgroups; bg++) {
+            for (int bk = 0; bk < config_.banks_per_group; bk++) {
+                if (channel_state_.IsRowOpen(r, bg, bk))
+                    banks |= uint64_t(1) << ((r * config_.bankgroups + bg) *
+                                                 config_.banks_per_group +
+                                             bk);
+            }
+        }
+    }
+    return banks;
+}
+
+bool Controller::DropPimActivate(const Command &cmd) const {
+    if (!config_.refresh_aware) return channel_state_.IsRefreshWaiting();
+    // only the cuts held for a refresh lose theirs
+    int bank = (cmd.Rank() * config_.bankgroups + cmd.Bankgroup()) *
+                   config_.banks_per_group +
+               cmd.Bank();
+    return pim_held_banks_ >> bank & 1;
+}
+
+void Controller::SetTenants(const std::vector<int> &bank_tenants,
+                            const std::vector<int> &weights,
+                            const std::vector<int> &priorities) {
+    bank_tenant_ = bank_tenants;
+    tenant_weight_ = weights;
+    tenant_priority_ = priorities;
+    tenant_next_ = 0;
+    tenant_credit_.assign(weights.size(), 0);
+    simple_stats_.InitTenantStats(weights.size());
+}
+
+void Controller::EndTenantKernel(int tenant, uint64_t busy_cycles) {
+    simple_stats_.IncrementVec("tenant_kernels", tenant);
+    simple_stats_.IncrementVecBy("tenant_busy_cycles", tenant, busy_cycles);
+}
+
+int Controller::PimTenant(const Command &cmd) const {
+    return bank_tenant_[(cmd.Rank() * config_.bankgroups + cmd.Bankgroup()) *
+                            config_.banks_per_group +
+                        cmd.Bank()];
+}
+
+uint64_t Controller::ReadyPimTenants() {
+    // the same checks as the queue loops in ClockTick()
+    uint64_t ready = 0;
+    for (const auto &cmd : rd_w_cmds_) {
+        Command probe = cmd;
+        if (cmd.cmd_type == CommandType::PIM_ACTIVATE)
+            probe.cmd_type = CommandType::GH_READ;
+        Command ready_cmd = cmd.cmd_type == CommandType::PRECHARGE
+                                ? cmd
+                                : GetReadyCommand(probe, clk_);
+        if (ready_cmd.IsValid() && ready_cmd.cmd_type == cmd.cmd_type)
+            ready |= uint64_t(1) << PimTenant(cmd);
+    }
+    for (size_t i = 0; i < rd_in_cmds_.size(); i++) {
+        const Command &cmd = rd_in_cmds_[i];
+        if (clk_ < release_time[i]) continue;
+        Command probe = cmd;
+        if (cmd.cmd_type == CommandType::PIM_ACTIVATE)
+            probe.cmd_type = CommandType::GH_READ;
+        Command ready_cmd = GetReadyCommand(probe, clk_);
+        if (ready_cmd.IsValid() && ready_cmd.cmd_type == cmd.cmd_type)
+            ready |= uint64_t(1) << PimTenant(cmd);
+    }
+    for (const auto &cmd : wr_cmds_) {
+        Command probe = cmd;
+        if (cmd.cmd_type == CommandType::PIM_ACTIVATE)
+            probe.cmd_type = CommandType::PIM_WRITE;
+        Command ready_cmd = GetReadyCommand(probe, clk_);
+        if (ready_cmd.IsValid() && ready_cmd.cmd_type == cmd.cmd_type)
+            ready |= uint64_t(1) << PimTenant(cmd);
+    }
+    return ready;
+}
+
+int Controller::ArbitrateTenants(uint64_t ready) {
+    if (ready == 0) return -1;
+    int grant = -1;
+    if ((ready & (ready - 1)) == 0) {
+        // no contention
+        for (grant = 0; !(ready >> grant & 1); grant++) {
+        }
+        return grant;
+    }
+    int tenants = static_cast<int>(tenant_weight_.size());
+    if (config_.tenant_arbitration == TenantArbitration::WEIGHTED) {
+        // smooth weighted round robin: the tenant with the most credit
+        // wins and pays for everyone's share
+        int64_t total = 0;
+        for (int t = 0; t < tenants; t++) {
+            if (!(ready >> t & 1)) continue;
+            tenant_credit_[t] += tenant_weight_[t];
+            total += tenant_weight_[t];
+            if (grant == -1 || tenant_credit_[t] > tenant_credit_[grant])
+                grant = t;
+        }
+        tenant_credit_[grant] -= total;
+        return grant;
+    }
+    // round robin, among the tenants of the highest priority (lowest
+    // value) in PRIORITY mode
+    bool by_priority = config_.tenant_arbitration == TenantArbitration::PRIORITY;
+    for (int n = 0; n < tenants; n++) {
+        int t = (tenant_next_ + n) % tenants;
+        if (!(ready >> t & 1)) continue;
+        if (grant == -1 ||
+            (by_priority && tenant_priority_[t] < tenant_priority_[grant]))
+            grant = t;
+    }
+    tenant_next_ = (grant + 1) % tenants;
+    return grant;
+}
+
+uint64_t Controller::NextEventCycle() const {
+    if (active_ || config_.enable_self_refresh ||
+        !unified_queue_.empty() || !read_queue_.empty() ||
+        !write_buffer_.empty()) {
+        return clk_;
+    }
+    // nothing was issued last cycle, so nothing will be until a timing
+    // constraint expires, a refresh is due or a transaction completes
+    uint64_t next = std::min(channel_state_.NextEventCycle(clk_),
+                             refresh_.NextEventCycle());
+    for (const auto& trans : return_queue_) {
+        next = std::min(next, std::max(clk_, trans.complete_cycle));
+    }
+    return next;
+}
+
+void Controller::SkipCycles(uint64_t cycles) {
+    refresh_.SkipCycles(cycles);
+    for (int i = 0; i < config_.ranks; i++) {
+        if (channel_state_.IsRankSelfRefreshing(i)) {
+            simple_stats_.IncrementVecBy("sref_cycles", i, cycles);
+        } else if (channel_state_.IsAllBankIdleInRank(i)) {
+            simple_stats_.IncrementVecBy("all_bank_idle_cycles", i, cycles);
+            channel_state_.rank_idle_cycles[i] += cycles;
+        } else {
+            simple_stats_.IncrementVecBy("rank_active_cycles", i, cycles);
+            channel_state_.rank_idle_cycles[i] = 0;
+        }
+    }
+    clk_ += cycles;
+    cmd_queue_.SkipCycles(cycles);
+    simple_stats_.IncrementBy("num_cycles", cycles);
+}
+
+bool Controller::IsQuiescent() const {
+    if (!rd_w_cmds_.empty() || !rd_in_cmds_.empty() || !wr_cmds_.empty() ||
+        !unified_queue_.empty() || !read_queue_.empty() ||
+        !write_buffer_.empty() || !pending_rd_q_.empty() ||
+        !pending_wr_q_.empty() || !return_queue_.empty() ||
+        !cmd_queue_.QueueEmpty() || cmd_queue_.IsInRef() ||
+        channel_state_.IsRefreshWaiting() || config_.enable_self_refresh) {
+        return false;
+    }
+    for (int i = 0; i < config_.ranks; i++) {
+        if (!channel_state_.IsAllBankIdleInRank(i) ||
+            channel_state_.IsRankSelfRefreshing(i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+ChannelTileState Controller::GetTileState() const {
+    ChannelTileState state;
+    channel_state_.SaveRelativeState(clk_, state.timing);
+    state.rank_idle_cycles = channel_state_.rank_idle_cycles;
+    state.refresh_target = refresh_.NextTarget();
+    state.counters = simple_stats_.GetCounters();
+    return state;
+}
+
+void Controller::ReplayTile(const ChannelTileState& begin,
+                            const ChannelTileState& end, uint64_t cycles) {
+    auto it = end.timing.cbegin();
+    channel_state_.RestoreRelativeState(clk_ + cycles, it);
+    channel_state_.rank_idle_cycles = end.rank_idle_cycles;
+    refresh_.SetNextTarget(end.refresh_target);
+    simple_stats_.AddCountersDelta(end.counters, begin.counters);
+}
+
+void Put(CheckpointWriter &out, const ChannelTileState &state) {
+    Put(out, state.timing);
+    Put(out, state.rank_idle_cycles);
+    Put(out, state.refresh_target);
+    Put(out, state.counters);
+}
+
+void Get(CheckpointReader &in, ChannelTileState &state) {
+    Get(in, state.timing);
+    Get(in, state.rank_idle_cycles);
+    Get(in, state.refresh_target);
+    Get(in, state.counters);
+}
+
+void Controller::SaveCheckpoint(CheckpointWriter &out) const {
+    Put(out, clk_);
+    simple_stats_.SaveCheckpoint(out);
+    channel_state_.SaveCheckpoint(out);
+    cmd_queue_.SaveCheckpoint(out);
+    refresh_.SaveCheckpoint(out);
+    Put(out, unified_queue_);
+    Put(out, read_queue_);
+    Put(out, write_buffer_);
+    Put(out, pending_rd_q_);
+    Put(out, pending_wr_q_);
+    Put(out, return_queue_);
+    Put(out, last_trans_clk_);
+    Put(out, active_);
+    Put(out, write_draining_);
+    Put(out, rd_in_cmds_);
+    Put(out, rd_w_cmds_);
+    Put(out, wr_cmds_);
+    Put(out, release_time);
+    Put(out, wr_multitenant);
+    Put(out, in_pim);
+    Put(out, pim_held_banks_);
+    Put(out, tenant_next_);
+    Put(out, tenant_credit_);
+}
+
+void Controller::RestoreCheckpoint(CheckpointReader &in) {
+    Get(in, clk_);
+    simple_stats_.RestoreCheckpoint(in);
+    channel_state_.RestoreCheckpoint(in);
+    cmd_queue_.RestoreCheckpoint(in);
+    refresh_.RestoreCheckpoint(in);
+    Get(in, unified_queue_);
+    Get(in, read_queue_);
+    Get(in, write_buffer_);
+    Get(in, pending_rd_q_);
+    Get(in, pending_wr_q_);
+    Get(in, return_queue_);
+    Get(in, last_trans_clk_);
+    Get(in, active_);
+    Get(in, write_draining_);
+    Get(in, rd_in_cmds_);
+    Get(in, rd_w_cmds_);
+    Get(in, wr_cmds_);
+    Get(in, release_time);
+    Get(in, wr_multitenant);
+    Get(in, in_pim);
+    Get(in, pim_held_banks_);
+    Get(in, tenant_next_);
+    Get(in, tenant_credit_);
+}
+
+void Controller::AdvanceClock(uint64_t cycles) {
+    refresh_.SkipCycles(cycles);
+    clk_ += cycles;
+    cmd_queue_.SkipCycles(cycles);
+}
+
 void Controller::ClockTick() {
+    active_ = false;
     // update refresh counter
     refresh_.ClockTick();
 
@@ -79,6 +340,8 @@ void Controller::ClockTick() {
 
     // priority 1: refresh command
     if (channel_state_.IsRefreshWaiting()) {
+        // entering refresh changes what the PIM scheduler sees
+        if (!cmd_queue_.IsInRef()) active_ = true;
         cmd = cmd_queue_.FinishRefresh();
     }
 
@@ -109,7 +372,21 @@ void Controller::ClockTick() {
     else {
         // TODO if second == 0, issue and set cmd_issue true. else, decrement by 1.
         cmd_issued = true;
+        // tenants share the command bus, one of them issues per cycle
+        int grant = -1;
+        if (!bank_tenant_.empty()) {
+            uint64_t ready = ReadyPimTenants();
+            grant = ArbitrateTenants(ready);
+            for (size_t t = 0; t < tenant_weight_.size(); t++) {
+                if ((ready >> t & 1) && static_cast<int>(t) != grant)
+                    simple_stats_.IncrementVec("tenant_lost_slots", t);
+            }
+        }
         for (auto it = rd_w_cmds_.begin(); it != rd_w_cmds_.end(); ) {
+            if (grant != -1 && PimTenant(*it) != grant) {
+                it++;
+                continue;
+            }
 
             bool is_act = it->cmd_type == CommandType::PIM_ACTIVATE;
             bool is_read = it->cmd_type == CommandType::GH_READ;
@@ -132,10 +409,12 @@ void Controller::ClockTick() {
 
 
             if (ready_cmd.IsValid() && ready_cmd.cmd_type == it->cmd_type) {
-                if (!(channel_state_.IsRefreshWaiting() && is_act)) {
+                if (!(is_act && DropPimActivate(*it))) {
 
                     IssueCommand(*it);
+                    if (grant != -1) simple_stats_.IncrementVec("tenant_pim_cmds", grant);
                 }
+                active_ = true;
                 it = rd_w_cmds_.erase(it); // TODO it++ when not erased
             }
             else it++;
@@ -144,6 +423,12 @@ void Controller::ClockTick() {
         int i = 0;
         int j = 0;
         for (auto it = rd_in_cmds_.begin(); it != rd_in_cmds_.end(); ) {
+            if (grant != -1 && PimTenant(*it) != grant) {
+                it++;
+                i++;
+                j++;
+                continue;
+            }
 
             bool is_act = it->cmd_type == CommandType::PIM_ACTIVATE;
             bool is_read = it->cmd_type == CommandType::LH_READ || it->cmd_type == CommandType::GH_READ;
@@ -164,10 +449,12 @@ void Controller::ClockTick() {
                 ready_cmd = GetReadyCommand(*it, clk_);
 
             if(ready_cmd.IsValid() && ready_cmd.cmd_type == it->cmd_type && clk_ >= release_time[i]) {
-                if (!(channel_state_.IsRefreshWaiting() && is_act)) {
+                if (!(is_act && DropPimActivate(*it))) {
                     IssueCommand(*it);
+                    if (grant != -1) simple_stats_.IncrementVec("tenant_pim_cmds", grant);
                 }
                 // std::cout<<clk_<<" erase "<<std::endl;
+                active_ = true;
                 it = rd_in_cmds_.erase(it); // TODO it++ when not erased
                 release_time.erase(release_time.begin() + i);
             }
@@ -178,6 +465,10 @@ void Controller::ClockTick() {
             j++;
         }
         for (auto it = wr_cmds_.begin(); it != wr_cmds_.end(); ) {
+            if (grant != -1 && PimTenant(*it) != grant) {
+                it++;
+                continue;
+            }
             Command ready_cmd;
             if (it->cmd_type == CommandType::PIM_ACTIVATE) {
                 Command wr_cmd = Command(CommandType::PIM_WRITE, it->addr, it->hex_addr);
@@ -187,8 +478,10 @@ void Controller::ClockTick() {
                 ready_cmd = GetReadyCommand(*it, clk_);
 
             if(ready_cmd.IsValid() && ready_cmd.cmd_type == it->cmd_type) {
-                if (!(channel_state_.IsRefreshWaiting() && it->cmd_type == CommandType::PIM_ACTIVATE)) {
+                active_ = true;
+                if (!(it->cmd_type == CommandType::PIM_ACTIVATE && DropPimActivate(*it))) {
                     IssueCommand(*it);
+                    if (grant != -1) simple_stats_.IncrementVec("tenant_pim_cmds", grant);
                     it = wr_cmds_.erase(it); // TODO it++ when not erased
                     if (wr_multitenant) break;
                 }
@@ -332,15 +625,14 @@ void Controller::ScheduleTransaction() {
             }
             cmd_queue_.AddCommand(cmd);
             queue.erase(it);
+            active_ = true;
             break;
         }
     }
 }
 
 void Controller::IssueCommand(const Command &cmd) {
-#ifdef CMD_TRACE
-    cmd_trace_ << std::left << std::setw(18) << clk_ << " " << cmd << std::endl;
-#endif  // CMD_TRACE
+    if (cmd_trace_) cmd_trace_->Append(clk_, cmd);
 #ifdef THERMAL
     // add channel in, only needed by thermal module
     thermal_calc_.UpdateCMDPower(channel_id_, cmd, clk_);
@@ -376,6 +668,7 @@ void Controller::IssueCommand(const Command &cmd) {
     }
 
     // must update stats before states (for row hits)
+    active_ = true;
 
     UpdateCommandStats(cmd);
     channel_state_.UpdateTimingAndStates(cmd, clk_);
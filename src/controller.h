@@ -7,6 +7,7 @@
 #include <vector>
 #include "channel_state.h"
 #include "command_queue.h"
+#include "command_tracer.h"
 #include "common.h"
 #include "refresh.h"
 #include "simple_stats.h"
@@ -19,6 +20,18 @@ namespace dramsim3 {
 
 enum class RowBufPolicy { OPEN_PAGE, CLOSE_PAGE, SIZE };
 
+// State of a channel at a PIM tile boundary. Timing is kept relative to the
+// boundary cycle so that a tile can be replayed from a later boundary.
+struct ChannelTileState {
+    std::vector<int64_t> timing;
+    std::vector<int> rank_idle_cycles;
+    std::vector<int> refresh_target;
+    SimpleStats::Counters counters;
+};
+
+void Put(CheckpointWriter &out, const ChannelTileState &state);
+void Get(CheckpointReader &in, ChannelTileState &state);
+
 class Controller {
    public:
 #ifdef THERMAL
@@ -28,25 +41,89 @@ class Controller {
     Controller(int channel, const Config &config, const Timing &timing);
 #endif  // THERMAL
     void ClockTick();
+    // Earliest cycle >= clk_ at which ClockTick() may do more than count
+    // cycles, clk_ itself if the controller is busy
+    uint64_t NextEventCycle() const;
+    // Fast forward over cycles before NextEventCycle() in one step
+    void SkipCycles(uint64_t cycles);
+
+    // PIM tile replay (steady state mode)
+    // no request, command or refresh in flight and all banks closed
+    bool IsQuiescent() const;
+    ChannelTileState GetTileState() const;
+    // apply the effect of the tile from begin to end as if it had run for
+    // the given cycles, which are then passed with AdvanceClock()
+    void ReplayTile(const ChannelTileState& begin, const ChannelTileState& end,
+                    uint64_t cycles);
+    void AdvanceClock(uint64_t cycles);
+    int RefreshPhase() const { return refresh_.Phase(); }
+    uint64_t NextRefreshEvent() const { return refresh_.NextEventCycle(); }
+    double TileEnergy(const ChannelTileState& begin,
+                      const ChannelTileState& end) const {
+        return simple_stats_.CountersDeltaEnergy(end.counters, begin.counters);
+    }
+    double Energy() const { return simple_stats_.Energy(); }
+    uint64_t Count(const std::string& name) const {
+        return simple_stats_.Count(name);
+    }
     bool WillAcceptTransaction(uint64_t hex_addr, bool is_write) const;
     bool AddTransaction(Transaction trans);
     int QueueUsage() const;
     // Stats output
     void PrintEpochStats();
     void PrintFinalStats();
+    const nlohmann::json &FinalStats() const {
+        return simple_stats_.FinalStats();
+    }
     void ResetStats() { simple_stats_.Reset(); }
     std::pair<uint64_t, int> ReturnDoneTrans(uint64_t clock);
     Command GetReadyCommand(Command& cmd, uint64_t clk);
-    bool pim_refresh_coming();
-    bool pim_refresh_coming2() { return refresh_.pim_refresh_coming2();};
-    bool IsInRef() { return cmd_queue_.IsInRef(); };
+    bool pim_refresh_coming() const;
+    bool pim_refresh_coming2() const { return refresh_.pim_refresh_coming2();};
+    bool IsInRef() const { return cmd_queue_.IsInRef(); };
+    // Refresh-aware PIM mode: banks of running PIM cuts, and of those held
+    // for a refresh, whose activations are dropped
+    void SetPimBanks(uint64_t busy, uint64_t held) {
+        refresh_.SetBusyBanks(busy);
+        pim_held_banks_ = held;
+    }
+    uint64_t OwedRefreshBanks() const { return refresh_.OwedBanks(); }
+    uint64_t RefreshWaitingBanks() const {
+        return channel_state_.RefreshWaitingBanks();
+    }
+    uint64_t OpenBanks() const;
+    void RefreshBank(int bank) { refresh_.RefreshBank(bank); }
+    // Multi-tenant PIM mode: the tenant owning each bank (-1 for none) and
+    // the weight and priority of each tenant. The PIM commands of one tenant
+    // are issued per cycle, picked by config_.tenant_arbitration.
+    void SetTenants(const std::vector<int> &bank_tenants,
+                    const std::vector<int> &weights,
+                    const std::vector<int> &priorities);
+    // PIM commands each tenant issued, and cycles in which it had one ready
+    // but the channel issued another tenant's
+    std::vector<uint64_t> TenantCommands() const {
+        return simple_stats_.VecCount("tenant_pim_cmds");
+    }
+    std::vector<uint64_t> TenantLostSlots() const {
+        return simple_stats_.VecCount("tenant_lost_slots");
+    }
+    // a kernel of a tenant running in this channel has finished
+    void EndTenantKernel(int tenant, uint64_t busy_cycles);
+    // a PIM scheduler event this channel took part in, e.g. cycles its
+    // kernel waited for a refresh
+    void IncrementPimStat(const char *name, uint64_t num) {
+        simple_stats_.IncrementBy(name, num);
+    }
+    void SaveCheckpoint(CheckpointWriter &out) const;
+    void RestoreCheckpoint(CheckpointReader &in);
+    void SetCommandTrace(CommandTracer::Ring *ring) { cmd_trace_ = ring; }
 
     int channel_id_;
 
     std::vector<Command> rd_in_cmds_;
     std::vector<Command> rd_w_cmds_;
     std::vector<Command> wr_cmds_;
-    std::vector<int> release_time;
+    std::vector<uint64_t> release_time;
     bool wr_multitenant = false;
     bool in_pim = false;
 
@@ -78,13 +155,30 @@ class Controller {
     // row buffer policy
     RowBufPolicy row_buf_policy_;
 
-#ifdef CMD_TRACE
-    std::ofstream cmd_trace_;
-#endif  // CMD_TRACE
+    CommandTracer::Ring *cmd_trace_ = nullptr;
+
+    uint64_t pim_held_banks_ = 0;
+
+    std::vector<int> bank_tenant_;
+    std::vector<int> tenant_weight_;
+    std::vector<int> tenant_priority_;
+    // round robin position and weighted round robin credits
+    int tenant_next_ = 0;
+    std::vector<int64_t> tenant_credit_;
+    int PimTenant(const Command &cmd) const;
+    // tenants with a PIM command the queues would issue this cycle
+    uint64_t ReadyPimTenants();
+    int ArbitrateTenants(uint64_t ready);
+    // PIM activations issued while a refresh waits are dropped, the
+    // scheduler places them again
+    bool DropPimActivate(const Command &cmd) const;
 
     // used to calculate inter-arrival latency
     uint64_t last_trans_clk_;
 
+    // whether the last ClockTick() changed any state besides counting cycles
+    bool active_;
+
     // transaction queueing
     int write_draining_;
     void ScheduleTransaction();
@@ -1,7 +1,48 @@
 #include "cpu.h"
 
+#include <sstream>
+#include "checkpoint.h"
+
 namespace dramsim3 {
 
+namespace {
+const char kCheckpointMagic[] = "HBDRAMsim checkpoint v1";
+
+// the engine state is only defined in its text form
+std::string EngineState(const std::mt19937_64& gen) {
+    std::ostringstream state;
+    state << gen;
+    return state.str();
+}
+
+void SetEngineState(std::mt19937_64& gen, const std::string& state) {
+    std::istringstream in(state);
+    in >> gen;
+}
+}  // namespace
+
+void CPU::SaveCheckpoint(const std::string& file_name) const {
+    CheckpointWriter out(file_name);
+    Put(out, std::string(kCheckpointMagic));
+    memory_system_.SaveCheckpoint(out);
+    Put(out, clk_);
+    SaveState(out);
+}
+
+void CPU::RestoreCheckpoint(const std::string& file_name) {
+    CheckpointReader in(file_name);
+    std::string magic;
+    Get(in, magic);
+    if (magic != kCheckpointMagic) {
+        std::cerr << file_name << " is not a checkpoint of this simulator"
+                  << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    memory_system_.RestoreCheckpoint(in);
+    Get(in, clk_);
+    RestoreState(in);
+}
+
 void RandomCPU::ClockTick() {
     // Create random CPU requests at full speed
     // this is useful to exploit the parallelism of a DRAM protocol
@@ -19,6 +60,22 @@ void RandomCPU::ClockTick() {
     return;
 }
 
+void RandomCPU::SaveState(CheckpointWriter& out) const {
+    Put(out, last_addr_);
+    Put(out, last_write_);
+    Put(out, EngineState(gen));
+    Put(out, get_next_);
+}
+
+void RandomCPU::RestoreState(CheckpointReader& in) {
+    std::string gen_state;
+    Get(in, last_addr_);
+    Get(in, last_write_);
+    Get(in, gen_state);
+    Get(in, get_next_);
+    SetEngineState(gen, gen_state);
+}
+
 void StreamCPU::ClockTick() {
     // stream-add, read 2 arrays, add them up to the third array
     // this is a very simple approximate but should be able to produce
@@ -59,23 +116,49 @@ void StreamCPU::ClockTick() {
     return;
 }
 
+void StreamCPU::SaveState(CheckpointWriter& out) const {
+    Put(out, addr_a_);
+    Put(out, addr_b_);
+    Put(out, addr_c_);
+    Put(out, offset_);
+    Put(out, EngineState(gen));
+    Put(out, inserted_a_);
+    Put(out, inserted_b_);
+    Put(out, inserted_c_);
+}
+
+void StreamCPU::RestoreState(CheckpointReader& in) {
+    std::string gen_state;
+    Get(in, addr_a_);
+    Get(in, addr_b_);
+    Get(in, addr_c_);
+    Get(in, offset_);
+    Get(in, gen_state);
+    Get(in, inserted_a_);
+    Get(in, inserted_b_);
+    Get(in, inserted_c_);
+    SetEngineState(gen, gen_state);
+}
+
 TraceBasedCPU::TraceBasedCPU(const std::string& config_file,
                              const std::string& output_dir,
-                             const std::string& trace_file)
-    : CPU(config_file, output_dir) {
-    trace_file_.open(trace_file);
-    if (trace_file_.fail()) {
-        std::cerr << "Trace file does not exist" << std::endl;
-        AbruptExit(__FILE__, __LINE__);
-    }
-}
+                             const std::string& trace_file,
+                             size_t prefetch_depth)
+    : CPU(config_file, output_dir),
+      trace_(OpenTrace(trace_file, prefetch_depth)) {}
+
+TraceBasedCPU::TraceBasedCPU(const Config& config, const Timing& timing,
+                             const std::string& trace_file,
+                             size_t prefetch_depth)
+    : CPU(config, timing),
+      trace_(OpenTrace(trace_file, prefetch_depth)) {}
 
 void TraceBasedCPU::ClockTick() {
     memory_system_.ClockTick();
-    if (!trace_file_.eof()) {
+    if (!trace_->Eof()) {
         if (get_next_) {
             get_next_ = false;
-            trace_file_ >> trans_;
+            trace_->Next(trans_);
         }
         if (trans_.added_cycle <= clk_ && trans_.active) {
             if (!trans_.is_pim) {
@@ -91,10 +174,138 @@ void TraceBasedCPU::ClockTick() {
         }
     }
     clk_++;
+
+    // let the memory run ahead until the next tick that may touch it
+    uint64_t next = UINT64_MAX;
+    if (!trace_->Eof()) {
+        if (get_next_) {
+            next = clk_;
+        } else if (trans_.active) {
+            next = std::max(clk_, trans_.added_cycle);
+        }
+    }
+    next = next == UINT64_MAX ? end_clk_ : std::min(next + 1, end_clk_);
+    memory_system_.SetQuietUntil(next);
     return;
 }
 
-bool TraceBasedCPU::turnOff() {
-    return memory_system_.turnOff();
+void TraceBasedCPU::SaveState(CheckpointWriter& out) const {
+    // the reading position, none once the whole trace was read
+    bool eof = trace_->Eof();
+    Put(out, eof);
+    if (!eof) {
+        Put(out, trace_->Tell());
+    }
+    Put(out, trans_);
+    Put(out, get_next_);
+}
+
+void TraceBasedCPU::RestoreState(CheckpointReader& in) {
+    bool eof;
+    Get(in, eof);
+    uint64_t pos = 0;
+    if (!eof) Get(in, pos);
+    trace_->Seek(pos, eof);
+    Get(in, trans_);
+    Get(in, get_next_);
+}
+
+uint64_t TraceBasedCPU::NextEventCycle() const {
+    uint64_t next = memory_system_.NextEventCycle();
+    if (!trace_->Eof()) {
+        if (get_next_) return clk_;
+        // the pending transaction is retried every cycle once it is due
+        if (trans_.active)
+            next = std::min(next, std::max(clk_, trans_.added_cycle));
+    }
+    return next;
+}
+
+void WorkloadCPU::Launch(const std::vector<PimTransaction>& kernel) {
+    kernel_ = kernel;
+    next_ = 0;
+    start_clk_ = clk_;
+}
+
+void WorkloadCPU::ClockTick() {
+    memory_system_.ClockTick();
+    if (next_ < kernel_.size() && start_clk_ + next_ <= clk_ &&
+        memory_system_.WillAcceptTransaction()) {
+        memory_system_.AddPimTransaction(kernel_[next_++]);
+    }
+    clk_++;
+
+    // a finished kernel may be followed by the next one right away
+    uint64_t next = memory_system_.turnOff() ? clk_ : UINT64_MAX;
+    if (next_ < kernel_.size()) next = std::max(clk_, start_clk_ + next_);
+    next = next == UINT64_MAX ? end_clk_ : std::min(next + 1, end_clk_);
+    memory_system_.SetQuietUntil(next);
+}
+
+void WorkloadCPU::SaveState(CheckpointWriter& out) const {
+    Put(out, static_cast<uint64_t>(next_));
+    Put(out, start_clk_);
+}
+
+void WorkloadCPU::RestoreState(CheckpointReader& in) {
+    uint64_t next;
+    Get(in, next);
+    next_ = next;
+    Get(in, start_clk_);
 }
+
+uint64_t WorkloadCPU::NextEventCycle() const {
+    uint64_t next = memory_system_.NextEventCycle();
+    if (next_ < kernel_.size()) {
+        next = std::min(next, std::max(clk_, start_clk_ + next_));
+    }
+    return next;
+}
+
+TenantCPU::TenantCPU(const std::string& config_file,
+                     const std::string& output_dir, const PimTenants& tenants)
+    : CPU(config_file, output_dir) {
+    memory_system_.SetTenants(tenants);
+    for (size_t t = 0; t < tenants.tenants.size(); t++) {
+        std::vector<PimTransaction> transactions;
+        for (const auto& workload : tenants.tenants[t].kernels) {
+            auto kernel = PimTenantKernel(tenants, t, workload);
+            transactions.insert(transactions.end(), kernel.begin(),
+                                kernel.end());
+        }
+        transactions_.push_back(transactions);
+    }
+    next_.assign(transactions_.size(), 0);
+}
+
+bool TenantCPU::Issuing() const {
+    for (size_t t = 0; t < transactions_.size(); t++) {
+        if (next_[t] < transactions_[t].size()) return true;
+    }
+    return false;
+}
+
+bool TenantCPU::turnOff() { return !Issuing() && memory_system_.turnOff(); }
+
+void TenantCPU::ClockTick() {
+    memory_system_.ClockTick();
+    for (size_t t = 0; t < transactions_.size(); t++) {
+        if (next_[t] < transactions_[t].size() &&
+            memory_system_.WillAcceptPimTransaction(t)) {
+            memory_system_.AddPimTransaction(transactions_[t][next_[t]++]);
+        }
+    }
+    clk_++;
+    memory_system_.SetQuietUntil(Issuing() ? std::min(clk_ + 1, end_clk_)
+                                           : end_clk_);
+}
+
+uint64_t TenantCPU::NextEventCycle() const {
+    return Issuing() ? clk_ : memory_system_.NextEventCycle();
+}
+
+void TenantCPU::SaveState(CheckpointWriter& out) const { Put(out, next_); }
+
+void TenantCPU::RestoreState(CheckpointReader& in) { Get(in, next_); }
+
 }  // namespace dramsim3
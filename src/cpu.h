@@ -6,6 +6,7 @@
 #include <random>
 #include <string>
 #include "memory_system.h"
+#include "trace_reader.h"
 
 namespace dramsim3 {
 
@@ -16,15 +17,47 @@ class CPU {
               config_file, output_dir,
               std::bind(&CPU::ReadCallBack, this, std::placeholders::_1),
               std::bind(&CPU::WriteCallBack, this, std::placeholders::_1)),
-          clk_(0) {}
+          clk_(0),
+          end_clk_(UINT64_MAX) {}
+    CPU(const Config& config, const Timing& timing)
+        : memory_system_(
+              config, timing,
+              std::bind(&CPU::ReadCallBack, this, std::placeholders::_1),
+              std::bind(&CPU::WriteCallBack, this, std::placeholders::_1)),
+          clk_(0),
+          end_clk_(UINT64_MAX) {}
+    virtual ~CPU() {}
     virtual void ClockTick() = 0;
+    // Earliest cycle at which ClockTick() may do more than advance clocks,
+    // the current cycle unless a CPU knows better
+    virtual uint64_t NextEventCycle() const { return clk_; }
+    // Advance the CPU and memory over idle cycles in one step
+    void SkipCycles(uint64_t cycles) {
+        memory_system_.SkipCycles(cycles);
+        clk_ += cycles;
+    }
+    uint64_t Clock() const { return clk_; }
+    // the memory state is read at this cycle (end of the run or a
+    // checkpoint), it must not run ahead of it
+    void SetEndCycle(uint64_t clk) { end_clk_ = clk; }
     void ReadCallBack(uint64_t addr) { return; }
     void WriteCallBack(uint64_t addr) { return; }
     void PrintStats() { memory_system_.PrintStats(); }
+    const MemorySystem& Memory() const { return memory_system_; }
+    // whether the PIM computation has finished
+    virtual bool turnOff() { return memory_system_.turnOff(); }
+    // snapshot of the memory and front-end state, restored by a run with the
+    // same config and trace
+    void SaveCheckpoint(const std::string& file_name) const;
+    void RestoreCheckpoint(const std::string& file_name);
 
    protected:
     MemorySystem memory_system_;
     uint64_t clk_;
+    uint64_t end_clk_;
+
+    virtual void SaveState(CheckpointWriter& out) const = 0;
+    virtual void RestoreState(CheckpointReader& in) = 0;
 };
 
 class RandomCPU : public CPU {
@@ -32,6 +65,10 @@ class RandomCPU : public CPU {
     using CPU::CPU;
     void ClockTick() override;
 
+   protected:
+    void SaveState(CheckpointWriter& out) const override;
+    void RestoreState(CheckpointReader& in) override;
+
    private:
     uint64_t last_addr_;
     bool last_write_ = false;
@@ -44,6 +81,10 @@ class StreamCPU : public CPU {
     using CPU::CPU;
     void ClockTick() override;
 
+   protected:
+    void SaveState(CheckpointWriter& out) const override;
+    void RestoreState(CheckpointReader& in) override;
+
    private:
     uint64_t addr_a_, addr_b_, addr_c_, offset_ = 0;
     std::mt19937_64 gen;
@@ -56,17 +97,79 @@ class StreamCPU : public CPU {
 
 class TraceBasedCPU : public CPU {
    public:
+    // prefetch_depth > 0 reads that many records ahead on another thread
     TraceBasedCPU(const std::string& config_file, const std::string& output_dir,
-                  const std::string& trace_file);
-    ~TraceBasedCPU() { trace_file_.close(); }
+                  const std::string& trace_file, size_t prefetch_depth = 0);
+    TraceBasedCPU(const Config& config, const Timing& timing,
+                  const std::string& trace_file, size_t prefetch_depth = 0);
     void ClockTick() override;
-    bool turnOff();
+    uint64_t NextEventCycle() const override;
+
+   protected:
+    void SaveState(CheckpointWriter& out) const override;
+    void RestoreState(CheckpointReader& in) override;
 
    private:
-    std::ifstream trace_file_;
+    std::unique_ptr<TraceReader> trace_;
     Transaction trans_;
     bool get_next_ = true;
 };
 
+// Runs PIM kernels (see PimKernel()) without a trace, issuing one kernel
+// transaction per cycle like the trace gen_pim_trace2.py writes
+class WorkloadCPU : public CPU {
+   public:
+    using CPU::CPU;
+    // start a kernel (or several, see PimKernels()), the previous one must
+    // be issued
+    void Launch(const std::vector<PimTransaction>& kernel);
+    // every transaction has been handed to the memory system
+    bool Issued() const { return next_ == kernel_.size(); }
+    // whether the kernel is issued and its computation has finished
+    bool Done() { return turnOff(); }
+    bool turnOff() override { return Issued() && CPU::turnOff(); }
+    // or hand whole kernels to the memory system's kernel queue instead
+    bool WillAcceptPimKernel() const {
+        return memory_system_.WillAcceptPimKernel();
+    }
+    bool SubmitPimKernel(const PimKernelDesc& desc) {
+        return memory_system_.SubmitPimKernel(desc);
+    }
+    void ClockTick() override;
+    uint64_t NextEventCycle() const override;
+
+   protected:
+    void SaveState(CheckpointWriter& out) const override;
+    void RestoreState(CheckpointReader& in) override;
+
+   private:
+    std::vector<PimTransaction> kernel_;
+    // index of the next transaction, due at start_clk_ + next_
+    size_t next_ = 0;
+    uint64_t start_clk_ = 0;
+};
+
+// Runs the kernels of several tenants (see PimTenants) on their cuts of the
+// array, each tenant issuing one transaction per cycle to its own queue
+class TenantCPU : public CPU {
+   public:
+    TenantCPU(const std::string& config_file, const std::string& output_dir,
+              const PimTenants& tenants);
+    // every kernel of every tenant is issued and has finished
+    bool turnOff() override;
+    void ClockTick() override;
+    uint64_t NextEventCycle() const override;
+
+   protected:
+    void SaveState(CheckpointWriter& out) const override;
+    void RestoreState(CheckpointReader& in) override;
+
+   private:
+    // the transactions of each tenant's kernels, in order
+    std::vector<std::vector<PimTransaction>> transactions_;
+    std::vector<uint64_t> next_;
+    bool Issuing() const;
+};
+
 }  // namespace dramsim3
 #endif
@@ -0,0 +1,454 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include "./../ext/headers/args.hxx"
+#include "cpu.h"
+#include "kv_cache.h"
+
+using namespace dramsim3;
+
+namespace {
+
+// a models_s line: model param_size n_layers d_model n_heads d_head TP PP
+struct Model {
+    std::string name;
+    std::string param_size;
+    int n_layers;
+    int d_model;
+    int n_heads;
+    int d_head;
+    int tp;
+    int pp;
+};
+
+// the named model, or the first one if no name is given
+bool ReadModel(const std::string &models_file, const std::string &name,
+               Model &model) {
+    std::ifstream in(models_file);
+    if (in.fail()) {
+        std::cerr << "Can't open model file " << models_file << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        if (!(fields >> model.name)) continue;
+        if (!name.empty() && model.name != name) continue;
+        if (!(fields >> model.param_size >> model.n_layers >> model.d_model >>
+              model.n_heads >> model.d_head >> model.tp >> model.pp)) {
+            std::cerr << "Bad model line in " << models_file << ": " << line
+                      << std::endl;
+            return false;
+        }
+        return true;
+    }
+    std::cerr << "No model " << name << " in " << models_file << std::endl;
+    return false;
+}
+
+struct Kernel {
+    std::string name;
+    PimKernelDesc desc;
+    // createQKV runs once for each of Q, K and V
+    int repeat;
+};
+
+// batch x K by K x M GEMV in input stationary dataflow, the 16 rows of a
+// bank are split into mcf multi-columns of 16 / mcf columns each. The batch
+// shares the matrix, or with per_sequence each sequence has its own.
+Kernel Gemv(const std::string &name, int64_t M, int64_t K, int mcf,
+            int batch, bool per_sequence, int repeat = 1) {
+    PimWorkload workload;
+    workload.name = name;
+    workload.mcf = mcf;
+    workload.ucf = 16 / mcf;
+    workload.df = 1;
+    workload.dims.push_back({M, K, per_sequence ? 1 : batch});
+    if (per_sequence) workload.sequences = batch;
+    return {name, PimKernelDescription(workload), repeat};
+}
+
+// a VPU op on vectors of elements each
+Kernel Vpu(const std::string &name, PimVpuOp op, int64_t elements,
+           int64_t vectors) {
+    PimWorkload workload;
+    workload.name = name;
+    workload.vpu_op = op;
+    workload.vpu_elements = elements;
+    workload.vpu_vectors = vectors;
+    return {name, PimKernelDescription(workload), 1};
+}
+
+// the kernels of one decoder layer for a batch of tokens at KV cache length
+// kv_len, as gen_workload_gpt_gen_parallel.py generates them for one. A KV
+// cache kept in memory (see KvCache) has one layout, and mcf, at any length.
+// With vpu the layernorms, softmax, GELU and residual adds between them run
+// on the VPU.
+std::vector<Kernel> DecoderLayer(const Model &model, int kv_len, int mcf,
+                                 int batch, bool kv_cache, bool vpu) {
+    int64_t heads = (model.n_heads + model.tp - 1) / model.tp;
+    int64_t d_qkv = model.d_head * heads;
+    int64_t d_ff = 4 * model.d_model / model.tp;
+    // short KV caches are too narrow for multi-columns
+    int attn_mcf = kv_len <= 16 && !kv_cache ? 1 : mcf;
+    int64_t qk_len = kv_len <= 16 ? std::max(2, kv_len) : kv_len;
+    // one head per subarray
+    int64_t d_heads = model.d_head * 16;
+    // attention reads the KV cache of each sequence
+    std::vector<Kernel> kernels = {
+        Gemv("createQKV", d_qkv, model.d_model, mcf, batch, false, 3),
+        Gemv("QK", qk_len, d_heads, attn_mcf, batch, true),
+        Gemv("SV", d_heads, kv_len, attn_mcf, batch, true),
+        Gemv("W_o", model.d_model, d_qkv, mcf, batch, false),
+        Gemv("L1", d_ff, model.d_model, mcf, batch, false),
+        Gemv("L2", model.d_model, d_ff, mcf, batch, false)};
+    if (!vpu) return kernels;
+    // each op follows the kernel whose outputs it reads
+    std::vector<std::pair<std::string, Kernel>> ops = {
+        {"QK", Vpu("softmax", PimVpuOp::SOFTMAX, kv_len, heads * batch)},
+        {"W_o", Vpu("residual1", PimVpuOp::ADD, model.d_model, batch)},
+        {"W_o", Vpu("layernorm2", PimVpuOp::LAYERNORM, model.d_model, batch)},
+        {"L1", Vpu("gelu", PimVpuOp::GELU, d_ff, batch)},
+        {"L2", Vpu("residual2", PimVpuOp::ADD, model.d_model, batch)}};
+    std::vector<Kernel> layer = {
+        Vpu("layernorm1", PimVpuOp::LAYERNORM, model.d_model, batch)};
+    for (const auto &kernel : kernels) {
+        layer.push_back(kernel);
+        for (const auto &op : ops) {
+            if (op.first == kernel.name) layer.push_back(op.second);
+        }
+    }
+    return layer;
+}
+
+struct Cost {
+    uint64_t cycles = 0;
+    double energy = 0.0;
+    // cycles no cut could issue because of refresh
+    uint64_t refresh_stalls = 0;
+    // cycles the next kernel was configured while this one drained
+    uint64_t staged_cycles = 0;
+    // row buffer locality: activations, and PIM commands to an open row
+    uint64_t activations = 0;
+    uint64_t row_hits = 0;
+};
+
+uint64_t RowHits(const MemorySystem &memory) {
+    return memory.Count("num_lh_read_row_hits") +
+           memory.Count("num_gh_read_row_hits") +
+           memory.Count("num_pim_write_row_hits");
+}
+
+// a kernel run and the cost it adds to
+struct Step {
+    const Kernel *kernel;
+    Cost *cost;
+};
+
+// Runs the steps back to back, submitted to the kernel queue as it has
+// room. Each kernel costs the cycles and energy from the end of the previous
+// one to its last output, so with pipeline_layers the next kernel is staged
+// as soon as the previous one is issued and its configuration and weight
+// loading overlap the previous drain.
+bool RunKernels(WorkloadCPU &cpu, const std::vector<Step> &steps,
+                uint64_t max_cycles, bool skip_idle) {
+    const MemorySystem &memory = cpu.Memory();
+    uint64_t start = cpu.Clock();
+    double start_energy = memory.Energy();
+    uint64_t start_stalls = memory.RefreshStallCycles();
+    uint64_t start_staged = memory.PipelineStagedCycles();
+    uint64_t start_acts = memory.Count("num_act_cmds");
+    uint64_t start_hits = RowHits(memory);
+    size_t submitted = 0;
+    // steps done, as the callbacks report them, and the ones costed
+    size_t done = 0;
+    size_t finished = 0;
+    auto can_submit = [&]() {
+        return submitted < steps.size() && cpu.WillAcceptPimKernel();
+    };
+    while (finished < steps.size()) {
+        while (can_submit()) {
+            PimKernelDesc desc = steps[submitted].kernel->desc;
+            desc.id = submitted++;
+            desc.callback = [&done](uint64_t id) { done = id + 1; };
+            cpu.SubmitPimKernel(desc);
+        }
+        uint64_t end = start + max_cycles;
+        if (cpu.Clock() >= end) {
+            std::cerr << steps[finished].kernel->name << " did not finish in "
+                      << max_cycles << " cycles" << std::endl;
+            return false;
+        }
+        cpu.ClockTick();
+        for (; finished < done; finished++) {
+            Cost &cost = *steps[finished].cost;
+            cost.cycles += cpu.Clock() - start;
+            cost.energy += memory.Energy() - start_energy;
+            cost.refresh_stalls += memory.RefreshStallCycles() - start_stalls;
+            cost.staged_cycles +=
+                memory.PipelineStagedCycles() - start_staged;
+            uint64_t acts = memory.Count("num_act_cmds");
+            uint64_t hits = RowHits(memory);
+            cost.activations += acts - start_acts;
+            cost.row_hits += hits - start_hits;
+            start = cpu.Clock();
+            start_energy = memory.Energy();
+            start_stalls = memory.RefreshStallCycles();
+            start_staged = memory.PipelineStagedCycles();
+            start_acts = acts;
+            start_hits = hits;
+        }
+        if (skip_idle && finished < steps.size() && !can_submit()) {
+            uint64_t next = std::min(cpu.NextEventCycle(), start + max_cycles);
+            if (next > cpu.Clock()) cpu.SkipCycles(next - cpu.Clock());
+        }
+    }
+    return true;
+}
+
+nlohmann::json CostJson(const Cost &cost) {
+    nlohmann::json j;
+    j["cycles"] = cost.cycles;
+    j["energy"] = cost.energy;
+    j["refresh_stalls"] = cost.refresh_stalls;
+    j["staged_cycles"] = cost.staged_cycles;
+    j["activations"] = cost.activations;
+    j["row_hits"] = cost.row_hits;
+    return j;
+}
+
+}  // namespace
+
+int main(int argc, const char **argv) {
+    args::ArgumentParser parser(
+        "LLM decode driver, runs every kernel of every decoder layer of the "
+        "generated tokens back to back in one memory system.",
+        "Examples: \n"
+        "./build/dramsim3decode configs/HBM2_8Gb_x128.ini -s 1 -e 64 "
+        "--mcf 4\n"
+        "./build/dramsim3decode configs/HBM2_8Gb_x128.ini -m GPT3_760M "
+        "-o gpt3.json\n"
+        "./build/dramsim3decode configs/HBM2_8Gb_x128.ini -s 64 -e 64 -b 8\n"
+        "./build/dramsim3decode configs/HBM2_8Gb_x128.ini -s 1 -e 256 "
+        "--kv-cache 256");
+    args::HelpFlag help(parser, "help", "Display the help menu", {'h', "help"});
+    args::ValueFlag<std::string> models_arg(
+        parser, "models",
+        "Model file, lines of \"model param_size n_layers d_model n_heads "
+        "d_head TP PP\"",
+        {"models"}, "models_s");
+    args::ValueFlag<std::string> model_arg(
+        parser, "model", "Model to run (default: the first one)",
+        {'m', "model"});
+    args::ValueFlag<int> start_arg(parser, "start",
+                                   "KV cache length of the first token",
+                                   {'s', "start"}, 1);
+    args::ValueFlag<int> end_arg(parser, "end",
+                                 "KV cache length of the last token",
+                                 {'e', "end"}, 64);
+    args::ValueFlag<int> mcf_arg(parser, "mcf",
+                                 "Multi-columns per bank (1, 2, 4, 8 or 16)",
+                                 {"mcf"}, 1);
+    args::ValueFlag<int> batch_arg(
+        parser, "batch", "Sequences decoded together, sharing each weight read",
+        {'b', "batch"}, 1);
+    args::ValueFlag<int> kv_cache_arg(
+        parser, "kv_cache",
+        "Keep the KV caches in memory, laid out for this many tokens, and "
+        "append each token's keys and values to them",
+        {"kv-cache"}, 0);
+    args::ValueFlag<uint64_t> num_cycles_arg(
+        parser, "num_cycles", "Cycle limit of a single kernel",
+        {'c', "cycles"}, 5000000);
+    args::ValueFlag<std::string> output_arg(parser, "output",
+                                            "Per-token result file",
+                                            {'o', "output"}, "decode.json");
+    args::Flag no_vpu_arg(
+        parser, "no_vpu",
+        "Leave out the layernorm, softmax, GELU and residual add VPU ops "
+        "between the kernels",
+        {"no-vpu"});
+    args::Flag no_skip_arg(
+        parser, "no_skip",
+        "Tick every cycle instead of skipping cycles where nothing happens",
+        {"no-skip"});
+    args::Positional<std::string> config_arg(
+        parser, "config", "The config file name (mandatory)");
+
+    try {
+        parser.ParseCLI(argc, argv);
+    } catch (args::Help) {
+        std::cout << parser;
+        return 0;
+    } catch (args::ParseError e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << parser;
+        return 1;
+    }
+
+    std::string config_file = args::get(config_arg);
+    if (config_file.empty()) {
+        std::cerr << parser;
+        return 1;
+    }
+    Model model;
+    if (!ReadModel(args::get(models_arg), args::get(model_arg), model)) {
+        return 1;
+    }
+    int start = args::get(start_arg);
+    int end = args::get(end_arg);
+    int mcf = args::get(mcf_arg);
+    if (mcf < 1 || mcf > 16 || (mcf & (mcf - 1)) != 0) {
+        std::cerr << "mcf must be 1, 2, 4, 8 or 16" << std::endl;
+        return 1;
+    }
+    int batch = args::get(batch_arg);
+    // the batch's ucf columns fill whole tiles of 128 PE columns
+    int columns = batch * 16 / mcf;
+    if (batch < 1 || batch > 64 || (columns > 128 && columns % 128 != 0)) {
+        std::cerr << "batch must be 1 to 64, and batch * 16 / mcf at most 128 "
+                  << "or a multiple of it" << std::endl;
+        return 1;
+    }
+    if (start < 1 || end < start) {
+        std::cerr << "Bad KV cache length range " << start << "-" << end
+                  << std::endl;
+        return 1;
+    }
+    int kv_capacity = args::get(kv_cache_arg);
+    if (kv_capacity != 0 && kv_capacity < end) {
+        std::cerr << "The KV cache must hold the " << end << " tokens"
+                  << std::endl;
+        return 1;
+    }
+    uint64_t max_cycles = args::get(num_cycles_arg);
+    bool skip_idle = !args::get(no_skip_arg);
+    bool vpu = !args::get(no_vpu_arg);
+
+    // per-kernel output would be one line per layer, only the summary is
+    // written
+    Config config(config_file, ".");
+    config.output_level = -1;
+    config.cmd_trace = false;
+    Timing timing(config);
+    WorkloadCPU cpu(config, timing);
+    std::unique_ptr<KvCache> kv_cache;
+    if (kv_capacity != 0) kv_cache.reset(new KvCache(config, kv_capacity));
+
+    std::cout << model.name << ": " << model.n_layers << " layers, d_model "
+              << model.d_model << ", " << model.n_heads << " heads of "
+              << model.d_head << ", TP " << model.tp << ", mcf " << mcf
+              << ", batch " << batch << std::endl;
+    auto wall_start = std::chrono::steady_clock::now();
+    nlohmann::json result;
+    result["model"] = model.name;
+    result["config"] = config_file;
+    result["mcf"] = mcf;
+    result["batch"] = batch;
+    result["kv_cache"] = kv_capacity;
+    result["vpu"] = vpu;
+    Cost total;
+    for (int kv_len = start; kv_len <= end; kv_len++) {
+        auto kernels = DecoderLayer(model, kv_len, mcf, batch,
+                                    kv_cache != nullptr, vpu);
+        // kernels by name, in layer order
+        std::vector<Cost> costs(kernels.size());
+        // Attention of each layer reads its own KV caches, after the keys
+        // and values createQKV made for this token are appended. Those of
+        // the earlier tokens, the prompt's included, are already in place.
+        std::vector<std::vector<Kernel>> layers(model.n_layers, kernels);
+        for (int layer = 0; layer < model.n_layers && kv_cache; layer++) {
+            for (auto &kernel : layers[layer]) {
+                if (kernel.name == "QK" || kernel.name == "SV") {
+                    kv_cache->Attach(kernel.desc, layer, kernel.name == "QK",
+                                     kv_len, 1);
+                }
+            }
+        }
+        std::vector<Step> steps;
+        for (int layer = 0; layer < model.n_layers; layer++) {
+            for (size_t k = 0; k < kernels.size(); k++) {
+                for (int r = 0; r < kernels[k].repeat; r++) {
+                    steps.push_back({&layers[layer][k], &costs[k]});
+                }
+            }
+        }
+        // the next token's input is sampled from this token's output
+        if (!RunKernels(cpu, steps, max_cycles, skip_idle)) {
+            return 1;
+        }
+        Cost token;
+        nlohmann::json token_json;
+        token_json["kv_len"] = kv_len;
+        for (size_t k = 0; k < kernels.size(); k++) {
+            token_json["kernels"][kernels[k].name] = CostJson(costs[k]);
+            token.cycles += costs[k].cycles;
+            token.energy += costs[k].energy;
+            token.refresh_stalls += costs[k].refresh_stalls;
+            token.staged_cycles += costs[k].staged_cycles;
+            token.activations += costs[k].activations;
+            token.row_hits += costs[k].row_hits;
+        }
+        token_json["cycles"] = token.cycles;
+        token_json["energy"] = token.energy;
+        token_json["refresh_stalls"] = token.refresh_stalls;
+        token_json["staged_cycles"] = token.staged_cycles;
+        token_json["activations"] = token.activations;
+        token_json["row_hits"] = token.row_hits;
+        result["tokens"].push_back(token_json);
+        total.cycles += token.cycles;
+        total.energy += token.energy;
+        total.refresh_stalls += token.refresh_stalls;
+        total.staged_cycles += token.staged_cycles;
+        total.activations += token.activations;
+        total.row_hits += token.row_hits;
+        std::cout << "kv_len " << kv_len << ": " << token.cycles
+                  << " cycles, " << token.energy << " pJ";
+        if (vpu) {
+            // from the end of the kernel before each op to the op's end
+            uint64_t vpu_cycles = 0;
+            for (size_t k = 0; k < kernels.size(); k++) {
+                if (kernels[k].desc.vpu_vectors > 0)
+                    vpu_cycles += costs[k].cycles;
+            }
+            std::cout << ", VPU " << vpu_cycles << " cycles";
+        }
+        if (kv_cache) {
+            Cost attention;
+            for (size_t k = 0; k < kernels.size(); k++) {
+                if (kernels[k].name != "QK" && kernels[k].name != "SV")
+                    continue;
+                attention.activations += costs[k].activations;
+                attention.row_hits += costs[k].row_hits;
+            }
+            std::cout << ", attention " << attention.activations
+                      << " activations, " << attention.row_hits
+                      << " row hits";
+        }
+        std::cout << std::endl;
+    }
+    if (kv_cache) result["kv_rows"] = kv_cache->RowsUsed();
+    result["cycles"] = total.cycles;
+    result["energy"] = total.energy;
+    result["refresh_stalls"] = total.refresh_stalls;
+    result["staged_cycles"] = total.staged_cycles;
+    result["activations"] = total.activations;
+    result["row_hits"] = total.row_hits;
+    auto seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - wall_start)
+                       .count();
+
+    std::ofstream out(args::get(output_arg));
+    if (out.fail()) {
+        std::cerr << "Can't write " << args::get(output_arg) << std::endl;
+        return 1;
+    }
+    out << result.dump(2) << std::endl;
+    std::cout << end - start + 1 << " tokens: " << total.cycles << " cycles, "
+              << total.energy << " pJ in " << seconds << " s" << std::endl;
+    return 0;
+}
@@ -1,20 +1,27 @@
 #include "dram_system.h"
 #include <assert.h>
+#include <algorithm>
+#include "checkpoint.h"
+#include "pim_kernel.h"
+#include "pim_model.h"
 #include <cmath>
+#include <limits>
 namespace dramsim3 {
 
 // alternative way is to assign the id in constructor but this is less
 // destructive
-int BaseDRAMSystem::total_channels_ = 0;
+std::atomic<int> BaseDRAMSystem::total_channels_(0);
 
 BaseDRAMSystem::BaseDRAMSystem(Config &config, const std::string &output_dir,
                                std::function<void(uint64_t)> read_callback,
-                               std::function<void(uint64_t)> write_callback)
+                               std::function<void(uint64_t)> write_callback,
+                               const Timing *timing)
     : read_callback_(read_callback),
       write_callback_(write_callback),
       last_req_clk_(0),
       config_(config),
-      timing_(config_),
+      timing_(timing ? *timing : Timing(config_)),
+      quiet_until_(0),
 #ifdef THERMAL
       thermal_calc_(config_),
 #endif  // THERMAL
@@ -28,19 +35,39 @@ BaseDRAMSystem::BaseDRAMSystem(Config &config, const std::string &output_dir,
 #endif
 }
 
+bool BaseDRAMSystem::AddPimTransaction(const PimTransaction &pim) {
+    std::cerr << "PIM kernels need a JEDEC memory system" << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+    return false;
+}
+
+bool BaseDRAMSystem::SubmitPimKernel(const PimKernelDesc &desc) {
+    std::cerr << "PIM kernels need a JEDEC memory system" << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+    return false;
+}
+
+void BaseDRAMSystem::SetTenants(const PimTenants &tenants) {
+    std::cerr << "PIM tenants need a JEDEC memory system" << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+}
+
 int BaseDRAMSystem::GetChannel(uint64_t hex_addr) const {
     hex_addr >>= config_.shift_bits;
     return (hex_addr >> config_.ch_pos) & config_.ch_mask;
 }
 
 void BaseDRAMSystem::PrintEpochStats() {
+    bool file_output = config_.output_level >= 0;
     // first epoch, print bracket
-    if (clk_ - config_.epoch_period == 0) {
+    if (file_output && !epoch_file_started_) {
         std::ofstream epoch_out(config_.json_epoch_name, std::ofstream::out);
         epoch_out << "[";
+        epoch_file_started_ = true;
     }
     for (size_t i = 0; i < ctrls_.size(); i++) {
         ctrls_[i]->PrintEpochStats();
+        if (!file_output) continue;
         std::ofstream epoch_out(config_.json_epoch_name, std::ofstream::app);
         epoch_out << "," << std::endl;
     }
@@ -51,6 +78,12 @@ void BaseDRAMSystem::PrintEpochStats() {
 }
 
 void BaseDRAMSystem::PrintStats() {
+    if (config_.output_level < 0) {
+        for (size_t i = 0; i < ctrls_.size(); i++) {
+            ctrls_[i]->PrintFinalStats();
+        }
+        return;
+    }
     // Finish epoch output, remove last comma and append ]
     std::ofstream epoch_out(config_.json_epoch_name, std::ios_base::in |
                                                          std::ios_base::out |
@@ -79,6 +112,50 @@ void BaseDRAMSystem::PrintStats() {
 #endif  // THERMAL
 }
 
+nlohmann::json BaseDRAMSystem::FinalStats() const {
+    nlohmann::json stats;
+    for (size_t i = 0; i < ctrls_.size(); i++) {
+        stats[std::to_string(i)] = ctrls_[i]->FinalStats();
+    }
+    return stats;
+}
+
+double BaseDRAMSystem::Energy() const {
+    double energy = 0.0;
+    for (size_t i = 0; i < ctrls_.size(); i++) {
+        energy += ctrls_[i]->Energy();
+    }
+    return energy;
+}
+
+uint64_t BaseDRAMSystem::Count(const std::string &name) const {
+    uint64_t count = 0;
+    for (size_t i = 0; i < ctrls_.size(); i++) {
+        count += ctrls_[i]->Count(name);
+    }
+    return count;
+}
+
+void BaseDRAMSystem::SaveCheckpoint(CheckpointWriter &out) const {
+    std::cerr << "Checkpoints are not supported by this memory system"
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+}
+
+void BaseDRAMSystem::RestoreCheckpoint(CheckpointReader &in) {
+    std::cerr << "Checkpoints are not supported by this memory system"
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+}
+
+void BaseDRAMSystem::TraceCommands() {
+    if (!config_.cmd_trace) return;
+    cmd_tracer_ = new CommandTracer(config_);
+    for (size_t i = 0; i < ctrls_.size(); i++) {
+        ctrls_[i]->SetCommandTrace(cmd_tracer_->GetRing(i));
+    }
+}
+
 void BaseDRAMSystem::ResetStats() {
     for (size_t i = 0; i < ctrls_.size(); i++) {
         ctrls_[i]->ResetStats();
@@ -95,8 +172,10 @@ void BaseDRAMSystem::RegisterCallbacks(
 
 JedecDRAMSystem::JedecDRAMSystem(Config &config, const std::string &output_dir,
                                  std::function<void(uint64_t)> read_callback,
-                                 std::function<void(uint64_t)> write_callback)
-    : BaseDRAMSystem(config, output_dir, read_callback, write_callback) {
+                                 std::function<void(uint64_t)> write_callback,
+                                 const Timing *timing)
+    : BaseDRAMSystem(config, output_dir, read_callback, write_callback,
+                     timing) {
     if (config_.IsHMC()) {
         std::cerr << "Initialized a memory system with an HMC config file!"
                   << std::endl;
@@ -111,6 +190,7 @@ JedecDRAMSystem::JedecDRAMSystem(Config &config, const std::string &output_dir,
         ctrls_.push_back(new Controller(i, config_, timing_));
 #endif  // THERMAL
     }
+    TraceCommands();
 
     int banks =  config_.ranks * config_.bankgroups * config_.banks_per_group;
     // std::cout<<"rank: "<<config_.ranks<<" bgs: "<<config_.bankgroups<<" bpg: "<<config_.banks_per_group<<std::endl;
@@ -119,17 +199,45 @@ JedecDRAMSystem::JedecDRAMSystem(Config &config, const std::string &output_dir,
             std::vector<bool>(banks, false);
         bank_occupancy_.push_back(chan_occupancy);
     }
+
+    if (config_.channel_threads > 1) {
+        channel_threads_ =
+            new ChannelThreads(config_.channel_threads, config_.channels);
+        window_returns_.resize(config_.channels);
+        window_returns_pos_.assign(config_.channels, 0);
+    }
 }
 
 JedecDRAMSystem::~JedecDRAMSystem() {
+    delete channel_threads_;
     for (auto it = ctrls_.begin(); it != ctrls_.end(); it++) {
         delete (*it);
     }
 }
 
 
+void JedecDRAMSystem::IncrementCutStat(uint64_t cut_mask, const char *name,
+                                       uint64_t num) {
+    if (vcuts <= 0 || hcuts <= 0) return IncrementArrayStat(name, num);
+    // the cuts of a row of the partition share its channels
+    int cut_height = config_.channels / hcuts;
+    for (int h = 0; h < hcuts; h++) {
+        uint64_t row_mask = ((uint64_t(1) << vcuts) - 1) << (h * vcuts);
+        if (!(cut_mask & row_mask)) continue;
+        for (int ch = h * cut_height; ch < (h + 1) * cut_height; ch++)
+            ctrls_[ch]->IncrementPimStat(name, num);
+    }
+}
+
+void JedecDRAMSystem::IncrementArrayStat(const char *name, uint64_t num) {
+    for (size_t i = 0; i < ctrls_.size(); i++) {
+        ctrls_[i]->IncrementPimStat(name, num);
+    }
+}
+
 bool JedecDRAMSystem::WillAcceptTransaction() const {
-    return pim_trans_queue_.size() < pim_trans_queue_depth_;
+    return pim_trans_queue_.size() <
+           static_cast<size_t>(config_.transaction_queue_depth);
 }
 
 bool JedecDRAMSystem::AddTransaction(uint64_t hex_addr) {
@@ -139,18 +247,209 @@ bool JedecDRAMSystem::AddTransaction(uint64_t hex_addr) {
                    << "PIM " << clk_ << std::endl;
 #endif
 
-    bool ok = WillAcceptTransaction();
+    return AddPimTransaction(DecodePimTransaction(hex_addr));
+}
+
+bool JedecDRAMSystem::AddPimTransaction(const PimTransaction &pim) {
+    if (!tenants_.empty() &&
+        (pim.tenant < 0 || pim.tenant >= static_cast<int>(tenants_.size()))) {
+        std::cerr << "No PIM tenant " << pim.tenant << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    bool ok = tenants_.empty() ? WillAcceptTransaction()
+                               : WillAcceptPimTransaction(pim.tenant);
 
     assert(ok);
+    assert(clk_ >= window_end_);
     if (ok) {
-        Transaction trans = Transaction(hex_addr);
-        pim_trans_queue_.push_back(trans);
+        tile_recording_ = false;
+        // a new kernel or VPU op, the computation is not over yet
+        if (pim.type == PimTransType::DATAFLOW || pim.type == PimTransType::VPU)
+            turn_off = false;
+        if (tenants_.empty()) {
+            if (pim_trans_queue_.empty()) pim_queue_waiting_ = false;
+            pim_trans_queue_.push_back(pim);
+        }
+        else
+            tenants_[pim.tenant].queue.push_back(pim);
+    }
+    last_req_clk_ = clk_;
+    return ok;
+}
+
+bool JedecDRAMSystem::WillAcceptPimTransaction(int tenant) const {
+    return tenants_[tenant].queue.size() <
+           static_cast<size_t>(config_.transaction_queue_depth);
+}
 
+bool JedecDRAMSystem::WillAcceptPimKernel(int tenant) const {
+    const auto &queue =
+        tenants_.empty() ? pim_kernel_queue_ : tenants_[tenant].kernels;
+    return queue.size() < static_cast<size_t>(config_.kernel_queue_depth);
+}
+
+bool JedecDRAMSystem::SubmitPimKernel(const PimKernelDesc &desc) {
+    if (!tenants_.empty() &&
+        (desc.tenant < 0 || desc.tenant >= static_cast<int>(tenants_.size()))) {
+        std::cerr << "No PIM tenant " << desc.tenant << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    for (const auto &cut : desc.cuts) {
+        if (cut.cut_no < 0 || cut.cut_no >= desc.vcuts * desc.hcuts) {
+            std::cerr << "PIM kernel cut " << cut.cut_no << " is not one of its "
+                      << desc.vcuts << "x" << desc.hcuts << " cuts" << std::endl;
+            AbruptExit(__FILE__, __LINE__);
+        }
+    }
+    bool ok = WillAcceptPimKernel(tenants_.empty() ? 0 : desc.tenant);
+
+    assert(clk_ >= window_end_);
+    if (ok) {
+        tile_recording_ = false;
+        turn_off = false;
+        // decoded once here instead of once per transaction per cycle
+        QueuedKernel kernel;
+        kernel.transactions = PimKernelTransactions(desc);
+        kernel.done = {desc.id, desc.callback};
+        if (tenants_.empty()) {
+            if (pim_kernel_queue_.empty()) pim_kernel_waiting_ = false;
+            pim_kernel_queue_.push_back(std::move(kernel));
+        } else {
+            tenants_[desc.tenant].kernels.push_back(std::move(kernel));
+        }
     }
     last_req_clk_ = clk_;
     return ok;
 }
 
+bool JedecDRAMSystem::ApplyQueuedKernel(std::vector<QueuedKernel> &queue) {
+    QueuedKernel &kernel = queue.front();
+    size_t first = kernel.applied;
+    while (kernel.applied < kernel.transactions.size()) {
+        const PimTransaction &pim = kernel.transactions[kernel.applied];
+        // a launch behind the running kernel stages the next one
+        bool staged = next_kernel_.status != 0;
+        if (!ApplyPimTransaction(pim)) return kernel.applied > first;
+        kernel.applied++;
+        // a kernel run once per sequence is done with its last launch
+        if (kernel.applied < kernel.transactions.size() ||
+            !kernel.done.callback)
+            continue;
+        if (!tenants_.empty())
+            tenants_[pim.tenant].callbacks.push_back(kernel.done);
+        else if (pim.type == PimTransType::VPU)
+            vpu_callbacks_.push_back({vpu_end_, kernel.done});
+        else if (staged)
+            next_kernel_.callbacks.push_back(kernel.done);
+        else
+            kernel_callbacks_.push_back(kernel.done);
+    }
+    queue.erase(queue.begin());
+    return true;
+}
+
+void JedecDRAMSystem::KernelDone(std::vector<KernelCallback> &callbacks) {
+    // the callbacks may submit the next kernels
+    std::vector<KernelCallback> done;
+    done.swap(callbacks);
+    for (const auto &it : done) it.callback(it.id);
+}
+
+void JedecDRAMSystem::SetTenants(const PimTenants &tenants) {
+    int cuts = tenants.vcuts * tenants.hcuts;
+    int cut_height = config_.channels / tenants.hcuts;
+    int cut_width = config_.banks / tenants.vcuts;
+    if (cuts > kMaxCuts || cut_height == 0 || cut_width == 0) {
+        std::cerr << "Can't partition the array into " << tenants.vcuts
+                  << "x" << tenants.hcuts << " cuts" << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    // narrower cuts write their outputs in pairs
+    if (cut_height < tenants.vcuts) {
+        std::cerr << "Tenant cuts need at least cutV channels each"
+                  << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    if (config_.steady_state) {
+        std::cout << "WARNING: steady_state is not supported with tenants, "
+                     "disabling it"
+                  << std::endl;
+        config_.steady_state = false;
+    }
+    vcuts = tenants.vcuts;
+    hcuts = tenants.hcuts;
+    cut_ = CutState();
+    cut_.out_cnt.fill(-1);
+    cut_programs_.assign(cuts, CutProgram());
+    cut_tenant_.fill(-1);
+    tenants_.clear();
+
+    // a cut's lanes stay in its channels and banks
+    std::vector<std::vector<int>> bank_tenants(
+        config_.channels, std::vector<int>(config_.ranks * config_.banks, -1));
+    std::vector<int> weights;
+    std::vector<int> priorities;
+    for (size_t t = 0; t < tenants.tenants.size(); t++) {
+        const PimTenant &tenant = tenants.tenants[t];
+        TenantState state;
+        state.cut_mask = tenant.cut_mask;
+        state.stats.name = tenant.name;
+        tenants_.push_back(state);
+        weights.push_back(tenant.weight);
+        priorities.push_back(tenant.priority);
+        for (int i = 0; i < cuts; i++) {
+            if (!(tenant.cut_mask >> i & 1)) continue;
+            cut_tenant_[i] = t;
+            int vcut_no = i % vcuts;
+            int hcut_no = i / vcuts;
+            for (int ch = 0; ch < cut_height; ch++) {
+                for (int bk = 0; bk < cut_width; bk++) {
+                    bank_tenants[hcut_no * cut_height + ch]
+                                [vcut_no * cut_width + bk] = t;
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < ctrls_.size(); i++) {
+        ctrls_[i]->SetTenants(bank_tenants[i], weights, priorities);
+        ctrls_[i]->wr_multitenant = cuts > 1;
+    }
+}
+
+std::vector<PimTenantStats> JedecDRAMSystem::TenantStats() const {
+    std::vector<PimTenantStats> stats;
+    for (size_t t = 0; t < tenants_.size(); t++) {
+        stats.push_back(tenants_[t].stats);
+        for (size_t i = 0; i < ctrls_.size(); i++) {
+            stats[t].pim_commands += ctrls_[i]->TenantCommands()[t];
+            stats[t].lost_slots += ctrls_[i]->TenantLostSlots()[t];
+        }
+    }
+    return stats;
+}
+
+void JedecDRAMSystem::EndTenantKernel(int cut) {
+    TenantState &tenant = tenants_[cut_tenant_[cut]];
+    for (int i = 0; i < Cuts(); i++) {
+        if ((tenant.cut_mask >> i & 1) && cut_.in_pim[i]) return;
+    }
+    tenant.stats.kernels++;
+    tenant.stats.busy_cycles += clk_ - tenant.launch_clk;
+    tenant.stats.end_cycle = clk_;
+    // and in the stats of each channel its cuts run in
+    int cut_height = config_.channels / hcuts;
+    for (int h = 0; h < hcuts; h++) {
+        uint64_t row_mask = ((uint64_t(1) << vcuts) - 1) << (h * vcuts);
+        if (!(tenant.cut_mask & row_mask)) continue;
+        for (int ch = h * cut_height; ch < (h + 1) * cut_height; ch++)
+            ctrls_[ch]->EndTenantKernel(cut_tenant_[cut], clk_ - tenant.launch_clk);
+    }
+    if (config_.output_level >= 0)
+        std::cout << clk_ << " Tenant " << tenant.stats.name << " finished kernel "
+                  << tenant.stats.kernels << std::endl;
+    KernelDone(tenant.callbacks);
+}
+
 bool JedecDRAMSystem::WillAcceptTransaction(uint64_t hex_addr,
                                             bool is_write) const {
     int channel = GetChannel(hex_addr);
@@ -168,8 +467,10 @@ bool JedecDRAMSystem::AddTransaction(uint64_t hex_addr, bool is_write) {
     bool ok = ctrls_[channel]->WillAcceptTransaction(hex_addr, is_write);
 
     assert(ok);
+    assert(clk_ >= window_end_);
     if (ok) {
         Transaction trans = Transaction(hex_addr, is_write);
+        tile_recording_ = false;
         ctrls_[channel]->AddTransaction(trans);
     }
     last_req_clk_ = clk_;
@@ -177,16 +478,49 @@ bool JedecDRAMSystem::AddTransaction(uint64_t hex_addr, bool is_write) {
 }
 
 void JedecDRAMSystem::ClockTick() {
-    for (size_t i = 0; i < ctrls_.size(); i++) {
-        // look ahead and return earlier
-        while (true) {
-            auto pair = ctrls_[i]->ReturnDoneTrans(clk_);
-            if (pair.second == 1) {
-                write_callback_(pair.first);
-            } else if (pair.second == 0) {
-                read_callback_(pair.first);
-            } else {
-                break;
+    if (tile_boundary_) {
+        tile_boundary_ = false;
+        TileBoundary();
+    }
+    // a replayed tile has already been accounted for, only time passes
+    if (clk_ < replay_until_) {
+        for (size_t i = 0; i < ctrls_.size(); i++) {
+            ctrls_[i]->AdvanceClock(1);
+        }
+        clk_++;
+        if (clk_ == replay_until_) tile_boundary_ = true;
+        return;
+    }
+
+    if (clk_ >= window_end_) {
+        uint64_t window = RunAheadWindow();
+        if (window > 1) RunControllers(window);
+    }
+    if (clk_ < window_end_) {
+        // returns were collected when the window was run
+        for (size_t i = 0; i < ctrls_.size(); i++) {
+            auto &returns = window_returns_[i];
+            size_t &pos = window_returns_pos_[i];
+            for (; pos < returns.size() && returns[pos].clk == clk_; pos++) {
+                if (returns[pos].is_write == 1) {
+                    write_callback_(returns[pos].addr);
+                } else {
+                    read_callback_(returns[pos].addr);
+                }
+            }
+        }
+    } else {
+        for (size_t i = 0; i < ctrls_.size(); i++) {
+            // look ahead and return earlier
+            while (true) {
+                auto pair = ctrls_[i]->ReturnDoneTrans(clk_);
+                if (pair.second == 1) {
+                    write_callback_(pair.first);
+                } else if (pair.second == 0) {
+                    read_callback_(pair.first);
+                } else {
+                    break;
+                }
             }
         }
     }
@@ -197,291 +531,136 @@ void JedecDRAMSystem::ClockTick() {
     // lookup refresh_ in each controller to check refresh countdown
     // if countdown is lower than pim delay, pause issuing pim commands until refresh is done over all ranks
     bool wait_refresh = false;
-    for (size_t i=0; i<ctrls_.size(); i++) {
+    sched_active_ = false;
+    for (size_t i=0; i<ctrls_.size() && !config_.refresh_aware; i++) {
         if (ctrls_[i]->pim_refresh_coming() && vcuts != -1 && hcuts != -1) {
             wait_refresh = true;
             for (int j=0; j<vcuts*hcuts; j++) {
-                in_act_placed[j] = false;
-                w_act_placed[j] = false;
-                out_act_placed[j] = false;
+                if (cut_.in_act_placed[j] || cut_.w_act_placed[j] || cut_.out_act_placed[j] ||
+                    cut_.pf_act_placed[j] || cut_.append_act_placed[j])
+                    sched_active_ = true;
+                cut_.in_act_placed[j] = false;
+                cut_.w_act_placed[j] = false;
+                cut_.out_act_placed[j] = false;
+                cut_.pf_act_placed[j] = false;
+                cut_.append_act_placed[j] = false;
+            }
+            if (next_kernel_.status == 2) {
+                for (size_t j = 0; j < next_kernel_.programs.size(); j++) {
+                    if (next_kernel_.cut.w_act_placed[j]) sched_active_ = true;
+                    next_kernel_.cut.w_act_placed[j] = false;
+                }
             }
             // std::cout<<clk_ << "\tWait Refresh\n";
         }
     }
+    if (config_.refresh_aware) {
+        UpdateRefreshHolds(cut_, cut_programs_);
+        if (next_kernel_.status == 2 && !next_kernel_.w_out_shared)
+            UpdateRefreshHolds(next_kernel_.cut, next_kernel_.programs);
+    }
+    CountRefreshStalls(1);
+    if (next_kernel_.status != 0) {
+        pipeline_staged_cycles++;
+        IncrementArrayStat("pipeline_staged_cycles", 1);
+        // the last output of the running kernel has been written
+        if (!Running()) StartNextKernel();
+    }
+    // the VPU is done with its ops
+    if (vpu_busy_ && clk_ >= vpu_end_) {
+        vpu_busy_ = false;
+        sched_active_ = true;
+        turn_off = !Running() && pim_trans_queue_.empty() && pim_kernel_queue_.empty() && next_kernel_.status == 0;
+    }
+    if (!vpu_callbacks_.empty() && clk_ >= vpu_callbacks_.front().first) {
+        std::vector<KernelCallback> done;
+        while (!vpu_callbacks_.empty() && clk_ >= vpu_callbacks_.front().first) {
+            done.push_back(vpu_callbacks_.front().second);
+            vpu_callbacks_.erase(vpu_callbacks_.begin());
+        }
+        KernelDone(done);
+    }
 
-
-
-    // Pop a PIM transaction if the queue is not empty
+    // Pop a PIM transaction if the queue is not empty, a transaction that
+    // has to wait is tried again once the scheduler state changes
     if (!pim_trans_queue_.empty()) {
-        int cut_no;
-        int bw_cutNo = 4;
-        int bw_vcuts = 3;
-        int bw_hcuts = 1;
-        int bw_mcf = 3;
-        int bw_ucf = 3;
-        int bw_df = 1;
-        int bw_Mtile = 4;
-        int bw_kernelSize = 5;
-        int bw_stride = 5;
-        int bw_dimValue = 32;
-        int bw_baseRow = 22;
-        int bw_loadType = 2;
-
-        auto it = pim_trans_queue_.begin();
-        uint64_t address = it->addr;
-
-        // distinguish transaction by LSB of its address into three types:
-        // launch computation, load dataflow configuration, and load workload configuration
-        if (it->addr & 1) { // launch computation
-            address = address >> 1;
-            int cuts = vcuts * hcuts;
-            bool configured = true;
-            for (int i=0; i<cuts; i++)
-                if ((address & (1 << i)) && (M[i] != 0 && N[i] != 0 && K[i] != 0));
-                else {
-                    configured = false;
-                }
-            if (configured) {
-                for (int i=0; i<cuts; i++)
-                    if(address & (1 << i))
-                        in_pim[i] = true;
-                pim_trans_queue_.erase(it);
-            }
-            for (size_t i=0; i<ctrls_.size(); i++) {
-                ctrls_[i]->in_pim = true;
-            }
-
+        pim_queue_waiting_ = !ApplyPimTransaction(pim_trans_queue_.front());
+        if (!pim_queue_waiting_) {
+            pim_trans_queue_.erase(pim_trans_queue_.begin());
+            sched_active_ = true;
         }
-        else if ((it->addr & (1 << 6)) && (it->addr & (1 << 5))) { // loading dataflow configuration
-
-
-            base_rows_w.clear();
-            base_rows_in.clear();
-            base_rows_out.clear();
-            M.clear();
-            N.clear();
-            K.clear();
-            M_it.clear();
-            K_tile_it.clear();
-            N_it.clear();
-            M_out_it.clear();
-            N_out_tile_it.clear();
-            in_pim.clear();
-            iw_status.clear();
-            in_cnt.clear();
-            out_cnt.clear();
-            vpu_cnt.clear();
-            in_act_placed.clear();
-            w_act_placed.clear();
-            out_act_placed.clear();
-            output_valid.clear();
-
-            address = address >> 1 >> 4 >> 2; // trans_type, cut_no, loadType
-            vcuts = 1 << (address & ((1<<bw_vcuts)-1));
-            address = address >> bw_vcuts;
-            hcuts = 1 << (address & ((1<<bw_hcuts)-1));
-            address = address >> bw_hcuts;
-            mcf = 1 << (address & ((1<<bw_mcf)-1));
-            address = address >> bw_mcf;
-            ucf = 1 << (address & ((1<<bw_ucf)-1));
-            address = address >> bw_ucf;
-            df = address & ((1<<bw_df)-1);
-            address = address >> bw_df;
-
-
-            mc = mcf * ucf;
-            if (vcuts * hcuts > 1) // TODO
-                for (int i=0; i<ctrls_.size(); i++) {
-                    ctrls_[i]->wr_multitenant = true;
-                }
-
-            M_tile_size = 1 << (address & ((1<<bw_Mtile)-1));
-            address = address >> bw_Mtile;
-            vcuts_next = 1 << (address & ((1<<bw_vcuts)-1));
-            address = address >> bw_vcuts;
-            hcuts_next = 1 << (address & ((1<<bw_hcuts)-1));
-            address = address >> bw_hcuts;
-            kernel_size = address & ((1<<bw_kernelSize)-1);
-            address = address >> bw_kernelSize;
-            stride = address & ((1<<bw_stride)-1);
-
-
-            int cuts = vcuts * hcuts;
-            base_rows_w.assign(cuts, 0);
-            base_rows_in.assign(cuts, 0);
-            base_rows_out.assign(cuts, 0);
-            M.assign(cuts, 0);
-            N.assign(cuts, 0);
-            K.assign(cuts, 0);
-            M_it.assign(cuts, 0);
-            K_tile_it.assign(cuts, 0);
-            N_it.assign(cuts, 0);
-            M_out_it.assign(cuts, 0);
-            N_out_tile_it.assign(cuts, 0);
-            in_pim.assign(cuts, false);
-            iw_status.assign(cuts, 0);
-            in_cnt.assign(cuts, 0);
-            out_cnt.assign(cuts, -1);
-            vpu_cnt.assign(cuts, 0);
-            in_act_placed.assign(cuts, false);
-            w_act_placed.assign(cuts, false);
-            out_act_placed.assign(cuts, false);
-            output_valid.assign(cuts, 0);
-
-            pim_trans_queue_.erase(it);
-        }
-        else { // loading workload configuration
-            address = address >> 1;
-            cut_no = address & ((1 << bw_cutNo)-1);
-            address = address >> 4;
-            int loadType = address & ((1<<bw_loadType)-1);
-            address = address >> bw_loadType;
-            int dim_value = address & (((uint64_t)1<<bw_dimValue)-1);
-            address = address >> bw_dimValue;
-            uint64_t base_row = address & ((1<<bw_baseRow)-1);
-            address = address >> bw_baseRow;
-            switch(loadType) {
-                case 0: // M, weight
-                    base_rows_w[cut_no] = base_row;
-                    M[cut_no] = dim_value;
-                    break;
-                case 1: // K, output
-                    base_rows_out[cut_no] = base_row;
-                    // std::cout<<base_row<<std::endl;
-                    K[cut_no] = dim_value;
-                    break;
-                case 2: // N, input
-                    base_rows_in[cut_no] = base_row;
-                    N[cut_no] = dim_value;
-                    break;
-                default:
-                    std::cerr << "Invalid load type!"
-                              << std::endl;
-                    AbruptExit(__FILE__, __LINE__);
-                    break;
-            }
-            pim_trans_queue_.erase(it);
-
+    } else if (!pim_kernel_queue_.empty()) {
+        // then the submitted kernels, as much of one as the scheduler takes
+        pim_kernel_waiting_ = !ApplyQueuedKernel(pim_kernel_queue_);
+        if (!pim_kernel_waiting_) sched_active_ = true;
+    }
+    // and one of each tenant's queue
+    for (auto &tenant : tenants_) {
+        if (!tenant.queue.empty()) {
+            sched_active_ = true;
+            if (ApplyPimTransaction(tenant.queue.front()))
+                tenant.queue.erase(tenant.queue.begin());
+        } else if (!tenant.kernels.empty()) {
+            sched_active_ = true;
+            ApplyQueuedKernel(tenant.kernels);
         }
     }
 
-    bool is_in_ref = false;
-    for (int i=0; i<ctrls_.size(); i++) {
-        if (ctrls_[i]->IsInRef() || ctrls_[i]->pim_refresh_coming2())
-            is_in_ref = true;
-    }
+    bool is_in_ref = IsInRef();
 
-    // We are currently developing multi-tenant workload support in the NPU by partitioning the array and running them independently.
-    // Please ignore these variables (~cut~) for now.
+    // The NPU array is partitioned into vcuts x hcuts cuts that run independently, e.g. the kernels of different tenants (see SetTenants()).
     int cuts = 0;
     if (vcuts != -1 && hcuts != -1) cuts = vcuts * hcuts;
+    const int cols = config_.columns / config_.BL;
     for (int i=0; i < cuts; i++) {
-        if (!in_pim[i] || is_in_ref) continue;
-
-        int vcut_no = i % vcuts;
-        int cut_height = config_.channels / hcuts;
-        int hcut_no = i / vcuts;
-        int cut_width = config_.banks / vcuts;
+        if (!cut_.in_pim[i] || is_in_ref || cut_.ref_hold[i]) continue;
 
-        int N_tile_size = 128 / vcuts; // 128 : the number of PEs in a row
-        int N_tile_it = N_it[i] / N_tile_size;
-        int M_tile_it = M_it[i] / M_tile_size;
-        int M_current_tile_size = M[i] < M_tile_size * (M_tile_it + 1) ? M[i] % M_tile_size : M_tile_size;
-        int K_tile_size = std::min(cut_height * 16, K[i]); // 16: the number of PEs supported by a bank's io
+        CutProgram &prog = cut_programs_[i];
+        int vcut_no = prog.vcut_no;
+        int cut_height = prog.cut_height;
 
+        int N_tile_size = prog.N_tile_size;
+        int N_tile_it = cut_.N_it[i] / N_tile_size;
+        int M_tile_it = cut_.M_it[i] / prog.M_tile_size;
+        int M_current_tile_size = cut_.M[i] < prog.M_tile_size * (M_tile_it + 1) ? cut_.M[i] % prog.M_tile_size : prog.M_tile_size;
+        int K_tile_size = prog.K_tile_size;
 
-        int weight_banks_reduce = df==0? 8:16; // BLP option for weight loading
-        std::vector<std::vector<Command>> in_cmds(cuts);
-        std::vector<std::vector<Command>> w_cmds(cuts);
+        std::vector<Command> &in_cmds = prog.in_batch;
+        std::vector<Command> &w_cmds = prog.w_batch;
+        in_cmds.clear();
+        w_cmds.clear();
 
-        bool output_ready = iw_status[i] == 3;
+        bool output_ready = cut_.iw_status[i] == 3;
 
-        // std::cout<<iw_status[i]<<"iw_status\n";
+        // std::cout<<cut_.iw_status[i]<<"iw_status\n";
         // Our PIM command scheduler changes iw_status value to switch the BLAS functions between loading data into PE array registers and streaming data into the array.
         // It manages matrix multiplication progress by monitoring and updating the BLAS status and NPU status
-        switch (iw_status[i]) {
+        switch (cut_.iw_status[i]) {
             case 0: { // data loading into PE registers
-                CommandType act_type = CommandType::PIM_ACTIVATE;
-                CommandType read_type = CommandType::GH_READ;
-                CommandType readp_type = CommandType::GH_READ_PRECHARGE;
-
-
-                int N_tile_size_per_bank = std::min(N[i], (N_tile_size-1)/(cut_width/weight_banks_reduce) + 1);
-                int col_offset = N_tile_it * (N_tile_size_per_bank * ((K[i]-1) / K_tile_size + 1)) + K_tile_it[i] * N_tile_size_per_bank + N_it[i] % N_tile_size; // N_it incremented by N_tile_size when N_it % N_tile_size_per_bank == 0 (but not with N_tile_size)
-                // Scheduler generates the commands for a data vector, divided into multiple channels and sends them to command queues in the corresponding channel controllers.
-                for (int j=0; j<cut_height; j++) {
-                    // It can read multiple banks or only one bank per channel, but fixed to one bank for now.
-                    for (int k=0; k<cut_width/weight_banks_reduce; k++) {
-                        int ch = hcut_no * cut_height + j;
-                        int bk = vcut_no * cut_width + k * weight_banks_reduce;
-                        int bg = bk / config_.banks_per_group;
-                        bk = bk % config_.banks_per_group;
-                        // building memory address by combining base physical address and BLAS configuration
-                        Address addr = Address(ch, 0, bg, bk, base_rows_w[i] + col_offset/(config_.columns/config_.BL),  col_offset % (config_.columns/config_.BL));
-                        uint64_t hex_addr = config_.AddressUnmapping(addr);
-                        // generate read-precharge command if this is the last access to read the tile.
-                        CommandType cmd_type;
-                        bool exit = ((N_it[i]+1) % N_tile_size_per_bank == 0 && (N_tile_size == N_tile_size_per_bank || (N_it[i]+1) % N_tile_size != 0));
-                        cmd_type = (addr.column + 1) % std::min(N[i], 128 / config_.banks * weight_banks_reduce) == 0 || (addr.column + 1) % (config_.columns / config_.BL) == 0 || exit ? readp_type : read_type;
-                        Command cmd = Command(cmd_type, addr, hex_addr);
-                        Command ready_cmd = ctrls_[ch]->GetReadyCommand(cmd, clk_);
-                        // If a command cannot be executed in some channels due to timing constraints, flush the commands going to other channels and try again later.
-                        // This is to prevent the commands from being sent multiple times.
-                        if (!ready_cmd.IsValid()) {
-                            w_cmds[i].clear();
-                            break;
-                        }
-                        else {
-                            w_cmds[i].push_back(ready_cmd);
-                            if (w_cmds[i].begin()->cmd_type != ready_cmd.cmd_type) {
-                                w_cmds[i].clear();
-                                break;
-                            }
-                        }
-                    }
-                    if (w_cmds[i].empty()) break;
-                }
-
-
-                if (w_cmds[i].empty()) break;
-                // Check if the activation command was already sent.
-                if (w_cmds[i].begin()->cmd_type == act_type) {
-                    if (w_act_placed[i] || wait_refresh) {
-                        w_cmds[i].clear();
-                        break;
-                    }
-                    else
-                        w_act_placed[i] = true;
-                }
-                //
-                else {
-                    if (w_cmds[i].begin()->cmd_type == readp_type) {
-                        w_act_placed[i] = false;
-                    }
-                    if (df == 1 && w_cmds[i].begin()->cmd_type == CommandType::PRECHARGE) {
-                        break;
-                    }
-
-                    // increment iterators
-                    N_it[i]++;
-                    if (N_it[i] % N_tile_size_per_bank == 0 && (N_tile_size == N_tile_size_per_bank || N_it[i] % N_tile_size != 0)) {
-                        N_it[i] = N_tile_size * N_tile_it;
-                        iw_status[i]++;
-                    }
-                }
-
-
+                // after the tokens appended to its KV cache, which share the weight banks
+                if (cut_.append_it[i] < prog.append_steps) break;
+                if (LoadWeights(prog, cut_.base_rows_w[i], cut_.N_it[i], cut_.K_tile_it[i], cut_.w_act_placed[i], wait_refresh, w_cmds))
+                    cut_.iw_status[i]++;
                 break;
             }
             case 1: { // Finished data loading
                 // wait npu signals
                 // For not multi-tenant cases, advance to next stage immediately.
-                iw_status[i]++;
-                vpu_cnt[i] = 1;
-                if (cuts == 1) { //N[i]==1) { //TODO support for MT
-                    for (int j=0; j<iw_status.size(); j++) {
-                        if (iw_status[j] == 0 || iw_status[j] == 3) {
-                            iw_status[i]--;
+                sched_active_ = true;
+                cut_.iw_status[i]++;
+                // the inputs are the outputs of the VPU op before it
+                cut_.vpu_cnt[i] = 1;
+                if (vpu_end_ > clk_) {
+                    cut_.vpu_cnt[i] += vpu_end_ - clk_;
+                    vpu_wait_cycles_ += vpu_end_ - clk_;
+                    IncrementCutStat(uint64_t(1) << i, "vpu_wait_cycles",
+                                     vpu_end_ - clk_);
+                }
+                // several cuts, e.g. of different tenants, do not wait for each other
+                if (cuts == 1) { //cut_.N[i]==1) {
+                    for (int j=0; j<cuts; j++) {
+                        if (cut_.iw_status[j] == 0 || cut_.iw_status[j] == 3) {
+                            cut_.iw_status[i]--;
                             break;
                         }
                     }
@@ -490,47 +669,58 @@ void JedecDRAMSystem::ClockTick() {
             }
             case 2: { // Streaming data into PE array
                 CommandType act_type = CommandType::PIM_ACTIVATE;
-                CommandType read_type = df == 0 ? CommandType::GH_READ : CommandType::LH_READ;
-                CommandType readp_type = df == 0 ? CommandType::GH_READ_PRECHARGE : CommandType::LH_READ_PRECHARGE;
-                vpu_cnt[i]--;
-                vpu_cnt[i] = std::max(0, vpu_cnt[i]);
-
-                int col_offset = M_tile_it * (M_tile_size * ((K[i]-1) / K_tile_size + 1)) + K_tile_it[i] * M_current_tile_size + M_it[i] % M_tile_size;
+                CommandType read_type = prog.df == 0 ? CommandType::GH_READ : CommandType::LH_READ;
+                CommandType readp_type = prog.df == 0 ? CommandType::GH_READ_PRECHARGE : CommandType::LH_READ_PRECHARGE;
+                cut_.vpu_cnt[i]--;
+                cut_.vpu_cnt[i] = std::max(0, cut_.vpu_cnt[i]);
+
+                int col_offset = InputColumn(prog, cut_.M_it[i], cut_.K_tile_it[i]);
+                bool close = cut_.M_it[i] + 1 == cut_.M[i]; // prevent closing between tiles
+                // A KV cache laid out for its capacity leaves a gap after each K tile, the row is closed unless the next one starts in it
+                if (prog.in_strided && !close && cut_.M_it[i] + 1 == M_tile_it * prog.M_tile_size + M_current_tile_size) {
+                    close = cut_.K_tile_it[i] + 1 == prog.K_tiles ||
+                            InputColumn(prog, M_tile_it * prog.M_tile_size, cut_.K_tile_it[i] + 1) / cols != col_offset / cols;
+                }
+                // A convolution spreads the tile's input reads over its steps. The steps in between generate their im2col rows from the input rows already read, without accessing DRAM.
+                bool buffered = false;
+                if (prog.kernel_size > 0) {
+                    int64_t reads = prog.in_tile_reads[M_tile_it];
+                    int64_t step = cut_.M_it[i] % prog.M_tile_size;
+                    int read = step * reads / M_current_tile_size;
+                    buffered = step > 0 && read == (step - 1) * reads / M_current_tile_size;
+                    col_offset = prog.in_tile_offsets[M_tile_it] + cut_.K_tile_it[i] * reads + read;
+                    // the reads of a tile do not end at a row boundary, and the next N tile reads them again
+                    close = read + 1 == reads;
+                    if (buffered) sched_active_ = true;
+                }
+                // building memory address by combining base physical address and BLAS configuration
+                int row = cut_.base_rows_in[i] + col_offset / cols;
+                int column = col_offset % cols;
+                bool close2 = (cut_.K_tile_it[i]+1) * K_tile_size >= cut_.K[i]; // leave open in GEMM since batch size is too small in LLMs
+                bool close3 = prog.df==0?close2 && close:close;
+                // generate read-precharge command if this is the last access to read the tile.
+                CommandType cmd_type = close3 || column == cols - 1 ? readp_type : read_type;
                 bool mixed = false;
                 Command mixed_cmd;
                 // Scheduler generates the commands for a data vector, divided into multiple channels and sends them to command queues in the corresponding channel controllers.
-                for (int j=0; j<cut_height; j++) {
+                for (int j=0; j<cut_height && !buffered; j++) {
                     // It can generate commands for multiple banks per channel simultaneously depending on the multi-column configuration.
-                    for (int k=0; k<mc; k++) {
-
-                        int ch = hcut_no * cut_height + j;
-                        int bk = vcut_no * cut_width + k*(cut_width/mc);
-                        if (df==0) bk++;
-                        int bg = bk / config_.banks_per_group;
-                        bk = bk % config_.banks_per_group;
-
-                        // building memory address by combining base physical address and BLAS configuration
-                        Address addr = Address(ch, 0, bg, bk, base_rows_in[i] + col_offset/(config_.columns/config_.BL),  col_offset % (config_.columns/config_.BL));
-                        uint64_t hex_addr = config_.AddressUnmapping(addr);
-                        bool close = M_it[i] + 1 == M[i]; // prevent closing between tiles
-                        bool close2 = (K_tile_it[i]+1) * K_tile_size >= K[i]; // leave open in GEMM since batch size is too small in LLMs
-                        bool close3 = df==0?close2 && close:close;
-                        // generate read-precharge command if this is the last access to read the tile.
-                        CommandType cmd_type = close3 || addr.column == config_.columns / config_.BL - 1 ? readp_type : read_type;
-                        Command cmd = Command(cmd_type, addr, hex_addr);
-                        Command ready_cmd = ctrls_[ch]->GetReadyCommand(cmd, clk_);
+                    for (int k=0; k<prog.mc; k++) {
+                        const Lane &lane = prog.in_lanes[j * prog.mc + k];
+                        Command cmd = LaneCommand(cmd_type, lane, row, column);
+                        Command ready_cmd = ctrls_[lane.addr.channel]->GetReadyCommand(cmd, clk_);
                         // If a command cannot be executed in some channels due to timing constraints, flush the commands going to other channels and try again later.
                         // This is to prevent the commands from being sent multiple times.
                         if (!ready_cmd.IsValid()) {
-                            in_cmds[i].clear();
+                            in_cmds.clear();
                             break;
                         }
                         else {
-                            in_cmds[i].push_back(ready_cmd);
-                            if (in_cmds[i].begin()->cmd_type != ready_cmd.cmd_type) {
+                            in_cmds.push_back(ready_cmd);
+                            if (in_cmds.begin()->cmd_type != ready_cmd.cmd_type) {
                                 if (mixed) {
-                                    if (mixed_cmd.cmd_type != in_cmds[i].begin()->cmd_type && mixed_cmd.cmd_type != ready_cmd.cmd_type) {
-                                        std::cout<<"3 ops mixed: "<<mixed_cmd<<*in_cmds[i].begin()<<ready_cmd<<std::endl;
+                                    if (mixed_cmd.cmd_type != in_cmds.begin()->cmd_type && mixed_cmd.cmd_type != ready_cmd.cmd_type) {
+                                        std::cout<<"3 ops mixed: "<<mixed_cmd<<*in_cmds.begin()<<ready_cmd<<std::endl;
                                     }
                                 }
                                 else {
@@ -542,69 +732,79 @@ void JedecDRAMSystem::ClockTick() {
                         }
                     }
                 }
-                if(cuts > 1 && in_cmds[i].size() != cut_height) {
-                    in_cmds[i].clear();
+                if(cuts > 1 && !buffered && in_cmds.size() != cut_height * prog.mc) {
+                    in_cmds.clear();
                     break;
                 }
                 if (mixed) {
-                    for (auto it = in_cmds[i].begin(); it != in_cmds[i].end();) {
-                        if (it->cmd_type == read_type || it->cmd_type == readp_type) {
-                            it = in_cmds[i].erase(it);
-                        }
-                        else
-                            it++;
-                    }
+                    // compact in place, the batch keeps its capacity
+                    in_cmds.erase(std::remove_if(in_cmds.begin(), in_cmds.end(),
+                                                 [read_type, readp_type](const Command &cmd) {
+                                                     return cmd.cmd_type == read_type || cmd.cmd_type == readp_type;
+                                                 }),
+                                  in_cmds.end());
                 }
 
-                if (in_cmds[i].empty()) break;
+                if (in_cmds.empty() && !buffered) break;
 
                 // Check if the activation command was already sent.
-                if (in_cmds[i].begin()->cmd_type == act_type) {
-                    if ((in_act_placed[i]) || wait_refresh) {
-                        in_cmds[i].clear();
+                if (!buffered && in_cmds.begin()->cmd_type == act_type) {
+                    if ((cut_.in_act_placed[i]) || wait_refresh) {
+                        in_cmds.clear();
                         break;
                     }
                     else{
-                        in_act_placed[i] = true;
+                        cut_.in_act_placed[i] = true;
 
                     }
                 }
                 else {
 
-                    if (in_cmds[i].begin()->cmd_type == readp_type) {
-                        in_act_placed[i] = false;
+                    if (!buffered && in_cmds.begin()->cmd_type == readp_type) {
+                        cut_.in_act_placed[i] = false;
                     }
-                    if (vpu_cnt[i]!=0){
-                        in_cmds[i].clear();
+                    if (cut_.vpu_cnt[i]!=0){
+                        in_cmds.clear();
                         break;
                     }
+                    if (prog.kernel_size > 0) {
+                        conv_rows_++;
+                        IncrementCutStat(uint64_t(1) << i, "conv_input_vectors", 1);
+                        if (!buffered) {
+                            conv_rows_read_++;
+                            IncrementCutStat(uint64_t(1) << i,
+                                             "conv_input_vectors_read", 1);
+                        }
+                    }
 
-                    assert(M_tile_size > 128/vcuts);
+                    assert(prog.M_tile_size > 128/vcuts);
 
                     // Update NPU status. Countdown the operation delay.
-                    if ((K_tile_it[i]+1) * K_tile_size >= K[i] && M_it[i] % M_tile_size == 0) {
-                        out_cnt[i] = std::max(1, config_.tCCD_L * (3 + 16) - config_.tRCDWR);
+                    if ((cut_.K_tile_it[i]+1) * K_tile_size >= cut_.K[i] && cut_.M_it[i] % prog.M_tile_size == 0) {
+                        cut_.out_cnt[i] = std::max(1, config_.tCCD_L * (3 + 16) - config_.tRCDWR);
                     }
 
 
                     // Increment Iterators
-                    M_it[i]++;
-                    if (M_it[i] % M_tile_size == 0 || M_it[i] == M[i]) {
-                        in_cnt[i] = std::max(1, config_.tCCD_L * std::max(128/(vcuts*mc), 16) - config_.tRCDRD);
-                        iw_status[i]++;
-                        M_it[i] = M_tile_size * M_tile_it;
-                        K_tile_it[i]++;
-
-                        if (K_tile_it[i] * K_tile_size >= K[i]) {
-                            // out_cnt[i] = 3;
-                            K_tile_it[i] = 0;
-                            N_it[i] = N_tile_size * (N_tile_it+1);
-                            if (N_it[i] >= N[i]) {
-                                N_it[i] = 0;
-                                M_it[i] = M_tile_size * (M_tile_it + 1);
-                                if (M_it[i] >= M[i]) {
-                                    std::cout<<clk_<<" End of Computation "<<i<<std::endl;
-                                    in_cnt[i] = -1;
+                    cut_.M_it[i]++;
+                    if (cut_.M_it[i] % prog.M_tile_size == 0 || cut_.M_it[i] == cut_.M[i]) {
+                        cut_.in_cnt[i] = std::max(1, config_.tCCD_L * std::max(128/(vcuts*prog.mc), 16) - config_.tRCDRD);
+                        cut_.iw_status[i]++;
+                        cut_.M_it[i] = prog.M_tile_size * M_tile_it;
+                        cut_.K_tile_it[i]++;
+
+                        if (cut_.K_tile_it[i] * K_tile_size >= cut_.K[i]) {
+                            // cut_.out_cnt[i] = 3;
+                            cut_.K_tile_it[i] = 0;
+                            cut_.N_it[i] = N_tile_size * (N_tile_it+1);
+                            if (cut_.N_it[i] >= cut_.N[i]) {
+                                cut_.N_it[i] = 0;
+                                cut_.M_it[i] = prog.M_tile_size * (M_tile_it + 1);
+                                if (cut_.M_it[i] >= cut_.M[i]) {
+                                    if (config_.output_level >= 0)
+                                        std::cout<<clk_<<" End of Computation "<<i<<std::endl;
+                                    computation_end_cycles.push_back(clk_);
+                                    cut_.in_cnt[i] = -1;
                                 }
                             }
                         }
@@ -615,12 +815,36 @@ void JedecDRAMSystem::ClockTick() {
             case 3: {// Finished input
                 // Lookup NPU status
                 // Wait until PE array is available for loading a new tile.
-                if (in_cnt[i] == -1) break;
+                if (cut_.in_cnt[i] == -1) break;
                 else {
 
-                    in_cnt[i] = std::max(0, in_cnt[i] - 1);
-                    if (in_cnt[i] == 0 && output_valid[i] == 0)
-                        iw_status[i] = 0;
+                    cut_.in_cnt[i] = std::max(0, cut_.in_cnt[i] - 1);
+                    if (cut_.in_cnt[i] == 0 && cut_.output_valid[i] == 0) {
+                        cut_.iw_status[i] = 0;
+                        if (config_.double_buffer) {
+                            // swap in the prefetched weights, or carry on
+                            // loading them where the prefetch stopped
+                            uint64_t cut_mask = uint64_t(1) << i;
+                            if (cut_.pf_status[i] == 2) {
+                                cut_.iw_status[i] = 1;
+                                weight_tiles_prefetched_++;
+                                IncrementCutStat(cut_mask, "weight_tiles_prefetched", 1);
+                            } else if (cut_.pf_status[i] == 1) {
+                                cut_.N_it[i] = cut_.pf_N_it[i];
+                                cut_.w_act_placed[i] = cut_.pf_act_placed[i];
+                                weight_tiles_part_prefetched_++;
+                                IncrementCutStat(cut_mask, "weight_tiles_part_prefetched", 1);
+                            } else {
+                                weight_tiles_loaded_++;
+                                IncrementCutStat(cut_mask, "weight_tiles_loaded", 1);
+                            }
+                            cut_.pf_status[i] = 0;
+                            cut_.pf_act_placed[i] = false;
+                        }
+                        sched_active_ = true;
+                        tile_boundary_ = config_.steady_state;
+                        if (config_.refresh_aware && OwesRefresh(i)) HoldForRefresh(cut_, prog, i);
+                    }
                     break;
                 }
                 break;
@@ -630,115 +854,142 @@ void JedecDRAMSystem::ClockTick() {
             }
         }
 
-
+        // Double buffering: load the next tile's weights while this one
+        // streams. The prefetch only uses banks that streaming does not
+        // (or waits for the drain) and that no output can be written to,
+        // so it never closes a row another BLAS function relies on. In a
+        // shared bank it waits a cycle past the last input read, which may
+        // still be in this cycle's batch.
+        if (config_.double_buffer && cut_.pf_status[i] != 2 && w_cmds.empty() &&
+            ((cut_.iw_status[i] == 3 && (output_ready || !prog.w_in_shared)) ||
+             (cut_.iw_status[i] == 2 && !prog.w_in_shared)) &&
+            (!prog.w_out_shared ||
+             (cut_.out_cnt[i] == -1 && cut_.output_valid[i] == 0 &&
+              (cut_.iw_status[i] == 3 || (cut_.K_tile_it[i] + 1) * K_tile_size < cut_.K[i])))) {
+            // the target tile is fixed by the first command issued for it
+            if (cut_.pf_status[i] == 1 || NextWeightTile(i, cut_.pf_N_it[i], cut_.pf_K_tile_it[i])) {
+                if (LoadWeights(prog, cut_.base_rows_w[i], cut_.pf_N_it[i], cut_.pf_K_tile_it[i], cut_.pf_act_placed[i], wait_refresh, w_cmds))
+                    cut_.pf_status[i] = 2;
+                else if (!w_cmds.empty())
+                    cut_.pf_status[i] = 1;
+            }
+        }
 
         // Update NPU status
-        if (out_cnt[i] == 0) output_valid[i]++;
-        if (out_cnt[i] != -1) out_cnt[i]--;
+        if (cut_.out_cnt[i] == 0) {
+            cut_.output_valid[i]++;
+            sched_active_ = true;
+        }
+        if (cut_.out_cnt[i] != -1) cut_.out_cnt[i]--;
 
 
-        std::vector<std::vector<Command>> out_cmds(cuts);
+        std::vector<Command> &out_cmds = prog.out_batch;
+        out_cmds.clear();
+
+        // Tokens appended to a KV cache are written to the input banks before the weights are loaded
+        if (cut_.append_it[i] < prog.append_steps &&
+            AppendKvCache(prog, i, wait_refresh, w_cmds, out_cmds)) {
+            uint64_t tokens = cut_.append_to[i] - cut_.append_from[i];
+            kv_tokens_appended_ += tokens;
+            IncrementCutStat(uint64_t(1) << i, "kv_tokens_appended", tokens);
+        }
 
 
         // Writing Output from NPU to DRAM
         // Command Scheduler lookups the NPU status to check if the output data is ready to be sent to DRAM.
         bool out_enable = cut_height / vcuts > 0 || vcut_no % 2 == 0;
-        if (output_valid[i] > 0 && output_ready && out_enable) {
-            int vcut_out_no = M[i] == 1 ? vcut_no : vcuts == 16 ? vcut_no / 2 : (vcut_no + N_out_tile_it[i]) % vcuts; // relates to channel number
-            int M_tile_size_out = df == 1 ? (M_tile_size/128)*mcf : M_tile_size;
-            int M_out_tile_it = M_out_it[i] / M_tile_size_out;
-            int M_out = df == 1 ? std::max(1, M[i]*mcf / 128) : M[i];
+        if (cut_.output_valid[i] > 0 && output_ready && out_enable) {
+            int vcut_out_no = cut_.M[i] == 1 ? vcut_no : vcuts == 16 ? vcut_no / 2 : (vcut_no + cut_.N_out_tile_it[i]) % vcuts; // relates to channel number
+            int M_tile_size_out = prog.M_tile_size_out;
+            int M_out_tile_it = cut_.M_out_it[i] / M_tile_size_out;
+            int M_out = prog.M_out;
             int M_out_current_tile_size = M_out < M_tile_size_out * (M_out_tile_it + 1) ? M_out % M_tile_size_out : M_tile_size_out;
-            int N_out = df == 1 ? 128 : N[i];
-            int N_tile_size_out = df == 1 ? 128 : N_tile_size;
-            int N_tile_num = (N[i]-1) / N_tile_size_out + 1;
+            int N_out = prog.N_out;
+            int N_tile_size_out = prog.N_tile_size_out;
+            int N_tile_num = prog.N_tile_num;
             int N_tile_num_ch = (N_tile_num) / vcuts; // varies by channels to be accessed
-            N_tile_num_ch += N_tile_num % vcuts > N_out_tile_it[i] % vcuts ? 1 : 0;
-            int N_tile_it_ch = N_out_tile_it[i] / vcuts;
-            int col_offset = M_out_tile_it * (M_tile_size_out * N_tile_num_ch) + N_tile_it_ch * M_out_current_tile_size + M_out_it[i] % M_tile_size_out;
+            N_tile_num_ch += N_tile_num % vcuts > cut_.N_out_tile_it[i] % vcuts ? 1 : 0;
+            int N_tile_it_ch = cut_.N_out_tile_it[i] / vcuts;
+            int col_offset = M_out_tile_it * (M_tile_size_out * N_tile_num_ch) + N_tile_it_ch * M_out_current_tile_size + cut_.M_out_it[i] % M_tile_size_out;
+            // building memory address by combining base physical address and BLAS configuration
+            int row = cut_.base_rows_out[i] + col_offset / cols;
+            int column = col_offset % cols;
+            // generate write-precharge command if this is the last access to write the output tile.
+            bool close = cut_.M_out_it[i] + 1 == M_out;
+            CommandType cmd_type = close || column == cols - 1 ? CommandType::PIM_WRITE_PRECHARGE : CommandType::PIM_WRITE;
 
             // Scheduler generates the commands for a data vector, divided into multiple channels and sends them to command queues in the corresponding channel controllers.
-            int cut_height_out = cut_height < vcuts ? 1 : cut_height / vcuts;
-            for (int j=0; j<cut_height_out; j++) {
-
-                // It can generate commands for multiple banks per channel simultaneously depending on the multi-column configuration.
-                // but it can send the same data only because the data bus is shared between the banks.
-                int ch = hcut_no * cut_height + vcut_out_no * cut_height_out + j;
-                int k_bound = df == 1 ? 1 : M[i] == 1 || true ? mc : 1;
-                for (int k=0; k<k_bound; k++) {
-                    int bk = vcut_no * cut_width + k*(cut_width/mc);
-                    if (df != 1) bk++;
-                    int bg = bk / config_.banks_per_group;
-                    bk = bk % config_.banks_per_group;
-                    if (df==0) bk += 2;
-                    // building memory address by combining base physical address and BLAS configuration
-                    Address addr = Address(ch, 0, bg, bk, base_rows_out[i] + col_offset/(config_.columns/config_.BL),  col_offset % (config_.columns/config_.BL));
-                    // Address addr = Address(ch, 0, bg, bk, base_rows_out[i] + col_offset,  col_offset % (config_.columns/config_.BL));
-                    uint64_t hex_addr = config_.AddressUnmapping(addr);
-                    // generate write-precharge command if this is the last access to write the output tile.
-                    bool close = M_out_it[i] + 1 == M_out;
-                    CommandType cmd_type = close || addr.column == config_.columns / config_.BL - 1 ? CommandType::PIM_WRITE_PRECHARGE : CommandType::PIM_WRITE;
-                    Command cmd = Command(cmd_type, addr, hex_addr);
-                    Command ready_cmd = ctrls_[ch]->GetReadyCommand(cmd, clk_);
-
-                    // If a command cannot be executed in some channels due to timing constraints, flush the commands going to other channels and try again later.
-                    // This is to prevent the commands from being sent multiple times.
-                    if (!ready_cmd.IsValid()) {
-                        out_cmds[i].clear();
+            // It can generate commands for multiple banks per channel simultaneously depending on the multi-column configuration.
+            // but it can send the same data only because the data bus is shared between the banks.
+            int lanes = prog.cut_height_out * prog.k_bound;
+            const Lane *out_lanes = prog.out_lanes.data() + vcut_out_no * lanes;
+            for (int j=0; j<lanes; j++) {
+                Command cmd = LaneCommand(cmd_type, out_lanes[j], row, column);
+                Command ready_cmd = ctrls_[out_lanes[j].addr.channel]->GetReadyCommand(cmd, clk_);
+
+                // If a command cannot be executed in some channels due to timing constraints, flush the commands going to other channels and try again later.
+                // This is to prevent the commands from being sent multiple times.
+                if (!ready_cmd.IsValid()) {
+                    out_cmds.clear();
+                    break;
+                }
+                else {
+                    out_cmds.push_back(ready_cmd);
+                    if (out_cmds.begin()->cmd_type != ready_cmd.cmd_type) {
+                        out_cmds.clear();
                         break;
                     }
-                    else {
-                        out_cmds[i].push_back(ready_cmd);
-                        if (out_cmds[i].begin()->cmd_type != ready_cmd.cmd_type) {
-                            out_cmds[i].clear();
-                            break;
-                        }
-                    }
                 }
-                if (out_cmds[i].empty()) break;
             }
 
             // Check if the activation command was already sent.
-            if (!out_cmds[i].empty()) {
-                if (out_cmds[i].begin()->cmd_type == CommandType::PIM_ACTIVATE) {
-                    if (out_act_placed[i] || wait_refresh) {
-                        out_cmds[i].clear();
+            if (!out_cmds.empty()) {
+                if (out_cmds.begin()->cmd_type == CommandType::PIM_ACTIVATE) {
+                    if (cut_.out_act_placed[i] || wait_refresh) {
+                        out_cmds.clear();
                     }
                     else {
-                        out_act_placed[i] = true;
+                        cut_.out_act_placed[i] = true;
                     }
                 }
                 else {
-                    if (out_cmds[i].begin()->cmd_type == CommandType::PIM_WRITE_PRECHARGE) {
-                        out_act_placed[i] = false;
+                    if (out_cmds.begin()->cmd_type == CommandType::PIM_WRITE_PRECHARGE) {
+                        cut_.out_act_placed[i] = false;
                     }
 
                     // Increment Iterators
-                    M_out_it[i]++;
-                    if (M_out_it[i] % M_tile_size_out == 0 || M_out_it[i] == M_out) {
-                        M_out_it[i] = M_tile_size_out * M_out_tile_it;
-                        N_out_tile_it[i]++;
-                        if (N_out_tile_it[i] * N_tile_size_out >= N_out) {
-                            N_out_tile_it[i] = 0;
-                            M_out_it[i] = M_tile_size_out * (M_out_tile_it+1);
-                            if (M_out_it[i] >= M_out) {
-                                assert(in_cnt[i] == -1);
-                                std::cout<<clk_<<" Output Exhausted: Array"<<i<<". Turn off PIM mode.\n";
-                                in_pim[i] = false;
-                                if (cut_height < vcuts) in_pim[i+1] = false;
-                                turn_off = true;
-                                for (size_t j = 0; j < in_pim.size(); j++) {
-                                    if (in_pim[j]) {
-                                        turn_off = false;
-                                    }
-
+                    cut_.M_out_it[i]++;
+                    if (cut_.M_out_it[i] % M_tile_size_out == 0 || cut_.M_out_it[i] == M_out) {
+                        cut_.M_out_it[i] = M_tile_size_out * M_out_tile_it;
+                        cut_.N_out_tile_it[i]++;
+                        if (cut_.N_out_tile_it[i] * N_tile_size_out >= N_out) {
+                            cut_.N_out_tile_it[i] = 0;
+                            cut_.M_out_it[i] = M_tile_size_out * (M_out_tile_it+1);
+                            if (cut_.M_out_it[i] >= M_out) {
+                                assert(cut_.in_cnt[i] == -1);
+                                if (config_.output_level >= 0)
+                                    std::cout<<clk_<<" Output Exhausted: Array"<<i<<". Turn off PIM mode.\n";
+                                cut_.in_pim[i] = false;
+                                if (cut_height < vcuts) cut_.in_pim[i+1] = false;
+                                if (!tenants_.empty()) EndTenantKernel(i);
+                                bool idle = !Running();
+                                if (idle && tenants_.empty()) {
+                                    kernels_finished++;
+                                    KernelDone(kernel_callbacks_);
+                                }
+                                for (const auto &tenant : tenants_) {
+                                    if (!tenant.queue.empty() || !tenant.kernels.empty()) idle = false;
                                 }
+                                if (idle && config_.refresh_aware && config_.output_level >= 0)
+                                    std::cout<<clk_<<" Refresh stalls: "<<refresh_stall_cycles - kernel_refresh_stalls_<<" cycles\n";
+                                // the next kernel may already be waiting
+                                turn_off = idle && pim_trans_queue_.empty() && pim_kernel_queue_.empty() && next_kernel_.status == 0;
                             }
 
                         }
 
-                        output_valid[i]--;
-                        if (cut_height < vcuts) output_valid[i+1]--;
+                        cut_.output_valid[i]--;
+                        if (cut_height < vcuts) cut_.output_valid[i+1]--;
                         // Output Tile Finished
                     }
                 }
@@ -747,25 +998,20 @@ void JedecDRAMSystem::ClockTick() {
         }
 
         // Finally the scheduler sends the aggregated commands to channel controllers by pushing them into PIM command queues, which are managed in-order.
+        if (!w_cmds.empty() || !in_cmds.empty() || !out_cmds.empty())
+            sched_active_ = true;
         for (auto& it: w_cmds) {
-            for (auto& it2: it) {
-               // std::cout<<clk_<<" "<<it<<std::endl;
-                ctrls_[it2.Channel()]->rd_w_cmds_.push_back(it2);
-            }
+           // std::cout<<clk_<<" "<<it<<std::endl;
+            ctrls_[it.Channel()]->rd_w_cmds_.push_back(it);
         }
         for (auto& it: in_cmds) {
-            for (auto& it2: it) {
-                ctrls_[it2.Channel()]->rd_in_cmds_.push_back(it2);
-                int release_time_ = clk_;
-                if (it2.cmd_type == CommandType::PIM_ACTIVATE) release_time_ += 0;  // + (it.Channel() % cut_height)*config_.tCCD_S);
-                ctrls_[it2.Channel()]->release_time.push_back(release_time_);
-            }
+            ctrls_[it.Channel()]->rd_in_cmds_.push_back(it);
+            uint64_t release_time_ = clk_;
+            if (it.cmd_type == CommandType::PIM_ACTIVATE) release_time_ += 0;  // + (it.Channel() % cut_height)*config_.tCCD_S);
+            ctrls_[it.Channel()]->release_time.push_back(release_time_);
         }
         for (auto& it: out_cmds) {
-            for (auto& it2: it) {
-
-                ctrls_[it2.Channel()]->wr_cmds_.push_back(it2);
-            }
+            ctrls_[it.Channel()]->wr_cmds_.push_back(it);
         }
 
     }
@@ -773,8 +1019,22 @@ void JedecDRAMSystem::ClockTick() {
 
 
 
-    for (size_t i = 0; i < ctrls_.size(); i++) {
-        ctrls_[i]->ClockTick();
+    // Pipelined layers: the next kernel loads its first weights into the
+    // array while the running one drains
+    if (next_kernel_.status == 2 && !is_in_ref) LoadNextKernelWeights(wait_refresh);
+
+    if (config_.refresh_aware) SetPimBanks();
+
+    if (clk_ >= window_end_) {
+        // a PIM kernel touches the controllers every cycle, a barrier per
+        // cycle costs more than the channels' work
+        if (channel_threads_ && !PimActive()) {
+            channel_threads_->Run([this](int i) { ctrls_[i]->ClockTick(); });
+        } else {
+            for (size_t i = 0; i < ctrls_.size(); i++) {
+                ctrls_[i]->ClockTick();
+            }
+        }
     }
 
     clk_++;
@@ -785,6 +1045,1576 @@ void JedecDRAMSystem::ClockTick() {
     return;
 }
 
+bool JedecDRAMSystem::ApplyPimTransaction(const PimTransaction &pim) {
+    // distinguish transaction by LSB of its address into three types:
+    // launch computation, load dataflow configuration, and load workload configuration
+    if (pim.type == PimTransType::LAUNCH) { // launch computation
+        if (next_kernel_.status != 0) return StageNextKernel(pim);
+        int cuts = vcuts * hcuts;
+        bool configured = true;
+        // every launched cut needs its workload, the others keep running
+        for (int i=0; i<cuts; i++)
+            if ((pim.cut_mask & (1 << i)) && (cut_.M[i] == 0 || cut_.N[i] == 0 || cut_.K[i] == 0))
+                configured = false;
+        if (configured) {
+            kernel_refresh_stalls_ = refresh_stall_cycles;
+            for (int i=0; i<cuts; i++)
+                if(pim.cut_mask & (1 << i)) {
+                    cut_.in_pim[i] = true;
+                    CompileCutProgram(i);
+                }
+            if (!tenants_.empty()) tenants_[pim.tenant].launch_clk = clk_;
+        }
+        for (size_t i=0; i<ctrls_.size(); i++) {
+            ctrls_[i]->in_pim = true;
+        }
+        return configured;
+    }
+    else if (pim.type == PimTransType::VPU) { // vector op on the outputs
+        if (!tenants_.empty()) {
+            std::cerr << "VPU ops are not supported with tenants" << std::endl;
+            AbruptExit(__FILE__, __LINE__);
+        }
+        // after the last output of the kernel before it
+        if (Running() || next_kernel_.status != 0) return false;
+        uint64_t cycles = VpuCycles(pim);
+        vpu_end_ = std::max(clk_, vpu_end_) + cycles;
+        vpu_busy_ = true;
+        vpu_ops_++;
+        vpu_cycles_ += cycles;
+        IncrementArrayStat("vpu_ops", 1);
+        IncrementArrayStat("vpu_cycles", cycles);
+        return true;
+    }
+    else if (pim.type == PimTransType::DATAFLOW) { // loading dataflow configuration
+        if (!tenants_.empty()) {
+            // only the tenant's cuts take it, once its last kernel is done
+            if (pim.vcuts != vcuts || pim.hcuts != hcuts) {
+                std::cerr << "Tenant kernels must keep the array partition"
+                          << std::endl;
+                AbruptExit(__FILE__, __LINE__);
+            }
+            uint64_t cut_mask = tenants_[pim.tenant].cut_mask;
+            for (int i = 0; i < Cuts(); i++) {
+                if ((cut_mask >> i & 1) && cut_.in_pim[i]) return false;
+            }
+            for (int i = 0; i < Cuts(); i++) {
+                if (!(cut_mask >> i & 1)) continue;
+                ResetCut(i);
+                cut_.mcf[i] = pim.mcf;
+                cut_.mc[i] = pim.mcf * pim.ucf;
+                cut_.df[i] = pim.df;
+                cut_.M_tile_size[i] = pim.M_tile_size;
+                cut_.kernel_size[i] = pim.kernel_size;
+                cut_.stride[i] = pim.stride;
+            }
+            return true;
+        }
+        // the next kernel waits for the running one, or is staged while it
+        // drains
+        if (Running()) return config_.pipeline_layers && StageNextKernel(pim);
+        ConfigureDataflow(pim);
+        return true;
+    }
+    else { // loading workload configuration
+        int cut_no = pim.cut_no;
+        // the next kernel of a tenant waits for the cut to finish
+        if (!tenants_.empty() && cut_.in_pim[cut_no]) return false;
+        if (next_kernel_.status != 0) return StageNextKernel(pim);
+        ResetTileCosts();
+        SetWorkload(cut_, pim);
+        // a running cut continues with the new workload
+        if (cut_.in_pim[cut_no]) CompileCutProgram(cut_no);
+        return true;
+    }
+}
+
+void JedecDRAMSystem::ResetCut(int cut) {
+    cut_.base_rows_in[cut] = 0;
+    cut_.base_rows_w[cut] = 0;
+    cut_.base_rows_out[cut] = 0;
+    cut_.M[cut] = 0;
+    cut_.N[cut] = 0;
+    cut_.K[cut] = 0;
+    cut_.M_cap[cut] = 0;
+    cut_.K_cap[cut] = 0;
+    cut_.append_from[cut] = 0;
+    cut_.append_to[cut] = 0;
+    cut_.M_it[cut] = 0;
+    cut_.N_it[cut] = 0;
+    cut_.K_tile_it[cut] = 0;
+    cut_.M_out_it[cut] = 0;
+    cut_.N_out_tile_it[cut] = 0;
+    cut_.in_pim[cut] = false;
+    cut_.iw_status[cut] = 0;
+    cut_.in_act_placed[cut] = false;
+    cut_.w_act_placed[cut] = false;
+    cut_.out_act_placed[cut] = false;
+    cut_.append_it[cut] = 0;
+    cut_.append_act_placed[cut] = false;
+    cut_.output_valid[cut] = 0;
+    cut_.in_cnt[cut] = 0;
+    cut_.out_cnt[cut] = -1;
+    cut_.vpu_cnt[cut] = 0;
+    cut_.pf_status[cut] = 0;
+    cut_.pf_N_it[cut] = 0;
+    cut_.pf_K_tile_it[cut] = 0;
+    cut_.pf_act_placed[cut] = false;
+    cut_.ref_hold[cut] = false;
+}
+
+void JedecDRAMSystem::ConfigureDataflow(const PimTransaction &pim) {
+    ResetTileCosts();
+
+    vcuts = pim.vcuts;
+    hcuts = pim.hcuts;
+    mcf = pim.mcf;
+    ucf = pim.ucf;
+    df = pim.df;
+
+
+    mc = mcf * ucf;
+    if (vcuts * hcuts > 1) // TODO
+        for (int i=0; i<ctrls_.size(); i++) {
+            ctrls_[i]->wr_multitenant = true;
+        }
+
+    M_tile_size = pim.M_tile_size;
+    vcuts_next = pim.vcuts_next;
+    hcuts_next = pim.hcuts_next;
+    kernel_size = pim.kernel_size;
+    stride = pim.stride;
+
+    cut_ = DataflowCutState(pim);
+    cut_programs_.assign(vcuts * hcuts, CutProgram());
+}
+
+JedecDRAMSystem::CutState JedecDRAMSystem::DataflowCutState(
+    const PimTransaction &pim) const {
+    if (pim.vcuts * pim.hcuts > kMaxCuts) {
+        std::cerr << "At most " << kMaxCuts << " cuts are supported"
+                  << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    CutState state = CutState();
+    state.out_cnt.fill(-1);
+    state.mcf.fill(pim.mcf);
+    state.mc.fill(pim.mcf * pim.ucf);
+    state.df.fill(pim.df);
+    state.M_tile_size.fill(pim.M_tile_size);
+    state.kernel_size.fill(pim.kernel_size);
+    state.stride.fill(pim.stride);
+    return state;
+}
+
+void JedecDRAMSystem::SetWorkload(CutState &state, const PimTransaction &pim) {
+    int cut_no = pim.cut_no;
+    int dim_value = pim.dim_value;
+    uint64_t base_row = pim.base_row;
+    switch(pim.load_type) {
+        case 0: // M, weight
+            state.base_rows_w[cut_no] = base_row;
+            state.M[cut_no] = dim_value;
+            break;
+        case 1: // K, output
+            state.base_rows_out[cut_no] = base_row;
+            state.K[cut_no] = dim_value;
+            break;
+        case 2: // N, input
+            state.base_rows_in[cut_no] = base_row;
+            state.N[cut_no] = dim_value;
+            state.M_cap[cut_no] = pim.M_cap;
+            state.K_cap[cut_no] = pim.K_cap;
+            state.append_from[cut_no] = pim.append_from;
+            state.append_to[cut_no] = pim.append_to;
+            break;
+        default:
+            std::cerr << "Invalid load type!"
+                      << std::endl;
+            AbruptExit(__FILE__, __LINE__);
+            break;
+    }
+}
+
+uint64_t JedecDRAMSystem::VpuCycles(const PimTransaction &pim) const {
+    return VpuOpCycles(config_, pim.vpu_op, pim.vpu_elements,
+                       pim.vpu_vectors);
+}
+
+bool JedecDRAMSystem::Running() const {
+    for (int i = 0; i < Cuts(); i++) {
+        if (cut_.in_pim[i]) return true;
+    }
+    return false;
+}
+
+bool JedecDRAMSystem::Draining() const {
+    bool running = false;
+    for (int i = 0; i < Cuts(); i++) {
+        if (!cut_.in_pim[i]) continue;
+        if (cut_.in_cnt[i] != -1) return false;
+        running = true;
+    }
+    return running;
+}
+
+bool JedecDRAMSystem::StageNextKernel(const PimTransaction &pim) {
+    NextKernel &next = next_kernel_;
+    if (pim.type == PimTransType::DATAFLOW) {
+        // one kernel ahead, with the announced partition
+        if (next.status != 0 || !Draining() || pim.vcuts != vcuts_next ||
+            pim.hcuts != hcuts_next)
+            return false;
+        next.dataflow = pim;
+        next.cut = DataflowCutState(pim);
+        next.programs.assign(pim.vcuts * pim.hcuts, CutProgram());
+        next.status = 1;
+        kernels_staged_++;
+        IncrementArrayStat("pipeline_kernels_staged", 1);
+        return true;
+    }
+    // a launched kernel keeps its workload until it takes over the array
+    if (next.status == 2) return false;
+    if (pim.type == PimTransType::WORKLOAD) {
+        SetWorkload(next.cut, pim);
+        return true;
+    }
+    int cuts = next.programs.size();
+    for (int i = 0; i < cuts; i++) {
+        if ((pim.cut_mask & (1 << i)) &&
+            (next.cut.M[i] == 0 || next.cut.N[i] == 0 || next.cut.K[i] == 0))
+            return false;
+    }
+    next.w_out_shared = false;
+    for (int i = 0; i < cuts; i++) {
+        if (!(pim.cut_mask & (1 << i))) continue;
+        next.cut.in_pim[i] = true;
+        CompileNextKernelProgram(i);
+        for (int j = 0; j < Cuts(); j++) {
+            if (cut_.in_pim[j] && SharesBank(next.programs[i].w_lanes,
+                                             cut_programs_[j].out_lanes))
+                next.w_out_shared = true;
+        }
+    }
+    next.status = 2;
+    return true;
+}
+
+void JedecDRAMSystem::CompileNextKernelProgram(int cut) {
+    NextKernel &next = next_kernel_;
+    CutProgram &prog = next.programs[cut];
+    CompileCutProgram(next.cut, next.dataflow.vcuts, next.dataflow.hcuts, cut,
+                      prog);
+    // until it takes over, refresh only has to spare its weight banks
+    std::fill(prog.bank_masks.begin(), prog.bank_masks.end(), 0);
+    for (const Lane &lane : prog.w_lanes) {
+        prog.bank_masks[lane.addr.channel] |=
+            uint64_t(1) << (lane.addr.bankgroup * config_.banks_per_group +
+                            lane.addr.bank);
+    }
+}
+
+void JedecDRAMSystem::LoadNextKernelWeights(bool wait_refresh) {
+    NextKernel &next = next_kernel_;
+    // weight banks that outputs are written to are left to the running
+    // kernel, they are loaded once it is done
+    if (next.w_out_shared) return;
+    for (size_t i = 0; i < next.programs.size(); i++) {
+        CutProgram &prog = next.programs[i];
+        // tokens are appended to its KV cache first
+        if (!next.cut.in_pim[i] || next.cut.iw_status[i] != 0 ||
+            next.cut.ref_hold[i] || prog.append_steps > 0)
+            continue;
+        std::vector<Command> &w_cmds = prog.w_batch;
+        w_cmds.clear();
+        if (LoadWeights(prog, next.cut.base_rows_w[i], next.cut.N_it[i],
+                        next.cut.K_tile_it[i], next.cut.w_act_placed[i],
+                        wait_refresh, w_cmds))
+            next.cut.iw_status[i] = 1;
+        if (!w_cmds.empty()) sched_active_ = true;
+        for (auto &it : w_cmds) {
+            ctrls_[it.Channel()]->rd_w_cmds_.push_back(it);
+        }
+    }
+}
+
+void JedecDRAMSystem::StartNextKernel() {
+    NextKernel &next = next_kernel_;
+    ConfigureDataflow(next.dataflow);
+    std::swap(cut_, next.cut);
+    std::swap(cut_programs_, next.programs);
+    kernel_callbacks_.insert(kernel_callbacks_.end(), next.callbacks.begin(),
+                             next.callbacks.end());
+    next.callbacks.clear();
+    sched_active_ = true;
+    bool launched = next.status == 2;
+    next.status = 0;
+    if (!launched) return;
+    kernel_refresh_stalls_ = refresh_stall_cycles;
+    for (int i = 0; i < Cuts(); i++) {
+        if (!cut_.in_pim[i]) continue;
+        // with the banks of all its lanes
+        CompileCutProgram(i);
+        if (cut_.iw_status[i] == 1) {
+            staged_tiles_loaded_++;
+            IncrementCutStat(uint64_t(1) << i, "pipeline_tiles_loaded", 1);
+        } else if (cut_.N_it[i] != 0 || cut_.w_act_placed[i]) {
+            staged_tiles_part_loaded_++;
+            IncrementCutStat(uint64_t(1) << i, "pipeline_tiles_part_loaded", 1);
+        }
+    }
+}
+
+JedecDRAMSystem::Lane JedecDRAMSystem::MakeLane(int ch, int bg, int bk) const {
+    Lane lane;
+    lane.addr = Address(ch, 0, bg, bk, -1, -1);
+    // same bits as Config::AddressUnmapping()
+    lane.bits = (bk << config_.ba_pos) | (bg << config_.bg_pos) |
+                (0 << config_.ra_pos) | (ch << config_.ch_pos);
+    return lane;
+}
+
+Command JedecDRAMSystem::LaneCommand(CommandType type, const Lane &lane,
+                                     int row, int column) const {
+    Address addr = lane.addr;
+    addr.row = row;
+    addr.column = column;
+    int bits = (column << config_.co_pos) | (row << config_.ro_pos) | lane.bits;
+    uint64_t hex_addr = bits;
+    return Command(type, addr, hex_addr << config_.shift_bits);
+}
+
+bool JedecDRAMSystem::SharesBank(const std::vector<Lane> &a,
+                                 const std::vector<Lane> &b) {
+    for (const Lane &x : a) {
+        for (const Lane &y : b) {
+            if (x.addr.channel == y.addr.channel &&
+                x.addr.bankgroup == y.addr.bankgroup &&
+                x.addr.bank == y.addr.bank)
+                return true;
+        }
+    }
+    return false;
+}
+
+void JedecDRAMSystem::CompileCutProgram(const CutState &state, int part_vcuts,
+                                        int part_hcuts, int cut,
+                                        CutProgram &prog) const {
+    prog.mcf = state.mcf[cut];
+    prog.mc = state.mc[cut];
+    prog.df = state.df[cut];
+    prog.M_tile_size = state.M_tile_size[cut];
+    int vcut_no = cut % part_vcuts;
+    int hcut_no = cut / part_vcuts;
+    int cut_height = config_.channels / part_hcuts;
+    int cut_width = config_.banks / part_vcuts;
+    prog.vcut_no = vcut_no;
+    prog.cut_height = cut_height;
+    prog.N_tile_size = 128 / part_vcuts;  // 128 : the number of PEs in a row
+    // 16: the number of PEs supported by a bank's io
+    prog.K_tile_size = std::min(cut_height * 16, state.K[cut]);
+    prog.K_tiles = (state.K[cut] - 1) / prog.K_tile_size + 1;
+
+    // a KV cache is laid out for its capacity, see PimKernelDesc::Cut
+    int M_cap = state.M_cap[cut];
+    int K_cap = state.K_cap[cut];
+    prog.in_strided = M_cap != 0 || K_cap != 0;
+    if (prog.in_strided &&
+        (prog.df != 1 || state.kernel_size[cut] > 0 || (M_cap != 0 && K_cap != 0) ||
+         (M_cap != 0 && M_cap < state.M[cut]) || (K_cap != 0 && K_cap < state.K[cut]))) {
+        std::cerr << "Cut " << cut << ": a KV cache is the input of a GEMV, "
+                  << "with a capacity of at least its M or K" << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    prog.in_M = M_cap != 0 ? M_cap : state.M[cut];
+    int in_K = K_cap != 0 ? K_cap : state.K[cut];
+    prog.in_K_tile_size = std::min(cut_height * 16, in_K);
+    prog.in_K_tiles = (in_K - 1) / prog.in_K_tile_size + 1;
+    // a key is a step of M, a value a position of K (of ucf tokens each)
+    int tokens = state.append_to[cut] - state.append_from[cut];
+    int length = M_cap != 0 ? state.M[cut] * prog.mcf
+                            : state.K[cut] * (prog.mc / prog.mcf);
+    if (tokens != 0 && (!prog.in_strided || tokens < 0 ||
+                        state.append_from[cut] < 0 ||
+                        state.append_to[cut] > length)) {
+        std::cerr << "Cut " << cut << ": tokens are appended to a KV cache, "
+                  << "within its length" << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    prog.append_steps = tokens * (M_cap != 0 ? prog.K_tiles : state.M[cut]);
+
+    // Weights are read from every weight_stride-th bank, which spreads them
+    // over the bank groups first. A load reads the same column of each at
+    // once, so the more banks the fewer columns it reads.
+    int weight_stride = config_.WeightBankStride(prog.df);
+    int weight_banks = cut_width / weight_stride;
+    if (weight_banks == 0) {
+        std::cerr << "Cuts of " << cut_width << " banks are too narrow to "
+                  << "load weights" << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    prog.N_tile_size_per_bank =
+        std::min(state.N[cut], (prog.N_tile_size - 1) / weight_banks + 1);
+    prog.w_close_period =
+        std::min(state.N[cut], 128 / config_.banks * weight_stride);
+    prog.w_lanes.clear();
+    for (int j = 0; j < cut_height; j++) {
+        for (int k = 0; k < weight_banks; k++) {
+            int bk = vcut_no * cut_width + k * weight_stride;
+            prog.w_lanes.push_back(MakeLane(hcut_no * cut_height + j,
+                                            bk / config_.banks_per_group,
+                                            bk % config_.banks_per_group));
+        }
+    }
+
+    prog.in_lanes.clear();
+    for (int j = 0; j < cut_height; j++) {
+        for (int k = 0; k < prog.mc; k++) {
+            int bk = vcut_no * cut_width + k * (cut_width / prog.mc);
+            if (prog.df == 0) bk++;
+            prog.in_lanes.push_back(MakeLane(hcut_no * cut_height + j,
+                                             bk / config_.banks_per_group,
+                                             bk % config_.banks_per_group));
+        }
+    }
+
+    prog.kernel_size = state.kernel_size[cut];
+    prog.stride = state.stride[cut];
+    prog.in_tile_reads.clear();
+    prog.in_tile_offsets.clear();
+    if (prog.kernel_size > 0) CompileConvInput(state, cut, prog);
+
+    // A GEMV (df 1) writes 128 outputs per vector. A batched one holds the
+    // ucf columns of up to a tile of input vectors, and writes the outputs
+    // of each one.
+    int batch_per_tile = 1;
+    if (prog.df == 1)
+        batch_per_tile = std::max(1, std::min(state.N[cut], prog.N_tile_size) / (prog.mc / prog.mcf));
+    prog.M_tile_size_out = prog.df == 1 ? (prog.M_tile_size / 128) * prog.mcf * batch_per_tile : prog.M_tile_size;
+    prog.M_out = prog.df == 1 ? std::max(1, state.M[cut] * prog.mcf * batch_per_tile / 128) : state.M[cut];
+    prog.N_tile_size_out = prog.df == 1 ? 128 : prog.N_tile_size;
+    // one output tile per tile of the batch
+    prog.N_tile_num = (state.N[cut] - 1) / prog.N_tile_size + 1;
+    prog.N_out = prog.df == 1 ? 128 * prog.N_tile_num : state.N[cut];
+    prog.cut_height_out = cut_height < part_vcuts ? 1 : cut_height / part_vcuts;
+    prog.k_bound = prog.df == 1 ? 1 : prog.mc;
+    // the output channels depend on the output cut number
+    prog.out_lanes.clear();
+    for (int o = 0; o < part_vcuts; o++) {
+        for (int j = 0; j < prog.cut_height_out; j++) {
+            int ch = hcut_no * cut_height + o * prog.cut_height_out + j;
+            for (int k = 0; k < prog.k_bound; k++) {
+                int bk = vcut_no * cut_width + k * (cut_width / prog.mc);
+                if (prog.df != 1) bk++;
+                int bg = bk / config_.banks_per_group;
+                bk = bk % config_.banks_per_group;
+                if (prog.df == 0) bk += 2;
+                prog.out_lanes.push_back(MakeLane(ch, bg, bk));
+            }
+        }
+    }
+
+    prog.bank_masks.assign(config_.channels, 0);
+    for (const auto *lanes : {&prog.w_lanes, &prog.in_lanes, &prog.out_lanes}) {
+        for (const Lane &lane : *lanes) {
+            prog.bank_masks[lane.addr.channel] |=
+                uint64_t(1) << (lane.addr.bankgroup * config_.banks_per_group +
+                                lane.addr.bank);
+        }
+    }
+    prog.w_in_shared = SharesBank(prog.w_lanes, prog.in_lanes);
+    prog.w_out_shared = SharesBank(prog.w_lanes, prog.out_lanes);
+
+    prog.w_batch.reserve(prog.w_lanes.size());
+    prog.in_batch.reserve(prog.in_lanes.size());
+    prog.out_batch.reserve(prog.cut_height_out * prog.k_bound);
+    // appending to a KV cache writes (or precharges) up to every input lane
+    if (prog.append_steps > 0) {
+        prog.w_batch.reserve(prog.in_lanes.size());
+        prog.out_batch.reserve(prog.in_lanes.size());
+    }
+}
+
+void JedecDRAMSystem::CompileConvInput(const CutState &state, int cut,
+                                       CutProgram &prog) const {
+    int64_t M = state.M[cut];
+    int64_t k = prog.kernel_size;
+    int64_t s = prog.stride;
+    if (prog.df != 0 || s < 1 || state.K[cut] % (k * k) != 0) {
+        std::cerr << "Convolution cut " << cut << ": needs df 0, a stride "
+                  << "and K = kernel_size^2 input channels" << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    // each step of M streams two output pixels (GEMM interleaving) of a
+    // square output
+    int64_t pixels = 2 * M;
+    int64_t width = std::ceil(std::sqrt(static_cast<double>(pixels)));
+    int64_t in_width = (width - 1) * s + k;
+    int offset = 0;
+    for (int64_t m = 0; m < M; m += prog.M_tile_size) {
+        int64_t steps = std::min<int64_t>(prog.M_tile_size, M - m);
+        int64_t first = 2 * m;
+        int64_t last = std::min(2 * (m + steps), pixels) - 1;
+        int64_t rows = last / width - first / width + 1;
+        // the input rows the tile's windows cover, and their pixels
+        int64_t in_rows = std::min((rows - 1) * s + k, rows * k);
+        int64_t in_pixels =
+            in_rows * (rows == 1 ? (last - first) * s + k : in_width);
+        // a read of each K tile carries two im2col rows of k^2 pixels
+        int64_t reads = (in_pixels - 1) / (2 * k * k) + 1;
+        reads = std::min(reads, steps);
+        prog.in_tile_reads.push_back(reads);
+        prog.in_tile_offsets.push_back(offset);
+        offset += reads * prog.K_tiles;
+    }
+}
+
+int JedecDRAMSystem::InputColumn(const CutProgram &prog, int M_it,
+                                 int K_tile_it) const {
+    int M_tile_it = M_it / prog.M_tile_size;
+    // K tiles are as far apart as the M tile of the layout is long
+    int in_tile_size = prog.in_M < prog.M_tile_size * (M_tile_it + 1)
+                           ? prog.in_M % prog.M_tile_size
+                           : prog.M_tile_size;
+    return M_tile_it * (prog.M_tile_size * prog.in_K_tiles) +
+           K_tile_it * in_tile_size + M_it % prog.M_tile_size;
+}
+
+JedecDRAMSystem::KvStep JedecDRAMSystem::KvAppendStep(const CutProgram &prog,
+                                                      int cut, int it) const {
+    int ucf = prog.mc / prog.mcf;
+    bool keys = cut_.M_cap[cut] != 0;
+    int token_steps = keys ? prog.K_tiles : cut_.M[cut];
+    int token = cut_.append_from[cut] + it / token_steps;
+    KvStep step;
+    if (keys) {
+        // a key is read at a step of M by the banks of its multi-column,
+        // one write per K tile to all channels
+        step.col_offset = InputColumn(prog, token / prog.mcf, it % token_steps);
+        step.j_begin = 0;
+        step.j_end = prog.cut_height;
+        step.k_div = ucf;
+        step.k_mod = prog.mcf;
+        step.k_sel = token % prog.mcf;
+    } else {
+        // a value is a position of K, in one channel and the banks of its
+        // unroll slot, and is read at every step of M. A write carries the
+        // burst of 16 positions it is part of.
+        int pos = token / ucf;
+        step.col_offset = InputColumn(prog, it % token_steps,
+                                      pos / prog.in_K_tile_size);
+        step.j_begin = pos % prog.in_K_tile_size / 16;
+        step.j_end = step.j_begin + 1;
+        step.k_div = 1;
+        step.k_mod = ucf;
+        step.k_sel = token % ucf;
+    }
+    return step;
+}
+
+bool JedecDRAMSystem::AppendKvCache(const CutProgram &prog, int cut,
+                                    bool wait_refresh,
+                                    std::vector<Command> &pre_cmds,
+                                    std::vector<Command> &cmds) {
+    const int cols = config_.columns / config_.BL;
+    int it = cut_.append_it[cut];
+    KvStep step = KvAppendStep(prog, cut, it);
+    int row = cut_.base_rows_in[cut] + step.col_offset / cols;
+    int column = step.col_offset % cols;
+    // write-precharge unless the next step writes the same row of the same banks
+    bool close = it + 1 == prog.append_steps || column == cols - 1;
+    if (!close) {
+        KvStep next = KvAppendStep(prog, cut, it + 1);
+        close = next.col_offset / cols != step.col_offset / cols ||
+                next.j_begin != step.j_begin || next.k_sel != step.k_sel;
+    }
+    CommandType cmd_type = close ? CommandType::PIM_WRITE_PRECHARGE : CommandType::PIM_WRITE;
+    for (int j = step.j_begin; j < step.j_end; j++) {
+        for (int k = 0; k < prog.mc; k++) {
+            if (k / step.k_div % step.k_mod != step.k_sel) continue;
+            const Lane &lane = prog.in_lanes[j * prog.mc + k];
+            Command cmd = LaneCommand(cmd_type, lane, row, column);
+            Command ready_cmd = ctrls_[lane.addr.channel]->GetReadyCommand(cmd, clk_);
+            // all lanes issue the same command or none does
+            if (!ready_cmd.IsValid() ||
+                (!cmds.empty() && cmds.begin()->cmd_type != ready_cmd.cmd_type)) {
+                cmds.clear();
+                return false;
+            }
+            cmds.push_back(ready_cmd);
+        }
+    }
+
+    CommandType type = cmds.begin()->cmd_type;
+    if (type == CommandType::PRECHARGE) {
+        // once the PIM queues are done with the open row
+        for (const auto &cmd : cmds) {
+            const Controller &ctrl = *ctrls_[cmd.Channel()];
+            if (!ctrl.rd_w_cmds_.empty() || !ctrl.rd_in_cmds_.empty() ||
+                !ctrl.wr_cmds_.empty()) {
+                cmds.clear();
+                return false;
+            }
+        }
+        pre_cmds.insert(pre_cmds.end(), cmds.begin(), cmds.end());
+        cmds.clear();
+        return false;
+    }
+    // Check if the activation command was already sent.
+    if (type == CommandType::PIM_ACTIVATE) {
+        if (cut_.append_act_placed[cut] || wait_refresh)
+            cmds.clear();
+        else
+            cut_.append_act_placed[cut] = true;
+        return false;
+    }
+    if (type == CommandType::PIM_WRITE_PRECHARGE) {
+        cut_.append_act_placed[cut] = false;
+    }
+    kv_append_writes_++;
+    IncrementCutStat(uint64_t(1) << cut, "kv_append_writes", 1);
+    cut_.append_it[cut]++;
+    return cut_.append_it[cut] == prog.append_steps;
+}
+
+bool JedecDRAMSystem::LoadWeights(const CutProgram &prog, uint64_t base_row_w,
+                                  int &N_it, int K_tile_it, bool &act_placed,
+                                  bool wait_refresh,
+                                  std::vector<Command> &cmds) {
+    const int cols = config_.columns / config_.BL;
+    CommandType act_type = CommandType::PIM_ACTIVATE;
+    CommandType read_type = CommandType::GH_READ;
+    CommandType readp_type = CommandType::GH_READ_PRECHARGE;
+
+    int N_tile_size = prog.N_tile_size;
+    int N_tile_it = N_it / N_tile_size;
+    int N_tile_size_per_bank = prog.N_tile_size_per_bank;
+    int col_offset = N_tile_it * (N_tile_size_per_bank * prog.K_tiles) + K_tile_it * N_tile_size_per_bank + N_it % N_tile_size; // N_it incremented by N_tile_size when N_it % N_tile_size_per_bank == 0 (but not with N_tile_size)
+    // building memory address by combining base physical address and BLAS configuration
+    int row = base_row_w + col_offset / cols;
+    int column = col_offset % cols;
+    // generate read-precharge command if this is the last access to read the tile.
+    bool exit = ((N_it+1) % N_tile_size_per_bank == 0 && (N_tile_size == N_tile_size_per_bank || (N_it+1) % N_tile_size != 0));
+    CommandType cmd_type = (column + 1) % prog.w_close_period == 0 || (column + 1) % cols == 0 || exit ? readp_type : read_type;
+    // Scheduler generates the commands for a data vector, divided into multiple channels and sends them to command queues in the corresponding channel controllers.
+    for (const Lane &lane : prog.w_lanes) {
+        Command cmd = LaneCommand(cmd_type, lane, row, column);
+        Command ready_cmd = ctrls_[lane.addr.channel]->GetReadyCommand(cmd, clk_);
+        // If a command cannot be executed in some channels due to timing constraints, flush the commands going to other channels and try again later.
+        // This is to prevent the commands from being sent multiple times.
+        if (!ready_cmd.IsValid()) {
+            cmds.clear();
+            break;
+        }
+        else {
+            cmds.push_back(ready_cmd);
+            if (cmds.begin()->cmd_type != ready_cmd.cmd_type) {
+                cmds.clear();
+                break;
+            }
+        }
+    }
+
+    if (cmds.empty()) return false;
+    // Check if the activation command was already sent.
+    if (cmds.begin()->cmd_type == act_type) {
+        if (act_placed || wait_refresh)
+            cmds.clear();
+        else
+            act_placed = true;
+        return false;
+    }
+    if (cmds.begin()->cmd_type == readp_type) {
+        act_placed = false;
+    }
+    if (prog.df == 1 && cmds.begin()->cmd_type == CommandType::PRECHARGE) {
+        return false;
+    }
+
+    // increment iterators
+    N_it++;
+    if (N_it % N_tile_size_per_bank == 0 && (N_tile_size == N_tile_size_per_bank || N_it % N_tile_size != 0)) {
+        N_it = N_tile_size * N_tile_it;
+        return true;
+    }
+    return false;
+}
+
+bool JedecDRAMSystem::NextWeightTile(int cut, int &N_it, int &K_tile_it) const {
+    // a draining cut has already advanced its iterators
+    if (cut_.iw_status[cut] == 3) {
+        if (cut_.in_cnt[cut] == -1) return false;
+        N_it = cut_.N_it[cut];
+        K_tile_it = cut_.K_tile_it[cut];
+        return true;
+    }
+    // as the end of streaming advances them
+    const CutProgram &prog = cut_programs_[cut];
+    N_it = cut_.N_it[cut];
+    K_tile_it = cut_.K_tile_it[cut] + 1;
+    if (K_tile_it * prog.K_tile_size < cut_.K[cut]) return true;
+    K_tile_it = 0;
+    N_it = prog.N_tile_size * (N_it / prog.N_tile_size + 1);
+    if (N_it < cut_.N[cut]) return true;
+    N_it = 0;
+    int M_tile_it = cut_.M_it[cut] / prog.M_tile_size;
+    return prog.M_tile_size * (M_tile_it + 1) < cut_.M[cut];
+}
+
+bool JedecDRAMSystem::OwesRefresh(int cut) const {
+    const CutProgram &prog = cut_programs_[cut];
+    for (size_t c = 0; c < ctrls_.size(); c++) {
+        if (prog.bank_masks[c] & ctrls_[c]->OwedRefreshBanks()) return true;
+    }
+    return false;
+}
+
+void JedecDRAMSystem::HoldForRefresh(CutState &state, const CutProgram &prog,
+                                     int cut) {
+    // A refresh closes the row of its bank. So that the lanes of each BLAS
+    // function agree again afterwards, every bank the cut left open is
+    // refreshed as well (ahead of time if it is not due) and the cut places
+    // all its activations again.
+    for (size_t c = 0; c < ctrls_.size(); c++) {
+        uint64_t banks = prog.bank_masks[c] &
+                         (ctrls_[c]->OwedRefreshBanks() | ctrls_[c]->OpenBanks()) &
+                         ~ctrls_[c]->RefreshWaitingBanks();
+        for (int b = 0; banks != 0; b++, banks >>= 1) {
+            if (banks & 1) ctrls_[c]->RefreshBank(b);
+        }
+    }
+    state.ref_hold[cut] = true;
+    state.in_act_placed[cut] = false;
+    state.w_act_placed[cut] = false;
+    state.out_act_placed[cut] = false;
+    state.pf_act_placed[cut] = false;
+    state.append_act_placed[cut] = false;
+    sched_active_ = true;
+}
+
+void JedecDRAMSystem::UpdateRefreshHolds(
+    CutState &state, const std::vector<CutProgram> &programs) {
+    for (size_t i = 0; i < programs.size(); i++) {
+        if (!state.in_pim[i]) continue;
+        const CutProgram &prog = programs[i];
+        bool waiting = false;
+        for (size_t c = 0; c < ctrls_.size(); c++) {
+            if (prog.bank_masks[c] & ctrls_[c]->RefreshWaitingBanks())
+                waiting = true;
+        }
+        if (state.ref_hold[i] && !waiting) {
+            state.ref_hold[i] = false;
+            sched_active_ = true;
+        } else if (!state.ref_hold[i] && waiting) {
+            // the postponement budget ran out in the middle of a tile
+            HoldForRefresh(state, prog, i);
+        }
+    }
+}
+
+void JedecDRAMSystem::SetPimBanks() {
+    for (size_t c = 0; c < ctrls_.size(); c++) {
+        uint64_t busy = 0;
+        uint64_t held = 0;
+        for (int i = 0; i < Cuts(); i++) {
+            if (!cut_.in_pim[i]) continue;
+            if (cut_.ref_hold[i])
+                held |= cut_programs_[i].bank_masks[c];
+            else
+                busy |= cut_programs_[i].bank_masks[c];
+        }
+        // and the weight banks the next kernel loads
+        for (size_t i = 0; i < next_kernel_.programs.size(); i++) {
+            if (next_kernel_.status != 2 || next_kernel_.w_out_shared ||
+                !next_kernel_.cut.in_pim[i])
+                continue;
+            if (next_kernel_.cut.ref_hold[i])
+                held |= next_kernel_.programs[i].bank_masks[c];
+            else
+                busy |= next_kernel_.programs[i].bank_masks[c];
+        }
+        ctrls_[c]->SetPimBanks(busy, held);
+    }
+}
+
+bool JedecDRAMSystem::RefreshStalled() const {
+    bool running = false;
+    for (int i = 0; i < Cuts(); i++) {
+        if (!cut_.in_pim[i]) continue;
+        if (cut_.ref_hold[i]) return true;
+        running = true;
+    }
+    if (!running || config_.refresh_aware) return false;
+    // every cut waits for a refresh, and places no activation shortly before
+    if (IsInRef()) return true;
+    for (size_t i = 0; i < ctrls_.size(); i++) {
+        if (ctrls_[i]->pim_refresh_coming()) return true;
+    }
+    return false;
+}
+
+bool JedecDRAMSystem::PimActive() const {
+    if (!pim_trans_queue_.empty() || !pim_kernel_queue_.empty()) return true;
+    for (const auto &tenant : tenants_) {
+        if (!tenant.queue.empty() || !tenant.kernels.empty()) return true;
+    }
+    for (int i = 0; i < Cuts(); i++) {
+        if (cut_.in_pim[i] || cut_.in_act_placed[i] || cut_.w_act_placed[i] ||
+            cut_.out_act_placed[i])
+            return true;
+    }
+    return false;
+}
+
+void JedecDRAMSystem::CountRefreshStalls(uint64_t cycles) {
+    if (!RefreshStalled()) return;
+    refresh_stall_cycles += cycles;
+    // the held cuts, or all of them while they wait for an all-bank refresh
+    uint64_t cut_mask = 0;
+    for (int i = 0; i < Cuts(); i++) {
+        if (cut_.in_pim[i] && (cut_.ref_hold[i] || !config_.refresh_aware))
+            cut_mask |= uint64_t(1) << i;
+    }
+    IncrementCutStat(cut_mask, "pim_refresh_stall_cycles", cycles);
+}
+
+uint64_t JedecDRAMSystem::RunAheadWindow() const {
+    // cycles per barrier, enough to make the barrier cost negligible
+    const uint64_t max_window = 1024;
+    if (!channel_threads_ || PimActive() || quiet_until_ <= clk_) return 0;
+    // epoch stats are read between windows
+    uint64_t window = std::min(quiet_until_ - clk_,
+                               config_.epoch_period -
+                                   clk_ % config_.epoch_period);
+    return std::min(window, max_window);
+}
+
+void JedecDRAMSystem::RunControllers(uint64_t cycles) {
+    uint64_t begin = clk_;
+    channel_threads_->Run([this, begin, cycles](int i) {
+        auto &returns = window_returns_[i];
+        returns.clear();
+        window_returns_pos_[i] = 0;
+        uint64_t end = begin + cycles;
+        for (uint64_t clk = begin; clk < end; clk++) {
+            while (true) {
+                auto pair = ctrls_[i]->ReturnDoneTrans(clk);
+                if (pair.second == -1) break;
+                returns.push_back({clk, pair.first, pair.second});
+            }
+            ctrls_[i]->ClockTick();
+            // each channel skips its own idle cycles
+            uint64_t next = std::min(ctrls_[i]->NextEventCycle(), end);
+            if (next > clk + 1) {
+                ctrls_[i]->SkipCycles(next - clk - 1);
+                clk = next - 1;
+            }
+        }
+    });
+    window_end_ = begin + cycles;
+}
+
+bool JedecDRAMSystem::IsInRef() const {
+    // refresh-aware mode holds single cuts instead
+    if (config_.refresh_aware) return false;
+    for (size_t i = 0; i < ctrls_.size(); i++) {
+        if (ctrls_[i]->IsInRef() || ctrls_[i]->pim_refresh_coming2())
+            return true;
+    }
+    return false;
+}
+
+uint64_t JedecDRAMSystem::NextEventCycle() const {
+    if (clk_ < replay_until_) return replay_until_;
+    if (clk_ < window_end_) {
+        // only the buffered returns are left to deliver
+        uint64_t next = std::min(window_end_, clk_ + config_.epoch_period -
+                                                  1 - clk_ % config_.epoch_period);
+        for (size_t i = 0; i < ctrls_.size(); i++) {
+            if (window_returns_pos_[i] < window_returns_[i].size())
+                next = std::min(next,
+                                window_returns_[i][window_returns_pos_[i]].clk);
+        }
+        return next;
+    }
+    if (sched_active_ || tile_boundary_ ||
+        (!pim_trans_queue_.empty() && !pim_queue_waiting_) ||
+        (!pim_kernel_queue_.empty() && !pim_kernel_waiting_))
+        return clk_;
+    for (const auto &tenant : tenants_) {
+        if (!tenant.queue.empty() || !tenant.kernels.empty()) return clk_;
+    }
+
+    // epoch stats are printed at the end of the cycle before the boundary
+    uint64_t next = clk_ + config_.epoch_period - 1 -
+                    clk_ % config_.epoch_period;
+    for (size_t i = 0; i < ctrls_.size(); i++) {
+        next = std::min(next, ctrls_[i]->NextEventCycle());
+        if (next == clk_) return next;
+    }
+    if (vpu_busy_) next = std::min(next, vpu_end_);
+    if (IsInRef()) return next;
+
+    // the NPU countdowns only run while no refresh is in progress
+    int cuts = vcuts != -1 && hcuts != -1 ? vcuts * hcuts : 0;
+    for (int i = 0; i < cuts; i++) {
+        if (!cut_.in_pim[i] || cut_.ref_hold[i]) continue;
+        if (cut_.iw_status[i] == 1) return clk_;
+        // streaming waits for the VPU, its ACT is issued meanwhile
+        if (cut_.vpu_cnt[i] > 0) next = std::min<uint64_t>(next, clk_ + cut_.vpu_cnt[i] - 1);
+        if (cut_.out_cnt[i] >= 0) next = std::min(next, clk_ + cut_.out_cnt[i]);
+        if (cut_.iw_status[i] == 3 && cut_.in_cnt[i] > 0)
+            next = std::min(next, clk_ + cut_.in_cnt[i] - 1);
+    }
+    return next;
+}
+
+void JedecDRAMSystem::SkipCycles(uint64_t cycles) {
+    if (clk_ < replay_until_) {
+        for (size_t i = 0; i < ctrls_.size(); i++) {
+            ctrls_[i]->AdvanceClock(cycles);
+        }
+        clk_ += cycles;
+        if (clk_ == replay_until_) tile_boundary_ = true;
+        return;
+    }
+    if (clk_ < window_end_) {
+        // the controllers have already run these cycles
+        clk_ += cycles;
+        return;
+    }
+    CountRefreshStalls(cycles);
+    if (next_kernel_.status != 0) {
+        pipeline_staged_cycles += cycles;
+        IncrementArrayStat("pipeline_staged_cycles", cycles);
+    }
+    if (!IsInRef()) {
+        int cuts = vcuts != -1 && hcuts != -1 ? vcuts * hcuts : 0;
+        for (int i = 0; i < cuts; i++) {
+            if (!cut_.in_pim[i] || cut_.ref_hold[i]) continue;
+            if (cut_.out_cnt[i] != -1) cut_.out_cnt[i] -= cycles;
+            if (cut_.iw_status[i] == 3 && cut_.in_cnt[i] > 0) cut_.in_cnt[i] -= cycles;
+            if (cut_.iw_status[i] == 2 && cut_.vpu_cnt[i] > 0) cut_.vpu_cnt[i] -= cycles;
+        }
+    }
+    for (size_t i = 0; i < ctrls_.size(); i++) {
+        ctrls_[i]->SkipCycles(cycles);
+    }
+    clk_ += cycles;
+}
+
+void JedecDRAMSystem::PrintStats() {
+    // the final stats fold the last epoch into the totals without clearing
+    // it, so the counters are read first
+    auto tenant_stats = TenantStats();
+    BaseDRAMSystem::PrintStats();
+    if (config_.double_buffer && config_.output_level >= 0) {
+        std::cout << "Double buffering: " << weight_tiles_prefetched_
+                  << " weight tiles loaded ahead, "
+                  << weight_tiles_part_prefetched_ << " partly, "
+                  << weight_tiles_loaded_ << " not" << std::endl;
+    }
+    if (conv_rows_ > 0 && config_.output_level >= 0) {
+        std::cout << "Convolution: " << conv_rows_read_ << " of "
+                  << conv_rows_ << " input vectors read from DRAM, the "
+                  << "others generated from buffered input rows" << std::endl;
+    }
+    if (kv_tokens_appended_ > 0 && config_.output_level >= 0) {
+        std::cout << "KV cache: " << kv_tokens_appended_ << " tokens appended "
+                  << "in " << kv_append_writes_ << " write steps" << std::endl;
+    }
+    if (vpu_ops_ > 0 && config_.output_level >= 0) {
+        std::cout << "VPU: " << vpu_ops_ << " ops in " << vpu_cycles_
+                  << " cycles, kernels waited " << vpu_wait_cycles_
+                  << " cycles for them" << std::endl;
+    }
+    if (config_.pipeline_layers && config_.output_level >= 0) {
+        std::cout << "Pipelined layers: " << kernels_staged_
+                  << " kernels staged while the previous one drained (for "
+                  << pipeline_staged_cycles << " cycles), "
+                  << staged_tiles_loaded_ << " first weight tiles loaded "
+                  << "ahead, " << staged_tiles_part_loaded_ << " partly"
+                  << std::endl;
+    }
+    if (config_.output_level >= 0) {
+        for (const auto &tenant : tenant_stats) {
+            std::cout << "Tenant " << tenant.name << ": " << tenant.kernels
+                      << " kernels in " << tenant.busy_cycles
+                      << " cycles (last ended at " << tenant.end_cycle << "), "
+                      << tenant.pim_commands << " PIM commands, "
+                      << tenant.lost_slots << " lost command slots"
+                      << std::endl;
+        }
+    }
+    if (!config_.steady_state || config_.output_level < 0) return;
+    std::cout << "Steady state: " << tiles_simulated_ << " tiles simulated, "
+              << tiles_replayed_ << " tiles (" << replayed_cycles_
+              << " cycles) replayed" << std::endl;
+    if (tiles_validated_ > 0) {
+        std::cout << "Steady state validation: " << tiles_validated_
+                  << " tiles, cycle error avg "
+                  << 100 * cycle_error_sum_ / tiles_validated_ << "% max "
+                  << 100 * cycle_error_max_ << "%, energy error avg "
+                  << 100 * energy_error_sum_ / tiles_validated_ << "% max "
+                  << 100 * energy_error_max_ << "%" << std::endl;
+    }
+}
+
+void Put(CheckpointWriter &out, const JedecDRAMSystem::CutState &cut) {
+    Put(out, cut.mcf);
+    Put(out, cut.mc);
+    Put(out, cut.df);
+    Put(out, cut.M_tile_size);
+    Put(out, cut.kernel_size);
+    Put(out, cut.stride);
+    Put(out, cut.base_rows_in);
+    Put(out, cut.base_rows_w);
+    Put(out, cut.base_rows_out);
+    Put(out, cut.M);
+    Put(out, cut.N);
+    Put(out, cut.K);
+    Put(out, cut.M_cap);
+    Put(out, cut.K_cap);
+    Put(out, cut.append_from);
+    Put(out, cut.append_to);
+    Put(out, cut.M_it);
+    Put(out, cut.N_it);
+    Put(out, cut.K_tile_it);
+    Put(out, cut.M_out_it);
+    Put(out, cut.N_out_tile_it);
+    Put(out, cut.in_pim);
+    Put(out, cut.iw_status);
+    Put(out, cut.in_act_placed);
+    Put(out, cut.w_act_placed);
+    Put(out, cut.out_act_placed);
+    Put(out, cut.append_it);
+    Put(out, cut.append_act_placed);
+    Put(out, cut.output_valid);
+    Put(out, cut.in_cnt);
+    Put(out, cut.out_cnt);
+    Put(out, cut.vpu_cnt);
+    Put(out, cut.pf_status);
+    Put(out, cut.pf_N_it);
+    Put(out, cut.pf_K_tile_it);
+    Put(out, cut.pf_act_placed);
+    Put(out, cut.ref_hold);
+}
+
+void Get(CheckpointReader &in, JedecDRAMSystem::CutState &cut) {
+    Get(in, cut.mcf);
+    Get(in, cut.mc);
+    Get(in, cut.df);
+    Get(in, cut.M_tile_size);
+    Get(in, cut.kernel_size);
+    Get(in, cut.stride);
+    Get(in, cut.base_rows_in);
+    Get(in, cut.base_rows_w);
+    Get(in, cut.base_rows_out);
+    Get(in, cut.M);
+    Get(in, cut.N);
+    Get(in, cut.K);
+    Get(in, cut.M_cap);
+    Get(in, cut.K_cap);
+    Get(in, cut.append_from);
+    Get(in, cut.append_to);
+    Get(in, cut.M_it);
+    Get(in, cut.N_it);
+    Get(in, cut.K_tile_it);
+    Get(in, cut.M_out_it);
+    Get(in, cut.N_out_tile_it);
+    Get(in, cut.in_pim);
+    Get(in, cut.iw_status);
+    Get(in, cut.in_act_placed);
+    Get(in, cut.w_act_placed);
+    Get(in, cut.out_act_placed);
+    Get(in, cut.append_it);
+    Get(in, cut.append_act_placed);
+    Get(in, cut.output_valid);
+    Get(in, cut.in_cnt);
+    Get(in, cut.out_cnt);
+    Get(in, cut.vpu_cnt);
+    Get(in, cut.pf_status);
+    Get(in, cut.pf_N_it);
+    Get(in, cut.pf_K_tile_it);
+    Get(in, cut.pf_act_placed);
+    Get(in, cut.ref_hold);
+}
+
+void Put(CheckpointWriter &out, const JedecDRAMSystem::TileState &state) {
+    Put(out, state.clk);
+    Put(out, state.sched);
+    Put(out, state.channels);
+}
+
+void Get(CheckpointReader &in, JedecDRAMSystem::TileState &state) {
+    Get(in, state.clk);
+    Get(in, state.sched);
+    Get(in, state.channels);
+}
+
+void Put(CheckpointWriter &out, const JedecDRAMSystem::TileCost &cost) {
+    Put(out, cost.begin);
+    Put(out, cost.end);
+}
+
+void Get(CheckpointReader &in, JedecDRAMSystem::TileCost &cost) {
+    Get(in, cost.begin);
+    Get(in, cost.end);
+}
+
+// a restored kernel keeps its id but not its callback
+void Put(CheckpointWriter &out, const JedecDRAMSystem::QueuedKernel &kernel) {
+    Put(out, kernel.transactions);
+    Put(out, static_cast<uint64_t>(kernel.applied));
+    Put(out, kernel.done.id);
+}
+
+void Get(CheckpointReader &in, JedecDRAMSystem::QueuedKernel &kernel) {
+    uint64_t applied;
+    Get(in, kernel.transactions);
+    Get(in, applied);
+    kernel.applied = applied;
+    Get(in, kernel.done.id);
+    kernel.done.callback = nullptr;
+}
+
+void JedecDRAMSystem::SaveCheckpoint(CheckpointWriter &out) const {
+#ifdef THERMAL
+    // the thermal model state is not part of a checkpoint
+    BaseDRAMSystem::SaveCheckpoint(out);
+#endif  // THERMAL
+    // checkpoints are taken between ticks, never inside a run-ahead window
+    assert(clk_ >= window_end_);
+    std::vector<int> shape = {config_.channels, config_.ranks,
+                              config_.bankgroups, config_.banks_per_group,
+                              config_.rows, config_.columns};
+    Put(out, shape);
+    Put(out, clk_);
+    Put(out, last_req_clk_);
+    Put(out, turn_off);
+    Put(out, computation_end_cycles);
+    Put(out, refresh_stall_cycles);
+    Put(out, kernel_refresh_stalls_);
+    Put(out, kernels_finished);
+    Put(out, pipeline_staged_cycles);
+    Put(out, static_cast<uint64_t>(tenants_.size()));
+    for (const auto &tenant : tenants_) {
+        Put(out, tenant.queue);
+        Put(out, tenant.kernels);
+        Put(out, tenant.launch_clk);
+        Put(out, tenant.stats.kernels);
+        Put(out, tenant.stats.busy_cycles);
+        Put(out, tenant.stats.end_cycle);
+    }
+    for (size_t i = 0; i < ctrls_.size(); i++) {
+        ctrls_[i]->SaveCheckpoint(out);
+    }
+
+    // PIM scheduler
+    Put(out, sched_active_);
+    for (int value : {vcuts, hcuts, mcf, ucf, mc, df, vcuts_next, hcuts_next,
+                      M_tile_size, stride, kernel_size}) {
+        Put(out, value);
+    }
+    Put(out, cut_);
+    Put(out, bank_occupancy_);
+    Put(out, pim_trans_queue_);
+    Put(out, pim_queue_waiting_);
+    Put(out, pim_kernel_queue_);
+    Put(out, pim_kernel_waiting_);
+    Put(out, next_kernel_.status);
+    Put(out, next_kernel_.dataflow);
+    Put(out, next_kernel_.cut);
+    Put(out, next_kernel_.w_out_shared);
+
+    // steady state mode
+    Put(out, tile_costs_);
+    Put(out, tile_boundary_);
+    Put(out, tile_recording_);
+    Put(out, tile_begin_);
+    Put(out, tile_key_);
+    Put(out, tile_refresh_key_);
+    Put(out, tile_refresh_event_);
+    bool validating = tile_validating_ != nullptr;
+    Put(out, validating);
+    for (const auto &it : tile_costs_) {
+        if (&it.second == tile_validating_) Put(out, it.first);
+    }
+    Put(out, replay_until_);
+    Put(out, tiles_simulated_);
+    Put(out, tiles_replayed_);
+    Put(out, tiles_replayable_);
+    Put(out, replayed_cycles_);
+    Put(out, tiles_validated_);
+    Put(out, cycle_error_sum_);
+    Put(out, cycle_error_max_);
+    Put(out, energy_error_sum_);
+    Put(out, energy_error_max_);
+
+    Put(out, weight_tiles_prefetched_);
+    Put(out, weight_tiles_part_prefetched_);
+    Put(out, weight_tiles_loaded_);
+    Put(out, conv_rows_);
+    Put(out, conv_rows_read_);
+    Put(out, kv_tokens_appended_);
+    Put(out, kv_append_writes_);
+    Put(out, vpu_end_);
+    Put(out, vpu_busy_);
+    Put(out, vpu_ops_);
+    Put(out, vpu_cycles_);
+    Put(out, vpu_wait_cycles_);
+    Put(out, kernels_staged_);
+    Put(out, staged_tiles_loaded_);
+    Put(out, staged_tiles_part_loaded_);
+}
+
+void JedecDRAMSystem::RestoreCheckpoint(CheckpointReader &in) {
+#ifdef THERMAL
+    BaseDRAMSystem::RestoreCheckpoint(in);
+#endif  // THERMAL
+    std::vector<int> shape;
+    Get(in, shape);
+    if (shape != std::vector<int>{config_.channels, config_.ranks,
+                                  config_.bankgroups, config_.banks_per_group,
+                                  config_.rows, config_.columns}) {
+        std::cerr << "Checkpoint was taken with a different DRAM organization"
+                  << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    Get(in, clk_);
+    Get(in, last_req_clk_);
+    Get(in, turn_off);
+    Get(in, computation_end_cycles);
+    Get(in, refresh_stall_cycles);
+    Get(in, kernel_refresh_stalls_);
+    Get(in, kernels_finished);
+    Get(in, pipeline_staged_cycles);
+    uint64_t tenants;
+    Get(in, tenants);
+    if (tenants != tenants_.size()) {
+        std::cerr << "Checkpoint has " << tenants << " PIM tenants, the run "
+                  << tenants_.size() << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    for (auto &tenant : tenants_) {
+        Get(in, tenant.queue);
+        Get(in, tenant.kernels);
+        tenant.callbacks.clear();
+        Get(in, tenant.launch_clk);
+        Get(in, tenant.stats.kernels);
+        Get(in, tenant.stats.busy_cycles);
+        Get(in, tenant.stats.end_cycle);
+    }
+    for (size_t i = 0; i < ctrls_.size(); i++) {
+        ctrls_[i]->RestoreCheckpoint(in);
+    }
+
+    Get(in, sched_active_);
+    for (int *value : {&vcuts, &hcuts, &mcf, &ucf, &mc, &df, &vcuts_next,
+                       &hcuts_next, &M_tile_size, &stride, &kernel_size}) {
+        Get(in, *value);
+    }
+    Get(in, cut_);
+    Get(in, bank_occupancy_);
+    Get(in, pim_trans_queue_);
+    Get(in, pim_queue_waiting_);
+    Get(in, pim_kernel_queue_);
+    Get(in, pim_kernel_waiting_);
+    // callbacks are code, the restored kernels complete without them
+    kernel_callbacks_.clear();
+    next_kernel_.callbacks.clear();
+    vpu_callbacks_.clear();
+    Get(in, next_kernel_.status);
+    Get(in, next_kernel_.dataflow);
+    Get(in, next_kernel_.cut);
+    Get(in, next_kernel_.w_out_shared);
+    // command programs follow from the workload
+    cut_programs_.assign(Cuts(), CutProgram());
+    for (int i = 0; i < Cuts(); i++) {
+        if (cut_.in_pim[i]) CompileCutProgram(i);
+    }
+    if (next_kernel_.status != 0) {
+        NextKernel &next = next_kernel_;
+        next.programs.assign(next.dataflow.vcuts * next.dataflow.hcuts,
+                             CutProgram());
+        for (size_t i = 0; i < next.programs.size(); i++) {
+            if (next.cut.in_pim[i]) CompileNextKernelProgram(i);
+        }
+    }
+
+    Get(in, tile_costs_);
+    Get(in, tile_boundary_);
+    Get(in, tile_recording_);
+    Get(in, tile_begin_);
+    Get(in, tile_key_);
+    Get(in, tile_refresh_key_);
+    Get(in, tile_refresh_event_);
+    bool validating;
+    Get(in, validating);
+    tile_validating_ = nullptr;
+    if (validating) {
+        std::vector<int64_t> key;
+        Get(in, key);
+        tile_validating_ = &tile_costs_.at(key);
+    }
+    Get(in, replay_until_);
+    Get(in, tiles_simulated_);
+    Get(in, tiles_replayed_);
+    Get(in, tiles_replayable_);
+    Get(in, replayed_cycles_);
+    Get(in, tiles_validated_);
+    Get(in, cycle_error_sum_);
+    Get(in, cycle_error_max_);
+    Get(in, energy_error_sum_);
+    Get(in, energy_error_max_);
+
+    Get(in, weight_tiles_prefetched_);
+    Get(in, weight_tiles_part_prefetched_);
+    Get(in, weight_tiles_loaded_);
+    Get(in, conv_rows_);
+    Get(in, conv_rows_read_);
+    Get(in, kv_tokens_appended_);
+    Get(in, kv_append_writes_);
+    Get(in, vpu_end_);
+    Get(in, vpu_busy_);
+    Get(in, vpu_ops_);
+    Get(in, vpu_cycles_);
+    Get(in, vpu_wait_cycles_);
+    Get(in, kernels_staged_);
+    Get(in, staged_tiles_loaded_);
+    Get(in, staged_tiles_part_loaded_);
+    window_end_ = 0;
+}
+
+void JedecDRAMSystem::ResetTileCosts() {
+    tile_costs_.clear();
+    tile_recording_ = false;
+    tile_validating_ = nullptr;
+}
+
+JedecDRAMSystem::TileState JedecDRAMSystem::GetTileState() const {
+    TileState state;
+    state.clk = clk_;
+    // iterators first, they are replayed as deltas, the rest as values
+    state.sched = {cut_.M_it[0],          cut_.N_it[0],
+                   cut_.K_tile_it[0],     cut_.M_out_it[0],
+                   cut_.N_out_tile_it[0], cut_.out_cnt[0],
+                   cut_.output_valid[0],  cut_.in_cnt[0],
+                   cut_.vpu_cnt[0],       cut_.iw_status[0],
+                   cut_.in_act_placed[0], cut_.w_act_placed[0],
+                   cut_.out_act_placed[0]};
+    for (size_t i = 0; i < ctrls_.size(); i++) {
+        state.channels.push_back(ctrls_[i]->GetTileState());
+    }
+    return state;
+}
+
+std::vector<int64_t> JedecDRAMSystem::TileKey(const TileState &state) const {
+    // Two tiles behave alike if the scheduler starts them at the same place
+    // relative to row boundaries and tile edges, so this mirrors the address
+    // generation of ClockTick() for cut 0
+    int cut_height = config_.channels / hcuts;
+    int row_columns = config_.columns / config_.BL;
+
+    int N_tile_size = 128 / vcuts;
+    int N_tile_it = cut_.N_it[0] / N_tile_size;
+    int M_tile_it = cut_.M_it[0] / M_tile_size;
+    int M_current_tile_size = cut_.M[0] < M_tile_size * (M_tile_it + 1) ? cut_.M[0] % M_tile_size : M_tile_size;
+    int K_tile_size = std::min(cut_height * 16, cut_.K[0]);
+    int K_tiles = (cut_.K[0] - 1) / K_tile_size + 1;
+    const CutProgram &prog = cut_programs_[0];
+    int N_tile_size_per_bank = prog.N_tile_size_per_bank;
+    int w_col_offset = N_tile_it * (N_tile_size_per_bank * K_tiles) + cut_.K_tile_it[0] * N_tile_size_per_bank + cut_.N_it[0] % N_tile_size;
+    int in_col_offset = M_tile_it * (M_tile_size * K_tiles) + cut_.K_tile_it[0] * M_current_tile_size + cut_.M_it[0] % M_tile_size;
+    int in_reads = M_current_tile_size;
+    if (prog.kernel_size > 0) {
+        in_reads = prog.in_tile_reads[M_tile_it];
+        in_col_offset = prog.in_tile_offsets[M_tile_it] + cut_.K_tile_it[0] * in_reads;
+    }
+
+    int M_tile_size_out = prog.M_tile_size_out;
+    int M_out_tile_it = cut_.M_out_it[0] / M_tile_size_out;
+    int M_out = prog.M_out;
+    int M_out_current_tile_size = M_out < M_tile_size_out * (M_out_tile_it + 1) ? M_out % M_tile_size_out : M_tile_size_out;
+    int N_tile_num = prog.N_tile_num;
+    int N_tile_num_ch = N_tile_num / vcuts + (N_tile_num % vcuts > cut_.N_out_tile_it[0] % vcuts ? 1 : 0);
+    int out_col_offset = M_out_tile_it * (M_tile_size_out * N_tile_num_ch) + cut_.N_out_tile_it[0] / vcuts * M_out_current_tile_size + cut_.M_out_it[0] % M_tile_size_out;
+
+    // where a run of columns crosses into the next row, -1 if it does not
+    auto row_cross = [row_columns](int col_offset, int length) {
+        int col = col_offset % row_columns;
+        return col + length >= row_columns ? col : -1;
+    };
+    // weight reads also close the row every weight_cols columns
+    int weight_cols = prog.w_close_period;
+    int w_cross = row_cross(w_col_offset, N_tile_size_per_bank);
+    std::vector<int64_t> key = {
+        (cut_.K_tile_it[0] + 1) * K_tile_size >= cut_.K[0],
+        N_tile_size * (N_tile_it + 1) >= cut_.N[0],
+        M_tile_size * (M_tile_it + 1) >= cut_.M[0],
+        M_current_tile_size,
+        in_reads,
+        w_cross >= 0 ? w_cross : -1 - w_col_offset % weight_cols,
+        row_cross(in_col_offset, in_reads),
+        M_tile_size_out * (M_out_tile_it + 1) >= M_out,
+        M_out_current_tile_size,
+        cut_.M_out_it[0] % M_tile_size_out,
+        (cut_.N_out_tile_it[0] + 1) * prog.N_tile_size_out >= prog.N_out,
+        row_cross(out_col_offset, M_out_current_tile_size - cut_.M_out_it[0] % M_tile_size_out),
+        ctrls_[0]->pim_refresh_coming()};
+    // scheduler status other than the iterators
+    key.insert(key.end(), state.sched.begin() + 5, state.sched.end());
+    for (const auto &channel : state.channels) {
+        key.insert(key.end(), channel.timing.begin(), channel.timing.end());
+    }
+    return key;
+}
+
+const JedecDRAMSystem::TileCost *JedecDRAMSystem::FindTileCost(
+    const std::vector<int64_t> &key) const {
+    uint64_t refresh_event = std::numeric_limits<uint64_t>::max();
+    for (size_t i = 0; i < ctrls_.size(); i++) {
+        refresh_event = std::min(refresh_event, ctrls_[i]->NextRefreshEvent());
+    }
+    uint64_t epoch = clk_ / config_.epoch_period;
+
+    // a tile recorded without refresh fits anywhere before the next refresh
+    auto free_key = key;
+    free_key.push_back(-1);
+    auto it = tile_costs_.find(free_key);
+    if (it != tile_costs_.end()) {
+        uint64_t end = clk_ + it->second.end.clk - it->second.begin.clk;
+        if (end <= refresh_event && end / config_.epoch_period == epoch)
+            return &it->second;
+    }
+    // otherwise it has to see the refresh at the same point
+    auto phase_key = key;
+    phase_key.insert(phase_key.end(), tile_refresh_key_.begin(),
+                     tile_refresh_key_.end());
+    it = tile_costs_.find(phase_key);
+    if (it != tile_costs_.end()) {
+        uint64_t end = clk_ + it->second.end.clk - it->second.begin.clk;
+        if (end / config_.epoch_period == epoch) return &it->second;
+    }
+    return nullptr;
+}
+
+void JedecDRAMSystem::TileBoundary() {
+    // a KV cache layout is not part of the tile key
+    bool quiescent = vcuts * hcuts == 1 && cut_.in_pim[0] && cut_.iw_status[0] == 0 &&
+                     cut_.M_cap[0] == 0 && cut_.K_cap[0] == 0 && !vpu_busy_ &&
+                     pim_trans_queue_.empty() && pim_kernel_queue_.empty() &&
+                     !IsInRef();
+    for (size_t i = 0; i < ctrls_.size() && quiescent; i++) {
+        quiescent = ctrls_[i]->IsQuiescent();
+    }
+    if (!quiescent) {
+        tile_recording_ = false;
+        tile_validating_ = nullptr;
+        return;
+    }
+
+    TileState state = GetTileState();
+    // record the tile that just finished
+    if (tile_recording_) {
+        tiles_simulated_++;
+        if (tile_validating_ != nullptr) {
+            ValidateTile(*tile_validating_, state);
+        } else if (tile_begin_.clk / config_.epoch_period ==
+                   clk_ / config_.epoch_period) {
+            auto key = tile_key_;
+            if (tile_refresh_event_ < clk_) {
+                key.insert(key.end(), tile_refresh_key_.begin(),
+                           tile_refresh_key_.end());
+            } else {
+                key.push_back(-1);
+            }
+            tile_costs_.emplace(key, TileCost{tile_begin_, state});
+        }
+    }
+    tile_recording_ = false;
+    tile_validating_ = nullptr;
+
+    std::vector<int64_t> key = TileKey(state);
+    tile_begin_ = std::move(state);
+    tile_refresh_key_ = {ctrls_[0]->RefreshPhase()};
+    for (auto target : tile_begin_.channels[0].refresh_target) {
+        tile_refresh_key_.push_back(target);
+    }
+    const TileCost *cost = FindTileCost(key);
+    if (cost != nullptr) {
+        tiles_replayable_++;
+        if (config_.steady_state_validate <= 0 ||
+            tiles_replayable_ % config_.steady_state_validate != 0) {
+            ReplayTile(*cost);
+            return;
+        }
+        tile_validating_ = cost;
+    }
+    // simulate it in detail and remember its cost
+    tile_recording_ = true;
+    tile_key_ = std::move(key);
+    tile_refresh_event_ = std::numeric_limits<uint64_t>::max();
+    for (size_t i = 0; i < ctrls_.size(); i++) {
+        tile_refresh_event_ =
+            std::min(tile_refresh_event_, ctrls_[i]->NextRefreshEvent());
+    }
+}
+
+void JedecDRAMSystem::ReplayTile(const TileCost &cost) {
+    uint64_t cycles = cost.end.clk - cost.begin.clk;
+    for (size_t i = 0; i < ctrls_.size(); i++) {
+        ctrls_[i]->ReplayTile(cost.begin.channels[i], cost.end.channels[i],
+                              cycles);
+    }
+    std::vector<int> sched = tile_begin_.sched;
+    for (size_t j = 0; j < sched.size(); j++) {
+        if (j < 5) {
+            sched[j] += cost.end.sched[j] - cost.begin.sched[j];
+        } else {
+            sched[j] = cost.end.sched[j];
+        }
+    }
+    cut_.M_it[0] = sched[0];
+    cut_.N_it[0] = sched[1];
+    cut_.K_tile_it[0] = sched[2];
+    cut_.M_out_it[0] = sched[3];
+    cut_.N_out_tile_it[0] = sched[4];
+    cut_.out_cnt[0] = sched[5];
+    cut_.output_valid[0] = sched[6];
+    cut_.in_cnt[0] = sched[7];
+    cut_.vpu_cnt[0] = sched[8];
+    cut_.iw_status[0] = sched[9];
+    cut_.in_act_placed[0] = sched[10];
+    cut_.w_act_placed[0] = sched[11];
+    cut_.out_act_placed[0] = sched[12];
+    replay_until_ = clk_ + cycles;
+    tiles_replayed_++;
+    replayed_cycles_ += cycles;
+}
+
+void JedecDRAMSystem::ValidateTile(const TileCost &predicted,
+                                   const TileState &end) {
+    double cycles = end.clk - tile_begin_.clk;
+    double predicted_cycles = predicted.end.clk - predicted.begin.clk;
+    double energy = 0.0;
+    double predicted_energy = 0.0;
+    for (size_t i = 0; i < ctrls_.size(); i++) {
+        energy += ctrls_[i]->TileEnergy(tile_begin_.channels[i],
+                                        end.channels[i]);
+        predicted_energy += ctrls_[i]->TileEnergy(predicted.begin.channels[i],
+                                                  predicted.end.channels[i]);
+    }
+    double cycle_error = std::abs(predicted_cycles - cycles) / cycles;
+    double energy_error =
+        energy > 0 ? std::abs(predicted_energy - energy) / energy : 0.0;
+    tiles_validated_++;
+    cycle_error_sum_ += cycle_error;
+    cycle_error_max_ = std::max(cycle_error_max_, cycle_error);
+    energy_error_sum_ += energy_error;
+    energy_error_max_ = std::max(energy_error_max_, energy_error);
+}
+
 Command JedecDRAMSystem::GetReadyCommandPIM(Transaction trans, CommandType type) {
     bool first = true;
     bool sameornot = false;
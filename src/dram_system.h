@@ -1,13 +1,19 @@
 #ifndef __DRAM_SYSTEM_H
 #define __DRAM_SYSTEM_H
 
+#include <array>
+#include <atomic>
 #include <fstream>
+#include <map>
 #include <string>
 #include <vector>
 
+#include "channel_threads.h"
+#include "command_tracer.h"
 #include "common.h"
 #include "configuration.h"
 #include "controller.h"
+#include "pim_kernel.h"
 #include "timing.h"
 
 #ifdef THERMAL
@@ -16,16 +22,41 @@
 
 namespace dramsim3 {
 
+// what a tenant of a multi-tenant run got out of the array, see PimTenants
+struct PimTenantStats {
+    std::string name;
+    uint64_t kernels = 0;
+    // from the launch to the last output of each kernel
+    uint64_t busy_cycles = 0;
+    // end of the last kernel
+    uint64_t end_cycle = 0;
+    uint64_t pim_commands = 0;
+    // channel cycles in which another tenant got the command bus
+    uint64_t lost_slots = 0;
+};
+
 class BaseDRAMSystem {
    public:
+    // timing tables are built from the config unless a prebuilt one is given
     BaseDRAMSystem(Config &config, const std::string &output_dir,
                    std::function<void(uint64_t)> read_callback,
-                   std::function<void(uint64_t)> write_callback);
-    virtual ~BaseDRAMSystem() {}
+                   std::function<void(uint64_t)> write_callback,
+                   const Timing *timing = nullptr);
+    virtual ~BaseDRAMSystem() { delete cmd_tracer_; }
     void RegisterCallbacks(std::function<void(uint64_t)> read_callback,
                            std::function<void(uint64_t)> write_callback);
     void PrintEpochStats();
-    void PrintStats();
+    virtual void PrintStats();
+    // final stats of all channels, keyed as in the json stats file; only
+    // valid after PrintStats()
+    nlohmann::json FinalStats() const;
+    // energy (pJ) of all channels so far
+    double Energy() const;
+    // a counter stat of all channels so far, e.g. "num_act_cmds"
+    uint64_t Count(const std::string &name) const;
+    // complete simulator state, see checkpoint.h
+    virtual void SaveCheckpoint(CheckpointWriter &out) const;
+    virtual void RestoreCheckpoint(CheckpointReader &in);
     void ResetStats();
 
     virtual bool WillAcceptTransaction() const = 0;
@@ -33,12 +64,40 @@ class BaseDRAMSystem {
     virtual bool WillAcceptTransaction(uint64_t hex_addr,
                                        bool is_write) const = 0;
     virtual bool AddTransaction(uint64_t hex_addr, bool is_write) = 0;
+    // an already decoded PIM transaction, see pim_kernel.h
+    virtual bool AddPimTransaction(const PimTransaction &pim);
+    // A whole kernel, queued apart from the transactions. The scheduler
+    // applies all of its transactions in one cycle, as far as the running
+    // kernel lets it.
+    virtual bool WillAcceptPimKernel(int tenant) const { return false; }
+    virtual bool SubmitPimKernel(const PimKernelDesc &desc);
+    // Multi-tenant mode: partition the array among tenants, which then each
+    // queue their transactions (PimTransaction::tenant) separately
+    virtual void SetTenants(const PimTenants &tenants);
+    virtual bool WillAcceptPimTransaction(int tenant) const { return false; }
+    virtual std::vector<PimTenantStats> TenantStats() const { return {}; }
     virtual void ClockTick() = 0;
+    // Earliest cycle >= clk_ at which ClockTick() may change any state other
+    // than cycle counters; systems that cannot tell are always busy
+    virtual uint64_t NextEventCycle() const { return clk_; }
+    // Advance over cycles known to be idle (i.e. before NextEventCycle())
+    virtual void SkipCycles(uint64_t cycles) {}
     int GetChannel(uint64_t hex_addr) const;
+    // the front-end promises not to add transactions before cycle clk
+    void SetQuietUntil(uint64_t clk) { quiet_until_ = clk; }
 
     std::function<void(uint64_t req_id)> read_callback_, write_callback_;
-    static int total_channels_;
+    static std::atomic<int> total_channels_;
     bool turn_off = false;
+    // cycles at which PIM computations ended
+    std::vector<uint64_t> computation_end_cycles;
+    // cycles in which refresh held back a running PIM kernel
+    uint64_t refresh_stall_cycles = 0;
+    // PIM kernels whose last output has been written
+    uint64_t kernels_finished = 0;
+    // cycles in which the next kernel was configured while the running one
+    // drained its outputs, not the cycles this saves
+    uint64_t pipeline_staged_cycles = 0;
 
    protected:
     uint64_t id_;
@@ -47,7 +106,12 @@ class BaseDRAMSystem {
     Timing timing_;
     uint64_t parallel_cycles_;
     uint64_t serial_cycles_;
-
+    uint64_t quiet_until_;
+    // a resumed run starts a new epoch file
+    bool epoch_file_started_ = false;
+    CommandTracer *cmd_tracer_ = nullptr;
+    // hand the controllers a command trace ring each if the config asks
+    void TraceCommands();
 
 #ifdef THERMAL
     ThermalCalculator thermal_calc_;
@@ -66,13 +130,25 @@ class JedecDRAMSystem : public BaseDRAMSystem {
    public:
     JedecDRAMSystem(Config &config, const std::string &output_dir,
                     std::function<void(uint64_t)> read_callback,
-                    std::function<void(uint64_t)> write_callback);
+                    std::function<void(uint64_t)> write_callback,
+                    const Timing *timing = nullptr);
     ~JedecDRAMSystem();
     bool WillAcceptTransaction(uint64_t hex_addr, bool is_write) const override;
     bool WillAcceptTransaction() const override;
     bool AddTransaction(uint64_t hex_addr) override;
     bool AddTransaction(uint64_t hex_addr, bool is_write) override;
+    bool AddPimTransaction(const PimTransaction &pim) override;
+    bool WillAcceptPimKernel(int tenant) const override;
+    bool SubmitPimKernel(const PimKernelDesc &desc) override;
+    void SetTenants(const PimTenants &tenants) override;
+    bool WillAcceptPimTransaction(int tenant) const override;
+    std::vector<PimTenantStats> TenantStats() const override;
     void ClockTick() override;
+    uint64_t NextEventCycle() const override;
+    void SkipCycles(uint64_t cycles) override;
+    void PrintStats() override;
+    void SaveCheckpoint(CheckpointWriter &out) const override;
+    void RestoreCheckpoint(CheckpointReader &in) override;
     Command GetReadyCommandPIM(Transaction trans, CommandType type);
     // dataflow configuration
     int vcuts = -1;
@@ -85,37 +161,363 @@ class JedecDRAMSystem : public BaseDRAMSystem {
     int hcuts_next = -1;
     // TODO now it is same with all cuts, but it should be not
     int M_tile_size = 0;
-    // TODO stride and kernel size also must be vectors
+    // convolution window, 0 for a matmul (see CutState for each cut's)
     int stride = 0;
     int kernel_size = 0;
-    // workload configuration
-    std::vector<uint64_t> base_rows_in;
-    std::vector<uint64_t> base_rows_w;
-    std::vector<uint64_t> base_rows_out;
-    std::vector<int> M;
-    std::vector<int> N;
-    std::vector<int> K;
-    // BLAS scheduler status
-    std::vector<int> M_it;
-    std::vector<int> N_it;
-    std::vector<int> K_tile_it;
-    std::vector<int> M_out_it;
-    std::vector<int> N_out_tile_it;
-    std::vector<bool> in_pim;
-    std::vector<int> iw_status;
-    std::vector<bool> in_act_placed;
-    std::vector<bool> w_act_placed;
-    std::vector<bool> out_act_placed;
-    // NPU status
-    std::vector<int> output_valid;
-    std::vector<int> in_cnt;
-    std::vector<int> out_cnt;
-    std::vector<int> vpu_cnt;
-
+    // at most one cut per bit of a launch transaction's cut mask
+    static const int kMaxCuts = 32;
+    // Per-cut workload and scheduler state, one fixed array per field so
+    // that a new dataflow configuration does not reallocate anything
+    struct CutState {
+        // dataflow configuration, the same for all cuts of a kernel but not
+        // for the cuts of different tenants
+        std::array<int, kMaxCuts> mcf;
+        std::array<int, kMaxCuts> mc;
+        std::array<int, kMaxCuts> df;
+        std::array<int, kMaxCuts> M_tile_size;
+        std::array<int, kMaxCuts> kernel_size;
+        std::array<int, kMaxCuts> stride;
+        // workload configuration
+        std::array<uint64_t, kMaxCuts> base_rows_in;
+        std::array<uint64_t, kMaxCuts> base_rows_w;
+        std::array<uint64_t, kMaxCuts> base_rows_out;
+        std::array<int, kMaxCuts> M;
+        std::array<int, kMaxCuts> N;
+        std::array<int, kMaxCuts> K;
+        // KV cache input, see PimKernelDesc::Cut
+        std::array<int, kMaxCuts> M_cap;
+        std::array<int, kMaxCuts> K_cap;
+        std::array<int, kMaxCuts> append_from;
+        std::array<int, kMaxCuts> append_to;
+        // BLAS scheduler status
+        std::array<int, kMaxCuts> M_it;
+        std::array<int, kMaxCuts> N_it;
+        std::array<int, kMaxCuts> K_tile_it;
+        std::array<int, kMaxCuts> M_out_it;
+        std::array<int, kMaxCuts> N_out_tile_it;
+        std::array<bool, kMaxCuts> in_pim;
+        std::array<int, kMaxCuts> iw_status;
+        std::array<bool, kMaxCuts> in_act_placed;
+        std::array<bool, kMaxCuts> w_act_placed;
+        std::array<bool, kMaxCuts> out_act_placed;
+        // write steps of the tokens appended to the KV cache so far
+        std::array<int, kMaxCuts> append_it;
+        std::array<bool, kMaxCuts> append_act_placed;
+        // NPU status
+        std::array<int, kMaxCuts> output_valid;
+        std::array<int, kMaxCuts> in_cnt;
+        std::array<int, kMaxCuts> out_cnt;
+        std::array<int, kMaxCuts> vpu_cnt;
+        // double buffering: the next tile's weights, 0 not loading, 1
+        // loading, 2 loaded into the shadow PE registers
+        std::array<int, kMaxCuts> pf_status;
+        std::array<int, kMaxCuts> pf_N_it;
+        std::array<int, kMaxCuts> pf_K_tile_it;
+        std::array<bool, kMaxCuts> pf_act_placed;
+        // refresh-aware mode: waiting for the refresh of its banks
+        std::array<bool, kMaxCuts> ref_hold;
+    };
+    CutState cut_ = CutState();
+    // cuts of the current dataflow configuration, 0 before the first one
+    int Cuts() const { return vcuts != -1 && hcuts != -1 ? vcuts * hcuts : 0; }
 
     std::vector<std::vector<bool>> bank_occupancy_;
-    std::vector<Transaction> pim_trans_queue_;
-    uint64_t pim_trans_queue_depth_ = 32; //TODO
+    std::vector<PimTransaction> pim_trans_queue_;
+
+   private:
+    // whether the PIM scheduler did anything besides counting down in the
+    // last ClockTick()
+    bool sched_active_ = true;
+    bool IsInRef() const;
+    // false if the transaction has to wait, e.g. a launch for its workload
+    bool ApplyPimTransaction(const PimTransaction &pim);
+    // back to the state before its first workload
+    void ResetCut(int cut);
+    // the front of pim_trans_queue_ had to wait in the last ClockTick()
+    bool pim_queue_waiting_ = false;
+    // A submitted kernel, its transactions and how many of them have been
+    // applied. The callback moves to the kernel's cuts when it launches and
+    // is called once they are done.
+    struct KernelCallback {
+        uint64_t id;
+        std::function<void(uint64_t)> callback;
+    };
+    struct QueuedKernel {
+        std::vector<PimTransaction> transactions;
+        size_t applied = 0;
+        KernelCallback done;
+    };
+    friend void Put(CheckpointWriter &out, const QueuedKernel &kernel);
+    friend void Get(CheckpointReader &in, QueuedKernel &kernel);
+    std::vector<QueuedKernel> pim_kernel_queue_;
+    bool pim_kernel_waiting_ = false;
+    // callbacks of the running kernel
+    std::vector<KernelCallback> kernel_callbacks_;
+    // applies what it can of the front kernel, false if nothing
+    bool ApplyQueuedKernel(std::vector<QueuedKernel> &queue);
+    void KernelDone(std::vector<KernelCallback> &callbacks);
+    // a new dataflow configuration for the whole array
+    void ConfigureDataflow(const PimTransaction &pim);
+    // per-cut state of a kernel with dataflow pim, before its workload
+    CutState DataflowCutState(const PimTransaction &pim) const;
+    void SetWorkload(CutState &state, const PimTransaction &pim);
+    bool Running() const;
+    // some cut runs, and every running cut has streamed its last input
+    bool Draining() const;
+
+    // Multi-tenant mode: each tenant's queue and its running kernel
+    struct TenantState {
+        uint64_t cut_mask;
+        std::vector<PimTransaction> queue;
+        std::vector<QueuedKernel> kernels;
+        std::vector<KernelCallback> callbacks;
+        uint64_t launch_clk = 0;
+        PimTenantStats stats;
+    };
+    std::vector<TenantState> tenants_;
+    std::array<int, kMaxCuts> cut_tenant_;
+    // counts the tenant's kernel as done once none of its cuts runs
+    void EndTenantKernel(int cut);
+    // adds num to a PIM stat of every channel the cuts of cut_mask span, or
+    // of all channels
+    void IncrementCutStat(uint64_t cut_mask, const char *name, uint64_t num);
+    void IncrementArrayStat(const char *name, uint64_t num);
+
+    // A launched cut's command program: the loop invariants of its BLAS
+    // functions and the banks each of them accesses, compiled once per
+    // kernel. Each cycle the scheduler then only computes the row and
+    // column of the next access from the BLAS iterators and ORs them into
+    // the precomputed bank addresses.
+    struct Lane {
+        Address addr;
+        // channel, rank, bankgroup and bank bits of the unshifted hex address
+        int bits;
+    };
+    struct CutProgram {
+        // dataflow of the cut when it was launched
+        int mcf;
+        int mc;
+        int df;
+        int M_tile_size;
+        int vcut_no;
+        int cut_height;
+        int N_tile_size;
+        int K_tile_size;
+        int K_tiles;
+        // weight loading, one lane per channel and weight bank
+        int N_tile_size_per_bank;
+        int w_close_period;
+        std::vector<Lane> w_lanes;
+        // input streaming, mc lanes per channel
+        std::vector<Lane> in_lanes;
+        // Input layout: M tiles of in_M steps hold in_K_tiles K tiles of
+        // in_K_tile_size each, M x K_tiles unless it is a KV cache laid out
+        // for its capacity. Appending to it takes append_steps writes.
+        int in_M;
+        int in_K_tiles;
+        int in_K_tile_size;
+        bool in_strided;
+        int append_steps;
+        // Convolution (kernel_size > 0), implicit im2col: each M tile reads
+        // the input rows its windows cover once per K tile and generates
+        // its im2col rows from them. The reads of each M tile and the
+        // column offset of its first one.
+        int kernel_size;
+        int stride;
+        std::vector<int> in_tile_reads;
+        std::vector<int> in_tile_offsets;
+        // output writing, k_bound lanes per channel, channels of every
+        // output cut number
+        int M_tile_size_out;
+        int M_out;
+        int N_out;
+        int N_tile_size_out;
+        int N_tile_num;
+        int cut_height_out;
+        int k_bound;
+        std::vector<Lane> out_lanes;
+        // weight banks that input streaming or output writing also access
+        bool w_in_shared;
+        bool w_out_shared;
+        // banks any lane accesses, per channel (see Refresh::OwedBanks())
+        std::vector<uint64_t> bank_masks;
+        // Commands of the current cycle, reserved for one per lane when the
+        // program is compiled so that filling them never allocates
+        std::vector<Command> w_batch;
+        std::vector<Command> in_batch;
+        std::vector<Command> out_batch;
+    };
+    std::vector<CutProgram> cut_programs_;
+    void CompileCutProgram(int cut) {
+        CompileCutProgram(cut_, vcuts, hcuts, cut, cut_programs_[cut]);
+    }
+    // the program of a cut of any partition, e.g. the next kernel's
+    void CompileCutProgram(const CutState &state, int part_vcuts,
+                           int part_hcuts, int cut, CutProgram &prog) const;
+    // the input reads of a convolution cut's M tiles
+    void CompileConvInput(const CutState &state, int cut,
+                          CutProgram &prog) const;
+    static bool SharesBank(const std::vector<Lane> &a,
+                           const std::vector<Lane> &b);
+    Lane MakeLane(int ch, int bg, int bk) const;
+    Command LaneCommand(CommandType type, const Lane &lane, int row,
+                        int column) const;
+    // One step of loading the weight tile at (N_it, K_tile_it) into PE
+    // registers, true once the tile is loaded
+    bool LoadWeights(const CutProgram &prog, uint64_t base_row_w, int &N_it,
+                     int K_tile_it, bool &act_placed, bool wait_refresh,
+                     std::vector<Command> &cmds);
+    // column offset of the input read at step M_it of K tile K_tile_it
+    int InputColumn(const CutProgram &prog, int M_it, int K_tile_it) const;
+    // Write step it of appending tokens to a KV cache: its column offset
+    // and its lanes, channels [j_begin, j_end) of the cut and the banks k
+    // of each with k / k_div % k_mod == k_sel
+    struct KvStep {
+        int col_offset;
+        int j_begin;
+        int j_end;
+        int k_div;
+        int k_mod;
+        int k_sel;
+    };
+    KvStep KvAppendStep(const CutProgram &prog, int cut, int it) const;
+    // One write step of appending tokens to a cut's KV cache, true once
+    // they are all written. Rows other kernels left open are precharged
+    // on the weight queue (pre_cmds), the only one that takes precharges.
+    bool AppendKvCache(const CutProgram &prog, int cut, bool wait_refresh,
+                       std::vector<Command> &pre_cmds,
+                       std::vector<Command> &cmds);
+    // weight tile a streaming or draining cut loads next, false if none
+    bool NextWeightTile(int cut, int &N_it, int &K_tile_it) const;
+    // weight tiles loaded fully, partly and not at all ahead of time
+    uint64_t weight_tiles_prefetched_ = 0;
+    uint64_t weight_tiles_part_prefetched_ = 0;
+    uint64_t weight_tiles_loaded_ = 0;
+    // convolution input vectors streamed, and those read from DRAM
+    uint64_t conv_rows_ = 0;
+    uint64_t conv_rows_read_ = 0;
+    // tokens appended to KV caches, and the write steps that took
+    uint64_t kv_tokens_appended_ = 0;
+    uint64_t kv_append_writes_ = 0;
+
+    // The VPU runs one op at a time, once the kernel before it has written
+    // its last output, until vpu_end_. The next kernel loads its weights
+    // meanwhile and streams its inputs once the op is done (vpu_cnt).
+    uint64_t VpuCycles(const PimTransaction &pim) const;
+    uint64_t vpu_end_ = 0;
+    bool vpu_busy_ = false;
+    // callbacks of submitted VPU ops and the cycles they end at
+    std::vector<std::pair<uint64_t, KernelCallback>> vpu_callbacks_;
+    // ops, the cycles they took, and the cycles kernels waited for them
+    uint64_t vpu_ops_ = 0;
+    uint64_t vpu_cycles_ = 0;
+    uint64_t vpu_wait_cycles_ = 0;
+
+    // Pipelined layers: the kernel after the running one. It is configured
+    // and launched while the running kernel drains its outputs, loads its
+    // first weight tiles, and takes over the array once the last output is
+    // written. Only a kernel with the partition the running one announced
+    // (vcuts_next, hcuts_next) is staged.
+    struct NextKernel {
+        // 0 none, 1 configured, 2 launched
+        int status = 0;
+        PimTransaction dataflow;
+        CutState cut;
+        std::vector<CutProgram> programs;
+        // its weight banks are banks the running kernel writes outputs to
+        bool w_out_shared = false;
+        std::vector<KernelCallback> callbacks;
+    };
+    NextKernel next_kernel_;
+    // false if the transaction has to wait for the running kernel
+    bool StageNextKernel(const PimTransaction &pim);
+    // its program, with the bank masks of its weight lanes only
+    void CompileNextKernelProgram(int cut);
+    void LoadNextKernelWeights(bool wait_refresh);
+    void StartNextKernel();
+    // kernels staged, and first weight tiles they loaded fully or partly
+    uint64_t kernels_staged_ = 0;
+    uint64_t staged_tiles_loaded_ = 0;
+    uint64_t staged_tiles_part_loaded_ = 0;
+
+    // Refresh-aware mode: a cut holds at a tile boundary while its banks
+    // owe refreshes, or where it is if a refresh is forced on them
+    bool OwesRefresh(int cut) const;
+    void HoldForRefresh(CutState &state, const CutProgram &prog, int cut);
+    void UpdateRefreshHolds(CutState &state,
+                            const std::vector<CutProgram> &programs);
+    void SetPimBanks();
+    // whether refresh holds back a running kernel in this cycle
+    bool RefreshStalled() const;
+    // counts cycles in which it does
+    void CountRefreshStalls(uint64_t cycles);
+    // refresh_stall_cycles when the running kernel was launched
+    uint64_t kernel_refresh_stalls_ = 0;
+
+    // Parallel controller stepping. While no PIM kernel runs and the
+    // front-end is quiet the controllers do not interact with anything, so
+    // each thread runs its channels a window of cycles ahead; the returns
+    // they produce are buffered and handed to the callbacks in the cycle
+    // and channel order of serial stepping.
+    struct DoneTrans {
+        uint64_t clk;
+        uint64_t addr;
+        int is_write;
+    };
+    ChannelThreads *channel_threads_ = nullptr;
+    uint64_t window_end_ = 0;
+    std::vector<std::vector<DoneTrans>> window_returns_;
+    std::vector<size_t> window_returns_pos_;
+    // PIM work is queued or running, the channels are then stepped serially
+    bool PimActive() const;
+    uint64_t RunAheadWindow() const;
+    void RunControllers(uint64_t cycles);
+
+    // Steady state mode: a tile runs from one iw_status 3->0 transition of a
+    // single cut to the next. When a tile starts from the same state as an
+    // already simulated one (relative to row boundaries, bank timing and, if
+    // it crosses a refresh, the refresh phase) its recorded cost and effects
+    // are replayed instead.
+    struct TileState {
+        uint64_t clk;
+        std::vector<int> sched;
+        std::vector<ChannelTileState> channels;
+    };
+    struct TileCost {
+        TileState begin;
+        TileState end;
+    };
+    friend void Put(CheckpointWriter &out, const TileState &state);
+    friend void Get(CheckpointReader &in, TileState &state);
+    friend void Put(CheckpointWriter &out, const TileCost &cost);
+    friend void Get(CheckpointReader &in, TileCost &cost);
+    std::map<std::vector<int64_t>, TileCost> tile_costs_;
+    bool tile_boundary_ = false;
+    bool tile_recording_ = false;
+    TileState tile_begin_;
+    std::vector<int64_t> tile_key_;
+    std::vector<int64_t> tile_refresh_key_;
+    uint64_t tile_refresh_event_ = 0;
+    // cost predicted for a tile that is simulated for validation
+    const TileCost *tile_validating_ = nullptr;
+    uint64_t replay_until_ = 0;
+    uint64_t tiles_simulated_ = 0;
+    uint64_t tiles_replayed_ = 0;
+    uint64_t tiles_replayable_ = 0;
+    uint64_t replayed_cycles_ = 0;
+    uint64_t tiles_validated_ = 0;
+    double cycle_error_sum_ = 0.0;
+    double cycle_error_max_ = 0.0;
+    double energy_error_sum_ = 0.0;
+    double energy_error_max_ = 0.0;
+
+    void TileBoundary();
+    TileState GetTileState() const;
+    std::vector<int64_t> TileKey(const TileState &state) const;
+    const TileCost *FindTileCost(const std::vector<int64_t> &key) const;
+    void ReplayTile(const TileCost &cost);
+    void ValidateTile(const TileCost &predicted, const TileState &end);
+    void ResetTileCosts();
 };
 
 // Model a memorysystem with an infinite bandwidth and a fixed latency (possibly
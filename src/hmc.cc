@@ -266,6 +266,7 @@ HMCMemorySystem::HMCMemorySystem(Config &config, const std::string &output_dir,
         ctrls_.push_back(new Controller(i, config_, timing_));
 #endif  // THERMAL
     }
+    TraceCommands();
     // initialize vaults and crossbar
     // the first layer of xbar will be num_links * 4 (4 for quadrants)
     // the second layer will be a 1:8 xbar
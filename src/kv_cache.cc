@@ -0,0 +1,76 @@
+#include "kv_cache.h"
+#include <algorithm>
+#include <iostream>
+#include "common.h"
+
+namespace dramsim3 {
+
+KvCache::KvCache(const Config &config, int capacity)
+    : capacity_(capacity),
+      channels_(config.channels),
+      row_columns_(config.columns / config.BL),
+      rows_(config.rows),
+      next_row_(config.rows) {
+    if (capacity < 1) {
+        std::cerr << "A KV cache needs a capacity of at least one token"
+                  << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+}
+
+void KvCache::Attach(PimKernelDesc &desc, int layer, bool keys, int tokens,
+                     int appended) {
+    if (desc.df != 1 || desc.cuts.size() != 1 || tokens > capacity_ ||
+        appended < 0 || appended > tokens) {
+        std::cerr << "KV cache of layer " << layer << ": " << tokens
+                  << " tokens do not fit the capacity of " << capacity_
+                  << " or the kernel is not a single cut GEMV" << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    PimKernelDesc::Cut &cut = desc.cuts[0];
+    int ucf = desc.ucf;
+    // the same layout as JedecDRAMSystem::CompileCutProgram()
+    int in_M, in_K;
+    if (keys) {
+        cut.M = (tokens - 1) / desc.mcf + 1;
+        cut.M_cap = (capacity_ - 1) / desc.mcf + 1;
+        in_M = cut.M_cap;
+        in_K = cut.K;
+    } else {
+        cut.K = (tokens - 1) / ucf + 1;
+        cut.K_cap = (capacity_ - 1) / ucf + 1;
+        in_M = cut.M;
+        in_K = cut.K_cap;
+    }
+    cut.append_from = tokens - appended;
+    cut.append_to = tokens;
+    int cut_height = channels_ / desc.hcuts;
+    int K_tile_size = std::min(cut_height * 16, in_K);
+    uint64_t columns = static_cast<uint64_t>(in_M) *
+                       ((in_K - 1) / K_tile_size + 1);
+    uint64_t rows = (columns - 1) / row_columns_ + 1;
+
+    int sequences = std::max<int>(1, cut.seq_base_rows_in.size());
+    cut.seq_base_rows_in.clear();
+    for (int s = 0; s < sequences; s++) {
+        cut.seq_base_rows_in.push_back(Place(layer, s, keys, rows));
+    }
+    cut.base_row_in = cut.seq_base_rows_in[0];
+    if (sequences == 1) cut.seq_base_rows_in.clear();
+}
+
+uint64_t KvCache::Place(int layer, int sequence, bool keys, uint64_t rows) {
+    auto key = std::make_tuple(layer, sequence, keys);
+    auto it = base_rows_.find(key);
+    if (it != base_rows_.end()) return it->second;
+    if (rows > next_row_) {
+        std::cerr << "KV caches of " << capacity_ << " tokens need more than "
+                  << "the " << rows_ << " rows of a bank" << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    next_row_ -= rows;
+    base_rows_[key] = next_row_;
+    return next_row_;
+}
+
+}  // namespace dramsim3
@@ -0,0 +1,43 @@
+#ifndef __KV_CACHE_H
+#define __KV_CACHE_H
+
+#include <stdint.h>
+#include <map>
+#include <tuple>
+#include "configuration.h"
+#include "pim_kernel.h"
+
+namespace dramsim3 {
+
+// The KV caches of decode attention, kept in the PIM banks across tokens.
+// The keys of a sequence are the streamed input of its QK kernel and grow
+// along M, its values are that of its SV kernel and grow along K (see
+// PimKernelDesc::Cut). Each cache is laid out for capacity tokens in rows
+// reserved when it is first attached, from the last row down, away from the
+// operands PimKernelDescription() places from row 0. A new token is written
+// in place and the kernels stream the cache where it is.
+class KvCache {
+   public:
+    KvCache(const Config &config, int capacity);
+    // Makes the caches of a layer the input of its QK (keys) or SV (values)
+    // kernel, one per sequence, sized for tokens of which the last appended
+    // ones are written to the caches before they are streamed
+    void Attach(PimKernelDesc &desc, int layer, bool keys, int tokens,
+                int appended);
+    int Capacity() const { return capacity_; }
+    uint64_t RowsUsed() const { return rows_ - next_row_; }
+
+   private:
+    // first row of a cache, which takes rows when it is first placed
+    uint64_t Place(int layer, int sequence, bool keys, uint64_t rows);
+
+    int capacity_;
+    int channels_;
+    int row_columns_;
+    uint64_t rows_;
+    uint64_t next_row_;
+    std::map<std::tuple<int, int, bool>, uint64_t> base_rows_;
+};
+
+}  // namespace dramsim3
+#endif
@@ -1,6 +1,8 @@
 #include <iostream>
+#include <memory>
 #include "./../ext/headers/args.hxx"
 #include "cpu.h"
+#include "result_cache.h"
 
 using namespace dramsim3;
 
@@ -25,6 +27,44 @@ int main(int argc, const char **argv) {
         parser, "trace",
         "Trace file, setting this option will ignore -s option",
         {'t', "trace"});
+    args::ValueFlagList<std::string> workload_arg(
+        parser, "workload",
+        "PIM workload file (as for gen_pim_trace2.py) to run without a trace, "
+        "repeat to run several kernels back to back",
+        {'w', "workload"});
+    args::ValueFlag<std::string> tenants_arg(
+        parser, "tenants",
+        "Tenant file (see pim_kernel.h), runs the workloads of several "
+        "tenants on cuts of the array",
+        {"tenants"});
+    args::ValueFlag<size_t> prefetch_arg(
+        parser, "trace_prefetch",
+        "Read this many trace records ahead on a separate thread",
+        {"trace-prefetch"}, 0);
+    args::Flag no_skip_arg(
+        parser, "no_skip",
+        "Tick every cycle instead of skipping cycles where nothing happens",
+        {"no-skip"});
+    args::ValueFlag<uint64_t> checkpoint_every_arg(
+        parser, "checkpoint_every",
+        "Write a checkpoint every this many cycles (overwriting the last one)",
+        {"checkpoint-every"}, 0);
+    args::ValueFlag<std::string> checkpoint_arg(
+        parser, "checkpoint",
+        "Checkpoint file (default: dramsim3.ckpt in the output directory)",
+        {"checkpoint"});
+    args::ValueFlag<std::string> restore_arg(
+        parser, "restore",
+        "Resume from a checkpoint taken with the same config and trace",
+        {"restore"});
+    args::ValueFlag<std::string> cache_arg(
+        parser, "cache",
+        "Result cache directory, runs already in it are not simulated",
+        {"cache"});
+    args::Flag cache_verify_arg(
+        parser, "cache_verify",
+        "Simulate cache hits anyway and check them against the cached result",
+        {"cache-verify"});
     args::Positional<std::string> config_arg(
         parser, "config", "The config file name (mandatory)");
 
@@ -48,11 +88,55 @@ int main(int argc, const char **argv) {
     uint64_t cycles = args::get(num_cycles_arg);
     std::string output_dir = args::get(output_dir_arg);
     std::string trace_file = args::get(trace_file_arg);
+    std::vector<PimWorkload> workloads;
+    for (const auto &file : args::get(workload_arg)) {
+        workloads.push_back(ReadPimWorkload(file));
+    }
+    std::string tenants_file = args::get(tenants_arg);
     std::string stream_type = args::get(stream_arg);
+    bool skip_idle = !args::get(no_skip_arg);
+    uint64_t checkpoint_every = args::get(checkpoint_every_arg);
+    std::string checkpoint_file = checkpoint_arg
+                                      ? args::get(checkpoint_arg)
+                                      : output_dir + "/dramsim3.ckpt";
+    std::string restore_file = args::get(restore_arg);
+    std::string cache_dir = args::get(cache_arg);
+    bool cache_verify = args::get(cache_verify_arg);
+
+    // a resumed run is only part of a simulation, don't cache it
+    std::unique_ptr<ResultCache> cache;
+    std::string cache_key;
+    nlohmann::json cached;
+    bool cache_hit = false;
+    if (!cache_dir.empty() && tenants_file.empty() &&
+        (!trace_file.empty() || !workloads.empty()) &&
+        restore_file.empty()) {
+        Config config(config_file, output_dir);
+        cache.reset(new ResultCache(cache_dir));
+        cache_key = !workloads.empty()
+                        ? ResultKey(config, PimKernels(workloads), cycles)
+                        : ResultKey(config, trace_file, cycles);
+        cache_hit = cache->Lookup(cache_key, cached);
+        if (cache_hit && !cache_verify) {
+            std::cout << "Result cache hit " << cache_key << ": "
+                      << cached["cycles"] << " cycles, " << cached["energy"]
+                      << " pJ" << std::endl;
+            if (config.output_level >= 0) WriteStatsFile(config, cached);
+            return 0;
+        }
+    }
 
     CPU *cpu;
-    if (!trace_file.empty()) {
-        cpu = new TraceBasedCPU(config_file, output_dir, trace_file);
+    if (!tenants_file.empty()) {
+        cpu = new TenantCPU(config_file, output_dir,
+                            ReadPimTenants(tenants_file));
+    } else if (!workloads.empty()) {
+        auto workload_cpu = new WorkloadCPU(config_file, output_dir);
+        workload_cpu->Launch(PimKernels(workloads));
+        cpu = workload_cpu;
+    } else if (!trace_file.empty()) {
+        cpu = new TraceBasedCPU(config_file, output_dir, trace_file,
+                                args::get(prefetch_arg));
     } else {
         if (stream_type == "stream" || stream_type == "s") {
             cpu = new StreamCPU(config_file, output_dir);
@@ -61,16 +145,62 @@ int main(int argc, const char **argv) {
         }
     }
 
-    for (uint64_t clk = 0; clk < cycles; clk++) {
+    uint64_t start = 0;
+    if (!restore_file.empty()) {
+        cpu->RestoreCheckpoint(restore_file);
+        start = cpu->Clock();
+    }
+    auto next_checkpoint = [&](uint64_t clk) {
+        if (checkpoint_every == 0) return cycles;
+        return std::min(cycles, (clk / checkpoint_every + 1) * checkpoint_every);
+    };
+    uint64_t checkpoint_clk = next_checkpoint(start);
+    cpu->SetEndCycle(checkpoint_clk);
+    bool turned_off = false;
+    for (uint64_t clk = start; clk < cycles; clk++) {
+        if (clk == checkpoint_clk) {
+            cpu->SaveCheckpoint(checkpoint_file);
+            checkpoint_clk = next_checkpoint(clk);
+            cpu->SetEndCycle(checkpoint_clk);
+        }
         cpu->ClockTick();
-        if (((TraceBasedCPU*) cpu)->turnOff()) {
+        if (cpu->turnOff()) {
             std::cout<<"Turn off PIM"<<std::endl;
+            turned_off = true;
             break;
         }
+        // jump straight to the next cycle where something can happen
+        if (skip_idle) {
+            uint64_t next = std::min(cpu->NextEventCycle(), checkpoint_clk);
+            if (next > clk + 1) {
+                cpu->SkipCycles(next - clk - 1);
+                clk = next - 1;
+            }
+        }
     }
     cpu->PrintStats();
 
+    int status = 0;
+    if (cache) {
+        auto result = SimulationResult(cpu->Memory(), turned_off);
+        if (!cache_hit) {
+            cache->Store(cache_key, result);
+        } else {
+            auto mismatches = ResultCache::Mismatches(cached, result);
+            if (mismatches.empty()) {
+                std::cout << "Result cache hit " << cache_key << " verified"
+                          << std::endl;
+            } else {
+                std::cerr << "Result cache entry " << cache_key
+                          << " differs in";
+                for (const auto &field : mismatches) std::cerr << " " << field;
+                std::cerr << std::endl;
+                status = 1;
+            }
+        }
+    }
+
     delete cpu;
 
-    return 0;
+    return status;
 }
@@ -16,6 +16,20 @@ MemorySystem::MemorySystem(const std::string &config_file,
     }
 }
 
+MemorySystem::MemorySystem(const Config &config, const Timing &timing,
+                           std::function<void(uint64_t)> read_callback,
+                           std::function<void(uint64_t)> write_callback)
+    : config_(new Config(config)) {
+    if (config_->IsHMC()) {
+        dram_system_ = new HMCMemorySystem(*config_, config_->output_dir,
+                                           read_callback, write_callback);
+    } else {
+        dram_system_ =
+            new JedecDRAMSystem(*config_, config_->output_dir, read_callback,
+                                write_callback, &timing);
+    }
+}
+
 MemorySystem::~MemorySystem() {
     delete (dram_system_);
     delete (config_);
@@ -23,6 +37,18 @@ MemorySystem::~MemorySystem() {
 
 void MemorySystem::ClockTick() { dram_system_->ClockTick(); }
 
+uint64_t MemorySystem::NextEventCycle() const {
+    return dram_system_->NextEventCycle();
+}
+
+void MemorySystem::SkipCycles(uint64_t cycles) {
+    dram_system_->SkipCycles(cycles);
+}
+
+void MemorySystem::SetQuietUntil(uint64_t clk) {
+    dram_system_->SetQuietUntil(clk);
+}
+
 double MemorySystem::GetTCK() const { return config_->tCK; }
 
 int MemorySystem::GetBusBits() const { return config_->bus_width; }
@@ -52,12 +78,70 @@ bool MemorySystem::AddTransaction(uint64_t hex_addr, bool is_write) {
     return dram_system_->AddTransaction(hex_addr, is_write);
 }
 
+bool MemorySystem::AddPimTransaction(const PimTransaction &pim) {
+    return dram_system_->AddPimTransaction(pim);
+}
+
+bool MemorySystem::WillAcceptPimKernel(int tenant) const {
+    return dram_system_->WillAcceptPimKernel(tenant);
+}
+
+bool MemorySystem::SubmitPimKernel(const PimKernelDesc &desc) {
+    return dram_system_->SubmitPimKernel(desc);
+}
+
+void MemorySystem::SetTenants(const PimTenants &tenants) {
+    dram_system_->SetTenants(tenants);
+}
+
+bool MemorySystem::WillAcceptPimTransaction(int tenant) const {
+    return dram_system_->WillAcceptPimTransaction(tenant);
+}
+
+std::vector<PimTenantStats> MemorySystem::TenantStats() const {
+    return dram_system_->TenantStats();
+}
+
 bool MemorySystem::turnOff() {
     return dram_system_->turn_off;
 }
 
 void MemorySystem::PrintStats() const { dram_system_->PrintStats(); }
 
+nlohmann::json MemorySystem::FinalStats() const {
+    return dram_system_->FinalStats();
+}
+
+double MemorySystem::Energy() const { return dram_system_->Energy(); }
+
+uint64_t MemorySystem::Count(const std::string &name) const {
+    return dram_system_->Count(name);
+}
+
+const std::vector<uint64_t> &MemorySystem::ComputationEndCycles() const {
+    return dram_system_->computation_end_cycles;
+}
+
+uint64_t MemorySystem::RefreshStallCycles() const {
+    return dram_system_->refresh_stall_cycles;
+}
+
+uint64_t MemorySystem::KernelsFinished() const {
+    return dram_system_->kernels_finished;
+}
+
+uint64_t MemorySystem::PipelineStagedCycles() const {
+    return dram_system_->pipeline_staged_cycles;
+}
+
+void MemorySystem::SaveCheckpoint(CheckpointWriter &out) const {
+    dram_system_->SaveCheckpoint(out);
+}
+
+void MemorySystem::RestoreCheckpoint(CheckpointReader &in) {
+    dram_system_->RestoreCheckpoint(in);
+}
+
 void MemorySystem::ResetStats() { dram_system_->ResetStats(); }
 
 MemorySystem* GetMemorySystem(const std::string &config_file, const std::string &output_dir,
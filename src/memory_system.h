@@ -16,8 +16,15 @@ class MemorySystem {
     MemorySystem(const std::string &config_file, const std::string &output_dir,
                  std::function<void(uint64_t)> read_callback,
                  std::function<void(uint64_t)> write_callback);
+    // runs on a copy of an already parsed config and its timing tables
+    MemorySystem(const Config &config, const Timing &timing,
+                 std::function<void(uint64_t)> read_callback,
+                 std::function<void(uint64_t)> write_callback);
     ~MemorySystem();
     void ClockTick();
+    uint64_t NextEventCycle() const;
+    void SkipCycles(uint64_t cycles);
+    void SetQuietUntil(uint64_t clk);
     void RegisterCallbacks(std::function<void(uint64_t)> read_callback,
                            std::function<void(uint64_t)> write_callback);
     double GetTCK() const;
@@ -25,12 +32,30 @@ class MemorySystem {
     int GetBurstLength() const;
     int GetQueueSize() const;
     void PrintStats() const;
+    nlohmann::json FinalStats() const;
+    double Energy() const;
+    uint64_t Count(const std::string &name) const;
+    const std::vector<uint64_t> &ComputationEndCycles() const;
+    uint64_t RefreshStallCycles() const;
+    uint64_t KernelsFinished() const;
+    uint64_t PipelineStagedCycles() const;
+    void SaveCheckpoint(CheckpointWriter &out) const;
+    void RestoreCheckpoint(CheckpointReader &in);
     void ResetStats();
 
     bool WillAcceptTransaction() const;
     bool AddTransaction(uint64_t hex_addr);
     bool WillAcceptTransaction(uint64_t hex_addr, bool is_write) const;
     bool AddTransaction(uint64_t hex_addr, bool is_write);
+    bool AddPimTransaction(const PimTransaction &pim);
+    // a whole kernel, see PimKernelDesc; the tenant is the kernel's own in
+    // multi-tenant mode
+    bool WillAcceptPimKernel(int tenant = 0) const;
+    bool SubmitPimKernel(const PimKernelDesc &desc);
+    // multi-tenant PIM mode, see PimTenants
+    void SetTenants(const PimTenants &tenants);
+    bool WillAcceptPimTransaction(int tenant) const;
+    std::vector<PimTenantStats> TenantStats() const;
     bool turnOff();
 
    private:
@@ -0,0 +1,525 @@
+#include "pim_kernel.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include "common.h"
+
+namespace dramsim3 {
+
+namespace {
+// field widths in bits
+const int bw_cutNo = 4;
+const int bw_vcuts = 3;
+const int bw_hcuts = 1;
+const int bw_mcf = 3;
+const int bw_ucf = 3;
+const int bw_df = 1;
+const int bw_Mtile = 4;
+const int bw_kernelSize = 5;
+const int bw_stride = 5;
+const int bw_dimValue = 32;
+const int bw_baseRow = 22;
+const int bw_loadType = 2;
+
+const char *const kVpuOpNames[] = {"softmax", "layernorm", "gelu", "add"};
+
+// a workload line is a comma separated list of integers
+bool ReadWorkloadLine(std::ifstream &in, std::vector<int64_t> &values) {
+    std::string line;
+    if (!std::getline(in, line)) return false;
+    std::replace(line.begin(), line.end(), ',', ' ');
+    std::istringstream fields(line);
+    values.clear();
+    int64_t value;
+    while (fields >> value) values.push_back(value);
+    return fields.eof();
+}
+
+bool IsPowerOfTwo(int64_t value) {
+    return value > 0 && (value & (value - 1)) == 0;
+}
+
+void WorkloadError(const std::string &name, const std::string &error) {
+    std::cerr << "Workload " << name << ": " << error << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+}
+
+void TenantError(const std::string &name, const std::string &error) {
+    std::cerr << "Tenant file " << name << ": " << error << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+}
+
+// a whole word, or a comma separated list of integers
+bool ReadIntegers(const std::string &text, std::vector<int64_t> &values) {
+    std::string list = text;
+    std::replace(list.begin(), list.end(), ',', ' ');
+    std::istringstream fields(list);
+    values.clear();
+    int64_t value;
+    while (fields >> value) values.push_back(value);
+    return fields.eof() && !values.empty();
+}
+}  // namespace
+
+bool ParseVpuOp(const std::string &name, PimVpuOp &op) {
+    for (int i = 0; i < 4; i++) {
+        if (name != kVpuOpNames[i]) continue;
+        op = static_cast<PimVpuOp>(i);
+        return true;
+    }
+    return false;
+}
+
+std::string VpuOpName(PimVpuOp op) {
+    return kVpuOpNames[static_cast<int>(op)];
+}
+
+PimTransaction DecodePimTransaction(uint64_t addr) {
+    PimTransaction trans;
+    uint64_t address = addr;
+    int vpu_op = (addr >> 1) & ((1 << bw_cutNo) - 1);
+    if (addr & 1) {
+        trans.type = PimTransType::LAUNCH;
+        trans.cut_mask = address >> 1;
+    } else if ((addr & (1 << 6)) && (addr & (1 << 5)) && vpu_op != 0) {
+        trans.type = PimTransType::VPU;
+        trans.vpu_op = static_cast<PimVpuOp>((vpu_op - 1) & 3);
+        address = address >> 1 >> 4 >> 2;
+        trans.vpu_elements = address & (((uint64_t)1 << bw_dimValue) - 1);
+        address = address >> bw_dimValue;
+        trans.vpu_vectors = address & ((1 << bw_baseRow) - 1);
+    } else if ((addr & (1 << 6)) && (addr & (1 << 5))) {
+        trans.type = PimTransType::DATAFLOW;
+        address = address >> 1 >> 4 >> 2;  // trans_type, cut_no, loadType
+        trans.vcuts = 1 << (address & ((1 << bw_vcuts) - 1));
+        address = address >> bw_vcuts;
+        trans.hcuts = 1 << (address & ((1 << bw_hcuts) - 1));
+        address = address >> bw_hcuts;
+        trans.mcf = 1 << (address & ((1 << bw_mcf) - 1));
+        address = address >> bw_mcf;
+        trans.ucf = 1 << (address & ((1 << bw_ucf) - 1));
+        address = address >> bw_ucf;
+        trans.df = address & ((1 << bw_df) - 1);
+        address = address >> bw_df;
+        trans.M_tile_size = 1 << (address & ((1 << bw_Mtile) - 1));
+        address = address >> bw_Mtile;
+        trans.vcuts_next = 1 << (address & ((1 << bw_vcuts) - 1));
+        address = address >> bw_vcuts;
+        trans.hcuts_next = 1 << (address & ((1 << bw_hcuts) - 1));
+        address = address >> bw_hcuts;
+        trans.kernel_size = address & ((1 << bw_kernelSize) - 1);
+        address = address >> bw_kernelSize;
+        trans.stride = address & ((1 << bw_stride) - 1);
+    } else {
+        trans.type = PimTransType::WORKLOAD;
+        address = address >> 1;
+        trans.cut_no = address & ((1 << bw_cutNo) - 1);
+        address = address >> 4;
+        trans.load_type = address & ((1 << bw_loadType) - 1);
+        address = address >> bw_loadType;
+        trans.dim_value = address & (((uint64_t)1 << bw_dimValue) - 1);
+        address = address >> bw_dimValue;
+        trans.base_row = address & ((1 << bw_baseRow) - 1);
+    }
+    return trans;
+}
+
+PimWorkload ReadPimWorkload(const std::string &file_name) {
+    std::ifstream in(file_name);
+    if (in.fail()) WorkloadError(file_name, "can't open");
+    std::vector<int64_t> values;
+    PimWorkload workload;
+    workload.name = file_name;
+    // a VPU op is named, a matmul starts with its partition
+    std::string line;
+    std::getline(in, line);
+    std::replace(line.begin(), line.end(), ',', ' ');
+    std::istringstream fields(line);
+    std::string op;
+    if (fields >> op && !std::isdigit(static_cast<unsigned char>(op[0]))) {
+        if (!ParseVpuOp(op, workload.vpu_op) ||
+            !(fields >> workload.vpu_elements >> workload.vpu_vectors) ||
+            !(fields >> std::ws).eof()) {
+            WorkloadError(file_name,
+                          "a VPU op is a line op, elements, vectors with op "
+                          "softmax, layernorm, gelu or add");
+        }
+        return workload;
+    }
+    in.clear();
+    in.seekg(0);
+    if (!ReadWorkloadLine(in, values) ||
+        (values.size() != 7 && values.size() != 9)) {
+        WorkloadError(file_name,
+                      "first line must be cutV, cutH, tile_M, post_delay, "
+                      "mcf, ucf, df[, kernel_size, stride]");
+    }
+    workload.vcuts = values[0];
+    workload.hcuts = values[1];
+    workload.M_tile_size = values[2];
+    workload.post_delay = values[3];
+    workload.mcf = values[4];
+    workload.ucf = values[5];
+    workload.df = values[6];
+    if (values.size() == 9) {
+        workload.kernel_size = values[7];
+        workload.stride = values[8];
+    }
+    // PimKernel() rejects bad cut counts
+    int64_t cuts = workload.vcuts * workload.hcuts;
+    for (int64_t i = 0; i < cuts && i < 32; i++) {
+        if (!ReadWorkloadLine(in, values) || values.size() != 3) {
+            WorkloadError(file_name, "expected an M, K, N line for cut " +
+                                         std::to_string(i));
+        }
+        workload.dims.push_back({values[0], values[1], values[2]});
+    }
+    return workload;
+}
+
+std::string PimWorkloadError(const PimWorkload &workload) {
+    if (workload.vpu_vectors != 0) {
+        // the field widths of its transaction
+        if (workload.vpu_elements < 1 ||
+            workload.vpu_elements > std::numeric_limits<int>::max() ||
+            workload.vpu_vectors < 1 ||
+            workload.vpu_vectors >= (1 << bw_baseRow)) {
+            return "VPU elements or vectors out of range";
+        }
+        return "";
+    }
+    for (int64_t value : {workload.vcuts, workload.hcuts,
+                          workload.M_tile_size, workload.mcf, workload.ucf}) {
+        if (!IsPowerOfTwo(value) || value > (1 << 30)) {
+            return "cutV, cutH, tile_M, mcf and ucf must be powers of two";
+        }
+    }
+    int64_t df = workload.df;
+    if (df != 0 && df != 1) return "df must be 0 or 1";
+    // both are 5 bit fields of the dataflow configuration
+    int64_t kernel_size = workload.kernel_size;
+    int64_t stride = workload.stride;
+    if (kernel_size != 0 || stride != 0) {
+        if (df != 0) return "a convolution must have df 0";
+        if (kernel_size < 1 || kernel_size > 31 || stride < 1 || stride > 31)
+            return "kernel_size and stride must be 1 to 31";
+    }
+    // launch masks are built with int shifts
+    int64_t cuts = workload.vcuts * workload.hcuts;
+    if (cuts > 31) return "at most 31 cuts";
+    if (static_cast<int64_t>(workload.dims.size()) != cuts) {
+        return "expected one M, K, N per cut";
+    }
+    // the batch shares the PE columns of a tile (128 / cutV)
+    int64_t tile_columns = 128 / workload.vcuts;
+    for (const auto &dims : workload.dims) {
+        if (df == 1 && dims[2] > 1 && dims[2] * workload.ucf > tile_columns &&
+            dims[2] * workload.ucf % tile_columns != 0) {
+            return "a batched GEMV needs N * ucf to fit or fill the 128 / "
+                   "cutV columns of a tile";
+        }
+        if (kernel_size == 0) continue;
+        int64_t width = std::llround(std::sqrt(static_cast<double>(dims[0])));
+        if (width * width != dims[0] ||
+            dims[1] % (kernel_size * kernel_size) != 0) {
+            return "a convolution needs a square output (M) and K = "
+                   "kernel_size^2 input channels";
+        }
+    }
+
+    int64_t sequences = workload.sequences;
+    if (sequences < 1 || (sequences > 1 && df != 1)) {
+        return "only a GEMV can run once per sequence";
+    }
+    return "";
+}
+
+PimKernelDesc PimKernelDescription(const PimWorkload &workload) {
+    const std::string &name = workload.name;
+    std::string error = PimWorkloadError(workload);
+    if (!error.empty()) WorkloadError(name, error);
+    if (workload.vpu_vectors != 0) {
+        PimKernelDesc desc;
+        desc.vpu_op = workload.vpu_op;
+        desc.vpu_elements = workload.vpu_elements;
+        desc.vpu_vectors = workload.vpu_vectors;
+        return desc;
+    }
+    int64_t df = workload.df;
+    int64_t kernel_size = workload.kernel_size;
+    int64_t stride = workload.stride;
+    int64_t cuts = workload.vcuts * workload.hcuts;
+    int64_t sequences = workload.sequences;
+
+    PimKernelDesc desc;
+    desc.vcuts = workload.vcuts;
+    desc.hcuts = workload.hcuts;
+    desc.mcf = workload.mcf;
+    desc.ucf = workload.ucf;
+    desc.df = df;
+    desc.M_tile_size = workload.M_tile_size;
+    desc.kernel_size = kernel_size;
+    desc.stride = stride;
+
+    for (int i = 0; i < cuts; i++) {
+        const auto &dims = workload.dims[i];
+        PimKernelDesc::Cut cut;
+        cut.cut_no = i;
+        // same operand layout as gen_pim_trace2.py, without its field widths
+        for (int j = 0; j < 3; j++) {
+            int64_t dim = dims[j];
+            if (df == 0 && j == 0) {
+                dim = dim / 2;  // GEMM interleaving
+            } else if (df == 1) {
+                if (j == 0) {
+                    dim = std::max<int64_t>(1, dim / workload.mcf);
+                } else if (j == 1) {
+                    dim = std::max<int64_t>(1, dim / workload.ucf);
+                } else {
+                    dim = dim * workload.ucf;
+                }
+            }
+            if (dim < 0 || dim > std::numeric_limits<int>::max()) {
+                WorkloadError(name, "dimension out of range");
+            }
+            // inputs and outputs are placed after the weights
+            uint64_t base_row = 0;
+            if (df == 0 && j != 0) {
+                base_row = dims[1] * dims[2] / 1024 + 1;
+            } else if (df == 1 && j != 2) {
+                base_row = sequences * (dims[0] * dims[1] / 1024 + 1);
+                // a batch of inputs takes rows of its own
+                if (j == 1 && dims[2] > 1) {
+                    base_row += dims[1] * dims[2] / 1024 + 1;
+                }
+            }
+            if (j == 0) {
+                cut.M = static_cast<int>(dim);
+                cut.base_row_w = base_row;
+            } else if (j == 1) {
+                cut.K = static_cast<int>(dim);
+                cut.base_row_out = base_row;
+            } else {
+                cut.N = static_cast<int>(dim);
+                cut.base_row_in = base_row;
+            }
+        }
+        // each sequence's matrix follows the previous one's
+        for (int64_t s = 0; s < sequences && sequences > 1; s++) {
+            cut.seq_base_rows_in.push_back(s * (dims[0] * dims[1] / 1024 + 1));
+        }
+        desc.cuts.push_back(cut);
+    }
+    return desc;
+}
+
+std::vector<PimTransaction> PimKernelTransactions(const PimKernelDesc &desc) {
+    if (desc.vpu_vectors > 0) {
+        PimTransaction vpu;
+        vpu.type = PimTransType::VPU;
+        vpu.vpu_op = desc.vpu_op;
+        vpu.vpu_elements = desc.vpu_elements;
+        vpu.vpu_vectors = desc.vpu_vectors;
+        vpu.tenant = desc.tenant;
+        return {vpu};
+    }
+    size_t sequences = 1;
+    for (const auto &cut : desc.cuts) {
+        sequences = std::max(sequences, cut.seq_base_rows_in.size());
+    }
+    std::vector<PimTransaction> kernel;
+    for (size_t s = 0; s < sequences; s++) {
+        PimTransaction dataflow;
+        dataflow.type = PimTransType::DATAFLOW;
+        dataflow.vcuts = desc.vcuts;
+        dataflow.hcuts = desc.hcuts;
+        dataflow.mcf = desc.mcf;
+        dataflow.ucf = desc.ucf;
+        dataflow.df = desc.df;
+        dataflow.M_tile_size = desc.M_tile_size;
+        // the next sequence keeps the partition
+        bool last = s + 1 == sequences;
+        dataflow.vcuts_next = last ? desc.vcuts_next : desc.vcuts;
+        dataflow.hcuts_next = last ? desc.hcuts_next : desc.hcuts;
+        dataflow.kernel_size = desc.kernel_size;
+        dataflow.stride = desc.stride;
+        dataflow.tenant = desc.tenant;
+        kernel.push_back(dataflow);
+
+        uint64_t cut_mask = 0;
+        for (const auto &cut : desc.cuts) {
+            cut_mask |= 1ULL << cut.cut_no;
+            const int dims[3] = {cut.M, cut.K, cut.N};
+            const uint64_t base_rows[3] = {
+                cut.base_row_w, cut.base_row_out,
+                cut.seq_base_rows_in.empty() ? cut.base_row_in
+                                             : cut.seq_base_rows_in[s]};
+            for (int j = 0; j < 3; j++) {
+                PimTransaction load;
+                load.type = PimTransType::WORKLOAD;
+                load.cut_no = cut.cut_no;
+                load.load_type = j;
+                load.dim_value = dims[j];
+                load.base_row = base_rows[j];
+                if (j == 2) {
+                    load.M_cap = cut.M_cap;
+                    load.K_cap = cut.K_cap;
+                    load.append_from = cut.append_from;
+                    load.append_to = cut.append_to;
+                }
+                load.tenant = desc.tenant;
+                kernel.push_back(load);
+            }
+        }
+
+        PimTransaction launch;
+        launch.type = PimTransType::LAUNCH;
+        launch.cut_mask = desc.cut_mask != 0 ? desc.cut_mask : cut_mask;
+        launch.tenant = desc.tenant;
+        kernel.push_back(launch);
+    }
+    return kernel;
+}
+
+std::vector<PimTransaction> PimKernel(const PimWorkload &workload) {
+    return PimKernelTransactions(PimKernelDescription(workload));
+}
+
+std::vector<PimTransaction> PimKernels(
+    const std::vector<PimWorkload> &workloads) {
+    std::vector<PimTransaction> kernels;
+    for (size_t i = 0; i < workloads.size(); i++) {
+        PimKernelDesc desc = PimKernelDescription(workloads[i]);
+        // the next matmul, past the VPU ops in between
+        for (size_t j = i + 1; j < workloads.size(); j++) {
+            if (workloads[j].vpu_vectors != 0) continue;
+            desc.vcuts_next = workloads[j].vcuts;
+            desc.hcuts_next = workloads[j].hcuts;
+            break;
+        }
+        auto kernel = PimKernelTransactions(desc);
+        kernels.insert(kernels.end(), kernel.begin(), kernel.end());
+    }
+    return kernels;
+}
+
+PimTenants ReadPimTenants(const std::string &file_name) {
+    std::ifstream in(file_name);
+    if (in.fail()) TenantError(file_name, "can't open");
+    PimTenants tenants;
+    bool partitioned = false;
+    int cuts = 0;
+    uint64_t owned = 0;
+    std::string line;
+    std::vector<int64_t> values;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::vector<std::string> words;
+        std::string word;
+        while (fields >> word) words.push_back(word);
+        if (words.empty() || words[0][0] == '#') continue;
+        if (!partitioned) {
+            std::vector<int64_t> hcuts;
+            if (words.size() != 2 || !ReadIntegers(words[0], values) ||
+                values.size() != 1 || !ReadIntegers(words[1], hcuts) ||
+                hcuts.size() != 1) {
+                TenantError(file_name, "first line must be cutV cutH");
+            }
+            if (!IsPowerOfTwo(values[0]) || !IsPowerOfTwo(hcuts[0]) ||
+                values[0] * hcuts[0] > 31) {
+                TenantError(file_name,
+                            "cutV and cutH must be powers of two, with at "
+                            "most 31 cuts");
+            }
+            tenants.vcuts = values[0];
+            tenants.hcuts = hcuts[0];
+            cuts = tenants.vcuts * tenants.hcuts;
+            partitioned = true;
+            continue;
+        }
+        if (words.size() < 5) {
+            TenantError(file_name, "expected name cuts weight priority "
+                                   "workload... in: " + line);
+        }
+        PimTenant tenant;
+        tenant.name = words[0];
+        if (!ReadIntegers(words[1], values)) {
+            TenantError(file_name, "bad cut list of tenant " + tenant.name);
+        }
+        for (int64_t cut : values) {
+            if (cut < 0 || cut >= cuts) {
+                TenantError(file_name, "tenant " + tenant.name + " has cut " +
+                                           std::to_string(cut) +
+                                           " outside the array");
+            }
+            if ((owned | tenant.cut_mask) & (1ULL << cut)) {
+                TenantError(file_name, "cut " + std::to_string(cut) +
+                                           " is owned twice");
+            }
+            tenant.cut_mask |= 1ULL << cut;
+        }
+        owned |= tenant.cut_mask;
+        std::vector<int64_t> priority;
+        if (!ReadIntegers(words[2], values) || values.size() != 1 ||
+            values[0] < 1 || values[0] > 1000000 ||
+            !ReadIntegers(words[3], priority) || priority.size() != 1 ||
+            priority[0] < 0 || priority[0] > 1000000) {
+            TenantError(file_name, "tenant " + tenant.name +
+                                       " needs a weight >= 1 and a "
+                                       "priority >= 0");
+        }
+        tenant.weight = values[0];
+        tenant.priority = priority[0];
+        int64_t tenant_cuts = 0;
+        for (int i = 0; i < cuts; i++) tenant_cuts += tenant.cut_mask >> i & 1;
+        for (size_t i = 4; i < words.size(); i++) {
+            PimWorkload workload = ReadPimWorkload(words[i]);
+            if (workload.vpu_vectors != 0) {
+                TenantError(file_name, "workload " + words[i] +
+                                           " is a VPU op, tenants only run "
+                                           "matmuls");
+            }
+            if (workload.vcuts * workload.hcuts != tenant_cuts) {
+                TenantError(file_name, "workload " + words[i] + " has " +
+                                           std::to_string(workload.vcuts *
+                                                          workload.hcuts) +
+                                           " cuts, tenant " + tenant.name +
+                                           " owns " +
+                                           std::to_string(tenant_cuts));
+            }
+            tenant.kernels.push_back(workload);
+        }
+        tenants.tenants.push_back(tenant);
+    }
+    if (tenants.tenants.empty()) TenantError(file_name, "no tenants");
+    return tenants;
+}
+
+std::vector<PimTransaction> PimTenantKernel(const PimTenants &tenants,
+                                            int tenant,
+                                            const PimWorkload &workload) {
+    const PimTenant &owner = tenants.tenants[tenant];
+    std::vector<int> cuts;
+    for (int i = 0; i < 64; i++) {
+        if (owner.cut_mask >> i & 1) cuts.push_back(i);
+    }
+    std::vector<PimTransaction> kernel = PimKernel(workload);
+    for (auto &trans : kernel) {
+        trans.tenant = tenant;
+        if (trans.type == PimTransType::DATAFLOW) {
+            trans.vcuts = tenants.vcuts;
+            trans.hcuts = tenants.hcuts;
+        } else if (trans.type == PimTransType::WORKLOAD) {
+            trans.cut_no = cuts[trans.cut_no];
+        } else {
+            trans.cut_mask = owner.cut_mask;
+        }
+    }
+    return kernel;
+}
+
+}  // namespace dramsim3
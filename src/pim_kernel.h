@@ -0,0 +1,199 @@
+#ifndef __PIM_KERNEL_H
+#define __PIM_KERNEL_H
+
+#include <stdint.h>
+#include <array>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace dramsim3 {
+
+// A PIM transaction is told apart by the LSBs of its address: bit 0 launches
+// the configured cuts, bits 5 and 6 load the dataflow configuration, anything
+// else loads one dimension of a cut's workload. A dataflow address with a
+// nonzero cut number (bits 1 to 4, op + 1) runs a VPU op instead, with the
+// elements and vectors where a workload has its dimension and base row.
+enum class PimTransType { LAUNCH, DATAFLOW, WORKLOAD, VPU };
+
+// The vector ops of the VPU, which work on the outputs of the kernel before
+// them and feed the kernel after them (see JedecDRAMSystem::VpuCycles())
+enum class PimVpuOp { SOFTMAX, LAYERNORM, GELU, ADD };
+
+// "softmax", "layernorm", "gelu" or "add", false for any other name
+bool ParseVpuOp(const std::string &name, PimVpuOp &op);
+std::string VpuOpName(PimVpuOp op);
+
+struct PimTransaction {
+    PimTransType type;
+    // launch: one bit per cut
+    uint64_t cut_mask = 0;
+    // dataflow configuration
+    int vcuts = 0;
+    int hcuts = 0;
+    int mcf = 0;
+    int ucf = 0;
+    int df = 0;
+    int M_tile_size = 0;
+    int vcuts_next = 0;
+    int hcuts_next = 0;
+    int kernel_size = 0;
+    int stride = 0;
+    // workload configuration, load_type 0: M/weight, 1: K/output, 2: N/input
+    int cut_no = 0;
+    int load_type = 0;
+    int dim_value = 0;
+    uint64_t base_row = 0;
+    // input of a KV cache (see KvCache), not part of the address encoding
+    int M_cap = 0;
+    int K_cap = 0;
+    int append_from = 0;
+    int append_to = 0;
+    // VPU op on vpu_vectors vectors of vpu_elements elements each
+    PimVpuOp vpu_op = PimVpuOp::SOFTMAX;
+    int vpu_elements = 0;
+    int vpu_vectors = 0;
+    // queue of the tenant that issued it, see PimTenants
+    int tenant = 0;
+};
+
+PimTransaction DecodePimTransaction(uint64_t addr);
+
+// A matmul kernel as described by a workload file: a first line
+// "cutV, cutH, tile_M, post_delay, mcf, ucf, df" followed by one "M, K, N"
+// line per cut. post_delay is not modeled.
+// A GEMV (df 1) is M, K, N with a batch of N input vectors, which share
+// each streamed row of the matrix.
+// A convolution (df 0) appends "kernel_size, stride" to the first line. Its
+// M, K, N are those of the flattened GEMM: M output pixels of a square
+// output, K = kernel_size^2 input channels, N output channels. The input
+// feature map is read instead of an im2col matrix.
+// A VPU op has a single line "op, elements, vectors" instead, e.g.
+// "softmax, 1024, 12" for the attention scores of 12 heads.
+struct PimWorkload {
+    std::string name;
+    int64_t vcuts = 1;
+    int64_t hcuts = 1;
+    int64_t M_tile_size = 2048;
+    int64_t post_delay = 8;
+    int64_t mcf = 1;
+    int64_t ucf = 1;
+    int64_t df = 0;
+    int64_t kernel_size = 0;
+    int64_t stride = 0;
+    std::vector<std::array<int64_t, 3>> dims;
+    // Not part of the file: a GEMV run once per sequence, each with its own
+    // matrix (e.g. the KV cache of an attention kernel)
+    int64_t sequences = 1;
+    // a VPU op if vpu_vectors > 0, without any of the above
+    PimVpuOp vpu_op = PimVpuOp::SOFTMAX;
+    int64_t vpu_elements = 0;
+    int64_t vpu_vectors = 0;
+};
+
+PimWorkload ReadPimWorkload(const std::string &file_name);
+
+// A whole kernel for MemorySystem::SubmitPimKernel(): what its dataflow,
+// workload and launch transactions carry, without the address encoding
+struct PimKernelDesc {
+    // dataflow configuration
+    int vcuts = 1;
+    int hcuts = 1;
+    int mcf = 1;
+    int ucf = 1;
+    int df = 0;
+    int M_tile_size = 2048;
+    int vcuts_next = 1;
+    int hcuts_next = 1;
+    int kernel_size = 0;
+    int stride = 0;
+    // The workload of a cut, with the dimensions the scheduler iterates
+    // over (e.g. GEMM interleaving halves M, see PimKernelDescription())
+    // and the base rows of the weight, output and input operands
+    struct Cut {
+        int cut_no = 0;
+        int M = 0;
+        int K = 0;
+        int N = 0;
+        uint64_t base_row_w = 0;
+        uint64_t base_row_out = 0;
+        uint64_t base_row_in = 0;
+        // if not empty, the cut runs once per sequence, streaming its input
+        // from each of these base rows in turn
+        std::vector<uint64_t> seq_base_rows_in;
+        // A GEMV input that is a KV cache is laid out for M_cap steps of M
+        // (keys) or K_cap of K (values) so that it can grow in place, and
+        // the tokens [append_from, append_to) are written to it before it
+        // is streamed. 0 caps are a dense layout of M x K.
+        int M_cap = 0;
+        int K_cap = 0;
+        int append_from = 0;
+        int append_to = 0;
+    };
+    std::vector<Cut> cuts;
+    // cuts to launch, 0 launches every cut in cuts
+    uint64_t cut_mask = 0;
+    // a VPU op instead of a matmul if vpu_vectors > 0, without cuts
+    PimVpuOp vpu_op = PimVpuOp::SOFTMAX;
+    int vpu_elements = 0;
+    int vpu_vectors = 0;
+    // queue of the tenant that runs it in multi-tenant mode
+    int tenant = 0;
+    // called with id once the last output of the kernel is written
+    uint64_t id = 0;
+    std::function<void(uint64_t)> callback;
+};
+
+// why PimKernelDescription() rejects a workload, empty if it does not
+std::string PimWorkloadError(const PimWorkload &workload);
+
+// The kernel of a workload, with the operand layout of gen_pim_trace2.py
+PimKernelDesc PimKernelDescription(const PimWorkload &workload);
+
+// The transactions of a kernel, in the order gen_pim_trace2.py puts them in
+// a trace: the dataflow, M/K/N of every cut, then the launch, once per
+// sequence. A VPU op is a single transaction.
+std::vector<PimTransaction> PimKernelTransactions(const PimKernelDesc &desc);
+
+// the transactions of a workload's kernel
+std::vector<PimTransaction> PimKernel(const PimWorkload &workload);
+
+// The transactions of kernels that run back to back, e.g. the layers of a
+// model. Each kernel's dataflow announces the partition of the next one
+// (vcuts_next, hcuts_next), so that it can be configured early (see
+// pipeline_layers).
+std::vector<PimTransaction> PimKernels(
+    const std::vector<PimWorkload> &workloads);
+
+// A tenant of a multi-tenant run: the cuts of the array it owns, its weight
+// and priority in the arbitration of the channels it shares with other
+// tenants, and the kernels it runs in order
+struct PimTenant {
+    std::string name;
+    uint64_t cut_mask = 0;
+    int weight = 1;
+    int priority = 0;
+    std::vector<PimWorkload> kernels;
+};
+
+// A tenant file: a first line "cutV cutH" partitioning the array, then one
+// line "name cuts weight priority workload..." per tenant, where cuts is a
+// comma separated list of cut numbers. Each workload must have one M, K, N
+// line per cut of its tenant, VPU ops are not supported. Lines starting with
+// # are comments.
+struct PimTenants {
+    int vcuts = 1;
+    int hcuts = 1;
+    std::vector<PimTenant> tenants;
+};
+
+PimTenants ReadPimTenants(const std::string &file_name);
+
+// The transactions of one kernel of a tenant: the workload's cuts are the
+// tenant's cuts in ascending order, and the array keeps its partition
+std::vector<PimTransaction> PimTenantKernel(const PimTenants &tenants,
+                                            int tenant,
+                                            const PimWorkload &workload);
+
+}  // namespace dramsim3
+#endif
@@ -0,0 +1,395 @@
+#include "pim_model.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace dramsim3 {
+
+namespace {
+
+// rows a run of count columns from offset touches, a row closing every
+// period columns
+int64_t Rows(int64_t offset, int64_t count, int64_t period) {
+    if (count <= 0) return 0;
+    return (offset % period + count - 1) / period + 1;
+}
+
+// what one cut spends, cycles of each phase and commands of all its lanes
+struct CutCost {
+    double load = 0.0;
+    double stream = 0.0;
+    double drain = 0.0;
+    double output = 0.0;
+    double acts = 0.0;
+    double gh_reads = 0.0;
+    double lh_reads = 0.0;
+    double writes = 0.0;
+    // when outputs wait for a refresh to open their row again
+    std::vector<double> refresh_waits;
+    double Cycles() const { return load + stream + drain + output; }
+};
+
+// The input reads of each M tile of a convolution and where they start,
+// as JedecDRAMSystem::CompileConvInput() lays them out
+void ConvInput(const PimKernelDesc &desc, const PimKernelDesc::Cut &cut,
+               int64_t K_tiles, std::vector<int64_t> &reads,
+               std::vector<int64_t> &offsets) {
+    int64_t M = cut.M;
+    int64_t k = desc.kernel_size;
+    int64_t s = std::max(1, desc.stride);
+    int64_t pixels = 2 * M;
+    int64_t width = std::ceil(std::sqrt(static_cast<double>(pixels)));
+    int64_t in_width = (width - 1) * s + k;
+    int64_t offset = 0;
+    for (int64_t m = 0; m < M; m += desc.M_tile_size) {
+        int64_t steps = std::min<int64_t>(desc.M_tile_size, M - m);
+        int64_t first = 2 * m;
+        int64_t last = std::min(2 * (m + steps), pixels) - 1;
+        int64_t rows = last / width - first / width + 1;
+        int64_t in_rows = std::min((rows - 1) * s + k, rows * k);
+        int64_t in_pixels =
+            in_rows * (rows == 1 ? (last - first) * s + k : in_width);
+        int64_t tile_reads = (in_pixels - 1) / (2 * k * k) + 1;
+        tile_reads = std::min(tile_reads, steps);
+        reads.push_back(tile_reads);
+        offsets.push_back(offset);
+        offset += tile_reads * K_tiles;
+    }
+}
+
+CutCost EstimateCut(const Config &config, const PimKernelDesc &desc,
+                    const PimKernelDesc::Cut &cut) {
+    const int cols = config.columns / config.BL;
+    // a PIM read or write of a bank every column cycle, a row is closed
+    // tRTP (tWR after the write data) and tRP before the next is opened
+    const int column = std::max(config.burst_cycle, config.tCCD_S);
+    const int read_to_act = config.AL + config.tRTP + config.tRP;
+    const int write_to_act =
+        config.WL + config.burst_cycle + config.tWR + config.tRP;
+    // the activations of a channel go four per tFAW
+    auto spread = [&config](int64_t acts) {
+        return (acts - 1) / 4 * config.tFAW;
+    };
+
+    int vcuts = desc.vcuts;
+    int df = desc.df;
+    int mc = desc.mcf * desc.ucf;
+    int cut_height = config.channels / desc.hcuts;
+    int cut_width = config.banks / vcuts;
+    int64_t M = std::max(1, cut.M);
+    int64_t K = std::max(1, cut.K);
+    int64_t N = std::max(1, cut.N);
+
+    // the tiling of JedecDRAMSystem::CompileCutProgram()
+    int64_t M_tile = desc.M_tile_size;
+    int64_t N_tile = 128 / vcuts;
+    int64_t K_tile = std::min<int64_t>(cut_height * 16, K);
+    int64_t M_tiles = (M - 1) / M_tile + 1;
+    int64_t N_tiles = (N - 1) / N_tile + 1;
+    int64_t K_tiles = (K - 1) / K_tile + 1;
+    int weight_stride = config.WeightBankStride(df);
+    int weight_banks = std::max(1, cut_width / weight_stride);
+    int64_t N_per_bank = std::min(N, (N_tile - 1) / weight_banks + 1);
+    int64_t w_close =
+        std::min<int64_t>({N, 128 / config.banks * weight_stride, cols});
+    int k_bound = df == 1 ? 1 : mc;
+    int cut_height_out = cut_height < vcuts ? 1 : cut_height / vcuts;
+    int batch_per_tile = 1;
+    if (df == 1)
+        batch_per_tile = std::max<int64_t>(
+            1, std::min(N, N_tile) / (mc / desc.mcf));
+    int64_t M_tile_out =
+        df == 1 ? (M_tile / 128) * desc.mcf * batch_per_tile : M_tile;
+    int64_t M_out = df == 1 ? std::max<int64_t>(
+                                  1, M * desc.mcf * batch_per_tile / 128)
+                            : M;
+    M_tile_out = std::max<int64_t>(1, M_tile_out);
+    // lanes of every vertical cut open their rows in the same channels
+    int64_t w_lanes = cut_height * weight_banks;
+    int64_t in_lanes = cut_height * mc;
+    int64_t out_lanes = cut_height_out * k_bound;
+    // cuts narrower than cutV channels write their outputs in pairs
+    double out_share = cut_height < vcuts ? 0.5 : 1.0;
+    int64_t w_acts = vcuts * weight_banks;
+    int64_t in_acts = vcuts * mc;
+    int64_t out_acts = k_bound;
+    // the controllers issue the output commands of several cuts one per
+    // cycle, those of a single cut all at once
+    int64_t out_serial = desc.vcuts * desc.hcuts > 1 ? out_acts : 1;
+    const int out_column =
+        out_serial > 1 ? std::max<int>(column, out_serial * config.tCCD_S + 1)
+                       : column;
+    // a GEMV loads its weights from its first input bank and writes its
+    // outputs to it, the other BLAS functions wait for its row to close
+    bool shared = df == 1;
+    int64_t in_cnt = std::max(
+        1, config.tCCD_L * std::max(128 / (vcuts * mc), 16) - config.tRCDRD);
+
+    std::vector<int64_t> conv_reads;
+    std::vector<int64_t> conv_offsets;
+    if (desc.kernel_size > 0)
+        ConvInput(desc, cut, K_tiles, conv_reads, conv_offsets);
+
+    CutCost cost;
+    // weight loads, the same N and K tiles for every M tile
+    double load_sum = 0.0;
+    double load_acts = 0.0;
+    for (int64_t n = 0; n < N_tiles; n++) {
+        for (int64_t k = 0; k < K_tiles; k++) {
+            int64_t offset = n * N_per_bank * K_tiles + k * N_per_bank;
+            int64_t rows = Rows(offset % cols, N_per_bank, w_close);
+            double load = rows * (spread(w_acts) + config.tRCDRD) +
+                          (rows - 1) * read_to_act +
+                          (N_per_bank - rows) * column;
+            // then streaming starts, in a shared bank once the load's row
+            // has been open for tRAS and closed
+            if (shared) {
+                load = std::max<double>(
+                    load + 2, std::max<double>(config.tRAS, load + config.AL +
+                                                                 config.tRTP) +
+                                  config.tRP);
+            } else {
+                load += 2;
+            }
+            load_sum += load;
+            load_acts += rows;
+        }
+    }
+    double loads = static_cast<double>(N_tiles * K_tiles);
+    double load_avg = load_sum / loads;
+    cost.acts += M_tiles * load_acts * w_lanes;
+    cost.gh_reads += M_tiles * loads * N_per_bank * w_lanes;
+
+    double last_drain = 0.0;
+    // the first tile is loaded before anything streams
+    double first_load = 0.0;
+    if (config.double_buffer) {
+        double window = shared ? std::max<double>(0, in_cnt + 1 - read_to_act)
+                               : in_cnt + 1;
+        first_load = std::min(std::max(0.0, load_avg - 2), window);
+    }
+    cost.load += first_load;
+    double elapsed = first_load;
+    bool row_left_open = false;
+    for (int64_t m = 0; m < M_tiles; m++) {
+        int64_t steps = std::min(M_tile, M - m * M_tile);
+        int64_t reads = desc.kernel_size > 0 ? conv_reads[m] : steps;
+        // input streaming, the same for every N tile
+        double stream = 0.0;
+        double drain = 0.0;
+        for (int64_t k = 0; k < K_tiles; k++) {
+            int64_t offset = desc.kernel_size > 0
+                                 ? conv_offsets[m] + k * reads
+                                 : m * M_tile * K_tiles + k * steps;
+            // a GEMM leaves the row open between K tiles
+            bool open = df == 0 && k > 0 && offset % cols != 0;
+            int64_t rows = Rows(offset, reads, cols);
+            int64_t acts = rows - (open ? 1 : 0);
+            double body = std::max<double>(steps - rows,
+                                           (reads - rows) * column);
+            stream += acts * (spread(in_acts) + config.tRCDRD) +
+                      (rows - 1) * read_to_act + body + (open ? column : 0);
+            cost.acts += N_tiles * acts * in_lanes;
+            (df == 0 ? cost.gh_reads : cost.lh_reads) +=
+                N_tiles * reads * in_lanes;
+            if (k + 1 < K_tiles) {
+                drain += shared ? std::max<int64_t>(in_cnt + 1, read_to_act)
+                                : in_cnt + 1;
+            }
+        }
+        // with double buffering the next tile's weights are loaded while
+        // this one streams (unless they share a bank) and drains, back to
+        // back with the previous load's row
+        double load = K_tiles * load_avg;
+        if (config.double_buffer) {
+            double window =
+                shared ? std::max<double>(0, in_cnt + 1 - read_to_act)
+                       : std::max<double>(
+                             0, stream / K_tiles + in_cnt + 1 - read_to_act);
+            double hidden = std::min(std::max(0.0, load_avg - 2), window);
+            load = K_tiles * (load_avg - hidden);
+        }
+        cost.load += N_tiles * load;
+        cost.stream += N_tiles * stream;
+        cost.drain += N_tiles * drain;
+        // the outputs of the last K tile are written while it drains,
+        // the next weight load waits for them
+        int64_t out_steps =
+            std::min(M_tile_out, M_out - std::min(M_out, m * M_tile_out));
+        for (int64_t n = 0; n < N_tiles && out_steps > 0; n++) {
+            int64_t tiles_ch = (N_tiles - 1) / vcuts + 1;
+            int64_t offset = m * M_tile_out * tiles_ch + n / vcuts * out_steps;
+            int64_t rows = Rows(offset, out_steps, cols);
+            double writes =
+                rows * (spread(out_acts) + config.tRCDWR +
+                        2 * (out_serial - 1)) +
+                (rows - 1) * write_to_act + (out_steps - rows) * out_column;
+            double start = shared ? read_to_act : 1;
+            double tile = std::max<double>(
+                start + writes + (shared ? write_to_act : 2), in_cnt + 1);
+            elapsed += load + stream + drain;
+            if (row_left_open) cost.refresh_waits.push_back(elapsed);
+            elapsed += tile;
+            cost.output += tile;
+            last_drain = tile - (start + writes + 1);
+            cost.acts += rows * out_lanes * out_share;
+            cost.writes += out_steps * out_lanes * out_share;
+            // A tile leaves its row open unless it ends the row or has the
+            // last outputs of M, and the scheduler doesn't activate it
+            // again until a refresh once the next weight load has closed it
+            // (the load shares its bank)
+            bool close = (m + 1) * M_tile_out >= M_out;
+            row_left_open =
+                shared && !close && (offset + out_steps) % cols != 0;
+        }
+        if (out_steps <= 0) {
+            cost.output += N_tiles * (in_cnt + 1);
+            elapsed += N_tiles * (load + stream + drain + in_cnt + 1);
+            last_drain = 0.0;
+        }
+    }
+    // the kernel ends with the last output
+    cost.output -= std::max(0.0, last_drain);
+    return cost;
+}
+
+}  // namespace
+
+PimCostEstimate EstimatePimKernel(const Config &config,
+                                  const PimKernelDesc &desc) {
+    PimCostEstimate estimate;
+    double background = config.channels * config.ranks;
+    if (desc.vpu_vectors > 0) {
+        estimate.cycles = 1 + VpuOpCycles(config, desc.vpu_op,
+                                          desc.vpu_elements, desc.vpu_vectors);
+        estimate.energy =
+            background * estimate.cycles * config.pre_stb_energy_inc;
+        return estimate;
+    }
+
+    int cuts = static_cast<int>(desc.cuts.size());
+    int sequences = 1;
+    double acts = 0.0;
+    double gh_reads = 0.0;
+    double lh_reads = 0.0;
+    double writes = 0.0;
+    const CutCost *slowest = nullptr;
+    std::vector<CutCost> costs;
+    for (const auto &cut : desc.cuts) {
+        costs.push_back(EstimateCut(config, desc, cut));
+        sequences = std::max<int>(sequences, cut.seq_base_rows_in.size());
+    }
+    for (const auto &cost : costs) {
+        if (!slowest || cost.Cycles() > slowest->Cycles()) slowest = &cost;
+        acts += cost.acts;
+        gh_reads += cost.gh_reads;
+        lh_reads += cost.lh_reads;
+        writes += cost.writes;
+    }
+    if (!slowest) return estimate;
+    // the transactions of the dataflow, the cuts and each launch
+    double cycles = 1 + 3 * cuts + sequences * (1 + slowest->Cycles());
+
+    // an all-bank refresh every tREFI stops the kernel for tRFC, then its
+    // rows are opened again
+    double refreshes = 0.0;
+    double total = cycles;
+    if (config.tREFI > 0 && !config.refresh_aware) {
+        // cycles of the kernel up to each output waiting for a refresh
+        std::vector<double> waits;
+        double header = 1 + 3 * cuts;
+        for (int s = 0; s < sequences; s++) {
+            double base = header + s * (1 + slowest->Cycles()) + 1;
+            for (double wait : slowest->refresh_waits)
+                waits.push_back(base + wait);
+        }
+        waits.push_back(cycles);
+        double done = 0.0;
+        total = 0.0;
+        for (size_t w = 0; w < waits.size(); w++) {
+            double start = total;
+            double work = waits[w] - done;
+            for (int i = 0; i < 4; i++) {
+                total = start + work +
+                        (std::floor(total / config.tREFI) -
+                         std::floor(start / config.tREFI)) *
+                            (config.tRFC + config.tRCDRD);
+            }
+            done = waits[w];
+            // unless a refresh has closed the row in the meantime
+            if (w + 1 < waits.size() &&
+                std::floor(total / config.tREFI) ==
+                    std::floor(start / config.tREFI)) {
+                total = (std::floor(total / config.tREFI) + 1) * config.tREFI +
+                        config.tRFC;
+            }
+        }
+        refreshes = std::floor(total / config.tREFI);
+    }
+    estimate.cycles = total;
+    estimate.load_cycles = sequences * slowest->load;
+    estimate.stream_cycles = sequences * slowest->stream;
+    estimate.drain_cycles = sequences * slowest->drain;
+    estimate.output_cycles = sequences * slowest->output;
+    estimate.refresh_cycles = total - cycles;
+    estimate.energy =
+        sequences * (acts * config.act_energy_inc +
+                     gh_reads * config.gh_read_energy_inc +
+                     lh_reads * config.lh_read_energy_inc +
+                     writes * config.pim_write_energy_inc) +
+        background * (refreshes * config.ref_energy_inc +
+                      total * config.act_stb_energy_inc);
+    return estimate;
+}
+
+uint64_t VpuOpCycles(const Config &config, PimVpuOp op, int64_t elements,
+                     int64_t vectors) {
+    // passes over each vector: softmax for its max, its exponent sum and
+    // the normalization, layernorm for its mean and variance and the
+    // normalization, the elementwise ops once
+    int passes = 1;
+    int latency = 0;
+    switch (op) {
+        case PimVpuOp::SOFTMAX:
+            passes = 3;
+            latency = config.vpu_softmax_latency;
+            break;
+        case PimVpuOp::LAYERNORM:
+            passes = 2;
+            latency = config.vpu_layernorm_latency;
+            break;
+        case PimVpuOp::GELU:
+            latency = config.vpu_gelu_latency;
+            break;
+        case PimVpuOp::ADD:
+            latency = config.vpu_add_latency;
+            break;
+    }
+    uint64_t E = std::max<int64_t>(1, elements);
+    uint64_t V = std::max<int64_t>(1, vectors);
+    uint64_t lanes = config.vpu_lanes;
+    uint64_t buffer = config.vpu_buffer;
+    // The buffer holds the vectors of a pass, which fill the pipeline once.
+    // A vector longer than the buffer is processed in parts of it, each
+    // filling the pipeline again.
+    uint64_t fills = E <= buffer ? (V - 1) / (buffer / E) + 1
+                                 : V * ((E - 1) / buffer + 1);
+    uint64_t beats = V * ((E - 1) / lanes + 1);
+    return passes * (beats + fills * latency);
+}
+
+std::string PimShapeClass(const PimKernelDesc &desc) {
+    if (desc.vpu_vectors > 0) return "VPU";
+    std::string name;
+    if (desc.df == 0) {
+        name = desc.kernel_size > 0 ? "conv" : "GEMM";
+    } else {
+        bool batched = !desc.cuts.empty() && desc.cuts[0].N > desc.ucf;
+        name = batched ? "batched GEMV" : "GEMV";
+    }
+    if (desc.vcuts * desc.hcuts > 1) name += ", split";
+    return name;
+}
+
+}  // namespace dramsim3
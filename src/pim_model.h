@@ -0,0 +1,43 @@
+#ifndef __PIM_MODEL_H
+#define __PIM_MODEL_H
+
+#include <stdint.h>
+#include <string>
+#include "configuration.h"
+#include "pim_kernel.h"
+
+namespace dramsim3 {
+
+// Closed-form cost of a PIM kernel, what the cycle simulator would report
+// for it when it runs alone. Cycles of the slowest cut, split by what it
+// waits for, and the energy (pJ) of all channels.
+struct PimCostEstimate {
+    double cycles = 0.0;
+    double energy = 0.0;
+    double load_cycles = 0.0;
+    double stream_cycles = 0.0;
+    double drain_cycles = 0.0;
+    double output_cycles = 0.0;
+    double refresh_cycles = 0.0;
+};
+
+// Follows the tile loop of the PIM scheduler (M tiles, N tiles, K tiles of
+// a weight load, input streaming and drain, outputs after the last K tile)
+// with the timing of its row activations: tRCDRD/tRCDWR to the first
+// column, tRTP/tWR + tRP to the next row, tFAW between the activations of
+// a channel, tRAS of a bank shared by two BLAS functions and tRFC every
+// tREFI. KV cache appends and refresh_aware bank refreshes are not
+// included.
+PimCostEstimate EstimatePimKernel(const Config &config,
+                                  const PimKernelDesc &desc);
+
+// cycles of a VPU op, see the [pim] vpu_* parameters
+uint64_t VpuOpCycles(const Config &config, PimVpuOp op, int64_t elements,
+                     int64_t vectors);
+
+// what calibration groups the estimate error by: GEMM, conv, GEMV,
+// batched GEMV or VPU, "split" if the kernel has several cuts
+std::string PimShapeClass(const PimKernelDesc &desc);
+
+}  // namespace dramsim3
+#endif
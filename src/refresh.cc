@@ -1,4 +1,7 @@
 #include "refresh.h"
+#include "checkpoint.h"
+
+#include <limits>
 
 namespace dramsim3 {
 Refresh::Refresh(const Config &config, ChannelState &channel_state)
@@ -8,7 +11,8 @@ Refresh::Refresh(const Config &config, ChannelState &channel_state)
       refresh_policy_(config.refresh_policy),
       next_rank_(0),
       next_bg_(0),
-      next_bank_(0) {
+      next_bank_(0),
+      owed_(config.ranks * config.banks, 0) {
     if (refresh_policy_ == RefreshPolicy::RANK_LEVEL_SIMULTANEOUS) {
         refresh_interval_ = config_.tREFI;
     } else if (refresh_policy_ == RefreshPolicy::BANK_LEVEL_STAGGERED) {
@@ -23,17 +27,39 @@ void Refresh::ClockTick() {
     if (clk_ % refresh_interval_ == 0 && clk_ > 0) {
         InsertRefresh();
     }
+    if (config_.refresh_aware) {
+        int bank = ReleaseTarget();
+        if (bank != -1) RefreshBank(bank);
+    }
     clk_++;
     return;
 }
 
-bool Refresh::pim_refresh_coming() {
+bool Refresh::pim_refresh_coming() const {
     return refresh_interval_ - (std::max(0, (int)clk_ - 1) % refresh_interval_)  < config_.tRAS + 3; //128 + config_.tRCD + config_.tFAW;
 }
-bool Refresh::pim_refresh_coming2() {
+bool Refresh::pim_refresh_coming2() const {
     return refresh_interval_ - (std::max(0, (int)clk_ - 1) % refresh_interval_)  < 3; //128 + config_.tRCD + config_.tFAW;
 }
 
+uint64_t Refresh::NextEventCycle() const {
+    if (clk_ == 0) return clk_;
+    if (config_.refresh_aware && ReleaseTarget() != -1) return clk_;
+    // both the insertion and the PIM windows only depend on the phase of the
+    // previous cycle within the refresh interval
+    int phase = (clk_ - 1) % refresh_interval_;
+    std::vector<int> edges = {0, refresh_interval_ - 1,
+                              refresh_interval_ - (config_.tRAS + 3) + 1,
+                              refresh_interval_ - 3 + 1};
+    uint64_t next = std::numeric_limits<uint64_t>::max();
+    for (auto edge : edges) {
+        if (edge < 0 || edge >= refresh_interval_) continue;
+        int delta = (edge - phase + refresh_interval_) % refresh_interval_;
+        next = std::min(next, clk_ + delta);
+    }
+    return next;
+}
+
 void Refresh::InsertRefresh() {
     switch (refresh_policy_) {
         // Simultaneous all rank refresh
@@ -55,8 +81,14 @@ void Refresh::InsertRefresh() {
         // Fully staggered per bank refresh
         case RefreshPolicy::BANK_LEVEL_STAGGERED:
             if (!channel_state_.IsRankSelfRefreshing(next_rank_)) {
-                channel_state_.BankNeedRefresh(next_rank_, next_bg_, next_bank_,
-                                               true);
+                if (config_.refresh_aware) {
+                    owed_[(next_rank_ * config_.bankgroups + next_bg_) *
+                              config_.banks_per_group +
+                          next_bank_]++;
+                } else {
+                    channel_state_.BankNeedRefresh(next_rank_, next_bg_,
+                                                   next_bank_, true);
+                }
             }
             IterateNext();
             break;
@@ -89,4 +121,51 @@ void Refresh::IterateNext() {
     }
 }
 
+uint64_t Refresh::OwedBanks() const {
+    uint64_t banks = 0;
+    for (size_t i = 0; i < owed_.size(); i++) {
+        if (owed_[i] > 0) banks |= uint64_t(1) << i;
+    }
+    return banks;
+}
+
+void Refresh::RefreshBank(int bank) {
+    int rank = bank / config_.banks;
+    int bg = bank % config_.banks / config_.banks_per_group;
+    channel_state_.BankNeedRefresh(rank, bg, bank % config_.banks_per_group,
+                                   true);
+    owed_[bank]--;
+}
+
+int Refresh::ReleaseTarget() const {
+    // one bank refresh at a time
+    if (channel_state_.IsRefreshWaiting()) return -1;
+    int busy = -1;
+    for (size_t i = 0; i < owed_.size(); i++) {
+        if (owed_[i] <= 0) continue;
+        if (!(busy_banks_ >> i & 1)) return i;
+        // out of budget, the PIM scheduler has to give the bank up
+        if (busy == -1 && owed_[i] > config_.refresh_postpone) busy = i;
+    }
+    return busy;
+}
+
+void Refresh::SaveCheckpoint(CheckpointWriter& out) const {
+    Put(out, clk_);
+    Put(out, next_rank_);
+    Put(out, next_bg_);
+    Put(out, next_bank_);
+    Put(out, owed_);
+    Put(out, busy_banks_);
+}
+
+void Refresh::RestoreCheckpoint(CheckpointReader& in) {
+    Get(in, clk_);
+    Get(in, next_rank_);
+    Get(in, next_bg_);
+    Get(in, next_bank_);
+    Get(in, owed_);
+    Get(in, busy_banks_);
+}
+
 }  // namespace dramsim3
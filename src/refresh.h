@@ -12,8 +12,34 @@ class Refresh {
    public:
     Refresh(const Config& config, ChannelState& channel_state);
     void ClockTick();
-    bool pim_refresh_coming();
-    bool pim_refresh_coming2();
+    // advance the refresh counter over cycles known to insert no refresh
+    void SkipCycles(uint64_t cycles) { clk_ += cycles; }
+    bool pim_refresh_coming() const;
+    bool pim_refresh_coming2() const;
+    // Earliest cycle >= the current one at which a refresh is inserted or
+    // one of the PIM refresh windows above opens or closes
+    uint64_t NextEventCycle() const;
+    // position in the refresh interval and the next rank/bank to refresh,
+    // all a refresh depends on (PIM tile replay)
+    int Phase() const { return clk_ % refresh_interval_; }
+    std::vector<int> NextTarget() const {
+        return {next_rank_, next_bg_, next_bank_};
+    }
+    void SetNextTarget(const std::vector<int>& target) {
+        next_rank_ = target[0];
+        next_bg_ = target[1];
+        next_bank_ = target[2];
+    }
+    // Refresh-aware PIM mode (see [pim] refresh_aware): due bank refreshes
+    // are owed and only issued to banks the PIM scheduler does not use,
+    // until the channel runs out of postponement budget. Banks are bits
+    // (rank * bankgroups + bankgroup) * banks_per_group + bank.
+    void SetBusyBanks(uint64_t banks) { busy_banks_ = banks; }
+    uint64_t OwedBanks() const;
+    // refresh a bank now, ahead of time if it is not due
+    void RefreshBank(int bank);
+    void SaveCheckpoint(CheckpointWriter& out) const;
+    void RestoreCheckpoint(CheckpointReader& in);
 
    private:
     uint64_t clk_;
@@ -23,6 +49,11 @@ class Refresh {
     RefreshPolicy refresh_policy_;
 
     int next_rank_, next_bg_, next_bank_;
+    // due refreshes per bank, negative once refreshed ahead of time
+    std::vector<int> owed_;
+    uint64_t busy_banks_ = 0;
+    // owed bank to refresh now, -1 if none
+    int ReleaseTarget() const;
 
     void InsertRefresh();
 
@@ -0,0 +1,334 @@
+#include "result_cache.h"
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include "pim_kernel.h"
+#include "trace_reader.h"
+
+namespace dramsim3 {
+
+namespace {
+
+// 128-bit FNV-1a, collisions are out of reach for any realistic cache size.
+// A 64-bit multiply-xorshift digest of the same bytes is appended for the
+// entry to be checked against on a hit (see ResultCache::Lookup()).
+class KeyHasher {
+   public:
+    void Add(const void *data, size_t size) {
+        // the prime is 2^88 + 0x13b
+        const unsigned __int128 prime =
+            (static_cast<unsigned __int128>(1) << 88) + 0x13b;
+        auto bytes = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash_ = (hash_ ^ bytes[i]) * prime;
+            check_ = (check_ ^ bytes[i]) * 0x9e3779b97f4a7c15ULL;
+            check_ ^= check_ >> 29;
+        }
+    }
+    template <typename T>
+    void Add(const T &value) {
+        Add(&value, sizeof(T));
+    }
+    void Add(const std::string &value) {
+        Add(static_cast<uint64_t>(value.size()));
+        Add(value.data(), value.size());
+    }
+    std::string Hex() const {
+        char hex[49];
+        snprintf(hex, sizeof(hex), "%016llx%016llx%016llx",
+                 static_cast<unsigned long long>(hash_ >> 64),
+                 static_cast<unsigned long long>(hash_),
+                 static_cast<unsigned long long>(check_));
+        return hex;
+    }
+
+   private:
+    unsigned __int128 hash_ =
+        static_cast<unsigned __int128>(0x6c62272e07bb0142ULL) << 64 |
+        0x62b821756295c58dULL;
+    uint64_t check_ = 0x2545f4914f6cdd1dULL;
+};
+
+void AddConfig(KeyHasher &h, const Config &c) {
+    h.Add(c.protocol);
+    h.Add(c.channel_size);
+    h.Add(c.channels);
+    h.Add(c.ranks);
+    h.Add(c.banks);
+    h.Add(c.bankgroups);
+    h.Add(c.banks_per_group);
+    h.Add(c.rows);
+    h.Add(c.columns);
+    h.Add(c.device_width);
+    h.Add(c.bus_width);
+    h.Add(c.devices_per_rank);
+    h.Add(c.BL);
+
+    h.Add(c.address_mapping);
+    h.Add(c.shift_bits);
+    for (int pos : {c.ch_pos, c.ra_pos, c.bg_pos, c.ba_pos, c.ro_pos,
+                    c.co_pos}) {
+        h.Add(pos);
+    }
+    for (uint64_t mask : {c.ch_mask, c.ra_mask, c.bg_mask, c.ba_mask,
+                          c.ro_mask, c.co_mask}) {
+        h.Add(mask);
+    }
+
+    h.Add(c.tCK);
+    for (int t : {c.burst_cycle, c.AL, c.CL, c.CWL, c.RL, c.WL, c.tCCD_L,
+                  c.tCCD_S, c.tRTRS, c.tRTP, c.tWTR_L, c.tWTR_S, c.tWR, c.tRP,
+                  c.tRRD_L, c.tRRD_S, c.tRAS, c.tRCD, c.tRFC, c.tRC, c.tCKE,
+                  c.tCKESR, c.tXS, c.tXP, c.tRFCb, c.tREFI, c.tREFIb, c.tFAW,
+                  c.tRPRE, c.tWPRE, c.read_delay, c.write_delay, c.tPPD,
+                  c.t32AW, c.tRCDRD, c.tRCDWR}) {
+        h.Add(t);
+    }
+
+    for (double e : {c.act_energy_inc, c.pre_energy_inc, c.read_energy_inc,
+                     c.write_energy_inc, c.lh_read_energy_inc,
+                     c.gh_read_energy_inc, c.pim_write_energy_inc,
+                     c.ref_energy_inc, c.refb_energy_inc,
+                     c.act_stb_energy_inc, c.pre_stb_energy_inc,
+                     c.pre_pd_energy_inc, c.sref_energy_inc}) {
+        h.Add(e);
+    }
+
+    for (int v : {c.num_links, c.num_dies, c.link_width, c.link_speed,
+                  c.num_vaults, c.block_size, c.xbar_queue_depth}) {
+        h.Add(v);
+    }
+
+    h.Add(c.queue_structure);
+    h.Add(c.row_buf_policy);
+    h.Add(c.refresh_policy);
+    h.Add(c.cmd_queue_size);
+    h.Add(c.unified_queue);
+    h.Add(c.trans_queue_size);
+    h.Add(c.write_buf_size);
+    h.Add(c.enable_self_refresh);
+    h.Add(c.sref_threshold);
+    h.Add(c.aggressive_precharging_enabled);
+    h.Add(c.enable_hbm_dual_cmd);
+
+    h.Add(c.steady_state);
+    h.Add(c.steady_state_validate);
+    h.Add(c.double_buffer);
+    h.Add(c.gemm_weight_banks);
+    h.Add(c.gemv_weight_banks);
+    h.Add(c.refresh_aware);
+    h.Add(c.refresh_postpone);
+    h.Add(c.pipeline_layers);
+    h.Add(c.tenant_arbitration);
+    h.Add(c.transaction_queue_depth);
+    h.Add(c.kernel_queue_depth);
+    h.Add(c.vpu_lanes);
+    h.Add(c.vpu_buffer);
+    h.Add(c.vpu_softmax_latency);
+    h.Add(c.vpu_layernorm_latency);
+    h.Add(c.vpu_gelu_latency);
+    h.Add(c.vpu_add_latency);
+    // sets the epoch_num stat
+    h.Add(c.epoch_period);
+    h.Add(c.request_size_bytes);
+    h.Add(c.ideal_memory_latency);
+}
+
+void AddPimTransaction(KeyHasher &h, const PimTransaction &pim) {
+    h.Add(pim.type);
+    switch (pim.type) {
+        case PimTransType::LAUNCH:
+            h.Add(pim.cut_mask);
+            break;
+        case PimTransType::DATAFLOW:
+            for (int v : {pim.vcuts, pim.hcuts, pim.mcf, pim.ucf, pim.df,
+                          pim.M_tile_size, pim.vcuts_next, pim.hcuts_next,
+                          pim.kernel_size, pim.stride}) {
+                h.Add(v);
+            }
+            break;
+        case PimTransType::WORKLOAD:
+            h.Add(pim.cut_no);
+            h.Add(pim.load_type);
+            h.Add(pim.dim_value);
+            h.Add(pim.base_row);
+            // only submitted kernels have a KV cache input, trace keys stay
+            if (pim.M_cap != 0 || pim.K_cap != 0 ||
+                pim.append_from != pim.append_to) {
+                for (int v : {pim.M_cap, pim.K_cap, pim.append_from,
+                              pim.append_to}) {
+                    h.Add(v);
+                }
+            }
+            break;
+        case PimTransType::VPU:
+            h.Add(pim.vpu_op);
+            h.Add(pim.vpu_elements);
+            h.Add(pim.vpu_vectors);
+            break;
+    }
+}
+
+void AddTransaction(KeyHasher &h, const Transaction &trans) {
+    h.Add(trans.added_cycle);
+    h.Add(trans.is_pim);
+    if (!trans.is_pim) {
+        h.Add(trans.addr);
+        h.Add(trans.is_write);
+        return;
+    }
+    AddPimTransaction(h, DecodePimTransaction(trans.addr));
+}
+
+}  // namespace
+
+std::string ResultKey(const Config &config, const std::string &trace_file,
+                      uint64_t cycles) {
+    KeyHasher h;
+    h.Add(std::string("HBDRAMsim result v1"));
+    AddConfig(h, config);
+    h.Add(cycles);
+
+    // the front-end stalls at the first inactive record, nothing after it
+    // is ever simulated
+    auto trace = OpenTrace(trace_file);
+    Transaction trans;
+    for (trace->Next(trans); trans.active; trace->Next(trans)) {
+        AddTransaction(h, trans);
+    }
+    return h.Hex();
+}
+
+std::string ResultKey(const Config &config,
+                      const std::vector<PimTransaction> &kernel,
+                      uint64_t cycles) {
+    KeyHasher h;
+    h.Add(std::string("HBDRAMsim result v1"));
+    AddConfig(h, config);
+    h.Add(cycles);
+
+    // hashed like the trace gen_pim_trace2.py writes for the same workload
+    for (size_t i = 0; i < kernel.size(); i++) {
+        h.Add(static_cast<uint64_t>(i));
+        h.Add(true);
+        AddPimTransaction(h, kernel[i]);
+    }
+    return h.Hex();
+}
+
+nlohmann::json SimulationResult(const MemorySystem &memory, bool turned_off) {
+    nlohmann::json stats = memory.FinalStats();
+    double energy = 0.0;
+    for (const auto &channel : stats) {
+        energy += channel["total_energy"].get<double>();
+    }
+    nlohmann::json result;
+    result["cycles"] = stats["0"]["num_cycles"];
+    result["energy"] = energy;
+    result["turned_off"] = turned_off;
+    result["end_of_computation"] = memory.ComputationEndCycles();
+    result["stats"] = stats;
+    return result;
+}
+
+void WriteStatsFile(const Config &config, const nlohmann::json &result) {
+    // same layout as BaseDRAMSystem::PrintStats()
+    const auto &stats = result["stats"];
+    std::ofstream json_out(config.json_stats_name, std::ofstream::out);
+    json_out << "{";
+    for (size_t i = 0; i < stats.size(); i++) {
+        if (i != 0) json_out << "," << std::endl;
+        json_out << "\"" << i << "\":" << stats[std::to_string(i)];
+    }
+    json_out << "}";
+}
+
+ResultCache::ResultCache(const std::string &dir) : dir_(dir) {
+    if (!DirExist(dir_) && mkdir(dir_.c_str(), 0755) != 0) {
+        std::cerr << "Can't create result cache " << dir_ << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+}
+
+std::string ResultCache::FileName(const std::string &key) const {
+    // named by the 128-bit hash, the entry holds the whole key
+    return dir_ + "/" + key.substr(0, 32) + ".json";
+}
+
+bool ResultCache::Lookup(const std::string &key,
+                         nlohmann::json &result) const {
+    std::ifstream in(FileName(key));
+    if (in.fail()) return false;
+    try {
+        in >> result;
+    } catch (nlohmann::json::exception &e) {
+        std::cerr << "WARNING: ignoring broken cache entry " << FileName(key)
+                  << std::endl;
+        return false;
+    }
+    // a colliding hash or an entry of an older key scheme
+    auto stored = result.find("key");
+    if (stored == result.end() || *stored != key) {
+        std::cerr << "WARNING: ignoring cache entry " << FileName(key)
+                  << " of another key" << std::endl;
+        return false;
+    }
+    result.erase("key");
+    return true;
+}
+
+void ResultCache::Store(const std::string &key,
+                        const nlohmann::json &result) const {
+    // write aside and rename so that concurrent runs never see half an entry
+    std::ostringstream tmp_name;
+    tmp_name << FileName(key) << ".tmp" << getpid() << "_"
+             << std::this_thread::get_id();
+    {
+        std::ofstream out(tmp_name.str());
+        nlohmann::json entry = result;
+        entry["key"] = key;
+        out << entry;
+        if (out.fail()) {
+            std::cerr << "WARNING: can't write cache entry " << tmp_name.str()
+                      << std::endl;
+            return;
+        }
+    }
+    if (rename(tmp_name.str().c_str(), FileName(key).c_str()) != 0) {
+        std::cerr << "WARNING: can't write cache entry " << FileName(key)
+                  << std::endl;
+        remove(tmp_name.str().c_str());
+    }
+}
+
+std::vector<std::string> ResultCache::Mismatches(const nlohmann::json &cached,
+                                                 const nlohmann::json &fresh) {
+    std::vector<std::string> fields;
+    for (const char *field :
+         {"cycles", "energy", "turned_off", "end_of_computation"}) {
+        auto it = cached.find(field);
+        if (it == cached.end() || *it != fresh[field]) fields.push_back(field);
+    }
+    static const nlohmann::json none;
+    auto cached_stats = cached.find("stats");
+    for (auto channel = fresh["stats"].begin();
+         channel != fresh["stats"].end(); ++channel) {
+        const nlohmann::json *cached_channel = &none;
+        if (cached_stats != cached.end() &&
+            cached_stats->find(channel.key()) != cached_stats->end()) {
+            cached_channel = &(*cached_stats)[channel.key()];
+        }
+        for (auto stat = channel->begin(); stat != channel->end(); ++stat) {
+            auto it = cached_channel->find(stat.key());
+            if (it == cached_channel->end() || *it != stat.value()) {
+                fields.push_back("stats." + channel.key() + "." + stat.key());
+            }
+        }
+    }
+    return fields;
+}
+
+}  // namespace dramsim3
@@ -0,0 +1,46 @@
+#ifndef __RESULT_CACHE_H
+#define __RESULT_CACHE_H
+
+#include <string>
+#include <vector>
+#include "configuration.h"
+#include "memory_system.h"
+
+namespace dramsim3 {
+
+// Key of a trace simulation: the parsed config fields that affect results,
+// the decoded trace (PIM transactions by their dataflow and workload fields)
+// and the cycle limit. Output settings and channel_threads are left out.
+std::string ResultKey(const Config &config, const std::string &trace_file,
+                      uint64_t cycles);
+// same for a PIM workload run, equal to the key of its trace
+std::string ResultKey(const Config &config,
+                      const std::vector<PimTransaction> &kernel,
+                      uint64_t cycles);
+
+// Summary of a finished run: cycles, energy, turned_off, end_of_computation
+// and the final stats of all channels
+nlohmann::json SimulationResult(const MemorySystem &memory, bool turned_off);
+
+// Rewrite the json stats file of a run from its result
+void WriteStatsFile(const Config &config, const nlohmann::json &result);
+
+// On-disk cache of simulation results, one json file per key. An entry
+// records its key, which a hit is checked against. The key does not cover
+// the simulator itself, clear the cache after changing the model.
+class ResultCache {
+   public:
+    explicit ResultCache(const std::string &dir);
+    bool Lookup(const std::string &key, nlohmann::json &result) const;
+    void Store(const std::string &key, const nlohmann::json &result) const;
+    // fields of a cached result that a fresh one disagrees with
+    static std::vector<std::string> Mismatches(const nlohmann::json &cached,
+                                               const nlohmann::json &fresh);
+
+   private:
+    std::string dir_;
+    std::string FileName(const std::string &key) const;
+};
+
+}  // namespace dramsim3
+#endif
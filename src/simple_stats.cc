@@ -1,5 +1,6 @@
 #include <iostream>
 
+#include "checkpoint.h"
 #include "fmt/format.h"
 #include "simple_stats.h"
 
@@ -48,6 +49,36 @@ SimpleStats::SimpleStats(const Config& config, int channel_id)
     InitStat("num_srefx_cmds", "counter", "Number of SREFX commands");
     InitStat("hbm_dual_cmds", "counter", "Number of cycles dual cmds issued");
 
+    // PIM scheduler events of the kernels running in this channel
+    InitStat("weight_tiles_prefetched", "counter",
+             "Number of weight tiles prefetched while the tile before ran");
+    InitStat("weight_tiles_part_prefetched", "counter",
+             "Number of weight tiles partly prefetched");
+    InitStat("weight_tiles_loaded", "counter",
+             "Number of weight tiles loaded after the tile before");
+    InitStat("pim_refresh_stall_cycles", "counter",
+             "Cycles the PIM kernel waited for a refresh");
+    InitStat("pipeline_kernels_staged", "counter",
+             "Number of PIM kernels staged while the previous one drained");
+    InitStat("pipeline_staged_cycles", "counter",
+             "Cycles a next PIM kernel was staged");
+    InitStat("pipeline_tiles_loaded", "counter",
+             "Number of first weight tiles loaded before their kernel ran");
+    InitStat("pipeline_tiles_part_loaded", "counter",
+             "Number of first weight tiles partly loaded before their kernel ran");
+    InitStat("conv_input_vectors", "counter",
+             "Number of input vectors of convolutions");
+    InitStat("conv_input_vectors_read", "counter",
+             "Number of input vectors of convolutions read from DRAM");
+    InitStat("kv_tokens_appended", "counter",
+             "Number of tokens appended to KV caches");
+    InitStat("kv_append_writes", "counter",
+             "Number of write steps appending tokens to KV caches");
+    InitStat("vpu_ops", "counter", "Number of VPU ops");
+    InitStat("vpu_cycles", "counter", "Cycles of VPU ops");
+    InitStat("vpu_wait_cycles", "counter",
+             "Cycles the PIM kernel waited for a VPU op");
+
     // double stats
     InitStat("act_energy", "double", "Activation energy");
     InitStat("read_energy", "double", "Read energy");
@@ -117,6 +148,109 @@ double SimpleStats::RankBackgroundEnergy(const int rank) const{
            vec_doubles_.at("sref_energy")[rank];
 }
 
+void SimpleStats::AddCountersDelta(const Counters& end,
+                                   const Counters& begin) {
+    for (const auto& it : end.counters) {
+        auto begin_it = begin.counters.find(it.first);
+        uint64_t begin_val =
+            begin_it == begin.counters.end() ? 0 : begin_it->second;
+        epoch_counters_[it.first] += it.second - begin_val;
+    }
+    for (const auto& it : end.vec_counters) {
+        auto& vec = epoch_vec_counters_[it.first];
+        const auto& begin_vec = begin.vec_counters.at(it.first);
+        for (size_t i = 0; i < vec.size(); i++) {
+            vec[i] += it.second[i] - begin_vec[i];
+        }
+    }
+}
+
+double SimpleStats::CountersDeltaEnergy(const Counters& end,
+                                        const Counters& begin) const {
+    auto delta = [&](const std::string& name) -> double {
+        auto it = end.counters.find(name);
+        auto begin_it = begin.counters.find(name);
+        if (it == end.counters.end()) return 0.0;
+        if (begin_it == begin.counters.end()) return it->second;
+        return static_cast<double>(it->second) - begin_it->second;
+    };
+    auto vec_delta = [&](const std::string& name, int i) -> double {
+        auto begin_it = begin.vec_counters.find(name);
+        if (begin_it == begin.vec_counters.end())
+            return end.vec_counters.at(name)[i];
+        return static_cast<double>(end.vec_counters.at(name)[i]) -
+               begin_it->second[i];
+    };
+    double energy = delta("num_act_cmds") * config_.act_energy_inc +
+                    delta("num_read_cmds") * config_.read_energy_inc +
+                    delta("num_write_cmds") * config_.write_energy_inc +
+                    delta("num_lh_read_cmds") * config_.lh_read_energy_inc +
+                    delta("num_gh_read_cmds") * config_.gh_read_energy_inc +
+                    delta("num_pim_write_cmds") * config_.pim_write_energy_inc +
+                    delta("num_ref_cmds") * config_.ref_energy_inc +
+                    delta("num_refb_cmds") * config_.refb_energy_inc;
+    for (int i = 0; i < config_.ranks; i++) {
+        energy += vec_delta("rank_active_cycles", i) * config_.act_stb_energy_inc +
+                  vec_delta("all_bank_idle_cycles", i) * config_.pre_stb_energy_inc +
+                  vec_delta("sref_cycles", i) * config_.sref_energy_inc;
+    }
+    return energy;
+}
+
+double SimpleStats::Energy() const {
+    Counters total = GetCounters();
+    for (const auto& it : counters_) {
+        total.counters[it.first] += it.second;
+    }
+    for (const auto& vec : vec_counters_) {
+        for (size_t i = 0; i < vec.second.size(); i++) {
+            total.vec_counters[vec.first][i] += vec.second[i];
+        }
+    }
+    return CountersDeltaEnergy(total, Counters());
+}
+
+uint64_t SimpleStats::Count(const std::string& name) const {
+    uint64_t count = 0;
+    auto it = counters_.find(name);
+    if (it != counters_.end()) count += it->second;
+    it = epoch_counters_.find(name);
+    if (it != epoch_counters_.end()) count += it->second;
+    return count;
+}
+
+std::vector<uint64_t> SimpleStats::VecCount(const std::string& name) const {
+    std::vector<uint64_t> count;
+    auto it = vec_counters_.find(name);
+    if (it != vec_counters_.end()) count = it->second;
+    it = epoch_vec_counters_.find(name);
+    if (it != epoch_vec_counters_.end()) {
+        count.resize(it->second.size(), 0);
+        for (size_t i = 0; i < it->second.size(); i++) count[i] += it->second[i];
+    }
+    return count;
+}
+
+void SimpleStats::InitTenantStats(int tenants) {
+    InitVecStat("tenant_pim_cmds", "vec_counter", "PIM commands issued by",
+                "tenant", tenants);
+    InitVecStat("tenant_lost_slots", "vec_counter",
+                "Cycles another tenant got the command bus over", "tenant",
+                tenants);
+    InitVecStat("tenant_kernels", "vec_counter", "Kernels finished by",
+                "tenant", tenants);
+    InitVecStat("tenant_busy_cycles", "vec_counter",
+                "Cycles from launch to last output of the kernels of",
+                "tenant", tenants);
+    // a new set of tenants starts from 0, in place as counters are never
+    // erased (see EpochVecCounter())
+    for (const char* name : {"tenant_pim_cmds", "tenant_lost_slots",
+                             "tenant_kernels", "tenant_busy_cycles"}) {
+        vec_counters_[name].assign(tenants, 0);
+        epoch_vec_counters_[name].assign(tenants, 0);
+    }
+}
+
 void SimpleStats::PrintEpochStats() {
     UpdateEpochStats();
     if (config_.output_level >= 1) {
@@ -156,6 +290,44 @@ void SimpleStats::PrintFinalStats() {
     print_pairs_.clear();
 }
 
+void SimpleStats::SaveCheckpoint(CheckpointWriter& out) const {
+    Put(out, counters_);
+    Put(out, epoch_counters_);
+    Put(out, vec_counters_);
+    Put(out, epoch_vec_counters_);
+    Put(out, doubles_);
+    Put(out, vec_doubles_);
+    Put(out, calculated_);
+    Put(out, histo_counts_);
+    Put(out, epoch_histo_counts_);
+    Put(out, histo_bins_);
+    Put(out, epoch_histo_bins_);
+}
+
+void SimpleStats::RestoreCheckpoint(CheckpointReader& in) {
+    Get(in, counters_);
+    Get(in, epoch_counters_);
+    Get(in, vec_counters_);
+    Get(in, epoch_vec_counters_);
+    Get(in, doubles_);
+    Get(in, vec_doubles_);
+    Get(in, calculated_);
+    Get(in, histo_counts_);
+    Get(in, epoch_histo_counts_);
+    Get(in, histo_bins_);
+    Get(in, epoch_histo_bins_);
+}
+
+void Put(CheckpointWriter& out, const SimpleStats::Counters& counters) {
+    Put(out, counters.counters);
+    Put(out, counters.vec_counters);
+}
+
+void Get(CheckpointReader& in, SimpleStats::Counters& counters) {
+    Get(in, counters.counters);
+    Get(in, counters.vec_counters);
+}
+
 void SimpleStats::Reset() {
     for (auto& it : counters_) {
         it.second = 0;
@@ -186,6 +358,18 @@ void SimpleStats::Reset() {
     }
 }
 
+uint64_t* SimpleStats::EpochCounter(const char* name) {
+    auto& counter = literal_counters_.counters[name];
+    if (counter == nullptr) counter = &epoch_counters_[name];
+    return counter;
+}
+
+std::vector<uint64_t>* SimpleStats::EpochVecCounter(const char* name) {
+    auto& counter = literal_vec_counters_.counters[name];
+    if (counter == nullptr) counter = &epoch_vec_counters_[name];
+    return counter;
+}
+
 void SimpleStats::InitStat(std::string name, std::string stat_type,
                            std::string description) {
     header_descs_.emplace(name, description);
@@ -457,11 +641,11 @@ void SimpleStats::UpdateFinalStats() {
     doubles_["refb_energy"] =
         counters_["num_refb_cmds"] * config_.refb_energy_inc;
     doubles_["lh_read_energy"] =
-        epoch_counters_["num_lh_read_cmds"] * config_.lh_read_energy_inc;
+        counters_["num_lh_read_cmds"] * config_.lh_read_energy_inc;
     doubles_["gh_read_energy"] =
-        epoch_counters_["num_gh_read_cmds"] * config_.gh_read_energy_inc;
+        counters_["num_gh_read_cmds"] * config_.gh_read_energy_inc;
     doubles_["pim_write_energy"] =
-        epoch_counters_["num_pim_write_cmds"] * config_.pim_write_energy_inc;
+        counters_["num_pim_write_cmds"] * config_.pim_write_energy_inc;
 
     // vector doubles, update first, then push
     double background_energy = 0.0;
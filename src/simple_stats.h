@@ -13,19 +13,55 @@ namespace dramsim3 {
 
 class SimpleStats {
    public:
+    using VecStat = std::unordered_map<std::string, std::vector<uint64_t> >;
+    // snapshot of the counters of the current epoch
+    struct Counters {
+        std::unordered_map<std::string, uint64_t> counters;
+        VecStat vec_counters;
+    };
+
     SimpleStats(const Config& config, int channel_id);
     // incrementing counter
     void Increment(const std::string name) { epoch_counters_[name] += 1; }
+    void Increment(const char* name) { *EpochCounter(name) += 1; }
+
+    // increment counter by number
+    void IncrementBy(const std::string name, uint64_t num) {
+        epoch_counters_[name] += num;
+    }
+    void IncrementBy(const char* name, uint64_t num) {
+        *EpochCounter(name) += num;
+    }
 
     // incrementing for vec counter
     void IncrementVec(const std::string name, int pos) {
         epoch_vec_counters_[name][pos] += 1;
     }
+    void IncrementVec(const char* name, int pos) {
+        (*EpochVecCounter(name))[pos] += 1;
+    }
 
     // increment vec counter by number
-    void IncrementVecBy(const std::string name, int pos, int num) {
+    void IncrementVecBy(const std::string name, int pos, uint64_t num) {
         epoch_vec_counters_[name][pos] += num;
     }
+    void IncrementVecBy(const char* name, int pos, uint64_t num) {
+        (*EpochVecCounter(name))[pos] += num;
+    }
+
+    // counter snapshots, used to replay the stats of a PIM tile
+    Counters GetCounters() const { return {epoch_counters_, epoch_vec_counters_}; }
+    void AddCountersDelta(const Counters& end, const Counters& begin);
+    // energy (pJ) accounted by the difference of two snapshots
+    double CountersDeltaEnergy(const Counters& end, const Counters& begin) const;
+    // energy (pJ) accounted so far, finished epochs included
+    double Energy() const;
+    // a counter so far, finished epochs included
+    uint64_t Count(const std::string& name) const;
+    std::vector<uint64_t> VecCount(const std::string& name) const;
+
+    // per tenant counters of a multi-tenant PIM run, see PimTenants
+    void InitTenantStats(int tenants);
 
     // add historgram value
     void AddValue(const std::string name, const int value);
@@ -39,11 +75,16 @@ class SimpleStats {
     // Final statas output
     void PrintFinalStats();
 
+    // stats computed by the last PrintFinalStats()
+    const nlohmann::json& FinalStats() const { return j_data_; }
+
     // Reset (usually after one phase of simulation)
     void Reset();
 
+    void SaveCheckpoint(CheckpointWriter& out) const;
+    void RestoreCheckpoint(CheckpointReader& in);
+
    private:
-    using VecStat = std::unordered_map<std::string, std::vector<uint64_t> >;
     using HistoCount = std::unordered_map<int, uint64_t>;
     using Json = nlohmann::json;
     void InitStat(std::string name, std::string stat_type,
@@ -76,6 +117,24 @@ class SimpleStats {
     VecStat vec_counters_;
     VecStat epoch_vec_counters_;
 
+    // Epoch counters by the address of a string literal name, so counting
+    // every cycle does not build (and allocate) a std::string. Counters are
+    // never erased, but a copy must not point into the original's.
+    template <typename T>
+    struct LiteralIndex {
+        LiteralIndex() {}
+        LiteralIndex(const LiteralIndex&) {}
+        LiteralIndex& operator=(const LiteralIndex&) {
+            counters.clear();
+            return *this;
+        }
+        std::unordered_map<const char*, T*> counters;
+    };
+    LiteralIndex<uint64_t> literal_counters_;
+    LiteralIndex<std::vector<uint64_t> > literal_vec_counters_;
+    uint64_t* EpochCounter(const char* name);
+    std::vector<uint64_t>* EpochVecCounter(const char* name);
+
     // NOTE: doubles_ vec_doubles_ and calculated_ are basically one time
     // placeholders after each epoch they store the value for that epoch
     // (different from the counters) and in the end updated to the overall value
@@ -101,5 +160,8 @@ class SimpleStats {
     std::vector<std::pair<std::string, std::string> > print_pairs_;
 };
 
+void Put(CheckpointWriter& out, const SimpleStats::Counters& counters);
+void Get(CheckpointReader& in, SimpleStats::Counters& counters);
+
 }  // namespace dramsim3
 #endif
\ No newline at end of file
@@ -317,19 +317,37 @@ Timing::Timing(const Config& config)
             {CommandType::REFRESH_BANK, refresh_to_activate_bank},
             {CommandType::SREF_ENTER, refresh_to_activate_bank}};
 
-    other_banks_same_bankgroup[static_cast<int>(CommandType::REFRESH_BANK)] =
-        std::vector<std::pair<CommandType, int> >{
-            {CommandType::ACTIVATE, refresh_to_activate},
-            {CommandType::PIM_ACTIVATE, refresh_to_activate},
-            {CommandType::REFRESH_BANK, refresh_to_refresh},
-        };
+    // In refresh-aware PIM mode a bank refresh only keeps its own bank
+    // busy, the other banks wait as after an activation (tRREFD)
+    if (config.refresh_aware) {
+        other_banks_same_bankgroup[static_cast<int>(CommandType::REFRESH_BANK)] =
+            std::vector<std::pair<CommandType, int> >{
+                {CommandType::ACTIVATE, activate_to_activate_l},
+                {CommandType::PIM_ACTIVATE, activate_to_activate_l},
+                {CommandType::REFRESH_BANK, activate_to_activate_l},
+            };
 
-    other_bankgroups_same_rank[static_cast<int>(CommandType::REFRESH_BANK)] =
-        std::vector<std::pair<CommandType, int> >{
-            {CommandType::ACTIVATE, refresh_to_activate},
-            {CommandType::PIM_ACTIVATE, refresh_to_activate},
-            {CommandType::REFRESH_BANK, refresh_to_refresh},
-        };
+        other_bankgroups_same_rank[static_cast<int>(CommandType::REFRESH_BANK)] =
+            std::vector<std::pair<CommandType, int> >{
+                {CommandType::ACTIVATE, activate_to_activate_s},
+                {CommandType::PIM_ACTIVATE, activate_to_activate_s},
+                {CommandType::REFRESH_BANK, activate_to_activate_s},
+            };
+    } else {
+        other_banks_same_bankgroup[static_cast<int>(CommandType::REFRESH_BANK)] =
+            std::vector<std::pair<CommandType, int> >{
+                {CommandType::ACTIVATE, refresh_to_activate},
+                {CommandType::PIM_ACTIVATE, refresh_to_activate},
+                {CommandType::REFRESH_BANK, refresh_to_refresh},
+            };
+
+        other_bankgroups_same_rank[static_cast<int>(CommandType::REFRESH_BANK)] =
+            std::vector<std::pair<CommandType, int> >{
+                {CommandType::ACTIVATE, refresh_to_activate},
+                {CommandType::PIM_ACTIVATE, refresh_to_activate},
+                {CommandType::REFRESH_BANK, refresh_to_refresh},
+            };
+    }
 
     // REFRESH, SREF_ENTER and SREF_EXIT are isued to the entire
     // rank  command REFRESH
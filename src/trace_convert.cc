@@ -0,0 +1,44 @@
+#include <iostream>
+#include "./../ext/headers/args.hxx"
+#include "trace_reader.h"
+
+using namespace dramsim3;
+
+int main(int argc, const char **argv) {
+    args::ArgumentParser parser(
+        "Converts a text trace to the binary trace format, which "
+        "dramsim3main and dramsim3batch read directly.",
+        "./build/dramsim3convert traces/QK_128 traces/QK_128.bin");
+    args::HelpFlag help(parser, "help", "Display the help menu", {'h', "help"});
+    args::Positional<std::string> text_arg(parser, "text_trace",
+                                           "The text trace (mandatory)");
+    args::Positional<std::string> binary_arg(
+        parser, "binary_trace", "The binary trace to write (mandatory)");
+
+    try {
+        parser.ParseCLI(argc, argv);
+    } catch (args::Help) {
+        std::cout << parser;
+        return 0;
+    } catch (args::ParseError e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << parser;
+        return 1;
+    }
+
+    std::string text_file = args::get(text_arg);
+    std::string binary_file = args::get(binary_arg);
+    if (text_file.empty() || binary_file.empty()) {
+        std::cerr << parser;
+        return 1;
+    }
+    if (IsBinaryTrace(text_file)) {
+        std::cerr << text_file << " already is a binary trace" << std::endl;
+        return 1;
+    }
+
+    uint64_t records = ConvertTextTrace(text_file, binary_file);
+    std::cout << records << " records written to " << binary_file
+              << std::endl;
+    return 0;
+}
@@ -0,0 +1,240 @@
+#include "trace_reader.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include "channel_threads.h"
+
+namespace dramsim3 {
+
+TextTraceReader::TextTraceReader(const std::string& trace_file)
+    : trace_file_(trace_file) {
+    if (trace_file_.fail()) {
+        std::cerr << "Trace file does not exist" << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+}
+
+void TextTraceReader::Seek(uint64_t pos, bool eof) {
+    trace_file_.clear();
+    if (eof) {
+        trace_file_.seekg(0, std::ios_base::end);
+        trace_file_.get();
+        records_ = pos;
+        return;
+    }
+    trace_file_.seekg(0);
+    records_ = 0;
+    Transaction trans;
+    while (records_ < pos) Next(trans);
+}
+
+BinaryTraceReader::BinaryTraceReader(const std::string& trace_file) {
+    int fd = open(trace_file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Trace file does not exist" << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 ||
+        static_cast<size_t>(info.st_size) < sizeof(BinaryTraceHeader)) {
+        std::cerr << "Binary trace " << trace_file << " is truncated"
+                  << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    map_size_ = info.st_size;
+    map_ = mmap(nullptr, map_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map_ == MAP_FAILED) {
+        std::cerr << "Can't map trace file " << trace_file << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    madvise(map_, map_size_, MADV_SEQUENTIAL);
+
+    const auto* header = static_cast<const BinaryTraceHeader*>(map_);
+    if (memcmp(header->magic, kBinaryTraceMagic, sizeof(header->magic)) != 0 ||
+        header->version != kBinaryTraceVersion ||
+        header->record_size != sizeof(BinaryTraceRecord)) {
+        std::cerr << "Unsupported binary trace " << trace_file << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    num_records_ = header->num_records;
+    if (map_size_ != sizeof(BinaryTraceHeader) +
+                         num_records_ * sizeof(BinaryTraceRecord)) {
+        std::cerr << "Binary trace " << trace_file << " is truncated"
+                  << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    records_ = reinterpret_cast<const BinaryTraceRecord*>(header + 1);
+}
+
+BinaryTraceReader::~BinaryTraceReader() { munmap(map_, map_size_); }
+
+void BinaryTraceReader::Next(Transaction& trans) {
+    if (pos_ == num_records_) {
+        eof_ = true;
+        trans.active = false;
+        return;
+    }
+    const BinaryTraceRecord& record = records_[pos_++];
+    trans.addr = record.addr;
+    trans.added_cycle = record.added_cycle;
+    trans.is_write = record.op == TraceOp::WRITE;
+    trans.is_pim = record.op == TraceOp::PIM;
+    trans.active = record.op != TraceOp::INACTIVE;
+}
+
+void BinaryTraceReader::Seek(uint64_t pos, bool eof) {
+    pos_ = eof ? num_records_ : pos;
+    eof_ = eof;
+}
+
+PrefetchTraceReader::PrefetchTraceReader(std::unique_ptr<TraceReader> trace,
+                                         size_t depth)
+    : trace_(std::move(trace)), head_(0), tail_(0), stop_(false) {
+    size_t size = 1;
+    while (size < depth) size <<= 1;
+    ring_.resize(size);
+    mask_ = size - 1;
+    pos_ = trace_->Tell();
+    eof_ = trace_->Eof();
+    Start();
+}
+
+PrefetchTraceReader::~PrefetchTraceReader() { Stop(); }
+
+void PrefetchTraceReader::Start() {
+    stop_.store(false, std::memory_order_relaxed);
+    thread_ = std::thread(&PrefetchTraceReader::ReadAhead, this);
+}
+
+void PrefetchTraceReader::Stop() {
+    stop_.store(true, std::memory_order_release);
+    if (thread_.joinable()) thread_.join();
+}
+
+void PrefetchTraceReader::ReadAhead() {
+    Transaction trans;
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    while (!trace_->Eof()) {
+        // a full ring means the simulation is behind, no hurry
+        while (head - tail_.load(std::memory_order_acquire) == ring_.size()) {
+            if (stop_.load(std::memory_order_acquire)) return;
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        if (stop_.load(std::memory_order_acquire)) return;
+        trace_->Next(trans);
+        Record& record = ring_[head & mask_];
+        record.addr = trans.addr;
+        record.added_cycle = trans.added_cycle;
+        record.is_write = trans.is_write;
+        record.is_pim = trans.is_pim;
+        record.active = trans.active;
+        record.eof = trace_->Eof();
+        head_.store(++head, std::memory_order_release);
+    }
+}
+
+void PrefetchTraceReader::Next(Transaction& trans) {
+    if (eof_) {
+        trans.active = false;
+        return;
+    }
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    SpinUntil([this, tail] {
+        return head_.load(std::memory_order_acquire) != tail;
+    });
+    const Record& record = ring_[tail & mask_];
+    trans.addr = record.addr;
+    trans.added_cycle = record.added_cycle;
+    trans.is_write = record.is_write;
+    trans.is_pim = record.is_pim;
+    trans.active = record.active;
+    eof_ = record.eof;
+    pos_++;
+    tail_.store(tail + 1, std::memory_order_release);
+}
+
+void PrefetchTraceReader::Seek(uint64_t pos, bool eof) {
+    Stop();
+    trace_->Seek(pos, eof);
+    head_.store(0, std::memory_order_relaxed);
+    tail_.store(0, std::memory_order_relaxed);
+    pos_ = pos;
+    eof_ = eof;
+    Start();
+}
+
+bool IsBinaryTrace(const std::string& trace_file) {
+    char magic[sizeof(kBinaryTraceMagic)];
+    std::ifstream in(trace_file, std::ifstream::binary);
+    in.read(magic, sizeof(magic));
+    return in.good() && memcmp(magic, kBinaryTraceMagic, sizeof(magic)) == 0;
+}
+
+std::unique_ptr<TraceReader> OpenTrace(const std::string& trace_file,
+                                       size_t prefetch_depth) {
+    std::unique_ptr<TraceReader> trace;
+    if (IsBinaryTrace(trace_file)) {
+        trace.reset(new BinaryTraceReader(trace_file));
+    } else {
+        trace.reset(new TextTraceReader(trace_file));
+    }
+    if (prefetch_depth > 0) {
+        trace.reset(new PrefetchTraceReader(std::move(trace), prefetch_depth));
+    }
+    return trace;
+}
+
+uint64_t ConvertTextTrace(const std::string& text_file,
+                          const std::string& binary_file) {
+    std::ifstream in(text_file);
+    if (in.fail()) {
+        std::cerr << "Trace file " << text_file << " does not exist"
+                  << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    std::ofstream out(binary_file, std::ofstream::binary);
+    if (out.fail()) {
+        std::cerr << "Can't write " << binary_file << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+
+    // the record count is filled in at the end
+    BinaryTraceHeader header;
+    memcpy(header.magic, kBinaryTraceMagic, sizeof(header.magic));
+    header.version = kBinaryTraceVersion;
+    header.record_size = sizeof(BinaryTraceRecord);
+    header.num_records = 0;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    Transaction trans;
+    BinaryTraceRecord record;
+    memset(&record, 0, sizeof(record));
+    while (in >> trans) {
+        record.addr = trans.addr;
+        record.added_cycle = trans.added_cycle;
+        record.op = trans.is_pim ? TraceOp::PIM
+                    : trans.is_write ? TraceOp::WRITE
+                    : TraceOp::INACTIVE;
+        out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+        header.num_records++;
+    }
+    if (!in.eof()) {
+        std::cerr << "Can't parse record " << header.num_records + 1 << " of "
+                  << text_file << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (out.fail()) {
+        std::cerr << "Failed writing " << binary_file << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    return header.num_records;
+}
+
+}  // namespace dramsim3
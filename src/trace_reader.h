@@ -0,0 +1,135 @@
+#ifndef __TRACE_READER_H
+#define __TRACE_READER_H
+
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "common.h"
+
+namespace dramsim3 {
+
+// Binary trace: a header followed by fixed-width records in host byte order.
+// A converted trace replays exactly like its text form.
+const char kBinaryTraceMagic[8] = {'H', 'B', 'D', 'T', 'R', 'A', 'C', 'E'};
+const uint32_t kBinaryTraceVersion = 1;
+
+struct BinaryTraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t num_records;
+};
+
+// ops the text reader does not know (READ included) are inactive and stall
+// the trace there, same as in text
+enum class TraceOp : uint8_t { INACTIVE, WRITE, PIM };
+
+struct BinaryTraceRecord {
+    uint64_t addr;
+    uint64_t added_cycle;
+    TraceOp op;
+    uint8_t reserved[7];
+};
+
+class TraceReader {
+   public:
+    virtual ~TraceReader() {}
+    // the next record; past the last one trans is inactive and Eof() is set
+    virtual void Next(Transaction& trans) = 0;
+    virtual bool Eof() const = 0;
+    // records read so far, for checkpoints
+    virtual uint64_t Tell() const = 0;
+    virtual void Seek(uint64_t pos, bool eof) = 0;
+};
+
+class TextTraceReader : public TraceReader {
+   public:
+    explicit TextTraceReader(const std::string& trace_file);
+    void Next(Transaction& trans) override {
+        trace_file_ >> trans;
+        records_++;
+    }
+    bool Eof() const override { return trace_file_.eof(); }
+    uint64_t Tell() const override { return records_; }
+    // rereads the trace up to pos, text records have no fixed offsets
+    void Seek(uint64_t pos, bool eof) override;
+
+   private:
+    std::ifstream trace_file_;
+    uint64_t records_ = 0;
+};
+
+// maps the whole file, records are decoded in place
+class BinaryTraceReader : public TraceReader {
+   public:
+    explicit BinaryTraceReader(const std::string& trace_file);
+    ~BinaryTraceReader();
+    void Next(Transaction& trans) override;
+    bool Eof() const override { return eof_; }
+    uint64_t Tell() const override { return pos_; }
+    void Seek(uint64_t pos, bool eof) override;
+
+   private:
+    void* map_ = nullptr;
+    size_t map_size_ = 0;
+    const BinaryTraceRecord* records_ = nullptr;
+    uint64_t num_records_ = 0;
+    uint64_t pos_ = 0;
+    bool eof_ = false;
+};
+
+// Reads another reader ahead on its own thread. Records are handed over
+// through a single-producer single-consumer ring, Next() neither locks nor
+// makes system calls unless the ring runs empty.
+class PrefetchTraceReader : public TraceReader {
+   public:
+    PrefetchTraceReader(std::unique_ptr<TraceReader> trace, size_t depth);
+    ~PrefetchTraceReader();
+    void Next(Transaction& trans) override;
+    bool Eof() const override { return eof_; }
+    uint64_t Tell() const override { return pos_; }
+    void Seek(uint64_t pos, bool eof) override;
+
+   private:
+    struct Record {
+        uint64_t addr;
+        uint64_t added_cycle;
+        bool is_write;
+        bool is_pim;
+        bool active;
+        bool eof;
+    };
+    std::unique_ptr<TraceReader> trace_;
+    std::vector<Record> ring_;
+    uint64_t mask_;
+    // written by the reader thread and by Next() respectively, kept on
+    // separate cache lines
+    char pad_head_[64];
+    std::atomic<uint64_t> head_;
+    char pad_tail_[64];
+    std::atomic<uint64_t> tail_;
+    char pad_end_[64];
+    std::atomic<bool> stop_;
+    std::thread thread_;
+    uint64_t pos_ = 0;
+    bool eof_ = false;
+
+    void Start();
+    void Stop();
+    void ReadAhead();
+};
+
+bool IsBinaryTrace(const std::string& trace_file);
+// opens a text or binary trace, whichever the file is, read ahead on a
+// separate thread if prefetch_depth records > 0
+std::unique_ptr<TraceReader> OpenTrace(const std::string& trace_file,
+                                       size_t prefetch_depth = 0);
+// converts a text trace, returns the number of records written
+uint64_t ConvertTextTrace(const std::string& text_file,
+                          const std::string& binary_file);
+
+}  // namespace dramsim3
+#endif
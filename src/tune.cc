@@ -0,0 +1,589 @@
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include "./../ext/headers/args.hxx"
+#include "cpu.h"
+#include "pim_model.h"
+#include "result_cache.h"
+
+using namespace dramsim3;
+
+namespace {
+
+// shared (read only) by all simulations, see dramsim3batch
+struct ParsedConfig {
+    ParsedConfig(const std::string &config_file)
+        : config(config_file, "."), timing(config) {
+        config.output_level = -1;
+        config.cmd_trace = false;
+        config.channel_threads = 1;
+    }
+    Config config;
+    Timing timing;
+};
+
+// A layer as a matmul of rows input vectors of length K into cols outputs
+// each. A GEMM workload (df 0) streams M rows into N output channels, a
+// GEMV (df 1) a batch of N vectors into M outputs. A convolution keeps its
+// kernel and only runs as a GEMM. Other workloads (several cuts, VPU ops)
+// are only simulated as they are, to calibrate the model.
+struct Shape {
+    std::string name;
+    bool tunable;
+    int64_t rows;
+    int64_t K;
+    int64_t cols;
+    int64_t kernel_size;
+    int64_t stride;
+    int64_t post_delay;
+};
+
+Shape WorkloadShape(const std::string &file, bool calibrate) {
+    PimWorkload workload = ReadPimWorkload(file);
+    Shape shape = Shape();
+    shape.name = file;
+    shape.tunable = workload.vpu_vectors == 0 && workload.dims.size() == 1;
+    if (!shape.tunable) {
+        if (calibrate) return shape;
+        std::cerr << "Workload " << file << ": only single cut matmuls can "
+                  << "be tuned" << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+    }
+    const auto &dims = workload.dims[0];
+    shape.rows = workload.df == 1 ? dims[2] : dims[0];
+    shape.K = dims[1];
+    shape.cols = workload.df == 1 ? dims[0] : dims[2];
+    shape.kernel_size = workload.kernel_size;
+    shape.stride = workload.stride;
+    shape.post_delay = workload.post_delay;
+    return shape;
+}
+
+struct Mapping {
+    int df;
+    int vcuts;
+    int hcuts;
+    int mcf;
+    int ucf;
+    int M_tile_size;
+};
+
+std::string MappingName(const Mapping &m) {
+    std::ostringstream name;
+    name << "df " << m.df << ", " << m.vcuts << "x" << m.hcuts << " cuts, mcf "
+         << m.mcf << ", ucf " << m.ucf << ", tile_M " << m.M_tile_size;
+    return name.str();
+}
+
+// The workload of a mapping, or false if the shape does not split evenly.
+// A GEMM splits its output channels over the vertical cuts and its rows
+// over the horizontal ones, a GEMV its outputs over all cuts.
+bool MappedWorkload(const Shape &shape, const Mapping &m,
+                    PimWorkload &workload) {
+    workload = PimWorkload();
+    workload.name = shape.name;
+    workload.vcuts = m.vcuts;
+    workload.hcuts = m.hcuts;
+    workload.M_tile_size = m.M_tile_size;
+    workload.post_delay = shape.post_delay;
+    workload.mcf = m.mcf;
+    workload.ucf = m.ucf;
+    workload.df = m.df;
+    workload.kernel_size = shape.kernel_size;
+    workload.stride = shape.stride;
+    int cuts = m.vcuts * m.hcuts;
+    std::array<int64_t, 3> dims;
+    if (m.df == 0) {
+        // GEMM interleaving streams two rows per step
+        if (shape.rows % m.hcuts != 0 || shape.cols % m.vcuts != 0 ||
+            shape.rows / m.hcuts < 2)
+            return false;
+        dims = {shape.rows / m.hcuts, shape.K, shape.cols / m.vcuts};
+    } else {
+        // dimensions are divided by mcf and ucf in integer arithmetic
+        if (shape.cols % cuts != 0 || shape.cols / cuts % m.mcf != 0 ||
+            shape.K % m.ucf != 0)
+            return false;
+        dims = {shape.cols / cuts, shape.K, shape.rows};
+    }
+    workload.dims.assign(cuts, dims);
+    return true;
+}
+
+// Why the scheduler can't run a workload on this memory, empty if it can.
+// These are the cut geometries JedecDRAMSystem::CompileCutProgram() and the
+// streaming state of ClockTick() assume.
+std::string MappingError(const Config &config, const PimWorkload &workload) {
+    std::string error = PimWorkloadError(workload);
+    if (!error.empty() || workload.vpu_vectors != 0) return error;
+    if (config.channels % workload.hcuts != 0 ||
+        config.banks % workload.vcuts != 0)
+        return "cuts must split the channels and banks evenly";
+    int cut_height = config.channels / workload.hcuts;
+    int cut_width = config.banks / workload.vcuts;
+    // each output cut number writes to its own channels of the cut
+    if (cut_height < workload.vcuts) return "fewer channels than cutV";
+    // weights are read from every 8th (GEMM) or 16th (GEMV) bank by default
+    if (cut_width < config.WeightBankStride(workload.df))
+        return "cuts too narrow to load weights";
+    int mc = workload.mcf * workload.ucf;
+    if (workload.df == 1 && mc != 16)
+        return "a GEMV splits the 16 rows of a bank, mcf * ucf = 16";
+    if (workload.df == 0) {
+        // inputs are one bank and outputs three banks into a bank group
+        if (workload.ucf != 1 || mc > cut_width ||
+            (cut_width / mc) % config.banks_per_group != 0 ||
+            config.banks_per_group < 4)
+            return "a GEMM needs ucf 1 and a bank group per multi-column";
+    }
+    if (workload.M_tile_size <= 128 / workload.vcuts)
+        return "tile_M must exceed the 128 / cutV PE columns of a tile";
+    return "";
+}
+
+// every mapping of the shape the scheduler can run
+std::vector<Mapping> LegalMappings(const Config &config, const Shape &shape,
+                                   int only_df, int max_tile_M) {
+    std::vector<Mapping> mappings;
+    for (int df = 0; df <= 1; df++) {
+        if (only_df != -1 && df != only_df) continue;
+        if (df == 1 && shape.kernel_size != 0) continue;
+        for (int vcuts = 1; vcuts <= config.banks; vcuts *= 2) {
+            for (int hcuts = 1; hcuts <= config.channels; hcuts *= 2) {
+                for (int mcf = 1; mcf <= 16; mcf *= 2) {
+                    for (int tile = 2; tile <= max_tile_M; tile *= 2) {
+                        Mapping m = {df, vcuts, hcuts, mcf,
+                                     df == 1 ? 16 / mcf : 1, tile};
+                        PimWorkload workload;
+                        if (MappedWorkload(shape, m, workload) &&
+                            MappingError(config, workload).empty())
+                            mappings.push_back(m);
+                    }
+                }
+            }
+        }
+    }
+    return mappings;
+}
+
+struct Candidate {
+    const Shape *shape;
+    Mapping mapping;
+    PimWorkload workload;
+    PimCostEstimate estimate;
+    // the workload file's own mapping
+    bool given;
+    nlohmann::json result;
+    bool cache_hit;
+};
+
+nlohmann::json Simulate(const ParsedConfig &parsed,
+                        const std::vector<PimTransaction> &kernel,
+                        uint64_t cycles, bool skip_idle) {
+    WorkloadCPU cpu(parsed.config, parsed.timing);
+    cpu.Launch(kernel);
+    cpu.SetEndCycle(cycles);
+    bool turned_off = false;
+    for (uint64_t clk = 0; clk < cycles; clk++) {
+        cpu.ClockTick();
+        if (cpu.turnOff()) {
+            turned_off = true;
+            break;
+        }
+        if (skip_idle) {
+            uint64_t next = std::min(cpu.NextEventCycle(), cycles);
+            if (next > clk + 1) {
+                cpu.SkipCycles(next - clk - 1);
+                clk = next - 1;
+            }
+        }
+    }
+    cpu.PrintStats();
+    nlohmann::json result = SimulationResult(cpu.Memory(), turned_off);
+    result.erase("stats");
+    return result;
+}
+
+void RunCandidate(Candidate &candidate, const ParsedConfig &parsed,
+                  uint64_t cycles, bool skip_idle, const ResultCache *cache) {
+    auto kernel = PimKernel(candidate.workload);
+    std::string key;
+    candidate.cache_hit = false;
+    if (cache) {
+        key = ResultKey(parsed.config, kernel, cycles);
+        candidate.cache_hit = cache->Lookup(key, candidate.result);
+    }
+    if (!candidate.cache_hit) {
+        candidate.result = Simulate(parsed, kernel, cycles, skip_idle);
+        if (cache) cache->Store(key, candidate.result);
+    }
+}
+
+uint64_t Cycles(const Candidate &candidate) {
+    // a mapping that did not finish is never the best one
+    if (!candidate.result["turned_off"].get<bool>()) return UINT64_MAX;
+    return candidate.result["cycles"].get<uint64_t>();
+}
+
+bool WriteWorkload(const std::string &file, const PimWorkload &workload) {
+    std::ofstream out(file);
+    out << workload.vcuts << ", " << workload.hcuts << ", "
+        << workload.M_tile_size << ", " << workload.post_delay << ", "
+        << workload.mcf << ", " << workload.ucf << ", " << workload.df;
+    if (workload.kernel_size != 0) {
+        out << ", " << workload.kernel_size << ", " << workload.stride;
+    }
+    out << std::endl;
+    for (const auto &dims : workload.dims) {
+        out << dims[0] << ", " << dims[1] << ", " << dims[2] << std::endl;
+    }
+    return !out.fail();
+}
+
+nlohmann::json CandidateJson(const Candidate &candidate) {
+    const Mapping &m = candidate.mapping;
+    nlohmann::json j;
+    if (candidate.workload.vpu_vectors == 0) {
+        j["df"] = m.df;
+        j["vcuts"] = m.vcuts;
+        j["hcuts"] = m.hcuts;
+        j["mcf"] = m.mcf;
+        j["ucf"] = m.ucf;
+        j["tile_M"] = m.M_tile_size;
+    }
+    j["estimate"] = candidate.estimate.cycles;
+    j["estimate_energy"] = candidate.estimate.energy;
+    j["cycles"] = candidate.result["cycles"];
+    j["energy"] = candidate.result["energy"];
+    j["turned_off"] = candidate.result["turned_off"];
+    if (candidate.given) j["given"] = true;
+    return j;
+}
+
+// The mappings worth simulating: the k best estimates, and those on the
+// estimated Pareto front of cycles and energy
+std::vector<Candidate> Finalists(std::vector<Candidate> ranked, size_t k) {
+    std::stable_sort(ranked.begin(), ranked.end(),
+                     [](const Candidate &a, const Candidate &b) {
+                         return a.estimate.cycles < b.estimate.cycles;
+                     });
+    std::vector<Candidate> finalists;
+    double energy = std::numeric_limits<double>::infinity();
+    for (size_t i = 0; i < ranked.size(); i++) {
+        bool front = ranked[i].estimate.energy < energy;
+        energy = std::min(energy, ranked[i].estimate.energy);
+        if (i < k || front) finalists.push_back(ranked[i]);
+    }
+    return finalists;
+}
+
+// relative errors of the estimates of a shape class
+struct ClassError {
+    int runs = 0;
+    double cycles_sum = 0.0;
+    double cycles_max = 0.0;
+    double energy_sum = 0.0;
+    double energy_max = 0.0;
+};
+
+void AddError(ClassError &error, const Candidate &candidate) {
+    double cycles = candidate.result["cycles"].get<double>();
+    double energy = candidate.result["energy"].get<double>();
+    double cycles_error =
+        std::abs(candidate.estimate.cycles - cycles) / std::max(1.0, cycles);
+    double energy_error =
+        std::abs(candidate.estimate.energy - energy) / std::max(1.0, energy);
+    error.runs++;
+    error.cycles_sum += cycles_error;
+    error.cycles_max = std::max(error.cycles_max, cycles_error);
+    error.energy_sum += energy_error;
+    error.energy_max = std::max(error.energy_max, energy_error);
+}
+
+}  // namespace
+
+int main(int argc, const char **argv) {
+    args::ArgumentParser parser(
+        "PIM dataflow autotuner, finds the fastest mapping (df, cuts, mcf, "
+        "ucf, tile_M) of each workload's shape.",
+        "Every legal mapping is estimated, the best ones are simulated and "
+        "the fastest is written as a workload file, e.g.\n"
+        "./build/dramsim3tune configs/HBM2_8Gb_x128.ini -w wl/L1 -w wl/L2 "
+        "-d tuned -k 8");
+    args::HelpFlag help(parser, "help", "Display the help menu", {'h', "help"});
+    args::ValueFlagList<std::string> workload_arg(
+        parser, "workload",
+        "Workload file whose shape is tuned, its mapping is simulated too",
+        {'w', "workload"});
+    args::ValueFlag<std::string> dir_arg(
+        parser, "dir", "Directory the tuned workload files are written to",
+        {'d', "dir"}, "tuned");
+    args::ValueFlag<std::string> output_arg(parser, "output",
+                                            "Result file of all simulations",
+                                            {'o', "output"}, "tune.json");
+    args::ValueFlag<unsigned> finalists_arg(
+        parser, "finalists", "Mappings simulated per workload, best estimates "
+        "first (and those on the estimated cycles/energy Pareto front)",
+        {'k', "finalists"}, 8);
+    args::Flag calibrate_arg(
+        parser, "calibrate",
+        "Simulate every legal mapping and report the error of the estimates "
+        "per shape class, workloads that can't be tuned are simulated as they "
+        "are", {"calibrate"});
+    args::ValueFlag<int> df_arg(parser, "df",
+                                "Only GEMM (0) or GEMV (1) mappings",
+                                {"df"}, -1);
+    args::ValueFlag<int> max_tile_arg(
+        parser, "max_tile_M", "Largest tile_M, the accumulation buffer depth",
+        {"max-tile-m"}, 2048);
+    args::ValueFlag<uint64_t> num_cycles_arg(
+        parser, "num_cycles", "Cycle limit of a simulation", {'c', "cycles"},
+        5000000);
+    args::ValueFlag<unsigned> threads_arg(
+        parser, "threads", "Worker threads (default: all cores)",
+        {'j', "threads"}, std::thread::hardware_concurrency());
+    args::Flag no_skip_arg(
+        parser, "no_skip",
+        "Tick every cycle instead of skipping cycles where nothing happens",
+        {"no-skip"});
+    args::ValueFlag<std::string> cache_arg(
+        parser, "cache", "Result cache directory, cached mappings are not "
+        "simulated again", {"cache"});
+    args::Positional<std::string> config_arg(
+        parser, "config", "The config file name (mandatory)");
+
+    try {
+        parser.ParseCLI(argc, argv);
+    } catch (args::Help) {
+        std::cout << parser;
+        return 0;
+    } catch (args::ParseError e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << parser;
+        return 1;
+    }
+
+    std::string config_file = args::get(config_arg);
+    if (config_file.empty() || args::get(workload_arg).empty()) {
+        std::cerr << parser;
+        return 1;
+    }
+    int only_df = args::get(df_arg);
+    if (only_df < -1 || only_df > 1) {
+        std::cerr << "--df must be 0 or 1" << std::endl;
+        return 1;
+    }
+    size_t finalists = std::max(1u, args::get(finalists_arg));
+    bool calibrate = args::get(calibrate_arg);
+    uint64_t cycles = args::get(num_cycles_arg);
+    bool skip_idle = !args::get(no_skip_arg);
+    std::unique_ptr<ResultCache> cache;
+    if (cache_arg) cache.reset(new ResultCache(args::get(cache_arg)));
+    std::string dir = args::get(dir_arg);
+    if (!DirExist(dir) && mkdir(dir.c_str(), 0755) != 0) {
+        std::cerr << "Can't create " << dir << std::endl;
+        return 1;
+    }
+
+    ParsedConfig parsed(config_file);
+    const Config &config = parsed.config;
+    std::vector<Shape> shapes;
+    for (const auto &file : args::get(workload_arg)) {
+        shapes.push_back(WorkloadShape(file, calibrate));
+    }
+
+    // the finalists of every shape, and its own mapping, in one pool
+    std::vector<std::vector<Candidate>> candidates(shapes.size());
+    std::vector<size_t> legal(shapes.size());
+    size_t estimates = 0;
+    auto estimate_start = std::chrono::steady_clock::now();
+    for (size_t s = 0; s < shapes.size(); s++) {
+        const Shape &shape = shapes[s];
+        std::vector<Candidate> ranked;
+        std::vector<Mapping> mappings;
+        if (shape.tunable)
+            mappings = LegalMappings(config, shape, only_df,
+                                     args::get(max_tile_arg));
+        for (const Mapping &m : mappings) {
+            Candidate candidate;
+            candidate.shape = &shape;
+            candidate.mapping = m;
+            MappedWorkload(shape, m, candidate.workload);
+            candidate.estimate = EstimatePimKernel(
+                config, PimKernelDescription(candidate.workload));
+            candidate.given = false;
+            ranked.push_back(candidate);
+        }
+        legal[s] = ranked.size();
+        estimates += ranked.size();
+        if (!calibrate) ranked = Finalists(ranked, finalists);
+
+        PimWorkload given = ReadPimWorkload(shape.name);
+        std::string error = MappingError(config, given);
+        if (!error.empty()) {
+            std::cout << shape.name << ": the given mapping can't run ("
+                      << error << ")" << std::endl;
+        } else {
+            Candidate own;
+            own.shape = &shape;
+            own.mapping = {static_cast<int>(given.df),
+                           static_cast<int>(given.vcuts),
+                           static_cast<int>(given.hcuts),
+                           static_cast<int>(given.mcf),
+                           static_cast<int>(given.ucf),
+                           static_cast<int>(given.M_tile_size)};
+            own.workload = given;
+            own.estimate =
+                EstimatePimKernel(config, PimKernelDescription(given));
+            own.given = true;
+            ranked.push_back(own);
+        }
+        candidates[s] = ranked;
+    }
+    double estimate_seconds = std::chrono::duration<double>(
+                                  std::chrono::steady_clock::now() -
+                                  estimate_start)
+                                  .count();
+
+    std::vector<Candidate *> jobs;
+    for (auto &ranked : candidates) {
+        for (auto &candidate : ranked) jobs.push_back(&candidate);
+    }
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<size_t> next_job(0);
+    auto worker = [&]() {
+        for (size_t i = next_job++; i < jobs.size(); i = next_job++) {
+            RunCandidate(*jobs[i], parsed, cycles, skip_idle, cache.get());
+        }
+    };
+    unsigned num_threads = std::max(1u, args::get(threads_arg));
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < num_threads && i < jobs.size(); i++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : workers) {
+        thread.join();
+    }
+    auto seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+    nlohmann::json result;
+    result["config"] = config_file;
+    int status = 0;
+    for (size_t s = 0; s < shapes.size(); s++) {
+        const Shape &shape = shapes[s];
+        const auto &ranked = candidates[s];
+        const Candidate *best = nullptr;
+        const Candidate *own = nullptr;
+        for (const auto &candidate : ranked) {
+            if (candidate.given) own = &candidate;
+            if (Cycles(candidate) != UINT64_MAX &&
+                (best == nullptr || Cycles(candidate) < Cycles(*best)))
+                best = &candidate;
+        }
+        nlohmann::json layer;
+        layer["workload"] = shape.name;
+        for (const auto &candidate : ranked) {
+            layer["simulated"].push_back(CandidateJson(candidate));
+        }
+        if (!shape.tunable) {
+            std::cout << shape.name << ": ";
+            if (best == nullptr) {
+                std::cout << "didn't finish in " << cycles << " cycles"
+                          << std::endl;
+                status = 1;
+            } else {
+                std::cout << Cycles(*best) << " cycles, estimate "
+                          << static_cast<uint64_t>(best->estimate.cycles)
+                          << std::endl;
+            }
+            result["layers"].push_back(layer);
+            continue;
+        }
+        layer["rows"] = shape.rows;
+        layer["K"] = shape.K;
+        layer["cols"] = shape.cols;
+        layer["legal_mappings"] = legal[s];
+        std::cout << shape.name << " (" << shape.rows << "x" << shape.K
+                  << "x" << shape.cols << "): " << legal[s]
+                  << " legal mappings, ";
+        if (best == nullptr) {
+            std::cout << "none finished in " << cycles << " cycles"
+                      << std::endl;
+            status = 1;
+            result["layers"].push_back(layer);
+            continue;
+        }
+        std::string base = shape.name.substr(shape.name.rfind('/') + 1);
+        std::string file = dir + "/" + base;
+        if (!WriteWorkload(file, best->workload)) {
+            std::cerr << "Can't write " << file << std::endl;
+            return 1;
+        }
+        layer["best"] = CandidateJson(*best);
+        layer["file"] = file;
+        result["layers"].push_back(layer);
+        std::cout << "best " << MappingName(best->mapping) << ": "
+                  << Cycles(*best) << " cycles";
+        if (own != nullptr && Cycles(*own) != UINT64_MAX) {
+            std::cout << ", given mapping " << Cycles(*own) << " cycles ("
+                      << static_cast<double>(Cycles(*own)) / Cycles(*best)
+                      << "x)";
+        }
+        std::cout << std::endl;
+    }
+
+    std::ofstream out(args::get(output_arg));
+    if (out.fail()) {
+        std::cerr << "Can't write " << args::get(output_arg) << std::endl;
+        return 1;
+    }
+
+    if (calibrate) {
+        std::map<std::string, ClassError> errors;
+        for (const auto *job : jobs) {
+            if (Cycles(*job) == UINT64_MAX) continue;
+            AddError(errors[PimShapeClass(PimKernelDescription(job->workload))],
+                     *job);
+        }
+        std::cout << "Estimate error of finished runs:" << std::endl;
+        for (const auto &it : errors) {
+            const ClassError &e = it.second;
+            std::cout << "  " << it.first << ": " << e.runs
+                      << " runs, cycles " << 100 * e.cycles_sum / e.runs
+                      << "% mean, " << 100 * e.cycles_max << "% max, energy "
+                      << 100 * e.energy_sum / e.runs << "% mean, "
+                      << 100 * e.energy_max << "% max" << std::endl;
+            nlohmann::json j;
+            j["runs"] = e.runs;
+            j["cycles_error_mean"] = e.cycles_sum / e.runs;
+            j["cycles_error_max"] = e.cycles_max;
+            j["energy_error_mean"] = e.energy_sum / e.runs;
+            j["energy_error_max"] = e.energy_max;
+            result["calibration"][it.first] = j;
+        }
+    }
+    out << result.dump(2) << std::endl;
+    std::cout << estimates << " estimates in " << estimate_seconds * 1e3
+              << " ms, ";
+    std::cout << jobs.size() << " simulations in " << seconds << " s on "
+              << std::max<size_t>(1, workers.size() + 1) << " threads";
+    if (cache) {
+        int hits = 0;
+        for (const auto *job : jobs) hits += job->cache_hit;
+        std::cout << ", " << hits << " result cache hits";
+    }
+    std::cout << std::endl;
+    return status;
+}
@@ -0,0 +1,62 @@
+#include <cstdio>
+#include "catch.hpp"
+#include "configuration.h"
+#include "cpu.h"
+#include "test_helpers.h"
+#include "timing.h"
+
+namespace {
+
+const char kCheckpoint[] = "test_checkpoint.ckpt";
+
+// runs until the computation has finished, saving a checkpoint on the way
+// if save_clk is reached, and returns the final stats
+nlohmann::json Finish(dramsim3::CPU &cpu, uint64_t save_clk = UINT64_MAX) {
+    while (!cpu.turnOff() && cpu.Clock() < 1000000) {
+        if (cpu.Clock() == save_clk) cpu.SaveCheckpoint(kCheckpoint);
+        cpu.ClockTick();
+    }
+    REQUIRE(cpu.turnOff());
+    cpu.PrintStats();
+    return cpu.Memory().FinalStats();
+}
+
+}  // namespace
+
+TEST_CASE("Checkpoint round trip", "[checkpoint]") {
+    dramsim3::Config config(kPimConfig, ".");
+    config.output_level = -1;
+    dramsim3::Timing timing(config);
+
+    SECTION("A restored trace run ends with the same stats") {
+        dramsim3::TraceBasedCPU saved(config, timing, kSampleTrace);
+        auto expected = Finish(saved, 100);
+        uint64_t cycles = saved.Clock();
+        REQUIRE(cycles > 100);
+
+        dramsim3::TraceBasedCPU restored(config, timing, kSampleTrace);
+        restored.RestoreCheckpoint(kCheckpoint);
+        REQUIRE(restored.Clock() == 100);
+        REQUIRE(Finish(restored) == expected);
+        REQUIRE(restored.Clock() == cycles);
+        std::remove(kCheckpoint);
+    }
+
+    SECTION("A restored kernel run ends with the same stats") {
+        auto kernel = dramsim3::PimKernel(Gemv(128, 4096));
+        dramsim3::WorkloadCPU saved(config, timing);
+        saved.Launch(kernel);
+        auto expected = Finish(saved, 1000);
+        uint64_t cycles = saved.Clock();
+        REQUIRE(cycles > 1000);
+
+        // the kernel is not part of the checkpoint, only how far it got
+        dramsim3::WorkloadCPU restored(config, timing);
+        restored.Launch(kernel);
+        restored.RestoreCheckpoint(kCheckpoint);
+        REQUIRE(restored.Clock() == 1000);
+        REQUIRE(Finish(restored) == expected);
+        REQUIRE(restored.Clock() == cycles);
+        std::remove(kCheckpoint);
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef __TEST_HELPERS_H
+#define __TEST_HELPERS_H
+
+#include "pim_kernel.h"
+
+// PIM tests run on the config of the README examples
+const char kPimConfig[] = "configs/HBM2_8Gb_x128.ini";
+// a 128x128 GEMV written by gen_pim_trace2.py, see SampleWorkload()
+const char kSampleTrace[] = "sample.trc";
+
+// an M x K GEMV with 4 multi-columns and 4 unit columns on a single cut
+inline dramsim3::PimWorkload Gemv(int64_t M, int64_t K) {
+    dramsim3::PimWorkload workload;
+    workload.mcf = 4;
+    workload.ucf = 4;
+    workload.df = 1;
+    workload.dims.push_back({M, K, 1});
+    return workload;
+}
+
+// the kernel of kSampleTrace
+inline dramsim3::PimWorkload SampleWorkload() { return Gemv(128, 128); }
+
+#endif
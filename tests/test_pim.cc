@@ -0,0 +1,91 @@
+#include <cstdio>
+#include <fstream>
+#include "catch.hpp"
+#include "configuration.h"
+#include "cpu.h"
+#include "pim_kernel.h"
+#include "result_cache.h"
+#include "test_helpers.h"
+#include "timing.h"
+
+namespace {
+
+const char kWorkloadFile[] = "test_workload.txt";
+
+dramsim3::PimWorkload ReadWorkload(const std::string &text) {
+    std::ofstream(kWorkloadFile) << text;
+    auto workload = dramsim3::ReadPimWorkload(kWorkloadFile);
+    std::remove(kWorkloadFile);
+    return workload;
+}
+
+// cycles until the kernel's computation has finished
+uint64_t RunCycles(const dramsim3::Config &config,
+                   const dramsim3::PimWorkload &workload) {
+    dramsim3::Timing timing(config);
+    dramsim3::WorkloadCPU cpu(config, timing);
+    cpu.Launch(dramsim3::PimKernel(workload));
+    while (!cpu.Done() && cpu.Clock() < 1000000) cpu.ClockTick();
+    REQUIRE(cpu.Done());
+    return cpu.Clock();
+}
+
+}  // namespace
+
+TEST_CASE("Workload files", "[pim]") {
+    SECTION("The file runs the kernel of its trace") {
+        auto workload = ReadWorkload("1,1,2048,8,4,4,1\n128,128,1\n");
+        dramsim3::Config config(kPimConfig, ".");
+        REQUIRE(dramsim3::ResultKey(config, dramsim3::PimKernel(workload),
+                                    100000) ==
+                dramsim3::ResultKey(config, kSampleTrace, 100000));
+    }
+
+    SECTION("Matmul") {
+        // separators may be commas, spaces or both
+        auto workload =
+            ReadWorkload("2, 1, 1024, 8, 4, 2, 1\n64, 512, 1\n32 256 1\n");
+        REQUIRE(workload.vcuts == 2);
+        REQUIRE(workload.hcuts == 1);
+        REQUIRE(workload.M_tile_size == 1024);
+        REQUIRE(workload.post_delay == 8);
+        REQUIRE(workload.mcf == 4);
+        REQUIRE(workload.ucf == 2);
+        REQUIRE(workload.df == 1);
+        REQUIRE(workload.dims.size() == 2);
+        REQUIRE(workload.dims[0] == (std::array<int64_t, 3>{64, 512, 1}));
+        REQUIRE(workload.dims[1] == (std::array<int64_t, 3>{32, 256, 1}));
+    }
+
+    SECTION("Convolution") {
+        auto workload = ReadWorkload("1,1,2048,8,1,1,0,3,1\n64,576,1024\n");
+        REQUIRE(workload.df == 0);
+        REQUIRE(workload.kernel_size == 3);
+        REQUIRE(workload.stride == 1);
+        REQUIRE(workload.dims.size() == 1);
+    }
+
+    SECTION("VPU op") {
+        auto workload = ReadWorkload("softmax, 1024, 12\n");
+        REQUIRE(workload.vpu_op == dramsim3::PimVpuOp::SOFTMAX);
+        REQUIRE(workload.vpu_elements == 1024);
+        REQUIRE(workload.vpu_vectors == 12);
+        REQUIRE(workload.dims.empty());
+    }
+}
+
+TEST_CASE("Double buffering", "[pim]") {
+    dramsim3::Config config(kPimConfig, ".");
+    config.output_level = -1;
+
+    SECTION("Single-step GEMV tiles are not slowed down") {
+        // the prefetch shares the bank of the tile's only input read
+        for (int64_t M : {4, 8, 16}) {
+            auto workload = Gemv(M, 4096);
+            config.double_buffer = false;
+            uint64_t single = RunCycles(config, workload);
+            config.double_buffer = true;
+            REQUIRE(RunCycles(config, workload) <= single);
+        }
+    }
+}
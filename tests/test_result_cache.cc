@@ -0,0 +1,46 @@
+#include <unistd.h>
+#include <cstdio>
+#include "catch.hpp"
+#include "configuration.h"
+#include "result_cache.h"
+#include "test_helpers.h"
+
+TEST_CASE("Result cache key", "[cache]") {
+    dramsim3::Config config(kPimConfig, ".");
+    auto key = dramsim3::ResultKey(config, kSampleTrace, 100000);
+
+    SECTION("A submitted kernel has the key of its trace") {
+        REQUIRE(dramsim3::ResultKey(config,
+                                    dramsim3::PimKernel(SampleWorkload()),
+                                    100000) == key);
+    }
+
+    SECTION("The key covers the workload, cycles and config") {
+        REQUIRE(dramsim3::ResultKey(config, "tests/example.trace", 100000) !=
+                key);
+        REQUIRE(dramsim3::ResultKey(config, kSampleTrace, 200000) != key);
+        REQUIRE(dramsim3::ResultKey(config, dramsim3::PimKernel(Gemv(128, 256)),
+                                    100000) != key);
+        config.tCCD_L++;
+        REQUIRE(dramsim3::ResultKey(config, kSampleTrace, 100000) != key);
+    }
+
+    SECTION("A hit is checked against the whole key") {
+        const char dir[] = "test_result_cache";
+        dramsim3::ResultCache cache(dir);
+        nlohmann::json result = {{"cycles", 253}};
+        cache.Store(key, result);
+
+        nlohmann::json cached;
+        REQUIRE(cache.Lookup(key, cached));
+        REQUIRE(cached == result);
+        // same file name, a different key
+        std::string other = key;
+        other.back() = other.back() == '0' ? '1' : '0';
+        REQUIRE_FALSE(cache.Lookup(other, cached));
+
+        std::remove((std::string(dir) + "/" + key.substr(0, 32) + ".json")
+                        .c_str());
+        rmdir(dir);
+    }
+}
@@ -0,0 +1,47 @@
+#include <cstdio>
+#include <string>
+#include "catch.hpp"
+#include "test_helpers.h"
+#include "trace_reader.h"
+
+namespace {
+
+const char kBinaryTrace[] = "test_trace.bin";
+
+// every record of the binary trace reads back as in the text trace
+void CheckConversion(const std::string &text_file, uint64_t records) {
+    REQUIRE(dramsim3::ConvertTextTrace(text_file, kBinaryTrace) == records);
+    REQUIRE_FALSE(dramsim3::IsBinaryTrace(text_file));
+    REQUIRE(dramsim3::IsBinaryTrace(kBinaryTrace));
+
+    auto text = dramsim3::OpenTrace(text_file);
+    auto binary = dramsim3::OpenTrace(kBinaryTrace);
+    dramsim3::Transaction expected, trans;
+    for (uint64_t i = 0; i < records; i++) {
+        text->Next(expected);
+        binary->Next(trans);
+        REQUIRE(trans.addr == expected.addr);
+        REQUIRE(trans.added_cycle == expected.added_cycle);
+        REQUIRE(trans.active == expected.active);
+        if (expected.active) {
+            REQUIRE(trans.is_write == expected.is_write);
+            REQUIRE(trans.is_pim == expected.is_pim);
+        }
+    }
+    text->Next(expected);
+    binary->Next(trans);
+    REQUIRE(text->Eof());
+    REQUIRE(binary->Eof());
+    REQUIRE_FALSE(trans.active);
+    std::remove(kBinaryTrace);
+}
+
+}  // namespace
+
+TEST_CASE("Binary trace conversion", "[trace]") {
+    SECTION("PIM trace") { CheckConversion(kSampleTrace, 5); }
+
+    SECTION("Host trace with reads") {
+        CheckConversion("tests/example.trace", 38374);
+    }
+}